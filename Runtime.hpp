@@ -0,0 +1,1144 @@
+/*
+ * File:   Runtime.hpp
+ * Author: Matthew
+ *
+ * OpenCL setup shared by the drivers: platform, device, program, the
+ * device copy of the gradient structure and tape, and the calls that
+ * record on and read back from them.
+ */
+
+#ifndef RUNTIME_HPP
+#define	RUNTIME_HPP
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "cl.hpp"
+#include "ad4cl.h"
+#include "ad_cl.h"
+
+/**
+ * Default directory of the program binary cache, see Runtime::cache.
+ */
+#ifndef AD4CL_CACHE_DIR
+#define AD4CL_CACHE_DIR ".ad4cl_cache"
+#endif
+
+#define AD4CL_BINARY_MAGIC "AD4CLBN1"
+
+/**
+ * CL_DEVICE_SVM_COARSE_GRAIN_BUFFER and CL_DEVICE_SVM_FINE_GRAIN_BUFFER, 
+ * also defined for OpenCL 1.x headers where they are never set.
+ */
+#define AD4CL_SVM_COARSE_GRAIN (1 << 0)
+#define AD4CL_SVM_FINE_GRAIN (1 << 1)
+
+namespace ad4cl {
+
+    /**
+     * Owns the context, queue and compiled program of a device together with
+     * persistent buffers for a gradient structure and its tape, so a driver
+     * sets them up once and then only enqueues work.
+     *
+     * Every call that touches the device is non-blocking. Host memory handed
+     * to write, read or gather must stay untouched until restore or finish
+     * returns. A typical evaluation is:
+     *
+     *     rt.write(a_d, &a, sizeof (ad_variable));
+     *     rt.record(kernel, global, local);
+     *     rt.readback();
+     *     ... host work overlapping the device ...
+     *     rt.restore();
+     *
+     * after which gs holds the recording as if it was made on the host.
+     * Errors are reported by throwing cl::Error.
+     *
+     * Evaluations can be double buffered with a second runtime set up by 
+     * share: each has its own queue, gradient structure and tape, so one 
+     * records evaluation N + 1 on the device while the host sweeps 
+     * evaluation N of the other after its restore.
+     */
+    class Runtime {
+    public:
+
+        /**
+         * How the tape gets between host and device, see bind.
+         *
+         * COPY - a device buffer, restore reads back the recorded range.
+         * MAPPED - a CL_MEM_ALLOC_HOST_PTR buffer the host works on through
+         * clEnqueueMapBuffer, no copy where host and device share memory.
+         * SVM_COARSE, SVM_FINE - OpenCL 2.0 shared virtual memory, mapped
+         * with clEnqueueSVMMap, or with fine grain not mapped at all.
+         * AUTO - SVM_FINE, SVM_COARSE or MAPPED, whichever the device
+         * supports first, if it shares memory with the host or is a CPU, 
+         * COPY otherwise. Mapping a discrete device's memory moves the 
+         * whole tape each round, where COPY only reads what was recorded.
+         */
+        enum Transport {
+            AUTO, COPY, MAPPED, SVM_COARSE, SVM_FINE
+        };
+
+        Runtime() : properties_(0), gs_(NULL), entries_(NULL), capacity_(0), transport_(COPY), svm_(NULL),
+        mapped_(NULL), uploaded_(false), tape_(false),
+        gradient_size_(0), rows_(0), rows_used_(0), inputs_(0), ids_size_(0) {
+            const char* dir = getenv("AD4CL_CACHE_DIR");
+            cache(dir != NULL ? dir : AD4CL_CACHE_DIR);
+        }
+
+        ~Runtime() {
+            try {
+                release();
+            } catch (const cl::Error& err) {
+                std::cout << err.what() << "(" << err.err() << ")\n";
+            }
+        }
+
+        /**
+         * Creates the context and queue on the first device of type type
+         * on platforms[platform].
+         *
+         * @param platform
+         * @param type
+         * @param properties - queue properties, e.g. CL_QUEUE_PROFILING_ENABLE.
+         */
+        void initialize(int platform = 0, cl_device_type type = CL_DEVICE_TYPE_GPU,
+                cl_command_queue_properties properties = 0) {
+            std::vector<cl::Platform> platforms;
+            cl::Platform::get(&platforms);
+            if (platforms.size() == 0) {
+                std::cout << "Platform size 0\n";
+                exit(0);
+            }
+            platform_ = platforms[std::min(platform, (int) platforms.size() - 1)];
+            cl_context_properties cprops[] = {CL_CONTEXT_PLATFORM, (cl_context_properties) (platform_)(), 0};
+            context_ = cl::Context(type, cprops);
+            devices_ = context_.getInfo<CL_CONTEXT_DEVICES > ();
+            properties_ = properties;
+            queue_ = cl::CommandQueue(context_, devices_[0], properties);
+        }
+
+        /**
+         * Uses the context, device and program of other, built already, 
+         * with a queue of its own, so the two runtimes record and read back
+         * independently. Bind gives it its own tape.
+         *
+         * @param other
+         */
+        void share(const Runtime& other) {
+            platform_ = other.platform_;
+            context_ = other.context_;
+            devices_ = other.devices_;
+            properties_ = other.properties_;
+            queue_ = cl::CommandQueue(context_, devices_[0], properties_);
+            program_ = other.program_;
+            cache_dir_ = other.cache_dir_;
+            kernels_.clear();
+        }
+
+        /**
+         * Reads a source file, e.g. ad.cl or a kernel file.
+         *
+         * @param path
+         * @return the contents, empty if the file can not be read.
+         */
+        static std::string read_source(const std::string& path) {
+            std::ifstream in(path.c_str());
+            std::stringstream ss;
+            ss << in.rdbuf();
+            return ss.str();
+        }
+
+        /**
+         * Compiles source for the device. On failure the build log is
+         * printed and the cl::Error rethrown.
+         *
+         * The device binary is kept in the cache directory, see cache, under
+         * a key made of the source, options, device name and driver
+         * version, so later runs with the same key skip the compiler. A
+         * cache entry that does not match its key or does not load is
+         * removed and rebuilt.
+         *
+         * @param source
+         * @param options - must match ad4cl.h, see AD4CL_BUILD_OPTIONS.
+         */
+        void build(const std::string& source, const std::string& options = AD4CL_BUILD_OPTIONS) {
+            kernels_.clear();
+            std::string device = devices_[0].getInfo<CL_DEVICE_NAME > ();
+            std::string driver = devices_[0].getInfo<CL_DRIVER_VERSION > ();
+            std::string key = source + '\0' + options + '\0' + device + '\0' + driver;
+            std::string path;
+            if (!cache_dir_.empty()) {
+                char name[32];
+                snprintf(name, sizeof (name), "/%016llx.bin", (unsigned long long) hash(key));
+                path = cache_dir_ + name;
+                if (load_binary(path, key, options)) {
+                    return;
+                }
+            }
+
+            cl::Program::Sources sources(1, std::make_pair(source.c_str(), source.size()));
+            program_ = cl::Program(context_, sources);
+            try {
+                program_.build(devices_, options.c_str());
+            } catch (const cl::Error& err) {
+                std::cout << "---> " << build_log() << "\n";
+                throw;
+            }
+            if (!path.empty()) {
+                store_binary(path, key);
+            }
+        }
+
+        /**
+         * Sets the directory of the program binary cache, created if
+         * missing. An empty dir turns the cache off. The default is
+         * $AD4CL_CACHE_DIR, or AD4CL_CACHE_DIR if that is not set.
+         *
+         * @param dir
+         * @return false if dir can not be created or written, the cache 
+         * is then off.
+         */
+        bool cache(const std::string& dir) {
+            cache_dir_.clear();
+            if (dir.empty()) {
+                return true;
+            }
+            struct stat st;
+#if defined(_WIN32)
+            _mkdir(dir.c_str());
+            bool writable = stat(dir.c_str(), &st) == 0 && (st.st_mode & S_IFDIR) && _access(dir.c_str(), 2) == 0;
+#else
+            mkdir(dir.c_str(), 0755);
+            bool writable = stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && access(dir.c_str(), W_OK) == 0;
+#endif
+            if (!writable) {
+                std::cout << "ad4cl: can not write the binary cache " << dir << ", caching is off\n";
+                return false;
+            }
+            cache_dir_ = dir;
+            return true;
+        }
+
+        /**
+         * Compiles the ad4cl api in api followed by the kernels in kernels.
+         *
+         * @param api - path of ad.cl.
+         * @param kernels - path of the user kernels.
+         * @param options
+         */
+        void build_files(const std::string& api, const std::string& kernels,
+                const std::string& options = AD4CL_BUILD_OPTIONS) {
+            build(read_source(api) + "\n" + read_source(kernels), options);
+        }
+
+        /**
+         * Compiles the kernels in the file kernels against the compiled in
+         * copy of ad.cl, pruned to what they use, see prune. Does not need
+         * ad.cl at run time.
+         *
+         * @param kernels - path of the user kernels.
+         * @param options
+         * @param keep - api kernels launched by the host besides the device
+         * sweep of sweep_begin, e.g. ad_sum_reduce.
+         */
+        void build_kernels(const std::string& kernels, const std::string& options = AD4CL_BUILD_OPTIONS,
+                const std::vector<std::string>& keep = std::vector<std::string>()) {
+            std::string source = read_source(kernels);
+#ifdef AD4CL_NO_PRUNE
+            build(api_source() + "\n" + source, options);
+#else
+            std::vector<std::string> roots(keep);
+            roots.push_back("ad_gradient_init");
+            roots.push_back("ad_reverse_sweep");
+            roots.push_back("ad_gradient_gather");
+            build(prune(api_source(), source, roots) + "\n" + source, options);
+#endif
+        }
+
+        /**
+         * ad.cl as it was when the host code was compiled, from ad_cl.h 
+         * which make generates from ad.cl.
+         *
+         * @return
+         */
+        static const std::string& api_source() {
+            static std::string api;
+            if (api.empty()) {
+                for (const char* const* line = ad4cl_api_lines; *line != 0; line++) {
+                    api += *line;
+                }
+            }
+            return api;
+        }
+
+        /**
+         * Identifiers of the code in text, skipping comments, string and
+         * character literals and preprocessor keywords.
+         */
+        static void identifiers(const std::string& text, std::set<std::string>& out) {
+            size_t i = 0, n = text.size();
+            while (i < n) {
+                char c = text[i];
+                if (c == '/' && i + 1 < n && text[i + 1] == '/') {
+                    i = text.find('\n', i);
+                    i = i == std::string::npos ? n : i;
+                } else if (c == '/' && i + 1 < n && text[i + 1] == '*') {
+                    i = text.find("*/", i + 2);
+                    i = i == std::string::npos ? n : i + 2;
+                } else if (c == '"' || c == '\'') {
+                    for (i++; i < n && text[i] != c; i++) {
+                        i += text[i] == '\\';
+                    }
+                    i++;
+                } else if (isalpha((unsigned char) c) || c == '_') {
+                    size_t b = i;
+                    while (i < n && (isalnum((unsigned char) text[i]) || text[i] == '_')) {
+                        i++;
+                    }
+                    out.insert(text.substr(b, i - b));
+                } else if (isdigit((unsigned char) c)) {
+                    while (i < n && (isalnum((unsigned char) text[i]) || text[i] == '.')) {
+                        i++;
+                    }
+                } else {
+                    i++;
+                }
+            }
+        }
+
+        /**
+         * Drops the function definitions of api that kernels can not reach.
+         * api is split into preprocessor lines, declarations and function
+         * definitions (with the comments before them). A function is kept
+         * if its name is used by kernels, named in keep, or used by a kept
+         * function or a macro those use. Everything else is kept as is and
+         * dropped functions are replaced by their line breaks, so line
+         * numbers in build logs still match api. All overloads of a name
+         * are kept together.
+         *
+         * @param api - e.g. the embedded ad.cl, see api_source.
+         * @param kernels - the user kernels.
+         * @param keep - names of api kernels the host launches, e.g. 
+         * ad_sum_reduce.
+         * @return the pruned api, or api if it could not be split.
+         */
+        static std::string prune(const std::string& api, const std::string& kernels,
+                const std::vector<std::string>& keep = std::vector<std::string>()) {
+            //chunks of api, name is set for function definitions
+            std::vector<std::pair<std::string, std::string> > chunks;
+            std::multimap<std::string, size_t> functions;
+            std::map<std::string, std::set<std::string> > macros;
+            std::set<std::string> roots(keep.begin(), keep.end());
+            identifiers(kernels, roots);
+
+            size_t i = 0, begin = 0, n = api.size();
+            int depth = 0;
+            bool line_start = true;
+            size_t body = std::string::npos;
+            while (i < n) {
+                char c = api[i];
+                if (line_start && c == '#') {
+                    size_t end = i;
+                    do {
+                        end = api.find('\n', end + 1);
+                    } while (end != std::string::npos && api[end - 1] == '\\');
+                    end = end == std::string::npos ? n : end + 1;
+                    if (depth == 0) {
+                        std::string line = api.substr(i, end - i);
+                        std::istringstream words(line.substr(1));
+                        std::string directive, name;
+                        words >> directive >> name;
+                        if (directive == "define") {
+                            name = name.substr(0, name.find('('));
+                            identifiers(line.substr(line.find(name) + name.size()), macros[name]);
+                        }
+                        chunks.push_back(std::make_pair(std::string(), api.substr(begin, end - begin)));
+                        begin = end;
+                    }
+                    i = end;
+                    continue;
+                }
+                if (c == '\n') {
+                    line_start = true;
+                    i++;
+                    continue;
+                }
+                if (!isspace((unsigned char) c)) {
+                    line_start = false;
+                }
+                if (c == '/' && i + 1 < n && api[i + 1] == '/') {
+                    i = api.find('\n', i);
+                    i = i == std::string::npos ? n : i;
+                } else if (c == '/' && i + 1 < n && api[i + 1] == '*') {
+                    i = api.find("*/", i + 2);
+                    i = i == std::string::npos ? n : i + 2;
+                } else if (c == '"' || c == '\'') {
+                    for (i++; i < n && api[i] != c; i++) {
+                        i += api[i] == '\\';
+                    }
+                    i++;
+                } else if (c == '{') {
+                    if (depth == 0) {
+                        //a function if the last token before the brace closes the parameter list
+                        size_t p = api.find_last_not_of(" \t\r\n", i - 1);
+                        body = p != std::string::npos && api[p] == ')' ? p : std::string::npos;
+                    }
+                    depth++;
+                    i++;
+                } else if (c == '}') {
+                    depth--;
+                    i++;
+                    if (depth < 0) {
+                        return api;
+                    }
+                    if (depth == 0 && body != std::string::npos) {
+                        //name before the parameter list, attributes come before it
+                        int level = 0;
+                        size_t p = body;
+                        do {
+                            level += api[p] == ')' ? 1 : api[p] == '(' ? -1 : 0;
+                        } while (level > 0 && p-- > begin);
+                        p = api.find_last_not_of(" \t\r\n", p - 1);
+                        size_t e = p + 1;
+                        while (p > begin && (isalnum((unsigned char) api[p - 1]) || api[p - 1] == '_')) {
+                            p--;
+                        }
+                        std::string name = api.substr(p, e - p);
+                        functions.insert(std::make_pair(name, chunks.size()));
+                        chunks.push_back(std::make_pair(name, api.substr(begin, i - begin)));
+                        begin = i;
+                        body = std::string::npos;
+                    }
+                } else if (c == ';' && depth == 0) {
+                    i++;
+                    chunks.push_back(std::make_pair(std::string(), api.substr(begin, i - begin)));
+                    begin = i;
+                } else {
+                    i++;
+                }
+            }
+            if (depth != 0) {
+                return api;
+            }
+            chunks.push_back(std::make_pair(std::string(), api.substr(begin)));
+
+            //declarations are always kept, so are the names they use
+            for (size_t k = 0; k < chunks.size(); k++) {
+                if (chunks[k].first.empty()) {
+                    identifiers(chunks[k].second, roots);
+                }
+            }
+
+            std::vector<bool> kept(chunks.size(), false);
+            std::set<std::string> seen;
+            std::vector<std::string> work(roots.begin(), roots.end());
+            while (!work.empty()) {
+                std::string name = work.back();
+                work.pop_back();
+                if (!seen.insert(name).second) {
+                    continue;
+                }
+                std::set<std::string> used;
+                std::pair<std::multimap<std::string, size_t>::iterator,
+                        std::multimap<std::string, size_t>::iterator> range = functions.equal_range(name);
+                for (std::multimap<std::string, size_t>::iterator it = range.first; it != range.second; ++it) {
+                    kept[it->second] = true;
+                    identifiers(chunks[it->second].second, used);
+                }
+                std::map<std::string, std::set<std::string> >::iterator m = macros.find(name);
+                if (m != macros.end()) {
+                    used.insert(m->second.begin(), m->second.end());
+                }
+                work.insert(work.end(), used.begin(), used.end());
+            }
+
+            std::string out;
+            out.reserve(api.size());
+            for (size_t k = 0; k < chunks.size(); k++) {
+                if (chunks[k].first.empty() || kept[k]) {
+                    out += chunks[k].second;
+                } else {
+                    out.append(std::count(chunks[k].second.begin(), chunks[k].second.end(), '\n'), '\n');
+                }
+            }
+            return out;
+        }
+
+        std::string build_log() const {
+            return program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices_[0]);
+        }
+
+        /**
+         * The kernel name of the program, created once and cached. The
+         * handle is shared, arguments set on it persist between calls.
+         *
+         * @param name
+         * @return
+         */
+        cl::Kernel& kernel(const std::string& name) {
+            std::map<std::string, cl::Kernel>::iterator it = kernels_.find(name);
+            if (it == kernels_.end()) {
+                it = kernels_.insert(std::make_pair(name, cl::Kernel(program_, name.c_str()))).first;
+            }
+            return it->second;
+        }
+
+        /**
+         * Same as kernel, with arguments 0 and 1 bound to the gradient
+         * structure and tape of bind, as taken by every recording kernel.
+         *
+         * @param name
+         * @return
+         */
+        cl::Kernel& ad_kernel(const std::string& name) {
+            cl::Kernel& k = kernel(name);
+            k.setArg(0, gs_d_);
+#if defined(CL_VERSION_2_0)
+            if (svm_ != NULL) {
+                check(clSetKernelArgSVMPointer(k(), 1, svm_), "clSetKernelArgSVMPointer");
+                return k;
+            }
+#endif
+            k.setArg(1, tape_d_);
+            return k;
+        }
+
+        /**
+         * A buffer of size bytes in the context.
+         *
+         * @param flags
+         * @param size
+         * @param host - for CL_MEM_USE_HOST_PTR or CL_MEM_COPY_HOST_PTR.
+         * @return
+         */
+        cl::Buffer buffer(cl_mem_flags flags, size_t size, void* host = NULL) {
+            return cl::Buffer(context_, flags, size, host);
+        }
+
+        /**
+         * Creates the device copies of gs and its tape of capacity entries,
+         * see ad_tape_bind or ad_csr_tape_bind. They live as long as the 
+         * runtime and are what record, readback and sweep work on. The tape
+         * must be flat, not a pool, see ad_tape_use_pool.
+         *
+         * With any transport but COPY the tape is moved into memory the 
+         * device shares and gs is bound to that, entries is no longer used
+         * and may be freed. gs->gradient_stack then only points to the tape
+         * between restore and the next record, the host must not touch it
+         * in between. A transport the platform lacks falls back to the next
+         * one down, SVM_FINE to SVM_COARSE to MAPPED.
+         *
+         * @param gs
+         * @param entries
+         * @param capacity
+         * @param transport
+         */
+        void bind(struct ad_gradient_structure* gs, struct ad_entry* entries, int capacity,
+                Transport transport = AUTO) {
+            release();
+            gs_ = gs;
+            entries_ = entries;
+            capacity_ = capacity;
+            uploaded_ = false;
+            tape_ = false;
+            gs_d_ = buffer(CL_MEM_READ_WRITE, sizeof (struct ad_gradient_structure));
+            transport_ = transport == AUTO ? select() : transport;
+            size_t bytes = tape_bytes();
+            if (transport_ == SVM_FINE && !(svm_capabilities() & AD4CL_SVM_FINE_GRAIN)) {
+                transport_ = SVM_COARSE;
+            }
+            if (transport_ == SVM_COARSE && !(svm_capabilities() & AD4CL_SVM_COARSE_GRAIN)) {
+                transport_ = MAPPED;
+            }
+#if defined(CL_VERSION_2_0)
+            if (transport_ == SVM_COARSE || transport_ == SVM_FINE) {
+                cl_svm_mem_flags flags = CL_MEM_READ_WRITE;
+                if (transport_ == SVM_FINE) {
+                    flags |= CL_MEM_SVM_FINE_GRAIN_BUFFER;
+                }
+                svm_ = clSVMAlloc(context_(), flags, bytes, 0);
+                if (svm_ == NULL) {
+                    transport_ = MAPPED;
+                }
+            }
+#endif
+            switch (transport_) {
+                case COPY:
+                    tape_d_ = buffer(CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes, entries);
+                    return;
+                case MAPPED:
+                    tape_d_ = buffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR, bytes, entries);
+                    break;
+                default:
+                    break;
+            }
+            map();
+            if (transport_ != MAPPED) {
+                memcpy(svm_, entries, bytes);
+            }
+        }
+
+        /**
+         * The transport bind settled on.
+         */
+        Transport transport() const {
+            return transport_;
+        }
+
+        /**
+         * Name of a transport, for logs.
+         */
+        static const char* transport_name(Transport transport) {
+            static const char* names[] = {"auto", "copy", "mapped", "svm coarse grain", "svm fine grain"};
+            return names[transport];
+        }
+
+        /**
+         * Size in bytes of the tape given to bind.
+         */
+        size_t tape_bytes() const {
+#ifdef AD_CSR_TAPE
+            return ad_csr_tape_bytes(capacity_, gs_->pair_capacity);
+#else
+            return ad_tape_bytes(capacity_);
+#endif
+        }
+
+        /**
+         * Non-blocking write of size bytes at host to buffer.
+         */
+        void write(cl::Buffer& buffer, const void* host, size_t size, size_t offset = 0) {
+            queue_.enqueueWriteBuffer(buffer, CL_FALSE, offset, size, host);
+        }
+
+        /**
+         * Non-blocking read of size bytes of buffer to host.
+         */
+        void read(cl::Buffer& buffer, void* host, size_t size, size_t offset = 0) {
+            queue_.enqueueReadBuffer(buffer, CL_FALSE, offset, size, host);
+        }
+
+        /**
+         * Enqueues k. Does not touch the gradient structure, see record.
+         *
+         * @return the event of the launch.
+         */
+        cl::Event launch(cl::Kernel& k, const cl::NDRange& global,
+                const cl::NDRange& local = cl::NullRange) {
+            cl::Event event;
+            queue_.enqueueNDRangeKernel(k, cl::NullRange, global, local, NULL, &event);
+            return event;
+        }
+
+        /**
+         * Enqueues the upload of the gradient structure as it is now, once
+         * after bind or restore, so recording continues where the host left
+         * off. Called by record.
+         */
+        void upload() {
+            unmap();
+            if (!uploaded_) {
+                gs_->counter = 0;
+                gs_->pair_counter = 0;
+                upload_ = *gs_;
+                write(gs_d_, &upload_, sizeof (struct ad_gradient_structure));
+                uploaded_ = true;
+            }
+        }
+
+        /**
+         * Enqueues k, a kernel working on the gradient structure, after
+         * upload.
+         *
+         * @return the event of the launch.
+         */
+        cl::Event record(cl::Kernel& k, const cl::NDRange& global,
+                const cl::NDRange& local = cl::NullRange) {
+            upload();
+            return launch(k, global, local);
+        }
+
+        /**
+         * Enqueues the read of the device gradient structure. If tape, 
+         * restore also reads the part of the tape the device recorded to 
+         * the entries given to bind. Everything enqueued is submitted, the 
+         * device works on it while the host does something else.
+         */
+        void readback(bool tape = true) {
+            read(gs_d_, &download_, sizeof (struct ad_gradient_structure));
+            tape_ = tape;
+            queue_.flush();
+        }
+
+        /**
+         * Waits for the queue and takes the counters of the readback over
+         * into gs, then gpu_restore makes the recording part of gs.
+         * 
+         * With COPY only the slots [stack_current, stack_current + counter)
+         * and with AD_CSR_TAPE the pairs [pair_current, pair_current + 
+         * pair_counter) are read, one read per column with AD_SOA_TAPE or 
+         * AD_CSR_TAPE. The other transports map the tape for the host
+         * instead, so compute_gradient runs on what the device wrote.
+         */
+        void restore() {
+            queue_.finish();
+            map();
+            gs_->current_variable_id = download_.current_variable_id;
+            gs_->stack_current = download_.stack_current;
+            gs_->counter = download_.counter;
+            gs_->pair_current = download_.pair_current;
+            gs_->pair_counter = download_.pair_counter;
+            gs_->gradient_stack = entries_;
+            if (tape_ && transport_ == COPY) {
+                read_tape(gs_->stack_current, gs_->counter, gs_->pair_current, gs_->pair_counter);
+                queue_.finish();
+                tape_ = false;
+            }
+            gpu_restore(gs_);
+            uploaded_ = false;
+        }
+
+        /**
+         * Starts a reverse sweep on the device of everything recorded since
+         * the last restore, see ad_gradient_init. Run before readback.
+         *
+         * @param inputs - ids below inputs are the independent variables.
+         * @param rows - at least the number of work groups of every sweep.
+         * @param global
+         * @param local
+         */
+        void sweep_begin(int inputs, int rows, size_t global, size_t local) {
+            unmap();
+            inputs_ = inputs;
+            size_t size = gs_->current_variable_id + (capacity_ - gs_->stack_current) + 1;
+            if (size > gradient_size_) {
+                gradient_size_ = size;
+                gradient_d_ = buffer(CL_MEM_READ_WRITE, size * sizeof (double));
+            }
+            if (rows * inputs > rows_) {
+                rows_ = rows * inputs;
+                input_adjoint_d_ = buffer(CL_MEM_READ_WRITE, rows_ * sizeof (double));
+            }
+            rows_used_ = rows;
+            cl::Kernel& k = ad_kernel("ad_gradient_init");
+            k.setArg(2, gradient_d_);
+            k.setArg(3, input_adjoint_d_);
+            k.setArg(4, rows);
+            k.setArg(5, inputs);
+            launch(k, cl::NDRange(global), cl::NDRange(local));
+        }
+
+        /**
+         * One level of the reverse sweep, the slots [begin, end) in
+         * segments of segment slots per work item, see ad_reverse_sweep.
+         */
+        void sweep(int begin, int end, int segment, size_t global, size_t local) {
+            cl::Kernel& k = ad_kernel("ad_reverse_sweep");
+            k.setArg(2, gradient_d_);
+            k.setArg(3, begin);
+            k.setArg(4, end);
+            k.setArg(5, segment);
+            k.setArg(6, inputs_);
+            k.setArg(7, input_adjoint_d_);
+            k.setArg(8, cl::__local(local * sizeof (double)));
+            launch(k, cl::NDRange(global), cl::NDRange(local));
+        }
+
+        /**
+         * Ends the sweep: enqueues the read of the adjoints of ids[0..n)
+         * to out, see ad_gradient_gather.
+         */
+        void gather(const int* ids, int n, double* out) {
+            if (n > ids_size_) {
+                ids_size_ = n;
+                ids_d_ = buffer(CL_MEM_READ_ONLY, n * sizeof (int));
+                out_d_ = buffer(CL_MEM_READ_WRITE, n * sizeof (double));
+            }
+            write(ids_d_, ids, n * sizeof (int));
+            cl::Kernel& k = kernel("ad_gradient_gather");
+            k.setArg(0, gradient_d_);
+            k.setArg(1, input_adjoint_d_);
+            k.setArg(2, rows_used_);
+            k.setArg(3, inputs_);
+            k.setArg(4, ids_d_);
+            k.setArg(5, n);
+            k.setArg(6, out_d_);
+            launch(k, cl::NDRange(n));
+            read(out_d_, out, n * sizeof (double));
+        }
+
+        /**
+         * Waits for everything enqueued.
+         */
+        void finish() {
+            queue_.finish();
+        }
+
+        cl::Context& context() {
+            return context_;
+        }
+
+        cl::CommandQueue& queue() {
+            return queue_;
+        }
+
+        cl::Program& program() {
+            return program_;
+        }
+
+        const cl::Device& device() const {
+            return devices_[0];
+        }
+
+        const cl::Platform& platform() const {
+            return platform_;
+        }
+
+        cl::Buffer& gs_buffer() {
+            return gs_d_;
+        }
+
+        /**
+         * The device tape, a null buffer with the SVM transports.
+         */
+        cl::Buffer& tape_buffer() {
+            return tape_d_;
+        }
+
+    private:
+
+        /**
+         * Throws cl::Error for a failed call of the C api.
+         */
+        static void check(cl_int err, const char* call) {
+            if (err != CL_SUCCESS) {
+                throw cl::Error(err, call);
+            }
+        }
+
+        /**
+         * The transport of AUTO for the device, see Transport.
+         */
+        Transport select() const {
+            cl_bool unified = devices_[0].getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY > ();
+            cl_device_type type = devices_[0].getInfo<CL_DEVICE_TYPE > ();
+            if (!unified && !(type & CL_DEVICE_TYPE_CPU)) {
+                return COPY;
+            }
+            unsigned int svm = svm_capabilities();
+            if (svm & AD4CL_SVM_FINE_GRAIN) {
+                return SVM_FINE;
+            }
+            if (svm & AD4CL_SVM_COARSE_GRAIN) {
+                return SVM_COARSE;
+            }
+            return MAPPED;
+        }
+
+        /**
+         * The CL_DEVICE_SVM_CAPABILITIES of the device, 0 if it or the 
+         * headers are older than OpenCL 2.0.
+         */
+        unsigned int svm_capabilities() const {
+#if defined(CL_VERSION_2_0)
+            std::string version = devices_[0].getInfo<CL_DEVICE_VERSION > ();
+            //"OpenCL <major>.<minor> <vendor specific>"
+            if (version.size() < 8 || version[7] < '2') {
+                return 0;
+            }
+            cl_device_svm_capabilities svm = 0;
+            if (clGetDeviceInfo(devices_[0](), CL_DEVICE_SVM_CAPABILITIES, sizeof (svm), &svm, NULL) != CL_SUCCESS) {
+                return 0;
+            }
+            return (unsigned int) svm;
+#else
+            return 0;
+#endif
+        }
+
+        /**
+         * Hands the tape to the host and binds gs to it, nothing with COPY,
+         * SVM_FINE or if it is mapped already. Blocks.
+         */
+        void map() {
+            if (transport_ == COPY || mapped_ != NULL) {
+                return;
+            }
+            size_t bytes = tape_bytes();
+            if (transport_ == MAPPED) {
+                mapped_ = queue_.enqueueMapBuffer(tape_d_, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes);
+            } else {
+#if defined(CL_VERSION_2_0)
+                if (transport_ == SVM_COARSE) {
+                    check(clEnqueueSVMMap(queue_(), CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, svm_, bytes, 0, NULL, NULL), "clEnqueueSVMMap");
+                }
+#endif
+                mapped_ = svm_;
+            }
+            entries_ = (struct ad_entry*) mapped_;
+            gs_->gradient_stack = entries_;
+            ad_tape_columns(gs_);
+        }
+
+        /**
+         * Hands the tape back to the device, before anything that records
+         * or sweeps. Nothing if it is not mapped. Fine grained SVM stays
+         * mapped, the queue orders host and device access to it.
+         */
+        void unmap() {
+            if (mapped_ == NULL || transport_ == SVM_FINE) {
+                return;
+            }
+            if (transport_ == MAPPED) {
+                queue_.enqueueUnmapMemObject(tape_d_, mapped_);
+            }
+#if defined(CL_VERSION_2_0)
+            if (transport_ == SVM_COARSE) {
+                check(clEnqueueSVMUnmap(queue_(), svm_, 0, NULL, NULL), "clEnqueueSVMUnmap");
+            }
+#endif
+            mapped_ = NULL;
+        }
+
+        /**
+         * Unmaps and frees the tape of the previous bind.
+         */
+        void release() {
+            if (gs_ == NULL) {
+                return;
+            }
+            if (transport_ == SVM_FINE) {
+                mapped_ = NULL;
+            }
+            unmap();
+            queue_.finish();
+#if defined(CL_VERSION_2_0)
+            if (svm_ != NULL) {
+                clSVMFree(context_(), svm_);
+            }
+#endif
+            svm_ = NULL;
+            tape_d_ = cl::Buffer();
+        }
+
+        /**
+         * Enqueues the read of the count elements of size bytes from first
+         * on of the tape column starting at column, a pointer into the 
+         * entries given to bind. Nothing if column is NULL.
+         */
+        void read_column(const void* column, size_t first, size_t count, size_t size) {
+            if (column == NULL || count == 0) {
+                return;
+            }
+            size_t offset = (const char*) column - (const char*) entries_ + first * size;
+            read(tape_d_, (char*) entries_ + offset, count * size, offset);
+        }
+
+        /**
+         * Enqueues the reads of count slots from first and, with AD_CSR_TAPE,
+         * pairs pairs from pair_first. The columns are laid out over the 
+         * entries and capacity given to bind, whatever gs points to.
+         */
+        void read_tape(int first, int count, int pair_first, int pairs) {
+            if (count <= 0) {
+                return;
+            }
+            if (first < 0 || first + count > capacity_) {
+                ad_fatal("device recording exceeds the tape capacity");
+            }
+            struct ad_gradient_structure tape = *gs_;
+            tape.gradient_stack = entries_;
+            tape.capacity = capacity_;
+            ad_tape_columns(&tape);
+#if defined(AD_CSR_TAPE)
+            read_column(tape.coeff_dx, pair_first, pairs, sizeof (ad_partial_t));
+            read_column(tape.coeff_id, pair_first, pairs, sizeof (int));
+            read_column(tape.entry_offset, first, count, sizeof (int));
+#elif defined(AD_SOA_TAPE)
+            for (int i = 0; i < MAX_VARIABLE_IN_EXPESSION; i++) {
+                read_column(tape.coeff_dx + (size_t) i * capacity_, first, count, sizeof (ad_partial_t));
+                read_column(tape.coeff_id + (size_t) i * capacity_, first, count, sizeof (int));
+            }
+#else
+            read_column(entries_, first, count, sizeof (struct ad_entry));
+#endif
+#if defined(AD_CSR_TAPE) || defined(AD_SOA_TAPE)
+            read_column(tape.entry_id, first, count, sizeof (int));
+            read_column(tape.entry_size, first, count, sizeof (int));
+#endif
+            queue_.flush();
+        }
+
+        /**
+         * 64 bit FNV-1a hash of size bytes at data.
+         */
+        static uint64_t hash(const void* data, size_t size) {
+            const unsigned char* p = (const unsigned char*) data;
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t i = 0; i < size; i++) {
+                h = (h ^ p[i]) * 1099511628211ULL;
+            }
+            return h;
+        }
+
+        static uint64_t hash(const std::string& s) {
+            return hash(s.data(), s.size());
+        }
+
+        /**
+         * Header of a cache entry, followed by binary_size bytes of
+         * CL_PROGRAM_BINARIES for the first device.
+         */
+        struct binary_header {
+            char magic[8];
+            uint64_t key_hash;
+            uint64_t key_size;
+            uint64_t binary_size;
+            uint64_t binary_hash;
+        };
+
+        /**
+         * Builds program_ from the cache entry at path if it was stored
+         * under key and the driver accepts it, otherwise removes the entry.
+         *
+         * @return true if program_ was built.
+         */
+        bool load_binary(const std::string& path, const std::string& key, const std::string& options) {
+            std::ifstream in(path.c_str(), std::ios::binary);
+            if (!in) {
+                return false;
+            }
+            struct binary_header h;
+            std::vector<unsigned char> binary;
+            bool valid = in.read((char*) &h, sizeof (h))
+                    && memcmp(h.magic, AD4CL_BINARY_MAGIC, sizeof (h.magic)) == 0
+                    && h.key_hash == hash(key) && h.key_size == key.size()
+                    && h.binary_size > 0 && h.binary_size < (1ULL << 31);
+            if (valid) {
+                binary.resize(h.binary_size);
+                valid = in.read((char*) &binary[0], binary.size())
+                        && in.peek() == std::ifstream::traits_type::eof()
+                        && hash(&binary[0], binary.size()) == h.binary_hash;
+            }
+            in.close();
+
+            if (valid) {
+                try {
+                    std::vector<cl::Device> device(1, devices_[0]);
+                    cl::Program::Binaries binaries(1, std::make_pair((const void*) &binary[0], binary.size()));
+                    std::vector<cl_int> status(1, CL_SUCCESS);
+                    program_ = cl::Program(context_, device, binaries, &status);
+                    program_.build(device, options.c_str());
+                    return true;
+                } catch (const cl::Error& err) {
+                    //stale, e.g. written by another driver build, recompile below
+                }
+            }
+            std::remove(path.c_str());
+            return false;
+        }
+
+        /**
+         * Writes the binary of program_ for the first device to path. The
+         * entry is written to a temporary file and renamed, so concurrent
+         * runs never see a partial entry.
+         */
+        void store_binary(const std::string& path, const std::string& key) {
+            std::vector<size_t> sizes = program_.getInfo<CL_PROGRAM_BINARY_SIZES > ();
+            if (sizes.empty() || sizes[0] == 0) {
+                return;
+            }
+            std::vector<std::vector<unsigned char> > images(sizes.size());
+            std::vector<char*> pointers(sizes.size());
+            for (size_t i = 0; i < sizes.size(); i++) {
+                images[i].resize(std::max(sizes[i], (size_t) 1));
+                pointers[i] = (char*) &images[i][0];
+            }
+            program_.getInfo(CL_PROGRAM_BINARIES, &pointers);
+
+            struct binary_header h;
+            memcpy(h.magic, AD4CL_BINARY_MAGIC, sizeof (h.magic));
+            h.key_hash = hash(key);
+            h.key_size = key.size();
+            h.binary_size = sizes[0];
+            h.binary_hash = hash(&images[0][0], sizes[0]);
+
+#if defined(_WIN32)
+            int pid = _getpid();
+#else
+            int pid = getpid();
+#endif
+            char suffix[32];
+            snprintf(suffix, sizeof (suffix), ".%d", pid);
+            std::string temp = path + suffix;
+            std::ofstream out(temp.c_str(), std::ios::binary);
+            out.write((const char*) &h, sizeof (h));
+            out.write((const char*) &images[0][0], sizes[0]);
+            out.close();
+            if (!out || std::rename(temp.c_str(), path.c_str()) != 0) {
+                std::remove(temp.c_str());
+            }
+        }
+
+        cl::Platform platform_;
+        cl::Context context_;
+        std::vector<cl::Device> devices_;
+        cl_command_queue_properties properties_;
+        cl::CommandQueue queue_;
+        cl::Program program_;
+        std::map<std::string, cl::Kernel> kernels_;
+        std::string cache_dir_;
+
+        struct ad_gradient_structure* gs_;
+        struct ad_entry* entries_;
+        int capacity_;
+        Transport transport_;
+        cl::Buffer gs_d_;
+        cl::Buffer tape_d_;
+        void* svm_;
+        //the tape as the host sees it while mapped, NULL while the device has it
+        void* mapped_;
+        //staging copies, the non-blocking transfers outlive the caller's gs updates
+        struct ad_gradient_structure upload_;
+        struct ad_gradient_structure download_;
+        bool uploaded_;
+        bool tape_;
+
+        cl::Buffer gradient_d_;
+        cl::Buffer input_adjoint_d_;
+        cl::Buffer ids_d_;
+        cl::Buffer out_d_;
+        size_t gradient_size_;
+        int rows_;
+        int rows_used_;
+        int inputs_;
+        int ids_size_;
+
+        //owns device memory
+        Runtime(const Runtime&);
+        Runtime& operator=(const Runtime&);
+    };
+
+}
+
+#endif	/* RUNTIME_HPP */
@@ -13,18 +13,29 @@ namespace ad4cl {
     /**
      * A c++ variable class to provide inter-operability between the native c
      * and OpenCL API's. Implements operator overloading. Template parameter
-     * group_id creates variables with different gradient_structure's.
+     * group_id creates variables with different gradient_structure's. 
+     * Values are stored as ad_value_t, see AD_FLOAT_VALUES, and widened 
+     * to double on conversion.
      */
     template<int group_id = 0 >
     class Variable {
     public:
-        struct variable var;
-        static struct gradient_structure* gs;
+        typedef ad_value_t value_type;
+        struct ad_variable var;
+        static struct ad_gradient_structure* gs;
 
-        Variable(const struct variable& v) {
+        Variable(const struct ad_variable& v) {
             var = v;
         }
 
+        /**
+         * Creates an independent variable.
+         * @param value
+         */
+        Variable(double value = 0.0) {
+            ad_init_var(gs, &var, value);
+        }
+
         operator double() {
             return var.value;
         }
@@ -37,66 +48,66 @@ namespace ad4cl {
     };
 
     template<int group_id>
-    struct gradient_structure* Variable<group_id>::gs = create_gradient_structure(DEFAULT_ENTRY_SIZE);
+    struct ad_gradient_structure* Variable<group_id>::gs = create_gradient_structure(DEFAULT_ENTRY_SIZE);
 
     template<int group_id>
     inline const Variable<group_id> operator +(const Variable<group_id>& a, const Variable<group_id>& b) {
-        return Variable<group_id>(plus_vv(a.gs, a.var, b.var));
+        return Variable<group_id>(ad_plus(a.gs, a.var, b.var));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator +(const Variable<group_id>& a, const double& b) {
-        return Variable<group_id>(plus_vd(a.gs, a.var, b));
+        return Variable<group_id>(ad_plus_vd(a.gs, a.var, b));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator +(const double& a, const Variable<group_id>& b) {
-        return Variable<group_id>(plus_dv(b.gs, a, b.var));
+        return Variable<group_id>(ad_plus_dv(b.gs, a, b.var));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator -(const Variable<group_id>& a, const Variable<group_id>& b) {
-        return Variable<group_id>(minus_vv(a.gs, a.var, b.var));
+        return Variable<group_id>(ad_minus(a.gs, a.var, b.var));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator -(const Variable<group_id>& a, const double& b) {
-        return Variable<group_id>(minus_vd(a.gs, a.var, b));
+        return Variable<group_id>(ad_minus_vd(a.gs, a.var, b));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator -(const double& a, const Variable<group_id>& b) {
-        return Variable<group_id>(minus_dv(b.gs, a, b.var));
+        return Variable<group_id>(ad_minus_dv(b.gs, a, b.var));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator *(const Variable<group_id>& a, const Variable<group_id>& b) {
-        return Variable<group_id>(times_vv(a.gs, a.var, b.var));
+        return Variable<group_id>(ad_times(a.gs, a.var, b.var));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator *(const Variable<group_id>& a, const double& b) {
-        return Variable<group_id>(times_vd(a.gs, a.var, b));
+        return Variable<group_id>(ad_times_vd(a.gs, a.var, b));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator *(const double& a, const Variable<group_id>& b) {
-        return Variable<group_id>(times_dv(b.gs, a, b.var));
+        return Variable<group_id>(ad_times_dv(b.gs, a, b.var));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator /(const Variable<group_id>& a, const Variable<group_id>& b) {
-        return Variable<group_id>(divide_vv(a.gs, a.var, b.var));
+        return Variable<group_id>(ad_divide(a.gs, a.var, b.var));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator /(const Variable<group_id>& a, const double& b) {
-        return Variable<group_id>(divide_vd(a.gs, a.var, b));
+        return Variable<group_id>(ad_divide_vd(a.gs, a.var, b));
     }
 
     template<int group_id>
     inline const Variable<group_id> operator /(const double& a, const Variable<group_id>& b) {
-        return Variable<group_id>(divide_dv(b.gs, a, b.var));
+        return Variable<group_id>(ad_divide_dv(b.gs, a, b.var));
     }
 
 
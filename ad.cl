@@ -48,6 +48,24 @@ typedef float16 real16_t;
 #endif
 
 
+/**
+ * Storage precision of values and tape partials, must match ad4cl.h. 
+ * Define AD_FLOAT_VALUES and/or AD_FLOAT_PARTIALS to store them in single 
+ * precision; arithmetic between them and adjoint accumulation are 
+ * unaffected.
+ */
+#ifdef AD_FLOAT_VALUES
+typedef float ad_value_t;
+#else
+typedef double ad_value_t;
+#endif
+
+#ifdef AD_FLOAT_PARTIALS
+typedef float ad_partial_t;
+#else
+typedef double ad_partial_t;
+#endif
+
 #ifndef PRIVATE_STACK_SIZE
 #define PRIVATE_STACK_SIZE 100
 #endif
@@ -56,36 +74,109 @@ typedef float16 real16_t;
 #define PRIVATE_GRADIENT_SIZE 150
 #endif
 
+/**
+ * Largest number of independent variables of a preaccumulation, see 
+ * pad_preaccumulate.
+ */
+#ifndef PREACCUMULATE_INPUTS
+#define PREACCUMULATE_INPUTS 8
+#endif
+
 #ifndef MAX_VARIABLE_IN_EXPESSION
 #define MAX_VARIABLE_IN_EXPESSION 2
 #endif
 
+/**
+ * Define AD_SOA_TAPE (-DAD_SOA_TAPE) to store the tape as a structure of 
+ * arrays, or AD_CSR_TAPE to store it in compressed sparse row form, see 
+ * ad_tape_columns in ad4cl.h. The host must use the same setting.
+ */
+
+#if defined(AD_SOA_TAPE) && defined(AD_CSR_TAPE)
+#error "AD_SOA_TAPE and AD_CSR_TAPE are mutually exclusive"
+#endif
+
+/**
+ * Define AD_IMPLICIT_ID to leave the result id out of every entry. The 
+ * entry in slot s is then the result with id 
+ * s + current_ad_variable_id - stack_current, see AD_ENTRY_ID.
+ */
+
+/**
+ * Define AD_HESSIAN_VECTOR to carry a tangent (the derivative along a 
+ * direction v) in every ad_variable and the tangent of every partial in 
+ * its ad_pair, see AD_RECORD_UNARY_OP and ad_reverse_sweep_hv. Only the 
+ * array of ad_entry's layout is supported.
+ */
+#if defined(AD_HESSIAN_VECTOR) && (defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE))
+#error "AD_HESSIAN_VECTOR needs the default tape layout"
+#endif
+
+/**
+ * Define AD_SECOND_ORDER to store the second order partials of every 
+ * entry, the upper triangle of its local Hessian packed as indexed by 
+ * AD_HESSIAN_INDEX, for the sparse Hessian in ad4cl.h. Only the array of 
+ * ad_entry's layout is supported.
+ */
+#if defined(AD_SECOND_ORDER) && (defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE))
+#error "AD_SECOND_ORDER needs the default tape layout"
+#endif
 
+#define AD_HESSIAN_SIZE (MAX_VARIABLE_IN_EXPESSION * (MAX_VARIABLE_IN_EXPESSION + 1) / 2)
+#define AD_HESSIAN_INDEX(a, b) ((a) * (2 * MAX_VARIABLE_IN_EXPESSION - (a) - 1) / 2 + (b))
 
 struct  ad_variable {
-    double value;
+    ad_value_t value;
     int id;
+#ifdef AD_HESSIAN_VECTOR
+    ad_value_t tangent;
+#endif
 };
 
 struct  ad_pair {
-    double dx;
+    ad_partial_t dx;
     int id;
+#ifdef AD_HESSIAN_VECTOR
+    ad_partial_t ddx;
+#endif
 };
 
 struct ad_entry {
     struct ad_pair coeff[MAX_VARIABLE_IN_EXPESSION];
+#ifndef AD_IMPLICIT_ID
     int id;
+#endif
     int size;
+#ifdef AD_SECOND_ORDER
+    ad_partial_t hessian[AD_HESSIAN_SIZE];
+#endif
 };
 
+/**
+ * Field order must match ad_gradient_structure in ad4cl.h, the host 
+ * appends its own fields after pair_reserved. parent, reserved and 
+ * pair_reserved are only used by the private gradient structures of the 
+ * pad_ operations: the global gradient structure and the ends of the 
+ * block reserved from it, see pad_slot.
+ */
 struct  ad_gradient_structure {
     __global struct ad_entry* gradient_stack;
     int current_ad_variable_id;
     int stack_current;
     int recording;
     int counter;
-    __global struct ad_entry* index;
-
+    int capacity;
+    __global ad_partial_t* coeff_dx;
+    __global int* coeff_id;
+    __global int* entry_id;
+    __global int* entry_size;
+    __global int* entry_offset;
+    int pair_capacity;
+    int pair_current;
+    int pair_counter;
+    __global struct ad_gradient_structure* parent;
+    int reserved;
+    int pair_reserved;
 };
 
 struct ad_private_gradient_structure {
@@ -126,13 +217,259 @@ inline void lbfgs_update_g(struct lbfgs_parameters_g* parameters);
 
 inline void lbfgs_update_p(struct lbfgs_parameters_p* parameters);
 
+#ifdef AD_CSR_TAPE
+
+/**
+ * Reserves n consecutive coefficient pairs and returns the offset of the 
+ * first.
+ */
+inline int __attribute__((overloadable)) ad_reserve_pairs(__global struct ad_gradient_structure* gs, int n) {
+    return gs->pair_current + atomic_add(&gs->pair_counter, n);
+}
+
+/**
+ * Reserves n pairs from the block a private gradient structure got from 
+ * pad_init, or from the global gradient structure once the block is used 
+ * up.
+ */
+inline int __attribute__((overloadable)) ad_reserve_pairs(struct ad_gradient_structure* gs, int n) {
+    if (gs->pair_counter + n > gs->pair_reserved) {
+        return ad_reserve_pairs(gs->parent, n);
+    }
+    int p = gs->pair_counter;
+    gs->pair_counter += n;
+    return gs->pair_current + p;
+}
+#endif
+
+/**
+ * Stores a result id into the tape, nothing with AD_IMPLICIT_ID.
+ */
+#ifdef AD_IMPLICIT_ID
+#define AD_STORE_ID(lvalue, rid) ((void) 0)
+#else
+#define AD_STORE_ID(lvalue, rid) ((lvalue) = (rid))
+#endif
+
+/**
+ * Writes a one coefficient entry to slot of the tape. gs may be a global 
+ * or a private gradient structure, hence a macro.
+ */
+#if defined(AD_CSR_TAPE)
+#define AD_RECORD_UNARY(gs, slot, rid, dx0, id0) do { \
+        int s_ = (slot); \
+        int p_ = ad_reserve_pairs((gs), 1); \
+        (gs)->coeff_dx[p_] = (dx0); \
+        (gs)->coeff_id[p_] = (id0); \
+        AD_STORE_ID((gs)->entry_id[s_], (rid)); \
+        (gs)->entry_size[s_] = 1; \
+        (gs)->entry_offset[s_] = p_; \
+    } while (0)
+
+#define AD_RECORD_BINARY(gs, slot, rid, dx0, id0, dx1, id1) do { \
+        int s_ = (slot); \
+        int p_ = ad_reserve_pairs((gs), 2); \
+        (gs)->coeff_dx[p_] = (dx0); \
+        (gs)->coeff_id[p_] = (id0); \
+        (gs)->coeff_dx[p_ + 1] = (dx1); \
+        (gs)->coeff_id[p_ + 1] = (id1); \
+        AD_STORE_ID((gs)->entry_id[s_], (rid)); \
+        (gs)->entry_size[s_] = 2; \
+        (gs)->entry_offset[s_] = p_; \
+    } while (0)
+
+#define AD_ENTRY_SIZE(gs, slot) ((gs)->entry_size[(slot)])
+#define AD_ENTRY_DX(gs, slot, i) ((gs)->coeff_dx[(gs)->entry_offset[(slot)] + (i)])
+#define AD_ENTRY_COEFF_ID(gs, slot, i) ((gs)->coeff_id[(gs)->entry_offset[(slot)] + (i)])
+#elif defined(AD_SOA_TAPE)
+#define AD_RECORD_UNARY(gs, slot, rid, dx0, id0) do { \
+        int s_ = (slot); \
+        (gs)->coeff_dx[s_] = (dx0); \
+        (gs)->coeff_id[s_] = (id0); \
+        AD_STORE_ID((gs)->entry_id[s_], (rid)); \
+        (gs)->entry_size[s_] = 1; \
+    } while (0)
+
+#define AD_RECORD_BINARY(gs, slot, rid, dx0, id0, dx1, id1) do { \
+        int s_ = (slot); \
+        (gs)->coeff_dx[s_] = (dx0); \
+        (gs)->coeff_id[s_] = (id0); \
+        (gs)->coeff_dx[(gs)->capacity + s_] = (dx1); \
+        (gs)->coeff_id[(gs)->capacity + s_] = (id1); \
+        AD_STORE_ID((gs)->entry_id[s_], (rid)); \
+        (gs)->entry_size[s_] = 2; \
+    } while (0)
+
+#define AD_ENTRY_SIZE(gs, slot) ((gs)->entry_size[(slot)])
+#define AD_ENTRY_DX(gs, slot, i) \
+        ((gs)->coeff_dx[(i) % MAX_VARIABLE_IN_EXPESSION * (gs)->capacity + (slot) - (i) / MAX_VARIABLE_IN_EXPESSION])
+#define AD_ENTRY_COEFF_ID(gs, slot, i) \
+        ((gs)->coeff_id[(i) % MAX_VARIABLE_IN_EXPESSION * (gs)->capacity + (slot) - (i) / MAX_VARIABLE_IN_EXPESSION])
+#else
+
+/**
+ * Zeroes the second order partials of entry e, nothing without 
+ * AD_SECOND_ORDER.
+ */
+#ifdef AD_SECOND_ORDER
+#define AD_CLEAR_HESSIAN(e) do { \
+        for (int h_ = 0; h_ < AD_HESSIAN_SIZE; h_++) { \
+            (e).hessian[h_] = 0.0; \
+        } \
+    } while (0)
+#else
+#define AD_CLEAR_HESSIAN(e) ((void) 0)
+#endif
+
+#define AD_RECORD_UNARY(gs, slot, rid, dx0, id0) do { \
+        struct ad_entry e_; \
+        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = (id0)}; \
+        AD_STORE_ID(e_.id, (rid)); \
+        e_.size = 1; \
+        AD_CLEAR_HESSIAN(e_); \
+        (gs)->gradient_stack[(slot)] = e_; \
+    } while (0)
+
+#define AD_RECORD_BINARY(gs, slot, rid, dx0, id0, dx1, id1) do { \
+        struct ad_entry e_; \
+        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = (id0)}; \
+        e_.coeff[1] = (struct ad_pair){.dx = (dx1), .id = (id1)}; \
+        AD_STORE_ID(e_.id, (rid)); \
+        e_.size = 2; \
+        AD_CLEAR_HESSIAN(e_); \
+        (gs)->gradient_stack[(slot)] = e_; \
+    } while (0)
+
+#define AD_ENTRY_SIZE(gs, slot) ((gs)->gradient_stack[(slot)].size)
+#define AD_ENTRY_DX(gs, slot, i) \
+        ((gs)->gradient_stack[(slot) - (i) / MAX_VARIABLE_IN_EXPESSION].coeff[(i) % MAX_VARIABLE_IN_EXPESSION].dx)
+#define AD_ENTRY_COEFF_ID(gs, slot, i) \
+        ((gs)->gradient_stack[(slot) - (i) / MAX_VARIABLE_IN_EXPESSION].coeff[(i) % MAX_VARIABLE_IN_EXPESSION].id)
+#endif
+
+/**
+ * Records ret = f(x) with f'(x) = dx0 and f''(x) = d2, or ret = f(x0, x1) 
+ * with the partials dx0, dx1 and the second order partials h00, h01 and 
+ * h11. With AD_HESSIAN_VECTOR ret gets its tangent and every pair the 
+ * tangent of its partial, with AD_SECOND_ORDER the entry keeps the second 
+ * order partials. Without either only the ids are used and the second 
+ * order partials are not even evaluated.
+ */
+#ifdef AD_HESSIAN_VECTOR
+#define AD_TANGENT_UNARY(e, ret, dx0, x, d2) do { \
+        (e).coeff[0].ddx = (d2) * (x).tangent; \
+        (ret).tangent = (dx0) * (x).tangent; \
+    } while (0)
+
+#define AD_TANGENT_BINARY(e, ret, dx0, x0, dx1, x1, h00, h01, h11) do { \
+        (e).coeff[0].ddx = (h00) * (x0).tangent + (h01) * (x1).tangent; \
+        (e).coeff[1].ddx = (h01) * (x0).tangent + (h11) * (x1).tangent; \
+        (ret).tangent = (dx0) * (x0).tangent + (dx1) * (x1).tangent; \
+    } while (0)
+
+#define AD_ENTRY_DDX(gs, slot, i) \
+        ((gs)->gradient_stack[(slot) - (i) / MAX_VARIABLE_IN_EXPESSION].coeff[(i) % MAX_VARIABLE_IN_EXPESSION].ddx)
+#else
+#define AD_TANGENT_UNARY(e, ret, dx0, x, d2) ((void) 0)
+#define AD_TANGENT_BINARY(e, ret, dx0, x0, dx1, x1, h00, h01, h11) ((void) 0)
+#endif
+
+#ifdef AD_SECOND_ORDER
+#define AD_HESSIAN_UNARY(e, d2) do { \
+        AD_CLEAR_HESSIAN(e); \
+        (e).hessian[0] = (d2); \
+    } while (0)
+
+#define AD_HESSIAN_BINARY(e, h00, h01, h11) do { \
+        AD_CLEAR_HESSIAN(e); \
+        (e).hessian[AD_HESSIAN_INDEX(0, 0)] = (h00); \
+        (e).hessian[AD_HESSIAN_INDEX(0, 1)] = (h01); \
+        (e).hessian[AD_HESSIAN_INDEX(1, 1)] = (h11); \
+    } while (0)
+#else
+#define AD_HESSIAN_UNARY(e, d2) ((void) 0)
+#define AD_HESSIAN_BINARY(e, h00, h01, h11) ((void) 0)
+#endif
+
+#if defined(AD_HESSIAN_VECTOR) || defined(AD_SECOND_ORDER)
+#define AD_RECORD_UNARY_OP(gs, slot, ret, dx0, x, d2) do { \
+        struct ad_variable x_ = (x); \
+        struct ad_entry e_; \
+        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = x_.id}; \
+        AD_STORE_ID(e_.id, (ret).id); \
+        e_.size = 1; \
+        AD_TANGENT_UNARY(e_, ret, dx0, x_, d2); \
+        AD_HESSIAN_UNARY(e_, d2); \
+        (gs)->gradient_stack[(slot)] = e_; \
+    } while (0)
+
+#define AD_RECORD_BINARY_OP(gs, slot, ret, dx0, x0, dx1, x1, h00, h01, h11) do { \
+        struct ad_variable x0_ = (x0); \
+        struct ad_variable x1_ = (x1); \
+        struct ad_entry e_; \
+        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = x0_.id}; \
+        e_.coeff[1] = (struct ad_pair){.dx = (dx1), .id = x1_.id}; \
+        AD_STORE_ID(e_.id, (ret).id); \
+        e_.size = 2; \
+        AD_TANGENT_BINARY(e_, ret, dx0, x0_, dx1, x1_, h00, h01, h11); \
+        AD_HESSIAN_BINARY(e_, h00, h01, h11); \
+        (gs)->gradient_stack[(slot)] = e_; \
+    } while (0)
+#else
+#define AD_RECORD_UNARY_OP(gs, slot, ret, dx0, x, d2) \
+        AD_RECORD_UNARY(gs, slot, (ret).id, dx0, (x).id)
+
+#define AD_RECORD_BINARY_OP(gs, slot, ret, dx0, x0, dx1, x1, h00, h01, h11) \
+        AD_RECORD_BINARY(gs, slot, (ret).id, dx0, (x0).id, dx1, (x1).id)
+#endif
+
+/**
+ * Reads the entry in slot. Coefficient i of an entry of more than 
+ * MAX_VARIABLE_IN_EXPESSION coefficients lives in slot - i / 
+ * MAX_VARIABLE_IN_EXPESSION, see ad_nary.
+ */
+#if defined(AD_IMPLICIT_ID)
+#define AD_ENTRY_ID(gs, slot) ((slot) + (gs)->current_ad_variable_id - (gs)->stack_current)
+#elif defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE)
+#define AD_ENTRY_ID(gs, slot) ((gs)->entry_id[(slot)])
+#else
+#define AD_ENTRY_ID(gs, slot) ((gs)->gradient_stack[(slot)].id)
+#endif
+
+/**
+ * Binds gradient_stack to gs. With AD_SOA_TAPE or AD_CSR_TAPE the buffer 
+ * is split into columns the same way as ad_tape_columns in ad4cl.h, using 
+ * gs->capacity and gs->pair_capacity.
+ */
 inline void ad_init(__global struct ad_gradient_structure* gs, __global struct ad_entry * gradient_stack) {
     gs->gradient_stack = gradient_stack;
+#if defined(AD_CSR_TAPE)
+    gs->coeff_dx = (__global ad_partial_t*) gradient_stack;
+    gs->coeff_id = (__global int*) (gs->coeff_dx + gs->pair_capacity);
+    gs->entry_id = gs->coeff_id + gs->pair_capacity;
+#ifdef AD_IMPLICIT_ID
+    gs->entry_size = gs->entry_id;
+    gs->entry_id = 0;
+#else
+    gs->entry_size = gs->entry_id + gs->capacity;
+#endif
+    gs->entry_offset = gs->entry_size + gs->capacity;
+#elif defined(AD_SOA_TAPE)
+    gs->coeff_dx = (__global ad_partial_t*) gradient_stack;
+    gs->coeff_id = (__global int*) (gs->coeff_dx + gs->capacity * MAX_VARIABLE_IN_EXPESSION);
+    gs->entry_id = gs->coeff_id + gs->capacity * MAX_VARIABLE_IN_EXPESSION;
+#ifdef AD_IMPLICIT_ID
+    gs->entry_size = gs->entry_id;
+    gs->entry_id = 0;
+#else
+    gs->entry_size = gs->entry_id + gs->capacity;
+#endif
+#endif
 }
 
 inline void ad_init_p(struct ad_private_gradient_structure* gs) {
     for (int i = 0; i < PRIVATE_STACK_SIZE; i++) {
-        gs->gradient_stack[i].id = 0;
+        AD_STORE_ID(gs->gradient_stack[i].id, 0);
         gs->gradient_stack[i].size = 0;
     }
     gs->counter = 0;
@@ -141,23 +478,264 @@ inline void ad_init_p(struct ad_private_gradient_structure* gs) {
     gs->stack_current = 0;
 }
 
+/**
+ * Binds the private gradient structure pgs to the block of operations 
+ * slots starting at counter (and pairs at pair_counter with AD_CSR_TAPE) 
+ * reserved from gs. The block is cleared so slots that end up unused are 
+ * empty entries, which keeps resets independent of the tape size, see 
+ * ad_reset.
+ */
+inline void pad_bind(struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs, __global struct ad_entry * gradient_stack,
+        int counter, int pair_counter, int operations) {
+    pgs->gradient_stack = gradient_stack;
+    pgs->counter = counter;
+    pgs->current_ad_variable_id = gs->current_ad_variable_id;
+    pgs->stack_current = gs->stack_current;
+    pgs->recording = gs->recording;
+    pgs->capacity = gs->capacity;
+    pgs->coeff_dx = gs->coeff_dx;
+    pgs->coeff_id = gs->coeff_id;
+    pgs->entry_id = gs->entry_id;
+    pgs->entry_size = gs->entry_size;
+    pgs->entry_offset = gs->entry_offset;
+    pgs->pair_capacity = gs->pair_capacity;
+    pgs->pair_current = gs->pair_current;
+    pgs->pair_counter = pair_counter;
+    pgs->parent = gs;
+    pgs->reserved = counter + operations;
+    pgs->pair_reserved = pair_counter + operations * MAX_VARIABLE_IN_EXPESSION;
+    for (int i = 0; i < operations; i++) {
+        AD_ENTRY_SIZE(pgs, pgs->stack_current + pgs->counter + i) = 0;
+    }
+}
+
+/**
+ * Initializes the private gradient structure pgs with a block of 
+ * operations consecutive tape slots for the pad_ operations of this work 
+ * item, see pad_bind. Costs one atomic_add on gs per work item, 
+ * pad_init_group only one per work group and pad_init_scan none.
+ * 
+ * @param operations - pad_ operations recorded, more only cost an 
+ * atomic_inc each, see pad_slot.
+ * @param pgs
+ * @param gs
+ * @param gradient_stack
+ */
 inline void pad_init(int operations, struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs, __global struct ad_entry * gradient_stack) {
 
     if (gs->recording == 1) {
-        pgs->gradient_stack = gradient_stack;
-        pgs->counter = atomic_add(&gs->counter, operations);
-        pgs->current_ad_variable_id = gs->current_ad_variable_id;
-        pgs->stack_current = gs->stack_current;
-        pgs->recording = gs->recording;
-        pgs->index = &gs->gradient_stack[gs->stack_current];
+        int pair_counter = 0;
+#ifdef AD_CSR_TAPE
+        pair_counter = atomic_add(&gs->pair_counter, operations * MAX_VARIABLE_IN_EXPESSION);
+#endif
+        pad_bind(pgs, gs, gradient_stack, atomic_add(&gs->counter, operations), pair_counter, operations);
+    } else {
+        pgs->recording = 0;
+    }
+}
+
+/**
+ * Same as pad_init, but the whole work group reserves its blocks with a 
+ * single atomic_add on gs: the operation counts of the work items are 
+ * prefix summed in local memory and the last work item reserves the 
+ * total. Every work item of the group must call it, those that record 
+ * nothing with operations 0.
+ * 
+ * @param operations - pad_ operations recorded by this work item, more 
+ * only cost an atomic_inc each, see pad_slot.
+ * @param pgs
+ * @param gs
+ * @param gradient_stack
+ * @param scratch - local memory for get_local_size(0) + 2 ints.
+ */
+inline void pad_init_group(int operations, struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs,
+        __global struct ad_entry * gradient_stack, __local int* scratch) {
+
+    if (gs->recording == 1) {
+        int lid = get_local_id(0);
+        int n = get_local_size(0);
+
+        //inclusive prefix sum of the operation counts
+        scratch[lid] = operations;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int s = 1; s < n; s <<= 1) {
+            int v = lid >= s ? scratch[lid - s] : 0;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            scratch[lid] += v;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (lid == n - 1) {
+            scratch[n] = atomic_add(&gs->counter, scratch[lid]);
+#ifdef AD_CSR_TAPE
+            scratch[n + 1] = atomic_add(&gs->pair_counter, scratch[lid] * MAX_VARIABLE_IN_EXPESSION);
+#endif
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        int offset = scratch[lid] - operations;
+        int pair_counter = 0;
+#ifdef AD_CSR_TAPE
+        pair_counter = scratch[n + 1] + offset * MAX_VARIABLE_IN_EXPESSION;
+#endif
+        pad_bind(pgs, gs, gradient_stack, scratch[n] + offset, pair_counter, operations);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    } else {
+        pgs->recording = 0;
+    }
+}
+
+/**
+ * Turns the operation counts of a counting pass into tape offsets, for
+ * recordings whose layout must not depend on scheduling, see
+ * pad_init_scan. offsets[0..n) holds the operation count of every work
+ * item on input; on output offsets[0..n] holds their exclusive prefix sum
+ * and offsets[n + 1], offsets[n + 2] the counter and pair_counter of gs
+ * the block starts at. gs is advanced past the whole block.
+ *
+ * Launch as a single work group, each work item scans a chunk of
+ * consecutive counts so any n works.
+ *
+ * @param gs
+ * @param offsets - n + 3 ints.
+ * @param n - global size of the counting and recording kernels.
+ * @param scratch - local memory for get_local_size(0) ints.
+ */
+__kernel void ad_scan_operations(__global struct ad_gradient_structure* gs,
+        __global int* offsets,
+        int n,
+        __local int* scratch) {
+    int lid = get_local_id(0);
+    int size = get_local_size(0);
+    int chunk = (n + size - 1) / size;
+    int first = min(lid * chunk, n);
+    int last = min(first + chunk, n);
+
+    int sum = 0;
+    for (int i = first; i < last; i++) {
+        sum += offsets[i];
+    }
+
+    //inclusive prefix sum of the chunk totals
+    scratch[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int s = 1; s < size; s <<= 1) {
+        int v = lid >= s ? scratch[lid - s] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[lid] += v;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    int running = scratch[lid] - sum;
+    for (int i = first; i < last; i++) {
+        int count = offsets[i];
+        offsets[i] = running;
+        running += count;
+    }
+
+    if (lid == size - 1) {
+        int total = scratch[lid];
+        offsets[n] = total;
+        offsets[n + 1] = gs->counter;
+        offsets[n + 2] = gs->pair_counter;
+        gs->counter += total;
+#ifdef AD_CSR_TAPE
+        gs->pair_counter += total * MAX_VARIABLE_IN_EXPESSION;
+#endif
+    }
+}
+
+/**
+ * Same as pad_init, but without atomics: the block of this work item is
+ * at the offset ad_scan_operations computed from the counting pass, so
+ * every slot is at the same position on every run and tapes and
+ * gradients are bit identical. The number of operations is the count
+ * given to the counting pass, recording more falls back to atomic_inc
+ * like pad_init, see pad_slot.
+ *
+ * @param offsets - output of ad_scan_operations, counted with the same
+ * global size as the calling kernel.
+ * @param pgs
+ * @param gs
+ * @param gradient_stack
+ */
+inline void pad_init_scan(__global const int* offsets, struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs,
+        __global struct ad_entry * gradient_stack) {
+
+    if (gs->recording == 1) {
+        int n = get_global_size(0);
+        int id = get_global_id(0);
+        int offset = offsets[id];
+        int operations = offsets[id + 1] - offset;
+        int pair_counter = 0;
+#ifdef AD_CSR_TAPE
+        pair_counter = offsets[n + 2] + offset * MAX_VARIABLE_IN_EXPESSION;
+#endif
+        pad_bind(pgs, gs, gradient_stack, offsets[n + 1] + offset, pair_counter, operations);
     } else {
         pgs->recording = 0;
     }
 }
 
+/**
+ * Hands out the next slot of the block reserved by pad_init, relative to 
+ * stack_current. Once the block is used up the slots come from the global 
+ * gradient structure, so recording more operations than reserved is only 
+ * slower.
+ */
+inline int pad_slot(struct ad_gradient_structure* pgs) {
+    if (pgs->counter < pgs->reserved) {
+        return pgs->counter++;
+    }
+    return atomic_inc(&pgs->parent->counter);
+}
+
+/**
+ * Same as pad_slot for n consecutive slots, the first is returned. They 
+ * come from the global gradient structure as a whole when they do not 
+ * fit the rest of the block.
+ */
+inline int pad_slots(struct ad_gradient_structure* pgs, int n) {
+    if (pgs->counter + n <= pgs->reserved) {
+        int index = pgs->counter;
+        pgs->counter += n;
+        return index;
+    }
+    return atomic_add(&pgs->parent->counter, n);
+}
+
+/**
+ * Starts a new recording. Only the counters are reset: every slot handed 
+ * out afterwards is written or cleared before it is read, see pad_init, 
+ * so the cost does not depend on the size of the tape. Must be called by 
+ * a single work item with no other work item recording, e.g. after the 
+ * reverse sweep. The host counterpart is ad_reset in ad4cl.h.
+ * 
+ * @param gs
+ * @param first_id - id of the first variable of the new recording, 
+ * smaller ids (independent variables) stay valid.
+ */
+inline void ad_reset(__global struct ad_gradient_structure* gs, int first_id) {
+    gs->current_ad_variable_id = first_id;
+    gs->stack_current = 0;
+    gs->counter = 0;
+    gs->pair_current = 0;
+    gs->pair_counter = 0;
+}
+
+/**
+ * Gives var a new id and value. The id comes with an empty tape slot, so 
+ * it can not collide with the ids of entries recorded concurrently. With 
+ * AD_HESSIAN_VECTOR the tangent is 0, set it to the direction after.
+ */
 inline void ad_init_var_g(__global struct ad_gradient_structure* gs, struct ad_variable* var, double value) {
-    var->id = atomic_inc(&gs->current_ad_variable_id);
+    int index = atomic_inc(&gs->counter);
+    var->id = index + gs->current_ad_variable_id;
+    AD_ENTRY_SIZE(gs, index + gs->stack_current) = 0;
     var->value = value;
+#ifdef AD_HESSIAN_VECTOR
+    var->tangent = 0.0;
+#endif
 }
 
 
@@ -177,12 +755,9 @@ inline const struct ad_variable ad_plus(__global struct ad_gradient_structure* g
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e->size = 2;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                1.0, a, 1.0, b,
+                0.0, 0.0, 0.0);
     }
 
     return ret;
@@ -203,11 +778,7 @@ inline const struct ad_variable ad_plus_vd(__global struct ad_gradient_structure
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e->size = 1;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);
     }
 
     return ret;
@@ -228,11 +799,7 @@ inline const struct ad_variable ad_plus_dv(__global struct ad_gradient_structure
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, b, 0.0);
     }
 
     return ret;
@@ -240,7 +807,8 @@ inline const struct ad_variable ad_plus_dv(__global struct ad_gradient_structure
 
 /**
  * Plus assign ad_variable a and ad_variable b. If the gradient structure is recording, 
- * entries will be added, otherwise the result is only computed.
+ * entries will be added and a gets the id of the new entry, otherwise the 
+ * result is only computed.
  * 
  * @param gs
  * @param a
@@ -251,12 +819,11 @@ inline void ad_plus_eq(__global struct ad_gradient_structure* gs, struct ad_vari
 
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-        e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e->size = 2;
-        e->id = a->id;
+        struct ad_variable ret = {.value = a->value, .id = index + gs->current_ad_variable_id};
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                1.0, *a, 1.0, b,
+                0.0, 0.0, 0.0);
+        *a = ret;
     }
 }
 
@@ -265,18 +832,18 @@ inline void ad_plus_eq_g(__global struct ad_gradient_structure* gs, __global str
 
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-        e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e->size = 2;
-        e->id = a->id;
+        struct ad_variable ret = {.value = a->value, .id = index + gs->current_ad_variable_id};
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                1.0, *a, 1.0, b,
+                0.0, 0.0, 0.0);
+        *a = ret;
     }
 }
 
 /**
  * Plus assign ad_variable a and double b. If the gradient structure is recording, 
- * entries will be added, otherwise the result is only computed.
+ * entries will be added and a gets the id of the new entry, otherwise the 
+ * result is only computed.
  *  
  * @param gs
  * @param a
@@ -287,11 +854,9 @@ inline void ad_plus_eq_d(__global struct ad_gradient_structure* gs, struct ad_va
 
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-        e->size = 1;
-        e->id = a->id;
+        struct ad_variable ret = {.value = a->value, .id = index + gs->current_ad_variable_id};
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, *a, 0.0);
+        *a = ret;
     }
 }
 
@@ -310,12 +875,9 @@ inline const struct ad_variable ad_minus(__global struct ad_gradient_structure*
     if (gs->recording) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e->coeff[1] = (struct ad_pair){.dx = -1.0, .id = b.id};
-        e->size = 2;
-        e->id = ret.id;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                1.0, a, -1.0, b,
+                0.0, 0.0, 0.0);
     }
 
     return ret;
@@ -336,11 +898,7 @@ inline const struct ad_variable ad_minus_vd(__global struct ad_gradient_structur
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e->size = 1;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);
     }
 
     return ret;
@@ -361,11 +919,7 @@ inline const struct ad_variable ad_minus_dv(__global struct ad_gradient_structur
     if (gs->recording) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = -1.0, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0, b, 0.0);
     }
 
     return ret;
@@ -387,12 +941,9 @@ inline const struct ad_variable ad_times(__global struct ad_gradient_structure*
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
-        e->coeff[0] = (struct ad_pair){.dx = a.value, .id = a.id};
-        e->coeff[1] = (struct ad_pair){.dx = b.value, .id = b.id};
-        e->size = 2;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                b.value, a, a.value, b,
+                0.0, 1.0, 0.0);
     }
 
     return ret;
@@ -413,11 +964,7 @@ inline const struct ad_variable ad_times_vd(__global struct ad_gradient_structur
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = b, .id = a.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, b, a, 0.0);
     }
 
     return ret;
@@ -438,11 +985,7 @@ inline const struct ad_variable ad_times_dv(__global struct ad_gradient_structur
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = b.value, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, a, b, 0.0);
     }
 
     return ret;
@@ -463,13 +1006,10 @@ inline const struct ad_variable ad_divide(__global struct ad_gradient_structure*
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = 1.0 / b.value;
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-        e->coeff[1] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
-        e->size = 2;
-        e->id = ret.id;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                inv, a, -1.0 * ret.value * inv, b,
+                0.0, -1.0 * inv * inv, 2.0 * ret.value * inv * inv);
     }
 
     return ret;
@@ -489,12 +1029,8 @@ inline const struct ad_variable ad_divide_vd(__global struct ad_gradient_structu
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = 1.0 / b;
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, a, 0.0);
     }
     return ret;
 }
@@ -513,12 +1049,8 @@ inline const struct ad_variable ad_divide_dv(__global struct ad_gradient_structu
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = 1.0 / b.value;
-        e->coeff[0] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0 * ret.value * inv, b, 2.0 * ret.value * inv * inv);
     }
 
     return ret;
@@ -537,18 +1069,15 @@ inline const struct ad_variable pad_plus(struct ad_gradient_structure* gs, const
     //    struct ad_variable ret = {.value = a.value + b.value, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         struct ad_variable ret = {.value = a.value + b.value, .id = gs->current_ad_variable_id + index};
         //        ret.id = index + gs->current_ad_variable_id;
         //        __global struct ad_entry* e =
         //                &gs->gradient_stack[index + gs->stack_current];
-        struct ad_entry e;
-        e.id = ret.id;
-        e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e.coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e.size = 2;
 
-        gs->gradient_stack[index + gs->stack_current] = e;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                1.0, a, 1.0, b,
+                0.0, 0.0, 0.0);
         return ret;
     } else {
 
@@ -573,13 +1102,9 @@ inline const struct ad_variable pad_plus_vd(struct ad_gradient_structure* gs, st
     struct ad_variable ret = {.value = a.value + b, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e->size = 1;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);
     }
 
     return ret;
@@ -598,13 +1123,9 @@ inline const struct ad_variable pad_plus_dv(struct ad_gradient_structure* gs, do
     struct ad_variable ret = {.value = a + b.value, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, b, 0.0);
     }
 
     return ret;
@@ -612,7 +1133,8 @@ inline const struct ad_variable pad_plus_dv(struct ad_gradient_structure* gs, do
 
 /**
  * Plus assign ad_variable a and ad_variable b. If the gradient structure is recording, 
- * entries will be added, otherwise the result is only computed.
+ * entries will be added and a gets the id of the new entry, otherwise the 
+ * result is only computed.
  * 
  * @param gs
  * @param a
@@ -622,13 +1144,9 @@ inline void pad_plus_eq(struct ad_gradient_structure* gs, struct ad_variable* a,
     a->value += b.value;
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-        e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e->size = 2;
-        e->id = a->id;
+        int index = pad_slot(gs);
+        AD_RECORD_BINARY(gs, index + gs->stack_current, a->id,
+                1.0, a->id, 1.0, b.id);
     }
 }
 
@@ -636,19 +1154,16 @@ inline void pad_plus_eq_g(struct ad_gradient_structure* gs, __global struct ad_v
     a->value += b.value;
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-        e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-        e->size = 2;
-        e->id = a->id;
+        int index = pad_slot(gs);
+        AD_RECORD_BINARY(gs, index + gs->stack_current, a->id,
+                1.0, a->id, 1.0, b.id);
     }
 }
 
 /**
  * Plus assign ad_variable a and double b. If the gradient structure is recording, 
- * entries will be added, otherwise the result is only computed.
+ * entries will be added and a gets the id of the new entry, otherwise the 
+ * result is only computed.
  *  
  * @param gs
  * @param a
@@ -658,12 +1173,8 @@ inline void pad_plus_eq_d(struct ad_gradient_structure* gs, struct ad_variable*
     a->value += b;
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-        e->size = 1;
-        e->id = a->id;
+        int index = pad_slot(gs);
+        AD_RECORD_UNARY(gs, index + gs->stack_current, a->id, 1.0, a->id);
     }
 }
 
@@ -680,14 +1191,11 @@ inline const struct ad_variable pad_minus(struct ad_gradient_structure* gs, cons
     struct ad_variable ret = {.value = a.value - b.value, .id = 0};
 
     if (gs->recording) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e->coeff[1] = (struct ad_pair){.dx = -1.0, .id = b.id};
-        e->size = 2;
-        e->id = ret.id;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                1.0, a, -1.0, b,
+                0.0, 0.0, 0.0);
     }
 
     return ret;
@@ -706,15 +1214,11 @@ inline const struct ad_variable pad_minus_vd(struct ad_gradient_structure* gs, s
     struct ad_variable ret = {.value = a.value - b, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
         //        __global struct ad_entry* e =
         //                &gs->gradient_stack[index + gs->stack_current];
-        struct ad_entry e;
-        e.id = ret.id;
-        e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-        e.size = 1;
-        gs->gradient_stack[index + gs->stack_current] = e;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);
     }
 
     return ret;
@@ -733,13 +1237,9 @@ inline const struct ad_variable pad_minus_dv(struct ad_gradient_structure* gs, d
     struct ad_variable ret = {.value = a - b.value, .id = 0};
 
     if (gs->recording) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = -1.0, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0, b, 0.0);
     }
 
     return ret;
@@ -759,20 +1259,17 @@ inline const struct ad_variable pad_times(struct ad_gradient_structure* gs, cons
 
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         //        ret.id = index + gs->current_ad_variable_id;
         struct ad_variable ret = {.value = a.value * b.value, .id = index + gs->current_ad_variable_id};
         //        __global struct ad_entry* e =
         //                &gs->gradient_stack[index + gs->stack_current];
-        struct ad_entry e;
         //        (struct ad_entry){.coeff ={{.dx = a.value, .id = a.id},{.dx = b.value, .id = b.id}}, .id=ret.id, .size=2};
-        e.id = ret.id;
         //////          struct ad_pair data[] ={{.dx = a.value, .id = a.id},{.dx = b.value, .id = b.id}};
         //////        e.coeff = data;
-        e.coeff[0] = (struct ad_pair){.dx = a.value, .id = a.id};
-        e.coeff[1] = (struct ad_pair){.dx = b.value, .id = b.id};
-        e.size = 2;
-        gs->gradient_stack[index + gs->stack_current] = e;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                b.value, a, a.value, b,
+                0.0, 1.0, 0.0);
 
         return ret;
     } else {
@@ -798,17 +1295,13 @@ inline const struct ad_variable pad_times_vd(struct ad_gradient_structure* gs, s
     //    struct ad_variable ret = {.value = a.value * b, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         struct ad_variable ret = {.value = a.value * b, .id = index + gs->current_ad_variable_id};
 
         //        ret.id = index + gs->current_ad_variable_id;
         //        __global struct ad_entry* e =
         //                &gs->gradient_stack[index + gs->stack_current];
-        struct ad_entry e;
-        e.coeff[0] = (struct ad_pair){.dx = b, .id = a.id};
-        e.size = 1;
-        e.id = ret.id;
-        gs->gradient_stack[index + gs->stack_current] = e;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, b, a, 0.0);
         return ret;
     } else {
 
@@ -833,13 +1326,9 @@ inline const struct ad_variable pad_times_dv(struct ad_gradient_structure* gs, d
     struct ad_variable ret = {.value = a * b.value, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = a, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, a, b, 0.0);
     }
 
     return ret;
@@ -858,15 +1347,12 @@ inline const struct ad_variable pad_divide(struct ad_gradient_structure* gs, con
     struct ad_variable ret = {.value = a.value / b.value, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = 1.0 / b.value;
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-        e->coeff[1] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
-        e->size = 2;
-        e->id = ret.id;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                inv, a, -1.0 * ret.value * inv, b,
+                0.0, -1.0 * inv * inv, 2.0 * ret.value * inv * inv);
     }
 
     return ret;
@@ -884,16 +1370,12 @@ inline const struct ad_variable pad_divide_vd(struct ad_gradient_structure* gs,
     struct ad_variable ret = {.value = a.value / b, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
         //        __global struct ad_entry* e =
         //                &gs->gradient_stack[index + gs->stack_current];
-        struct ad_entry e;
         double inv = 1.0 / b;
-        e.coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-        e.size = 1;
-        e.id = ret.id;
-        gs->gradient_stack[index + gs->stack_current] = e;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, a, 0.0);
     }
     return ret;
 }
@@ -910,30 +1392,151 @@ inline const struct ad_variable pad_divide_dv(struct ad_gradient_structure* gs,
     struct ad_variable ret = {.value = a / b.value, .id = 0};
 
     if (gs->recording == 1) {
-        int index = gs->counter++;
+        int index = pad_slot(gs);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = 1.0 / b.value;
-        e->coeff[0] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0 * ret.value * inv, b, 2.0 * ret.value * inv * inv);
+    }
+
+    return ret;
+}
+
+/**
+ * Number of operations an n argument ad_nary/pad_nary takes from the 
+ * count given to pad_init: the slots its entry spans.
+ */
+#ifdef AD_CSR_TAPE
+#define AD_NARY_OPERATIONS(n) 1
+#else
+#define AD_NARY_OPERATIONS(n) (((n) + MAX_VARIABLE_IN_EXPESSION - 1) / MAX_VARIABLE_IN_EXPESSION)
+#endif
+
+/**
+ * Marks slot as part of an n-ary entry: the last slot gets the result rid 
+ * and the size, the ones before it size 0 so the sweeps skip them. gs may 
+ * be a global or a private gradient structure, hence a macro.
+ */
+#if defined(AD_SOA_TAPE)
+#define AD_RECORD_NARY_SLOT(gs, slot, rid, size) do { \
+        int s_ = (slot); \
+        AD_STORE_ID((gs)->entry_id[s_], (rid)); \
+        (gs)->entry_size[s_] = (size); \
+    } while (0)
+#elif !defined(AD_CSR_TAPE)
+#define AD_RECORD_NARY_SLOT(gs, slot, rid, size) do { \
+        int s_ = (slot); \
+        AD_STORE_ID((gs)->gradient_stack[s_].id, (rid)); \
+        (gs)->gradient_stack[s_].size = (size); \
+        AD_CLEAR_HESSIAN((gs)->gradient_stack[s_]); \
+    } while (0)
+#endif
+
+/**
+ * Writes the n-ary entry of result rid over the AD_NARY_OPERATIONS(n) 
+ * slots ending at last, see ad_nary. With AD_CSR_TAPE one slot and n 
+ * pairs.
+ */
+#ifdef AD_CSR_TAPE
+#define AD_RECORD_NARY(gs, last, rid, n, dx, args) do { \
+        int p_ = ad_reserve_pairs((gs), (n)); \
+        for (int i_ = 0; i_ < (n); i_++) { \
+            (gs)->coeff_dx[p_ + i_] = (dx)[i_]; \
+            (gs)->coeff_id[p_ + i_] = (args)[i_].id; \
+        } \
+        AD_STORE_ID((gs)->entry_id[(last)], (rid)); \
+        (gs)->entry_size[(last)] = (n); \
+        (gs)->entry_offset[(last)] = p_; \
+    } while (0)
+#else
+#define AD_RECORD_NARY(gs, last, rid, n, dx, args) do { \
+        int l_ = (last); \
+        int k_ = AD_NARY_OPERATIONS(n); \
+        for (int i_ = 0; i_ < (n); i_++) { \
+            AD_ENTRY_DX(gs, l_, i_) = (dx)[i_]; \
+            AD_ENTRY_COEFF_ID(gs, l_, i_) = (args)[i_].id; \
+        } \
+        for (int s_ = l_ - k_ + 1; s_ < l_; s_++) { \
+            AD_RECORD_NARY_SLOT(gs, s_, 0, 0); \
+        } \
+        AD_RECORD_NARY_SLOT(gs, l_, (rid), (n)); \
+    } while (0)
+#endif
+
+/**
+ * Records a result with value whose partial derivative is dx[i] 
+ * w.r.t. args[i] as a single entry. With AD_CSR_TAPE it takes one slot 
+ * and exactly n pairs, otherwise AD_NARY_OPERATIONS(n) consecutive slots: 
+ * the last holds the result and the size, coefficient i sits in slot 
+ * last - i / MAX_VARIABLE_IN_EXPESSION and the slots before the last 
+ * have size 0, see ad_nary in ad4cl.h. The result takes the id of the 
+ * last slot. With AD_HESSIAN_VECTOR dx is taken to be constant along the 
+ * direction.
+ * 
+ * @param gs
+ * @param value
+ * @param n - number of arguments, at least 1.
+ * @param dx
+ * @param args
+ * @return 
+ */
+inline const struct ad_variable ad_nary(__global struct ad_gradient_structure* gs, double value, int n, const double* dx, const struct ad_variable* args) {
+    struct ad_variable ret = {.value = value, .id = 0};
+
+    if (gs->recording == 1) {
+        int operations = AD_NARY_OPERATIONS(n);
+        int index = atomic_add(&gs->counter, operations) + operations - 1;
+        ret.id = index + gs->current_ad_variable_id;
+        AD_RECORD_NARY(gs, index + gs->stack_current, ret.id, n, dx, args);
+#ifdef AD_HESSIAN_VECTOR
+        ret.tangent = 0.0;
+        for (int i = 0; i < n; i++) {
+            AD_ENTRY_DDX(gs, index + gs->stack_current, i) = 0.0;
+            ret.tangent += dx[i] * args[i].tangent;
+        }
+#endif
+    }
+
+    return ret;
+}
+
+/**
+ * Private version of ad_nary. The block reserved by pad_init should 
+ * account for AD_NARY_OPERATIONS(n) operations, see pad_slots.
+ * 
+ * @param gs
+ * @param value
+ * @param n - number of arguments, at least 1.
+ * @param dx
+ * @param args
+ * @return 
+ */
+inline const struct ad_variable pad_nary(struct ad_gradient_structure* gs, double value, int n, const double* dx, const struct ad_variable* args) {
+    struct ad_variable ret = {.value = value, .id = 0};
+
+    if (gs->recording == 1) {
+        int operations = AD_NARY_OPERATIONS(n);
+        int index = pad_slots(gs, operations) + operations - 1;
+        ret.id = index + gs->current_ad_variable_id;
+        AD_RECORD_NARY(gs, index + gs->stack_current, ret.id, n, dx, args);
+#ifdef AD_HESSIAN_VECTOR
+        ret.tangent = 0.0;
+        for (int i = 0; i < n; i++) {
+            AD_ENTRY_DDX(gs, index + gs->stack_current, i) = 0.0;
+            ret.tangent += dx[i] * args[i].tangent;
+        }
+#endif
     }
 
     return ret;
 }
 
 inline const struct ad_variable __attribute__((overloadable)) ad_cos(__global struct ad_gradient_structure* gs, struct ad_variable v) {
-    struct ad_variable ret = {.value = log(v.value), .id = 0};
+    struct ad_variable ret = {.value = cos(v.value), .id = 0};
 
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = -1.0 * sin(v.value), .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0 * sin(v.value), v, -1.0 * ret.value);
     }
 
     return ret;
@@ -945,11 +1548,7 @@ inline const struct ad_variable __attribute__((overloadable)) ad_sin(__global st
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = cos(v.value), .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, cos(v.value), v, -1.0 * ret.value);
     }
 
     return ret;
@@ -961,12 +1560,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_tan(__global st
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double temp = 1.0 / cos(v.value);
-        e->coeff[0] = (struct ad_pair){.dx = temp*temp, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp*temp, v, 2.0 * temp * temp * ret.value);
     }
 
     return ret;
@@ -978,15 +1573,11 @@ inline const struct ad_variable __attribute__((overloadable)) ad_acos(__global s
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double temp = (-1.0) /
                 pow(((1.0) -
                 pow(v.value, (2.0))),
                 (0.5));
-        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, temp * temp * temp * v.value);
     }
 
     return ret;
@@ -998,15 +1589,11 @@ inline const struct ad_variable __attribute__((overloadable)) ad_asin(__global s
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double temp = (1.0) /
                 pow(((1.0) -
                 pow(v.value, (2.0))),
                 (0.5));
-        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, temp * temp * temp * v.value);
     }
 
     return ret;
@@ -1018,12 +1605,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_atan(__global s
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double temp = (1.0) / (v.value * v.value + (1.0));
-        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, -2.0 * v.value * temp * temp);
     }
 
     return ret;
@@ -1035,11 +1618,7 @@ inline const struct ad_variable __attribute__((overloadable)) ad_cosh(__global s
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = sinh(v.value), .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, sinh(v.value), v, ret.value);
     }
 
     return ret;
@@ -1050,12 +1629,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_sinh(__global s
 
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
-        ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = cosh(v.value), .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        ret.id = index + gs->current_ad_variable_id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, cosh(v.value), v, ret.value);
     }
 
     return ret;
@@ -1067,12 +1642,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_tanh(__global s
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double temp = (1.0 / cosh(v.value))*(1.0 / cosh(v.value));
-        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, -2.0 * ret.value * temp);
     }
 
     return ret;
@@ -1084,11 +1655,7 @@ inline const struct ad_variable __attribute__((overloadable)) ad_exp(__global st
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
-        e->coeff[0] = (struct ad_pair){.dx = ret.value, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, ret.value, v, ret.value);
     }
 
     return ret;
@@ -1100,12 +1667,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_log(__global st
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = 1.0 / v.value;
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, v, -1.0 * inv * inv);
     }
 
     return ret;
@@ -1117,12 +1680,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_log10(__global
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = 1.0 / (v.value * 2.30258509299404590109361379290930926799774169921875);
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, v, -1.0 * inv / v.value);
     }
 
     return ret;
@@ -1135,13 +1694,12 @@ inline const struct ad_variable __attribute__((overloadable)) ad_pow(__global st
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = b.value * pow(a.value, b.value - (1.0));
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-        e->coeff[1] = (struct ad_pair){.dx = log(a.value) * ret.value, .id = b.id};
-        e->size = 2;
-        e->id = ret.id;
+        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,
+                inv, a, log(a.value) * ret.value, b,
+                (b.value - 1.0) * inv / a.value,
+                (1.0 + b.value * log(a.value)) * ret.value / a.value,
+                log(a.value) * log(a.value) * ret.value);
     }
 
     return ret;
@@ -1154,12 +1712,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_pow_vd(__global
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = b * pow(a.value, b - (1.0));
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, a, (b - 1.0) * inv / a.value);
     }
     return ret;
 }
@@ -1171,12 +1725,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_pow_dv(__global
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = b.value * pow(a, b.value - (1.0));
-        e->coeff[0] = (struct ad_pair){.dx = log(a) * ret.value, .id = b.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, log(a) * ret.value, b, log(a) * log(a) * ret.value);
     }
 
     return ret;
@@ -1188,12 +1738,8 @@ inline const struct ad_variable __attribute__((overloadable)) ad_sqrt(__global s
     if (gs->recording == 1) {
         int index = atomic_inc(&gs->counter);
         ret.id = index + gs->current_ad_variable_id;
-        __global struct ad_entry* e =
-                &gs->gradient_stack[index + gs->stack_current];
         double inv = .5 / ret.value;
-        e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
-        e->size = 1;
-        e->id = ret.id;
+        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, v, -0.5 * inv / v.value);
     }
 
     return ret;
@@ -1221,7 +1767,7 @@ inline const struct ad_variable ad_plus_p(struct ad_private_gradient_structure*
         ret.id = index + gs->current_ad_variable_id;
         struct ad_entry* e =
                 &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
         e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
         e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
         e->size = 2;
@@ -1247,7 +1793,7 @@ inline const struct ad_variable ad_plus_vd_p(struct ad_private_gradient_structur
         ret.id = index + gs->current_ad_variable_id;
         struct ad_entry* e =
                 &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
         e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
         e->size = 1;
     }
@@ -1274,7 +1820,7 @@ inline const struct ad_variable ad_plus_dv_p(struct ad_private_gradient_structur
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = b.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1282,7 +1828,8 @@ inline const struct ad_variable ad_plus_dv_p(struct ad_private_gradient_structur
 
 /**
  * Plus assign ad_variable a and ad_variable b in private memory space. If the gradient structure is recording, 
- * entries will be added, otherwise the result is only computed.
+ * entries will be added and a gets the id of the new entry, otherwise the 
+ * result is only computed.
  * 
  * @param gs
  * @param a
@@ -1298,13 +1845,15 @@ inline void ad_plus_eq_p(struct ad_private_gradient_structure* gs, struct ad_var
         e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
         e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
         e->size = 2;
-        e->id = a->id;
+        a->id = index + gs->current_ad_variable_id;
+        AD_STORE_ID(e->id, a->id);
     }
 }
 
 /**
  * Plus assign ad_variable a and real_t b in private memory space. If the gradient structure is recording, 
- * entries will be added, otherwise the result is only computed.
+ * entries will be added and a gets the id of the new entry, otherwise the 
+ * result is only computed.
  *  
  * @param gs
  * @param a
@@ -1319,7 +1868,8 @@ inline void ad_plus_eq_d_p(struct ad_private_gradient_structure* gs, struct ad_v
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
         e->size = 1;
-        e->id = a->id;
+        a->id = index + gs->current_ad_variable_id;
+        AD_STORE_ID(e->id, a->id);
     }
 }
 
@@ -1343,7 +1893,7 @@ inline const struct ad_variable ad_minus_p(struct ad_private_gradient_structure*
         e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
         e->coeff[1] = (struct ad_pair){.dx = -1.0, .id = b.id};
         e->size = 2;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1366,7 +1916,7 @@ inline const struct ad_variable ad_minus_vd_p(struct ad_private_gradient_structu
         ret.id = index + gs->current_ad_variable_id;
         struct ad_entry* e =
                 &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
         e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
         e->size = 1;
     }
@@ -1393,7 +1943,7 @@ inline const struct ad_variable ad_minus_dv_p(struct ad_private_gradient_structu
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = -1.0, .id = b.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1417,7 +1967,7 @@ inline const struct ad_variable ad_times_p(struct ad_private_gradient_structure*
         ret.id = index + gs->current_ad_variable_id;
         struct ad_entry* e =
                 &gs->gradient_stack[index + gs->stack_current];
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
         e->coeff[0] = (struct ad_pair){.dx = a.value, .id = a.id};
         e->coeff[1] = (struct ad_pair){.dx = b.value, .id = b.id};
         e->size = 2;
@@ -1445,7 +1995,7 @@ inline const struct ad_variable ad_times_vd_p(struct ad_private_gradient_structu
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = b, .id = a.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1470,7 +2020,7 @@ inline const struct ad_variable ad_times_dv_p(struct ad_private_gradient_structu
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = b.value, .id = b.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1497,7 +2047,7 @@ inline const struct ad_variable ad_divide_p(struct ad_private_gradient_structure
         e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
         e->coeff[1] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
         e->size = 2;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1522,7 +2072,7 @@ inline const struct ad_variable ad_divide_vd_p(struct ad_private_gradient_struct
         real_t inv = 1.0 / b;
         e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
     return ret;
 }
@@ -1546,14 +2096,14 @@ inline const struct ad_variable ad_divide_dv_p(struct ad_private_gradient_struct
         real_t inv = 1.0 / b.value;
         e->coeff[0] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
 }
 
 inline const struct ad_variable ad_cos_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {
-    struct ad_variable ret = {.value = (real_t) log(v.value), .id = 0};
+    struct ad_variable ret = {.value = (real_t) cos(v.value), .id = 0};
 
     if (gs->recording == 1) {
         int index = gs->counter++;
@@ -1562,7 +2112,7 @@ inline const struct ad_variable ad_cos_p(struct ad_private_gradient_structure* g
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = -1.0 * (real_t) sin(v.value), .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1578,7 +2128,7 @@ inline const struct ad_variable ad_sin_p(struct ad_private_gradient_structure* g
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = (real_t) cos(v.value), .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1595,7 +2145,7 @@ inline const struct ad_variable ad_tan_p(struct ad_private_gradient_structure* g
         real_t temp = 1.0 / (real_t) cos((real_t) v.value);
         e->coeff[0] = (struct ad_pair){.dx = temp*temp, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1615,7 +2165,7 @@ inline const struct ad_variable ad_acos_p(struct ad_private_gradient_structure*
                 (real_t) (0.5));
         e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1635,7 +2185,7 @@ inline const struct ad_variable ad_asin_p(struct ad_private_gradient_structure*
                 (0.5));
         e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1652,7 +2202,7 @@ inline const struct ad_variable ad_atan_p(struct ad_private_gradient_structure*
         real_t temp = (1.0) / (v.value * v.value + (1.0));
         e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1668,7 +2218,7 @@ inline const struct ad_variable ad_cosh_p(struct ad_private_gradient_structure*
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = (real_t) sinh((real_t) v.value), .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1684,7 +2234,7 @@ inline const struct ad_variable ad_sinh_p(struct ad_private_gradient_structure*
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = (real_t) cosh((real_t) v.value), .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1701,7 +2251,7 @@ inline const struct ad_variable ad_tanh_p(struct ad_private_gradient_structure*
         real_t temp = (1.0 / (real_t) cosh((real_t) v.value))*(1.0 / (real_t) cosh(v.value));
         e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1717,7 +2267,7 @@ inline const struct ad_variable ad_exp_p(struct ad_private_gradient_structure* g
                 &gs->gradient_stack[index + gs->stack_current];
         e->coeff[0] = (struct ad_pair){.dx = ret.value, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1734,7 +2284,7 @@ inline const struct ad_variable ad_log_p(struct ad_private_gradient_structure* g
         real_t inv = 1.0 / v.value;
         e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1751,7 +2301,7 @@ inline const struct ad_variable ad_log10_p(struct ad_private_gradient_structure*
         real_t inv = 1.0 / (v.value * (real_t) 2.30258509299404590109361379290930926799774169921875);
         e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1770,7 +2320,7 @@ inline const struct ad_variable ad_pow_p(struct ad_private_gradient_structure* g
         e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
         e->coeff[1] = (struct ad_pair){.dx = (real_t) log(a.value) * ret.value, .id = b.id};
         e->size = 2;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1788,7 +2338,7 @@ inline const struct ad_variable ad_pow_vd_p(struct ad_private_gradient_structure
         real_t inv = b * (real_t) pow((real_t) a.value, (real_t) b - (1.0));
         e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
     return ret;
 }
@@ -1805,7 +2355,7 @@ inline const struct ad_variable ad_pow_dv_p(struct ad_private_gradient_structure
         real_t inv = b.value * (real_t) pow(a, b.value - (1.0));
         e->coeff[0] = (struct ad_pair){.dx = (real_t) log((real_t) a) * ret.value, .id = b.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
     }
 
     return ret;
@@ -1822,14 +2372,825 @@ inline const struct ad_variable ad_sqrt_p(struct ad_private_gradient_structure*
         real_t inv = .5 / ret.value;
         e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
         e->size = 1;
-        e->id = ret.id;
+        AD_STORE_ID(e->id, ret.id);
+    }
+
+    return ret;
+}
+
+/**
+ * Preaccumulation: a work item records its own computation on a short 
+ * private tape, sweeps it and emits a single entry holding the partials 
+ * w.r.t. the independent variables, see pad_preaccumulate. The global 
+ * tape then gets AD_NARY_OPERATIONS(n) entries per work item instead of 
+ * one per operation.
+ */
+
+/**
+ * Starts a preaccumulation on the private gradient structure p. locals 
+ * get the values of the n independent variables in inputs and the 
+ * private ids 0 to n - 1, record with the _p operations on them. The tape 
+ * is not cleared, only the slots recorded are swept. 
+ * PRIVATE_STACK_SIZE bounds the operations recorded, 
+ * PRIVATE_GRADIENT_SIZE the operations plus n and PREACCUMULATE_INPUTS n.
+ * 
+ * @param p
+ * @param n
+ * @param inputs
+ * @param locals
+ */
+inline void ad_preaccumulate_init_p(struct ad_private_gradient_structure* p, int n, const struct ad_variable* inputs, struct ad_variable* locals) {
+    p->counter = 0;
+    p->stack_current = 0;
+    p->recording = 1;
+    p->current_ad_variable_id = n;
+    for (int i = 0; i < n; i++) {
+        locals[i].value = inputs[i].value;
+        locals[i].id = i;
+    }
+}
+
+/**
+ * Reverse sweep of the private tape of p seeded at result, dx[i] is set 
+ * to the partial derivative of result w.r.t. the private id i < n.
+ * 
+ * @param p
+ * @param result
+ * @param n
+ * @param dx
+ */
+inline void ad_preaccumulate_sweep_p(struct ad_private_gradient_structure* p, struct ad_variable result, int n, double* dx) {
+    double adjoint[PRIVATE_GRADIENT_SIZE];
+    int size = p->current_ad_variable_id + p->counter;
+    for (int i = 0; i < size; i++) {
+        adjoint[i] = 0.0;
+    }
+    adjoint[result.id] = 1.0;
+
+    //ids come with the slots, see ad_plus_p
+    int offset = p->current_ad_variable_id - p->stack_current;
+    for (int j = p->stack_current + p->counter - 1; j >= p->stack_current; j--) {
+        struct ad_entry* e = &p->gradient_stack[j];
+        double w = adjoint[j + offset];
+        if (w != 0.0) {
+            for (int i = 0; i < e->size; i++) {
+                adjoint[e->coeff[i].id] += w * e->coeff[i].dx;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        dx[i] = adjoint[i];
+    }
+}
+
+/**
+ * Ends a preaccumulation: sweeps the private tape of p and records result 
+ * on gs as one ad_nary entry w.r.t. inputs. pad_init should account for 
+ * AD_NARY_OPERATIONS(n) operations, 1 for n <= 2. The _p operations are 
+ * first order, so with AD_HESSIAN_VECTOR the second order terms of the 
+ * preaccumulated block are lost.
+ * 
+ * @param gs
+ * @param p
+ * @param result - recorded on p.
+ * @param n
+ * @param inputs - the independent variables given to ad_preaccumulate_init_p.
+ * @return result with an id of gs.
+ */
+inline const struct ad_variable pad_preaccumulate(struct ad_gradient_structure* gs, struct ad_private_gradient_structure* p,
+        struct ad_variable result, int n, const struct ad_variable* inputs) {
+    double dx[PREACCUMULATE_INPUTS];
+    if (gs->recording != 1) {
+        return (struct ad_variable) {
+            .value = result.value, .id = 0
+        };
     }
+    ad_preaccumulate_sweep_p(p, result, n, dx);
+    return pad_nary(gs, result.value, n, dx, inputs);
+}
+
+/**
+ * Same as pad_preaccumulate, recording on the global gradient structure.
+ */
+inline const struct ad_variable ad_preaccumulate(__global struct ad_gradient_structure* gs, struct ad_private_gradient_structure* p,
+        struct ad_variable result, int n, const struct ad_variable* inputs) {
+    double dx[PREACCUMULATE_INPUTS];
+    if (gs->recording != 1) {
+        return (struct ad_variable) {
+            .value = result.value, .id = 0
+        };
+    }
+    ad_preaccumulate_sweep_p(p, result, n, dx);
+    return ad_nary(gs, result.value, n, dx, inputs);
+}
+
+/**
+ * Forward mode. An ad_dual carries its value and its partial derivatives 
+ * w.r.t. AD_DUAL_WIDTH independent variables in one real_t vector, so 
+ * models with a handful of parameters need no tape at all: every work 
+ * item computes its term with the ad_dual_ operations and the terms are 
+ * summed with ad_dual_group_sum and ad_dual_reduce. Must match ad4cl.h, 
+ * see AD4CL_BUILD_OPTIONS.
+ */
+#ifndef AD_DUAL_WIDTH
+#define AD_DUAL_WIDTH 2
+#endif
+
+#if AD_DUAL_WIDTH == 2
+typedef real2_t ad_dual_vector_t;
+#elif AD_DUAL_WIDTH == 4
+typedef real4_t ad_dual_vector_t;
+#elif AD_DUAL_WIDTH == 8
+typedef real8_t ad_dual_vector_t;
+#elif AD_DUAL_WIDTH == 16
+typedef real16_t ad_dual_vector_t;
+#else
+#error "AD_DUAL_WIDTH must be 2, 4, 8 or 16"
+#endif
+
+struct ad_dual {
+    real_t value;
+    ad_dual_vector_t dx;
+};
+
+/**
+ * The independent variable i of AD_DUAL_WIDTH with the given value.
+ */
+inline struct ad_dual ad_dual_variable(real_t value, int i) {
+    struct ad_dual ret = {.value = value, .dx = (ad_dual_vector_t) (0.0)};
+    ((real_t*) &ret.dx)[i] = 1.0;
+    return ret;
+}
+
+/**
+ * A constant, all partial derivatives are 0.
+ */
+inline struct ad_dual ad_dual_constant(real_t value) {
+    struct ad_dual ret = {.value = value, .dx = (ad_dual_vector_t) (0.0)};
+    return ret;
+}
+
+/**
+ * Chain rule of the unary operations: the result has value and partial 
+ * derivative d w.r.t. v.
+ */
+inline struct ad_dual ad_dual_chain(real_t value, real_t d, struct ad_dual v) {
+    struct ad_dual ret = {.value = value, .dx = d * v.dx};
+    return ret;
+}
+
+inline struct ad_dual ad_dual_plus(struct ad_dual a, struct ad_dual b) {
+    struct ad_dual ret = {.value = a.value + b.value, .dx = a.dx + b.dx};
+    return ret;
+}
+
+inline struct ad_dual ad_dual_plus_vd(struct ad_dual a, real_t b) {
+    a.value += b;
+    return a;
+}
+
+inline struct ad_dual ad_dual_plus_dv(real_t a, struct ad_dual b) {
+    b.value += a;
+    return b;
+}
+
+inline struct ad_dual ad_dual_minus(struct ad_dual a, struct ad_dual b) {
+    struct ad_dual ret = {.value = a.value - b.value, .dx = a.dx - b.dx};
+    return ret;
+}
+
+inline struct ad_dual ad_dual_minus_vd(struct ad_dual a, real_t b) {
+    a.value -= b;
+    return a;
+}
+
+inline struct ad_dual ad_dual_minus_dv(real_t a, struct ad_dual b) {
+    struct ad_dual ret = {.value = a - b.value, .dx = -b.dx};
+    return ret;
+}
+
+inline struct ad_dual ad_dual_times(struct ad_dual a, struct ad_dual b) {
+    struct ad_dual ret = {.value = a.value * b.value, .dx = b.value * a.dx + a.value * b.dx};
+    return ret;
+}
+
+inline struct ad_dual ad_dual_times_vd(struct ad_dual a, real_t b) {
+    return ad_dual_chain(a.value * b, b, a);
+}
+
+inline struct ad_dual ad_dual_times_dv(real_t a, struct ad_dual b) {
+    return ad_dual_chain(a * b.value, a, b);
+}
+
+inline struct ad_dual ad_dual_divide(struct ad_dual a, struct ad_dual b) {
+    real_t inv = 1.0 / b.value;
+    real_t value = a.value * inv;
+    struct ad_dual ret = {.value = value, .dx = inv * a.dx - value * inv * b.dx};
+    return ret;
+}
+
+inline struct ad_dual ad_dual_divide_vd(struct ad_dual a, real_t b) {
+    real_t inv = 1.0 / b;
+    return ad_dual_chain(a.value * inv, inv, a);
+}
+
+inline struct ad_dual ad_dual_divide_dv(real_t a, struct ad_dual b) {
+    real_t value = a / b.value;
+    return ad_dual_chain(value, -1.0 * value / b.value, b);
+}
+
+inline struct ad_dual ad_dual_cos(struct ad_dual v) {
+    return ad_dual_chain(cos(v.value), -1.0 * sin(v.value), v);
+}
+
+inline struct ad_dual ad_dual_sin(struct ad_dual v) {
+    return ad_dual_chain(sin(v.value), cos(v.value), v);
+}
+
+inline struct ad_dual ad_dual_tan(struct ad_dual v) {
+    real_t temp = 1.0 / cos(v.value);
+    return ad_dual_chain(tan(v.value), temp*temp, v);
+}
+
+inline struct ad_dual ad_dual_acos(struct ad_dual v) {
+    return ad_dual_chain(acos(v.value), -1.0 / sqrt(1.0 - v.value * v.value), v);
+}
+
+inline struct ad_dual ad_dual_asin(struct ad_dual v) {
+    return ad_dual_chain(asin(v.value), 1.0 / sqrt(1.0 - v.value * v.value), v);
+}
+
+inline struct ad_dual ad_dual_atan(struct ad_dual v) {
+    return ad_dual_chain(atan(v.value), 1.0 / (v.value * v.value + 1.0), v);
+}
+
+inline struct ad_dual ad_dual_cosh(struct ad_dual v) {
+    return ad_dual_chain(cosh(v.value), sinh(v.value), v);
+}
+
+inline struct ad_dual ad_dual_sinh(struct ad_dual v) {
+    return ad_dual_chain(sinh(v.value), cosh(v.value), v);
+}
+
+inline struct ad_dual ad_dual_tanh(struct ad_dual v) {
+    real_t temp = 1.0 / cosh(v.value);
+    return ad_dual_chain(tanh(v.value), temp*temp, v);
+}
+
+inline struct ad_dual ad_dual_exp(struct ad_dual v) {
+    real_t value = exp(v.value);
+    return ad_dual_chain(value, value, v);
+}
+
+inline struct ad_dual ad_dual_log(struct ad_dual v) {
+    return ad_dual_chain(log(v.value), 1.0 / v.value, v);
+}
+
+inline struct ad_dual ad_dual_log10(struct ad_dual v) {
+    return ad_dual_chain(log10(v.value), 1.0 / (v.value * 2.30258509299404590109361379290930926799774169921875), v);
+}
 
+inline struct ad_dual ad_dual_pow(struct ad_dual a, struct ad_dual b) {
+    real_t value = pow(a.value, b.value);
+    struct ad_dual ret = {.value = value,
+        .dx = b.value * pow(a.value, b.value - 1.0) * a.dx + log(a.value) * value * b.dx};
     return ret;
 }
 
+inline struct ad_dual ad_dual_pow_vd(struct ad_dual a, real_t b) {
+    return ad_dual_chain(pow(a.value, b), b * pow(a.value, b - 1.0), a);
+}
+
+inline struct ad_dual ad_dual_pow_dv(real_t a, struct ad_dual b) {
+    real_t value = pow(a, b.value);
+    return ad_dual_chain(value, log(a) * value, b);
+}
+
+inline struct ad_dual ad_dual_sqrt(struct ad_dual v) {
+    real_t value = sqrt(v.value);
+    return ad_dual_chain(value, .5 / value, v);
+}
+
+/**
+ * Sums v over the work group, work item 0 writes the sum to 
+ * out[get_group_id(0)]. Every work item of the group must call it. The 
+ * local size must be a power of two.
+ * 
+ * @param v
+ * @param scratch - local memory for get_local_size(0) ad_duals.
+ * @param out - a row per work group, see ad_dual_reduce.
+ */
+inline void ad_dual_group_sum(struct ad_dual v, __local struct ad_dual* scratch, __global struct ad_dual* out) {
+    int lid = get_local_id(0);
+    scratch[lid] = v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int s = get_local_size(0) / 2; s > 0; s >>= 1) {
+        if (lid < s) {
+            scratch[lid] = ad_dual_plus(scratch[lid], scratch[lid + s]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        out[get_group_id(0)] = scratch[0];
+    }
+}
+
+/**
+ * Sums in[0..n) into out[get_group_id(0)], launched as a single work 
+ * group it reduces the rows of ad_dual_group_sum to one ad_dual. The 
+ * order of the additions only depends on n and the local size. A second 
+ * dimension reduces a batch: group k of it sums in[k * n..(k + 1) * n) 
+ * into out[k * get_num_groups(0) + get_group_id(0)].
+ * 
+ * @param in
+ * @param n
+ * @param out
+ * @param scratch - local memory for get_local_size(0) ad_duals.
+ */
+__kernel void ad_dual_reduce(__global const struct ad_dual* in,
+        int n,
+        __global struct ad_dual* out,
+        __local struct ad_dual* scratch) {
+    in += get_group_id(1) * n;
+    out += get_group_id(1) * get_num_groups(0);
+    struct ad_dual sum = ad_dual_constant(0.0);
+    for (int i = get_global_id(0); i < n; i += get_global_size(0)) {
+        sum = ad_dual_plus(sum, in[i]);
+    }
+    ad_dual_group_sum(sum, scratch, out);
+}
+
+/**
+ * Work group sum of the values (and tangents) of v, written to 
+ * out[get_group_id(0)] with id 0. The local size must be a power of two.
+ * 
+ * @param v
+ * @param scratch - local memory for get_local_size(0) ad_variables.
+ * @param out
+ */
+inline void ad_variable_group_sum(struct ad_variable v, __local struct ad_variable* scratch, __global struct ad_variable* out) {
+    int lid = get_local_id(0);
+    scratch[lid] = v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int s = get_local_size(0) / 2; s > 0; s >>= 1) {
+        if (lid < s) {
+            scratch[lid].value += scratch[lid + s].value;
+#ifdef AD_HESSIAN_VECTOR
+            scratch[lid].tangent += scratch[lid + s].tangent;
+#endif
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        scratch[0].id = 0;
+        out[get_group_id(0)] = scratch[0];
+    }
+}
+
+/**
+ * First pass of ad_sum_reduce/ad_dot_reduce. The result is recorded as 
+ * one entry of AD_NARY_OPERATIONS(n) operations starting at gs->counter, 
+ * laid out like ad_nary: with AD_CSR_TAPE one slot of n pairs, otherwise 
+ * consecutive slots of which the last holds the result. All slots, ids 
+ * and pairs follow from 
+ * gs->counter and gs->pair_counter, so every work item writes its own 
+ * part without atomics. The counters are only advanced by 
+ * ad_reduce_result.
+ * 
+ * @param gs
+ * @param in
+ * @param weights - the partial derivative of every input, 0 for all 1.
+ * @param n - number of inputs, at least 1.
+ * @param rows - a partial value per work group.
+ * @param scratch
+ */
+inline void ad_linear_reduce(__global struct ad_gradient_structure* gs,
+        __global const struct ad_variable* in,
+        __global const double* weights,
+        int n,
+        __global struct ad_variable* rows,
+        __local struct ad_variable* scratch) {
+    struct ad_variable r = {.value = 0.0, .id = 0};
+    int base = gs->counter;
+#ifdef AD_CSR_TAPE
+    int p = gs->pair_current + gs->pair_counter;
+#endif
+
+    for (int i = get_global_id(0); i < n; i += get_global_size(0)) {
+        double w = weights ? weights[i] : 1.0;
+        r.value += w * in[i].value;
+#ifdef AD_HESSIAN_VECTOR
+        r.tangent += w * in[i].tangent;
+#endif
+        if (gs->recording == 1) {
+#ifdef AD_CSR_TAPE
+            gs->coeff_dx[p + i] = w;
+            gs->coeff_id[p + i] = in[i].id;
+            if (i == 0) {
+                int current = base + gs->stack_current;
+                AD_STORE_ID(gs->entry_id[current], base + gs->current_ad_variable_id);
+                gs->entry_size[current] = n;
+                gs->entry_offset[current] = p;
+            }
+#else
+            int last = base + AD_NARY_OPERATIONS(n) - 1 + gs->stack_current;
+            AD_ENTRY_DX(gs, last, i) = w;
+            AD_ENTRY_COEFF_ID(gs, last, i) = in[i].id;
+#ifdef AD_HESSIAN_VECTOR
+            AD_ENTRY_DDX(gs, last, i) = 0.0;
+#endif
+            if (i % MAX_VARIABLE_IN_EXPESSION == 0) {
+                int slot = last - i / MAX_VARIABLE_IN_EXPESSION;
+                if (slot == last) {
+                    AD_RECORD_NARY_SLOT(gs, slot, last + gs->current_ad_variable_id - gs->stack_current, n);
+                } else {
+                    AD_RECORD_NARY_SLOT(gs, slot, 0, 0);
+                }
+            }
+#endif
+        }
+    }
+
+    ad_variable_group_sum(r, scratch, rows);
+}
+
+/**
+ * Records the sum of in[0..n) on the tape, see ad_linear_reduce. 
+ * Finished by ad_reduce_result over the get_num_groups(0) rows.
+ * 
+ * @param gs
+ * @param gradient_stack
+ * @param in
+ * @param n
+ * @param rows
+ * @param scratch - local memory for get_local_size(0) ad_variables.
+ */
+__kernel void ad_sum_reduce(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __global const struct ad_variable* in,
+        int n,
+        __global struct ad_variable* rows,
+        __local struct ad_variable* scratch) {
+    ad_init(gs, gradient_stack);
+    ad_linear_reduce(gs, in, 0, n, rows, scratch);
+}
+
+/**
+ * Records the sum of weights[i] * in[i] on the tape, see 
+ * ad_linear_reduce. Finished by ad_reduce_result over the 
+ * get_num_groups(0) rows.
+ * 
+ * @param gs
+ * @param gradient_stack
+ * @param in
+ * @param weights
+ * @param n
+ * @param rows
+ * @param scratch - local memory for get_local_size(0) ad_variables.
+ */
+__kernel void ad_dot_reduce(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __global const struct ad_variable* in,
+        __global const double* weights,
+        int n,
+        __global struct ad_variable* rows,
+        __local struct ad_variable* scratch) {
+    ad_init(gs, gradient_stack);
+    ad_linear_reduce(gs, in, weights, n, rows, scratch);
+}
+
+/**
+ * Second pass of ad_sum_reduce/ad_dot_reduce, launched as a single work 
+ * group: sums the rows into result, gives it the id of the last recorded 
+ * entry and advances the counters of gs past the n inputs.
+ * 
+ * @param gs
+ * @param rows
+ * @param groups - number of rows, the work groups of the first pass.
+ * @param n
+ * @param result
+ * @param scratch - local memory for get_local_size(0) ad_variables.
+ */
+__kernel void ad_reduce_result(__global struct ad_gradient_structure* gs,
+        __global const struct ad_variable* rows,
+        int groups,
+        int n,
+        __global struct ad_variable* result,
+        __local struct ad_variable* scratch) {
+    struct ad_variable r = {.value = 0.0, .id = 0};
+    for (int i = get_global_id(0); i < groups; i += get_global_size(0)) {
+        r.value += rows[i].value;
+#ifdef AD_HESSIAN_VECTOR
+        r.tangent += rows[i].tangent;
+#endif
+    }
+    ad_variable_group_sum(r, scratch, result);
+
+    if (get_local_id(0) == 0 && gs->recording == 1) {
+        int operations = AD_NARY_OPERATIONS(n);
+        result->id = gs->counter + operations - 1 + gs->current_ad_variable_id;
+        gs->counter += operations;
+#ifdef AD_CSR_TAPE
+        gs->pair_counter += n;
+#endif
+    }
+}
+
+
+
+
+
+
+
+
+#if defined(cl_khr_int64_base_atomics)
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+
+/**
+ * Number of independent variables whose adjoints ad_reverse_sweep sums 
+ * per work group instead of adding them atomically.
+ */
+#ifndef AD_SWEEP_INPUTS
+#define AD_SWEEP_INPUTS 4
+#endif
+
+/**
+ * Adds v to *p. OpenCL 1.x has no atomic add for doubles, so this is a 
+ * compare and swap loop on the bits.
+ */
+inline void ad_atomic_add(__global double* p, double v) {
+    union {
+        double d;
+        long l;
+    } old, next;
+    do {
+        old.d = *p;
+        next.d = old.d + v;
+    } while (atom_cmpxchg((volatile __global long*) p, old.l, next.l) != old.l);
+}
+
+/**
+ * Sums the first inputs entries of adjoint over the work group and adds 
+ * them to row get_group_id(0) of rows. The local size must be a power of 
+ * two.
+ */
+inline void ad_sweep_sum_inputs(const double* adjoint, int inputs, __global double* rows, __local double* scratch) {
+    int lid = get_local_id(0);
+    for (int i = 0; i < inputs; i++) {
+        scratch[lid] = adjoint[i];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int s = get_local_size(0) / 2; s > 0; s >>= 1) {
+            if (lid < s) {
+                scratch[lid] += scratch[lid + s];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (lid == 0) {
+            rows[get_group_id(0) * inputs + i] += scratch[0];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
 
+/**
+ * Prepares the buffers of ad_reverse_sweep: the adjoint of the last 
+ * variable recorded on gs is 1, all other adjoints and the rows of 
+ * input_adjoint are 0. Works with any global size.
+ * 
+ * @param gs
+ * @param gradient_stack
+ * @param gradient - room for every id of gs.
+ * @param input_adjoint
+ * @param rows - number of rows of input_adjoint.
+ * @param inputs
+ */
+__kernel void ad_gradient_init(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __global double* gradient,
+        __global double* input_adjoint,
+        int rows,
+        int inputs) {
+    ad_init(gs, gradient_stack);
+    inputs = min(inputs, AD_SWEEP_INPUTS);
+    int size = gs->current_ad_variable_id + gs->counter + 1;
+    int seed = AD_ENTRY_ID(gs, gs->stack_current + gs->counter - 1);
+    for (int i = get_global_id(0); i < size; i += get_global_size(0)) {
+        gradient[i] = i == seed ? 1.0 : 0.0;
+    }
+    for (int i = get_global_id(0); i < rows * inputs; i += get_global_size(0)) {
+        input_adjoint[i] = 0.0;
+    }
+}
 
+/**
+ * Reverse sweep of the tape slots [begin, end), one segment of segment 
+ * consecutive slots per work item. end < 0 stands for the end of the tape.
+ * 
+ * Launch once per level, in order: a slot using a result from another 
+ * segment must have been swept by an earlier launch. For a recording 
+ * made of pad_init blocks followed by a serial tail (e.g. the sum of the 
+ * kernel outputs) that is one launch over the tail with a single work 
+ * item, then one over the blocks with segment set to the operations 
+ * passed to pad_init.
+ * 
+ * Adjoints of ids below inputs (the independent variables, at most 
+ * AD_SWEEP_INPUTS) are summed per work group and added to row 
+ * get_group_id(0) of input_adjoint, see ad_gradient_gather. All other 
+ * adjoints are updated atomically. The local size must be a power of two.
+ * 
+ * @param gs
+ * @param gradient_stack
+ * @param gradient - initialized by ad_gradient_init.
+ * @param begin
+ * @param end
+ * @param segment
+ * @param inputs
+ * @param input_adjoint
+ * @param scratch - a double per work item.
+ */
+__kernel void ad_reverse_sweep(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __global double* gradient,
+        int begin,
+        int end,
+        int segment,
+        int inputs,
+        __global double* input_adjoint,
+        __local double* scratch) {
+    double adjoint[AD_SWEEP_INPUTS];
+    for (int i = 0; i < AD_SWEEP_INPUTS; i++) {
+        adjoint[i] = 0.0;
+    }
+
+    ad_init(gs, gradient_stack);
+    inputs = min(inputs, AD_SWEEP_INPUTS);
+    if (end < 0) {
+        end = gs->stack_current + gs->counter;
+    }
+
+    int first = begin + get_global_id(0) * segment;
+    int last = min(first + segment, end);
+    for (int j = last - 1; j >= first; j--) {
+        int size = AD_ENTRY_SIZE(gs, j);
+        if (size > 0) {
+            double w = gradient[AD_ENTRY_ID(gs, j)];
+            for (int i = 0; i < size; i++) {
+                int id = AD_ENTRY_COEFF_ID(gs, j, i);
+                double dx = w * AD_ENTRY_DX(gs, j, i);
+                if (id < inputs) {
+                    adjoint[id] += dx;
+                } else {
+                    ad_atomic_add(&gradient[id], dx);
+                }
+            }
+        }
+    }
+
+    ad_sweep_sum_inputs(adjoint, inputs, input_adjoint, scratch);
+}
+
+#ifdef AD_HESSIAN_VECTOR
 
+/**
+ * Same as ad_gradient_init for ad_reverse_sweep_hv, tangent and the rows 
+ * of input_tangent are set to 0.
+ * 
+ * @param gs
+ * @param gradient_stack
+ * @param gradient
+ * @param tangent - room for every id of gs.
+ * @param input_adjoint
+ * @param input_tangent
+ * @param rows
+ * @param inputs
+ */
+__kernel void ad_hessian_vector_init(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __global double* gradient,
+        __global double* tangent,
+        __global double* input_adjoint,
+        __global double* input_tangent,
+        int rows,
+        int inputs) {
+    ad_init(gs, gradient_stack);
+    inputs = min(inputs, AD_SWEEP_INPUTS);
+    int size = gs->current_ad_variable_id + gs->counter + 1;
+    int seed = AD_ENTRY_ID(gs, gs->stack_current + gs->counter - 1);
+    for (int i = get_global_id(0); i < size; i += get_global_size(0)) {
+        gradient[i] = i == seed ? 1.0 : 0.0;
+        tangent[i] = 0.0;
+    }
+    for (int i = get_global_id(0); i < rows * inputs; i += get_global_size(0)) {
+        input_adjoint[i] = 0.0;
+        input_tangent[i] = 0.0;
+    }
+}
 
+/**
+ * Combined reverse sweep of a tape recorded with AD_HESSIAN_VECTOR: 
+ * gradient gets the adjoints as with ad_reverse_sweep and tangent their 
+ * derivatives along the direction the independent variables were given 
+ * as tangents, so the tangents of the independent variables are H·v. 
+ * Launched like ad_reverse_sweep, the input rows of both are read with 
+ * ad_gradient_gather.
+ * 
+ * @param gs
+ * @param gradient_stack
+ * @param gradient - initialized by ad_hessian_vector_init.
+ * @param tangent - initialized by ad_hessian_vector_init.
+ * @param begin
+ * @param end
+ * @param segment
+ * @param inputs
+ * @param input_adjoint
+ * @param input_tangent
+ * @param scratch - a double per work item.
+ */
+__kernel void ad_reverse_sweep_hv(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __global double* gradient,
+        __global double* tangent,
+        int begin,
+        int end,
+        int segment,
+        int inputs,
+        __global double* input_adjoint,
+        __global double* input_tangent,
+        __local double* scratch) {
+    double adjoint[AD_SWEEP_INPUTS];
+    double adjoint_tangent[AD_SWEEP_INPUTS];
+    for (int i = 0; i < AD_SWEEP_INPUTS; i++) {
+        adjoint[i] = 0.0;
+        adjoint_tangent[i] = 0.0;
+    }
+
+    ad_init(gs, gradient_stack);
+    inputs = min(inputs, AD_SWEEP_INPUTS);
+    if (end < 0) {
+        end = gs->stack_current + gs->counter;
+    }
+
+    int first = begin + get_global_id(0) * segment;
+    int last = min(first + segment, end);
+    for (int j = last - 1; j >= first; j--) {
+        int size = AD_ENTRY_SIZE(gs, j);
+        if (size > 0) {
+            int result = AD_ENTRY_ID(gs, j);
+            double w = gradient[result];
+            double t = tangent[result];
+            for (int i = 0; i < size; i++) {
+                int id = AD_ENTRY_COEFF_ID(gs, j, i);
+                double dx = AD_ENTRY_DX(gs, j, i);
+                double a = w * dx;
+                double da = t * dx + w * AD_ENTRY_DDX(gs, j, i);
+                if (id < inputs) {
+                    adjoint[id] += a;
+                    adjoint_tangent[id] += da;
+                } else {
+                    ad_atomic_add(&gradient[id], a);
+                    ad_atomic_add(&tangent[id], da);
+                }
+            }
+        }
+    }
+
+    ad_sweep_sum_inputs(adjoint, inputs, input_adjoint, scratch);
+    ad_sweep_sum_inputs(adjoint_tangent, inputs, input_tangent, scratch);
+}
+#endif
 
+/**
+ * Copies the adjoints of ids[0..n) to out, adding up the rows of 
+ * input_adjoint for the independent variables, so only the n adjoints the 
+ * caller needs are read back instead of the tape or the whole gradient.
+ * 
+ * @param gradient
+ * @param input_adjoint
+ * @param rows
+ * @param inputs
+ * @param ids
+ * @param n
+ * @param out
+ */
+__kernel void ad_gradient_gather(__global const double* gradient,
+        __global const double* input_adjoint,
+        int rows,
+        int inputs,
+        __global const int* ids,
+        int n,
+        __global double* out) {
+    int k = get_global_id(0);
+    inputs = min(inputs, AD_SWEEP_INPUTS);
+    if (k < n) {
+        int id = ids[k];
+        double g = gradient[id];
+        if (id < inputs) {
+            for (int r = 0; r < rows; r++) {
+                g += input_adjoint[r * inputs + id];
+            }
+        }
+        out[k] = g;
+    }
+}
+#endif
@@ -8,27 +8,222 @@
 #ifndef ADCL_H
 #define	ADCL_H
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef AD_THREAD_SAFE
+#include <mutex>
+#endif
 
 #ifndef DEFAULT_ENTRY_SIZE
 #define DEFAULT_ENTRY_SIZE 10000000
 #endif
 
+/**
+ * When compiled with OpenMP, tapes of at least AD_PARALLEL_SWEEP_MIN 
+ * entries are swept in AD_SWEEP_BLOCKS (at most 64) blocks on the OpenMP 
+ * threads, see ad_parallel_reverse_sweep.
+ */
+#ifndef AD_PARALLEL_SWEEP_MIN
+#define AD_PARALLEL_SWEEP_MIN 65536
+#endif
+
+#ifndef AD_SWEEP_BLOCKS
+#define AD_SWEEP_BLOCKS 64
+#endif
+
 #ifndef MAX_VARIABLE_IN_EXPESSION
 #define MAX_VARIABLE_IN_EXPESSION 2
 #endif
 
+/**
+ * Number of independent variables an ad_dual carries partial derivatives 
+ * for: 2, 4, 8 or 16. Must match the device, see AD4CL_BUILD_OPTIONS.
+ */
+#ifndef AD_DUAL_WIDTH
+#define AD_DUAL_WIDTH 2
+#endif
+
+/**
+ * Store the tape as a structure of arrays (separate id, size, dx and 
+ * coefficient id columns) instead of an array of ad_entry's. Must match 
+ * the device, see AD4CL_BUILD_OPTIONS.
+ */
+//#define AD_SOA_TAPE
+
+/**
+ * Store the tape in compressed sparse row form: every entry keeps an 
+ * offset into one flat array of (dx, id) pairs and uses exactly as many 
+ * pairs as it has arguments, so an entry of any arity (see ad_nary) 
+ * takes one slot instead of one per MAX_VARIABLE_IN_EXPESSION arguments. 
+ * Must match the device, see AD4CL_BUILD_OPTIONS.
+ */
+//#define AD_CSR_TAPE
+
+#if defined(AD_SOA_TAPE) && defined(AD_CSR_TAPE)
+#error "AD_SOA_TAPE and AD_CSR_TAPE are mutually exclusive"
+#endif
+
+/**
+ * Do not store the result id of each entry. Every id is then handed out 
+ * together with a tape slot, so the entry in slot s is the result with id 
+ * s + ad_id_offset(gs) and compute_gradient walks the adjoints in step 
+ * with the tape. Independent variables occupy an empty slot, see 
+ * ad_init_var. Works with any tape layout and must match the device, see 
+ * AD4CL_BUILD_OPTIONS.
+ */
+//#define AD_IMPLICIT_ID
+
+/**
+ * Storage precision. AD_FLOAT_VALUES stores the value of every ad_variable 
+ * in single precision and AD_FLOAT_PARTIALS does the same for the partial 
+ * derivatives on the tape, halving the tape. Adjoints are always 
+ * accumulated in double, see compute_gradient. Must match the device, see 
+ * AD4CL_BUILD_OPTIONS.
+ */
+//#define AD_FLOAT_VALUES
+//#define AD_FLOAT_PARTIALS
+
+/**
+ * Second order mode. Every ad_variable carries a tangent, its derivative 
+ * along a direction v set by giving the independent variables the 
+ * tangents v, and every ad_pair the tangent of its partial. 
+ * compute_gradient_into then also yields H·v in the same sweep, see 
+ * ad_hessian_vector. Needs the default tape layout and must match the 
+ * device, see AD4CL_BUILD_OPTIONS.
+ */
+//#define AD_HESSIAN_VECTOR
+
+#if defined(AD_HESSIAN_VECTOR) && (defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE))
+#error "AD_HESSIAN_VECTOR needs the default tape layout"
+#endif
+
+/**
+ * Store the second order partials of every entry, the upper triangle of 
+ * its local Hessian packed as indexed by AD_HESSIAN_INDEX, so the sparse 
+ * Hessian can be computed from the tape, see compute_sparse_hessian. 
+ * Needs the default tape layout and must match the device, see 
+ * AD4CL_BUILD_OPTIONS.
+ */
+//#define AD_SECOND_ORDER
+
+#if defined(AD_SECOND_ORDER) && (defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE))
+#error "AD_SECOND_ORDER needs the default tape layout"
+#endif
+
+#define AD_HESSIAN_SIZE (MAX_VARIABLE_IN_EXPESSION * (MAX_VARIABLE_IN_EXPESSION + 1) / 2)
+#define AD_HESSIAN_INDEX(a, b) ((a) * (2 * MAX_VARIABLE_IN_EXPESSION - (a) - 1) / 2 + (b))
+
+#ifdef AD_FLOAT_VALUES
+typedef float ad_value_t;
+#else
+typedef double ad_value_t;
+#endif
+
+#ifdef AD_FLOAT_PARTIALS
+typedef float ad_partial_t;
+#else
+typedef double ad_partial_t;
+#endif
+
+#define AD4CL_STR_(x) #x
+#define AD4CL_STR(x) AD4CL_STR_(x)
+
+#ifdef AD_SOA_TAPE
+#define AD4CL_SOA_OPTION " -DAD_SOA_TAPE"
+#else
+#define AD4CL_SOA_OPTION ""
+#endif
+
+#ifdef AD_CSR_TAPE
+#define AD4CL_CSR_OPTION " -DAD_CSR_TAPE"
+#else
+#define AD4CL_CSR_OPTION ""
+#endif
+
+#ifdef AD_IMPLICIT_ID
+#define AD4CL_IMPLICIT_OPTION " -DAD_IMPLICIT_ID"
+#else
+#define AD4CL_IMPLICIT_OPTION ""
+#endif
+
+#ifdef AD_FLOAT_VALUES
+#define AD4CL_VALUES_OPTION " -DAD_FLOAT_VALUES"
+#else
+#define AD4CL_VALUES_OPTION ""
+#endif
+
+#ifdef AD_FLOAT_PARTIALS
+#define AD4CL_PARTIALS_OPTION " -DAD_FLOAT_PARTIALS"
+#else
+#define AD4CL_PARTIALS_OPTION ""
+#endif
+
+#ifdef AD_HESSIAN_VECTOR
+#define AD4CL_HESSIAN_VECTOR_OPTION " -DAD_HESSIAN_VECTOR"
+#else
+#define AD4CL_HESSIAN_VECTOR_OPTION ""
+#endif
+
+#ifdef AD_SECOND_ORDER
+#define AD4CL_SECOND_ORDER_OPTION " -DAD_SECOND_ORDER"
+#else
+#define AD4CL_SECOND_ORDER_OPTION ""
+#endif
+
+/**
+ * Options to pass to cl::Program::build so ad.cl is compiled with the 
+ * same tape configuration as this header.
+ */
+#define AD4CL_BUILD_OPTIONS "-DMAX_VARIABLE_IN_EXPESSION=" AD4CL_STR(MAX_VARIABLE_IN_EXPESSION) AD4CL_SOA_OPTION AD4CL_CSR_OPTION AD4CL_IMPLICIT_OPTION \
+        AD4CL_VALUES_OPTION AD4CL_PARTIALS_OPTION AD4CL_HESSIAN_VECTOR_OPTION AD4CL_SECOND_ORDER_OPTION \
+        " -DAD_DUAL_WIDTH=" AD4CL_STR(AD_DUAL_WIDTH)
+
 
 
+/**
+ * Lets several host threads record on one gradient structure at the same 
+ * time. Every thread takes slots and ids from its own block of 
+ * AD_THREAD_BLOCK, reserved together under a lock so their distance (see 
+ * ad_id_offset) is kept, and the remaining shared counters are updated 
+ * atomically. Like the pad_ operations on the device, a thread may only 
+ * use results of other threads recorded in the same parallel section 
+ * after they called ad_thread_flush, see AD in main.cpp. Needs a 
+ * contiguous tape (ad_tape_bind). Host only.
+ */
+//#define AD_THREAD_SAFE
+
+#ifndef AD_THREAD_BLOCK
+#define AD_THREAD_BLOCK 256
+#endif
+
+/**
+ * 1 with AD_THREAD_SAFE, for "#pragma omp parallel if (AD_HOST_THREADS)" 
+ * around code that records.
+ */
+#ifdef AD_THREAD_SAFE
+#define AD_HOST_THREADS 1
+#else
+#define AD_HOST_THREADS 0
+#endif
 
 //#define USE_ATOMICS
 
-#ifdef USE_ATOMICS
+#if defined(USE_ATOMICS) || defined(AD_THREAD_SAFE)
+#if defined(_WIN32)
 #define atomic_inc(ptr) InterlockedIncrement(&ptr)-1
+#define atomic_add(ptr, n) InterlockedExchangeAdd(&ptr, n)
+#else
+#define atomic_inc(ptr) __atomic_fetch_add(&(ptr), 1, __ATOMIC_RELAXED)
+#define atomic_add(ptr, n) __atomic_fetch_add(&(ptr), (n), __ATOMIC_RELAXED)
+#endif
 #else
 #define atomic_inc(ptr) ptr++;
+#define atomic_add(ptr, n) ((ptr += (n)) - (n))
 #endif
 
 
@@ -37,768 +232,2945 @@ extern "C" {
 #endif
 
     struct /*__attribute__ ((packed))*/ ad_variable {
-        double value;
+        ad_value_t value;
         int id;
+#ifdef AD_HESSIAN_VECTOR
+        ad_value_t tangent;
+#endif
     };
 
     struct /*__attribute__ ((packed))*/ ad_pair {
-        double dx;
+        ad_partial_t dx;
         int id;
+#ifdef AD_HESSIAN_VECTOR
+        ad_partial_t ddx;
+#endif
     };
 
     struct /*__attribute__ ((packed))*/ ad_entry {
         struct ad_pair coeff[MAX_VARIABLE_IN_EXPESSION];
+#ifndef AD_IMPLICIT_ID
         int id;
+#endif
         int size;
+#ifdef AD_SECOND_ORDER
+        ad_partial_t hessian[AD_HESSIAN_SIZE];
+#endif
     };
 
+    /**
+     * Field order must match ad_gradient_structure in ad.cl. The column 
+     * pointers are only used with AD_SOA_TAPE or AD_CSR_TAPE and point 
+     * into gradient_stack, see ad_tape_bind. The pair fields are the 
+     * AD_CSR_TAPE counterparts of capacity, stack_current and counter. 
+     * entry_id stays NULL with AD_IMPLICIT_ID. parent, reserved and 
+     * pair_reserved are only used by private gradient structures on the 
+     * device, see pad_init in ad.cl. pool, chunk, segment_base and segment_size are host only and 
+     * describe the segment gradient_stack currently points to, see 
+     * ad_tape_use_pool. workspace is host only and holds the adjoints of 
+     * compute_gradient_into between calls. epoch is host only and 
+     * changes whenever the counters are reset, which invalidates the 
+     * blocks of AD_THREAD_SAFE.
+     */
     struct /*__attribute__ ((packed))*/ ad_gradient_structure {
         struct ad_entry* gradient_stack;
         int current_variable_id;
         int stack_current;
         int recording;
         int counter;
+        int capacity;
+        ad_partial_t* coeff_dx;
+        int* coeff_id;
+        int* entry_id;
+        int* entry_size;
+        int* entry_offset;
+        int pair_capacity;
+        int pair_current;
+        int pair_counter;
+        void* parent;
+        int reserved;
+        int pair_reserved;
+        struct ad_chunk_pool* pool;
+        struct ad_tape_chunk* chunk;
+        int segment_base;
+        int segment_size;
+        struct ad_gradient_workspace* workspace;
+        int epoch;
+    };
+
+    /**
+     * Contribution of a block to an adjoint it does not own, see 
+     * ad_parallel_reverse_sweep.
+     */
+    struct ad_sweep_record {
+        int id;
+        double adjoint;
+    };
+
+    /**
+     * Slots [begin, end) of the tape swept as one unit by 
+     * ad_parallel_reverse_sweep. producers has bit o set if the block uses 
+     * results of block o, which then has a higher level and is swept 
+     * after it.
+     */
+    struct ad_sweep_block {
+        int begin;
+        int end;
+        int first;
+        int low;
+        int level;
+        uint64_t producers;
+        struct ad_sweep_record* records;
+        int record_count;
+        int record_capacity;
+    };
+
+    /**
+     * Adjoint buffer reused by compute_gradient_into. Only ids in 
+     * [low, high) can be non zero, so that range is all that has to be 
+     * cleared before the next sweep. tangent holds the derivatives of the 
+     * adjoints along the direction with AD_HESSIAN_VECTOR. The remaining 
+     * fields are scratch space of ad_parallel_reverse_sweep.
+     */
+    struct ad_gradient_workspace {
+        double* adjoint;
+        double* tangent;
+        int capacity;
+        int low;
+        int high;
+        int* owner;
+        int owner_capacity;
+        double* inputs;
+        size_t inputs_capacity;
+        struct ad_sweep_block* blocks;
     };
 
+#ifdef AD_IMPLICIT_ID
+#define AD_ENTRY_ID_COLUMNS 0
+#else
+#define AD_ENTRY_ID_COLUMNS 1
+#endif
+
     /**
-     * Creates a new gradient_structure.
-     * @param size - length of the entries array.
+     * Size in bytes of a tape of size entries.
+     * @param size
      * @return 
      */
-    struct ad_gradient_structure* create_gradient_structure(int size) {
-        struct ad_gradient_structure* gs = ( struct ad_gradient_structure*)malloc(sizeof (ad_gradient_structure));
-        gs->current_variable_id = 0;
-        gs->recording = 1;
-        gs->stack_current = 0;
-        gs->gradient_stack = (struct ad_entry*)malloc(sizeof (ad_entry) * size);
-        return gs;
+    inline size_t ad_tape_bytes(int size) {
+#if defined(AD_CSR_TAPE)
+        return (size_t) size * (MAX_VARIABLE_IN_EXPESSION * (sizeof (ad_partial_t) + sizeof (int)) + (AD_ENTRY_ID_COLUMNS + 2) * sizeof (int));
+#elif defined(AD_SOA_TAPE)
+        return (size_t) size * (MAX_VARIABLE_IN_EXPESSION * (sizeof (ad_partial_t) + sizeof (int)) + (AD_ENTRY_ID_COLUMNS + 1) * sizeof (int));
+#else
+        return (size_t) size * sizeof (struct ad_entry);
+#endif
     }
 
     /**
-     * To be called after the gradient_structure has been run in a 
-     * OpenCL application. This does not need to be called if the 
-     * gradient_structure has only been run on the host.
+     * Points the column pointers of gs into gs->gradient_stack. With 
+     * AD_SOA_TAPE the block is split into the coefficient dx columns, 
+     * coefficient id columns, entry ids and entry sizes. Column i of the 
+     * coefficients holds coefficient i of every entry, so neighboring 
+     * entries are adjacent in memory. With AD_CSR_TAPE the block holds 
+     * pair_capacity (dx, id) pairs followed by the entry ids, sizes and 
+     * pair offsets. The entry id column is left out with AD_IMPLICIT_ID. 
+     * ad_init does the same split on the device.
      * @param gs
      */
-    inline void gpu_restore(struct ad_gradient_structure* gs) {
-        gs->current_variable_id += gs->counter;
-        gs->stack_current += gs->counter;
-        gs->counter = 0;
+    inline void ad_tape_columns(struct ad_gradient_structure* gs) {
+        gs->entry_offset = NULL;
+#if defined(AD_CSR_TAPE)
+        void* tape = gs->gradient_stack;
+        int capacity = gs->capacity;
+        gs->coeff_dx = (ad_partial_t*) tape;
+        gs->coeff_id = (int*) (gs->coeff_dx + gs->pair_capacity);
+        gs->entry_id = AD_ENTRY_ID_COLUMNS ? gs->coeff_id + gs->pair_capacity : NULL;
+        gs->entry_size = gs->coeff_id + gs->pair_capacity + AD_ENTRY_ID_COLUMNS * capacity;
+        gs->entry_offset = gs->entry_size + capacity;
+#elif defined(AD_SOA_TAPE)
+        void* tape = gs->gradient_stack;
+        int capacity = gs->capacity;
+        gs->coeff_dx = (ad_partial_t*) tape;
+        gs->coeff_id = (int*) (gs->coeff_dx + (size_t) capacity * MAX_VARIABLE_IN_EXPESSION);
+        gs->entry_id = AD_ENTRY_ID_COLUMNS ? gs->coeff_id + (size_t) capacity * MAX_VARIABLE_IN_EXPESSION : NULL;
+        gs->entry_size = gs->coeff_id + (size_t) capacity * MAX_VARIABLE_IN_EXPESSION + AD_ENTRY_ID_COLUMNS * capacity;
+#else
+        gs->coeff_dx = NULL;
+        gs->coeff_id = NULL;
+        gs->entry_id = NULL;
+        gs->entry_size = NULL;
+#endif
     }
 
-    
-    inline void ad_init_var(struct ad_gradient_structure* gs, struct ad_variable* var, double value){
-        var->id = atomic_inc(gs->current_variable_id);
-        var->value = value;
-    }
-    
     /**
-     * Adds two variables together. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
+     * Sets tape as the gradient stack of gs, see ad_tape_columns.
      * 
      * @param gs
-     * @param a
-     * @param b
-     * @return 
+     * @param tape - ad_tape_bytes(capacity) bytes.
+     * @param capacity - number of entries.
      */
-    inline const struct ad_variable ad_plus(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a.value + b.value, .id = 0};
+    inline void ad_tape_bind(struct ad_gradient_structure* gs, void* tape, int capacity) {
+        gs->gradient_stack = (struct ad_entry*) tape;
+        gs->capacity = capacity;
+        gs->pair_capacity = capacity * MAX_VARIABLE_IN_EXPESSION;
+        gs->pool = NULL;
+        gs->chunk = NULL;
+        gs->segment_base = 0;
+        gs->segment_size = capacity;
+        ad_tape_columns(gs);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            ret.id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-            e.coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-            e.size = 2;
-            e.id = ret.id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
+#ifdef AD_CSR_TAPE
 
-        return ret;
+    /**
+     * Size in bytes of a compressed tape of size entries sharing pairs 
+     * coefficient pairs.
+     * @param size
+     * @param pairs
+     * @return 
+     */
+    inline size_t ad_csr_tape_bytes(int size, int pairs) {
+        return (size_t) pairs * (sizeof (ad_partial_t) + sizeof (int)) + (size_t) size * (AD_ENTRY_ID_COLUMNS + 2) * sizeof (int);
     }
 
     /**
-     * Adds variable a to double b. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
+     * Same as ad_tape_bind, but with room for only pairs coefficient 
+     * pairs instead of MAX_VARIABLE_IN_EXPESSION per entry.
      * 
      * @param gs
-     * @param a
-     * @param b
-     * @return 
+     * @param tape - ad_csr_tape_bytes(capacity, pairs) bytes.
+     * @param capacity - number of entries.
+     * @param pairs - number of coefficient pairs.
      */
-    inline const struct ad_variable ad_plus_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
-        struct ad_variable ret = {.value = a.value + b, .id = 0};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-            e.size = 1;
-            e.id = ret.id;
-            ret.id = var_id;
-            e.size = 2;
-            e.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
+    inline void ad_csr_tape_bind(struct ad_gradient_structure* gs, void* tape, int capacity, int pairs) {
+        gs->gradient_stack = (struct ad_entry*) tape;
+        gs->capacity = capacity;
+        gs->pair_capacity = pairs;
+        gs->pool = NULL;
+        gs->chunk = NULL;
+        gs->segment_base = 0;
+        gs->segment_size = capacity;
+        ad_tape_columns(gs);
+    }
+#endif
 
-        return ret;
+    /**
+     * Prints message and exits, for errors that would otherwise corrupt 
+     * memory.
+     * @param message
+     */
+    inline void ad_fatal(const char* message) {
+        fprintf(stderr, "ad4cl: %s\n", message);
+        exit(EXIT_FAILURE);
     }
 
     /**
-     * Adds double a to variable b. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
-     * @param gs
-     * @param a
-     * @param b
-     * @return 
+     * Header of one segment of a segmented tape. The ad_tape_bytes(capacity) 
+     * bytes of tape follow the header, see ad_chunk_tape. count is the 
+     * number of slots the segment covers, less than capacity if it was 
+     * closed early because its coefficient pairs ran out.
      */
-    inline const struct ad_variable ad_plus_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a + b.value, .id = gs->current_variable_id++};
+    struct ad_tape_chunk {
+        struct ad_tape_chunk* prev;
+        struct ad_tape_chunk* next;
+        int count;
+        int pair_current;
+    };
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = b.id};
-            e.size = 1;
-            ret.id = var_id;
-            e.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
+    /**
+     * Free list of equally sized tape chunks. A pool can be shared by 
+     * several gradient structures and keeps the chunks released by 
+     * ad_tape_reset for reuse.
+     */
+    struct ad_chunk_pool {
+        struct ad_tape_chunk* free_list;
+        int chunk_capacity;
+    };
 
-        return ret;
+    inline void* ad_chunk_tape(struct ad_tape_chunk* c) {
+        return (void*) (c + 1);
     }
 
     /**
-     * Plus assign variable a and variable b. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
-     * @param gs
-     * @param a
-     * @param b
+     * Creates an empty pool of chunks holding chunk_capacity entries each.
+     * @param chunk_capacity
+     * @return 
      */
-    inline void ad_plus_eq_v(struct ad_gradient_structure* gs, struct ad_variable* a, struct ad_variable b) {
-        a->value += b.value;
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-            e.coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};
-            e.size = 2;
-            e.id = a->id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
+    struct ad_chunk_pool* ad_chunk_pool_create(int chunk_capacity) {
+        struct ad_chunk_pool* pool = (struct ad_chunk_pool*) malloc(sizeof (struct ad_chunk_pool));
+        pool->free_list = NULL;
+        pool->chunk_capacity = chunk_capacity;
+        return pool;
     }
 
     /**
-     * Plus assign variable a and double b. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     *  
-     * @param gs
-     * @param a
-     * @param b
+     * Frees pool and the chunks in its free list. Chunks still in use by a 
+     * gradient structure are not freed.
+     * @param pool
      */
-    inline void ad_plus_eq_d(struct ad_gradient_structure* gs, struct ad_variable* a, double b) {
-        a->value += b;
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};
-            e.size = 1;
-            e.id = a->id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    void ad_chunk_pool_free(struct ad_chunk_pool* pool) {
+        while (pool->free_list != NULL) {
+            struct ad_tape_chunk* c = pool->free_list;
+            pool->free_list = c->next;
+            free(c);
         }
+        free(pool);
     }
 
     /**
-     * Subtracts variable b from variable a. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
-     * @param gs
-     * @param a
-     * @param b
+     * Takes a chunk from the free list, or allocates one if it is empty.
+     * @param pool
      * @return 
      */
-    inline const struct ad_variable ad_minus(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a.value - b.value, .id = 0};
-
-        if (gs->recording) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-            e.coeff[1] = (struct ad_pair){.dx = -1.0, .id = b.id};
-            e.size = 2;
-            ret.id = var_id;
-            e.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    inline struct ad_tape_chunk* ad_chunk_acquire(struct ad_chunk_pool* pool) {
+        struct ad_tape_chunk* c = pool->free_list;
+        if (c != NULL) {
+            pool->free_list = c->next;
+        } else {
+            c = (struct ad_tape_chunk*) malloc(sizeof (struct ad_tape_chunk) + ad_tape_bytes(pool->chunk_capacity));
+            if (c == NULL) {
+                ad_fatal("out of memory for tape chunk");
+            }
         }
+        c->prev = NULL;
+        c->next = NULL;
+        c->count = pool->chunk_capacity;
+        c->pair_current = 0;
+        return c;
+    }
 
-        return ret;
+    inline void ad_chunk_release(struct ad_chunk_pool* pool, struct ad_tape_chunk* c) {
+        c->next = pool->free_list;
+        pool->free_list = c;
     }
 
     /**
-     * Subtracts double b from variable a.If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
+     * Makes the tape of gs segmented: it starts with one chunk from pool 
+     * and takes more chunks as it grows, see ad_tape_slot. Segmented tapes 
+     * are host only.
      * @param gs
-     * @param a
-     * @param b
-     * @return 
+     * @param pool
      */
-    inline const struct ad_variable ad_minus_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
-        struct ad_variable ret = {.value = a.value - b, .id = 0};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            ret.id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};
-            e.size = 1;
-            e.id = ret.id;
-
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-
-        return ret;
+    inline void ad_tape_use_pool(struct ad_gradient_structure* gs, struct ad_chunk_pool* pool) {
+        struct ad_tape_chunk* c = ad_chunk_acquire(pool);
+        ad_tape_bind(gs, ad_chunk_tape(c), pool->chunk_capacity);
+        gs->pool = pool;
+        gs->chunk = c;
     }
 
     /**
-     * Subtracts variable b from double a. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     *  
+     * Binds the segment holding slot, which must be on the tape, and 
+     * returns the position of slot in it. Nothing is written to the 
+     * chunks, so private copies of a gradient structure can walk the same 
+     * tape from several threads, see ad_tape_view_slot.
      * @param gs
-     * @param a
-     * @param b
+     * @param slot
      * @return 
      */
-    inline const struct ad_variable ad_minus_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a - b.value, .id = 0};
-
-        if (gs->recording) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = -1.0, .id = b.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    inline int ad_tape_locate(struct ad_gradient_structure* gs, int slot) {
+        struct ad_tape_chunk* c = gs->chunk;
+        int base = gs->segment_base;
+        while (slot < base) {
+            c = c->prev;
+            base -= c->count;
         }
-
-        return ret;
+        while (slot >= base + c->count) {
+            base += c->count;
+            c = c->next;
+        }
+        gs->chunk = c;
+        gs->segment_base = base;
+        gs->segment_size = c->count;
+        gs->gradient_stack = (struct ad_entry*) ad_chunk_tape(c);
+        gs->pair_current = c->pair_current;
+        ad_tape_columns(gs);
+        return slot - base;
     }
 
     /**
-     * Multiplies to variables together. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
+     * Binds the segment holding slot, growing the tape from gs->pool if 
+     * needed, and returns the position of slot in it. A tape without a 
+     * pool can not grow.
      * @param gs
-     * @param a
-     * @param b
+     * @param slot
      * @return 
      */
-    inline const struct ad_variable ad_times(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a.value * b.value, .id = 0};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            ret.id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = a.value, .id = a.id};
-            e.coeff[1] = (struct ad_pair){.dx = b.value, .id = b.id};
-            e.size = 2;
-            e.id = ret.id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    inline int ad_tape_seek(struct ad_gradient_structure* gs, int slot) {
+        struct ad_tape_chunk* c = gs->chunk;
+        int base = gs->segment_base;
+        if (c == NULL) {
+            ad_fatal("tape overflow, increase its capacity or use ad_tape_use_pool");
         }
-
-        return ret;
+        c->pair_current = gs->pair_current;
+        while (slot >= base + c->count) {
+            if (c->next == NULL) {
+                c->next = ad_chunk_acquire(gs->pool);
+                c->next->prev = c;
+            }
+            base += c->count;
+            c = c->next;
+        }
+        return ad_tape_locate(gs, slot);
     }
 
     /**
-     * Multiplies variable a and double b.If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
+     * Position of slot in the bound segment, binding another segment first 
+     * if slot is outside of it. For a contiguous tape this is slot.
      * @param gs
-     * @param a
-     * @param b
+     * @param slot
      * @return 
      */
-    inline const struct ad_variable ad_times_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
-        struct ad_variable ret = {.value = a.value * b, .id = 0};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = b, .id = a.id};
-            e.size = 1;
-            ret.id = var_id;
-            e.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    inline int ad_tape_slot(struct ad_gradient_structure* gs, int slot) {
+        int local = slot - gs->segment_base;
+        if ((unsigned) local >= (unsigned) gs->segment_size) {
+            local = ad_tape_seek(gs, slot);
         }
-
-        return ret;
+        return local;
     }
 
     /**
-     * Multiplies double a and variable b.If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
-     * @param gs
-     * @param a
-     * @param b
+     * Same as ad_tape_slot for slots already on the tape, without writing 
+     * to it. view is a private copy of a gradient structure.
+     * @param view
+     * @param slot
      * @return 
      */
-    inline const struct ad_variable ad_times_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a * b.value, .id = 0};
+    inline int ad_tape_view_slot(struct ad_gradient_structure* view, int slot) {
+        int local = slot - view->segment_base;
+        if ((unsigned) local >= (unsigned) view->segment_size) {
+            local = ad_tape_locate(view, slot);
+        }
+        return local;
+    }
+
+#ifdef AD_CSR_TAPE
+
+    /**
+     * Reserves n coefficient pairs for the entry in slot and returns the 
+     * offset of the first. *local is set to the position of slot in the 
+     * bound segment. Entries are recorded in order, so the first entry of 
+     * a segment starts its pairs over. If the pairs of the segment run out 
+     * it is closed at slot and the entry starts the next one. With 
+     * AD_THREAD_SAFE the tape is contiguous and entries are not recorded in 
+     * order, the pairs are only taken atomically.
+     * @param gs
+     * @param slot
+     * @param n
+     * @param local
+     * @return 
+     */
+    inline int ad_tape_pairs(struct ad_gradient_structure* gs, int slot, int n, int* local) {
+        *local = ad_tape_slot(gs, slot);
+#ifdef AD_THREAD_SAFE
+        int p = atomic_add(gs->pair_current, n);
+        if (p + n > gs->pair_capacity) {
+            ad_fatal("out of coefficient pairs");
+        }
+        return p;
+#else
+        if (*local != 0 && gs->pair_current + n > gs->pair_capacity && gs->chunk != NULL) {
+            gs->chunk->count = *local;
+            gs->segment_size = *local;
+            *local = ad_tape_seek(gs, slot);
+        }
+        if (*local == 0) {
+            gs->pair_current = 0;
+        }
+        if (gs->pair_current + n > gs->pair_capacity) {
+            ad_fatal("out of coefficient pairs");
+        }
+        return atomic_add(gs->pair_current, n);
+#endif
+    }
+#else
+
+    /**
+     * Makes the n slots from slot, which hold a single entry, part of one 
+     * segment and returns the position of slot in it. If they do not fit 
+     * in the bound segment it is closed at slot and the entry starts the 
+     * next one, see ad_record_nary.
+     * @param gs
+     * @param slot
+     * @param n
+     * @return 
+     */
+    inline int ad_tape_span(struct ad_gradient_structure* gs, int slot, int n) {
+        int local = ad_tape_slot(gs, slot);
+        if (local != 0 && local + n > gs->segment_size && gs->chunk != NULL) {
+            gs->chunk->count = local;
+            gs->segment_size = local;
+            local = ad_tape_seek(gs, slot);
+        }
+        if (local == 0 && n > gs->segment_size && gs->chunk != NULL) {
+            //closed early by an earlier recording, nothing follows slot
+            gs->chunk->count = gs->capacity;
+            gs->segment_size = gs->capacity;
+        }
+        if (local + n > gs->segment_size) {
+            ad_fatal(gs->chunk != NULL ? "entry larger than a tape chunk" : "tape overflow, increase its capacity");
+        }
+        return local;
+    }
+#endif
+
+    /**
+     * Empties the tape. A segmented tape keeps its first chunk and returns 
+     * the others to the pool. Variable ids continue from 
+     * current_variable_id.
+     * @param gs
+     */
+    inline void ad_tape_reset(struct ad_gradient_structure* gs) {
+        if (gs->chunk != NULL) {
+            struct ad_tape_chunk* first = gs->chunk;
+            while (first->prev != NULL) {
+                first = first->prev;
+            }
+            struct ad_tape_chunk* c = first->next;
+            while (c != NULL) {
+                struct ad_tape_chunk* next = c->next;
+                ad_chunk_release(gs->pool, c);
+                c = next;
+            }
+            first->next = NULL;
+            first->count = gs->capacity;
+            gs->chunk = first;
+            gs->segment_base = 0;
+            gs->segment_size = first->count;
+            gs->gradient_stack = (struct ad_entry*) ad_chunk_tape(first);
+            ad_tape_columns(gs);
+        }
+        gs->stack_current = 0;
+        gs->counter = 0;
+        gs->pair_current = 0;
+        gs->pair_counter = 0;
+        gs->epoch++;
+    }
+
+    /**
+     * Starts a new recording. Nothing on the tape is cleared: the host 
+     * writes every slot it hands out and the device clears the blocks it 
+     * reserves, see pad_init in ad.cl, so the cost does not depend on the 
+     * size of the tape. Use instead of zeroing the entries between 
+     * iterations; ad_reset in ad.cl does the same on the device.
+     * @param gs
+     * @param first_id - id of the first variable of the new recording, 
+     * smaller ids (independent variables) stay valid.
+     */
+    inline void ad_reset(struct ad_gradient_structure* gs, int first_id) {
+        ad_tape_reset(gs);
+        gs->current_variable_id = first_id;
+    }
+
+    /**
+     * Creates a new gradient_structure with a segmented tape that grows 
+     * size entries at a time, see ad_tape_use_pool. With AD_THREAD_SAFE 
+     * the tape is contiguous and holds size entries, threads take their 
+     * blocks from it, see ad_thread_reserve.
+     * @param size - length of each tape segment.
+     * @return 
+     */
+    struct ad_gradient_structure* create_gradient_structure(int size) {
+        struct ad_gradient_structure* gs = ( struct ad_gradient_structure*)malloc(sizeof (ad_gradient_structure));
+        gs->current_variable_id = 0;
+        gs->recording = 1;
+        gs->stack_current = 0;
+        gs->counter = 0;
+        gs->pair_current = 0;
+        gs->pair_counter = 0;
+        gs->parent = NULL;
+        gs->workspace = NULL;
+        gs->epoch = 0;
+#ifdef AD_THREAD_SAFE
+        ad_tape_bind(gs, calloc(1, ad_tape_bytes(size)), size);
+#else
+        ad_tape_use_pool(gs, ad_chunk_pool_create(size));
+#endif
+        return gs;
+    }
+
+    /**
+     * To be called after the gradient_structure has been run in a 
+     * OpenCL application. This does not need to be called if the 
+     * gradient_structure has only been run on the host. gs->gradient_stack 
+     * must point to the host copy of the tape.
+     * @param gs
+     */
+    inline void gpu_restore(struct ad_gradient_structure* gs) {
+        ad_tape_columns(gs);
+        gs->current_variable_id += gs->counter;
+        gs->stack_current += gs->counter;
+        gs->counter = 0;
+        gs->pair_current += gs->pair_counter;
+        gs->pair_counter = 0;
+        gs->epoch++;
+    }
+
+    /**
+     * Difference between the result id and the slot of every entry with 
+     * AD_IMPLICIT_ID. Ids and slots are handed out together, so it only 
+     * changes when the counters are reset.
+     * @param gs
+     * @return 
+     */
+    inline int ad_id_offset(const struct ad_gradient_structure* gs) {
+        return gs->current_variable_id - gs->stack_current;
+    }
+
+    /**
+     * Stores the result id of the entry in slot, nothing with 
+     * AD_IMPLICIT_ID.
+     */
+#if defined(AD_IMPLICIT_ID)
+#define AD_SET_ENTRY_ID(gs, slot, rid) ((void) (rid))
+#elif defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE)
+#define AD_SET_ENTRY_ID(gs, slot, rid) ((gs)->entry_id[(slot)] = (rid))
+#else
+#define AD_SET_ENTRY_ID(gs, slot, rid) ((gs)->gradient_stack[(slot)].id = (rid))
+#endif
+
+    /**
+     * Zeroes the second order partials of e, nothing without 
+     * AD_SECOND_ORDER.
+     * @param e
+     */
+    inline void ad_entry_clear_hessian(struct ad_entry* e) {
+#ifdef AD_SECOND_ORDER
+        for (int i = 0; i < AD_HESSIAN_SIZE; i++) {
+            e->hessian[i] = 0.0;
+        }
+#endif
+    }
+
+    /**
+     * Writes a one coefficient entry to slot of the tape.
+     * @param gs
+     * @param slot
+     * @param id - id of the result.
+     * @param dx - partial derivative w.r.t. x.
+     * @param x - id of the argument.
+     */
+    inline void ad_record_unary(struct ad_gradient_structure* gs, int slot, int id, double dx, int x) {
+#if defined(AD_CSR_TAPE)
+        int p = ad_tape_pairs(gs, slot, 1, &slot);
+        gs->coeff_dx[p] = dx;
+        gs->coeff_id[p] = x;
+        AD_SET_ENTRY_ID(gs, slot, id);
+        gs->entry_size[slot] = 1;
+        gs->entry_offset[slot] = p;
+#elif defined(AD_SOA_TAPE)
+        slot = ad_tape_slot(gs, slot);
+        gs->coeff_dx[slot] = dx;
+        gs->coeff_id[slot] = x;
+        AD_SET_ENTRY_ID(gs, slot, id);
+        gs->entry_size[slot] = 1;
+#else
+        slot = ad_tape_slot(gs, slot);
+        struct ad_entry* e = &gs->gradient_stack[slot];
+        e->coeff[0] = (struct ad_pair){.dx = (ad_partial_t) dx, .id = x};
+        AD_SET_ENTRY_ID(gs, slot, id);
+        e->size = 1;
+        ad_entry_clear_hessian(e);
+#endif
+    }
+
+    /**
+     * Writes an entry without coefficients to slot of the tape, used to 
+     * give independent variables a slot with AD_IMPLICIT_ID.
+     * @param gs
+     * @param slot
+     * @param id - id of the variable.
+     */
+    inline void ad_record_empty(struct ad_gradient_structure* gs, int slot, int id) {
+        slot = ad_tape_slot(gs, slot);
+#if defined(AD_CSR_TAPE)
+        gs->entry_offset[slot] = gs->pair_current;
+        gs->entry_size[slot] = 0;
+#elif defined(AD_SOA_TAPE)
+        gs->entry_size[slot] = 0;
+#else
+        gs->gradient_stack[slot].size = 0;
+#endif
+        AD_SET_ENTRY_ID(gs, slot, id);
+    }
+
+    /**
+     * Writes a two coefficient entry to slot of the tape.
+     * @param gs
+     * @param slot
+     * @param id - id of the result.
+     * @param da - partial derivative w.r.t. a.
+     * @param a - id of the first argument.
+     * @param db - partial derivative w.r.t. b.
+     * @param b - id of the second argument.
+     */
+    inline void ad_record_binary(struct ad_gradient_structure* gs, int slot, int id, double da, int a, double db, int b) {
+#if defined(AD_CSR_TAPE)
+        int p = ad_tape_pairs(gs, slot, 2, &slot);
+        gs->coeff_dx[p] = da;
+        gs->coeff_id[p] = a;
+        gs->coeff_dx[p + 1] = db;
+        gs->coeff_id[p + 1] = b;
+        AD_SET_ENTRY_ID(gs, slot, id);
+        gs->entry_size[slot] = 2;
+        gs->entry_offset[slot] = p;
+#elif defined(AD_SOA_TAPE)
+        slot = ad_tape_slot(gs, slot);
+        gs->coeff_dx[slot] = da;
+        gs->coeff_id[slot] = a;
+        gs->coeff_dx[gs->capacity + slot] = db;
+        gs->coeff_id[gs->capacity + slot] = b;
+        AD_SET_ENTRY_ID(gs, slot, id);
+        gs->entry_size[slot] = 2;
+#else
+        slot = ad_tape_slot(gs, slot);
+        struct ad_entry* e = &gs->gradient_stack[slot];
+        e->coeff[0] = (struct ad_pair){.dx = (ad_partial_t) da, .id = a};
+        e->coeff[1] = (struct ad_pair){.dx = (ad_partial_t) db, .id = b};
+        AD_SET_ENTRY_ID(gs, slot, id);
+        e->size = 2;
+        ad_entry_clear_hessian(e);
+#endif
+    }
+
+    /**
+     * Records ret = f(x) with f'(x) = dx and f''(x) = d2. With 
+     * AD_HESSIAN_VECTOR ret gets its tangent and the pair the tangent of 
+     * dx, with AD_SECOND_ORDER the entry keeps d2. Without either this is 
+     * ad_record_unary and d2 is not used.
+     * @param gs
+     * @param slot
+     * @param ret - the result, its id is recorded.
+     * @param dx
+     * @param x
+     * @param d2
+     */
+    inline void ad_record_unary_op(struct ad_gradient_structure* gs, int slot, struct ad_variable* ret,
+            double dx, struct ad_variable x, double d2) {
+#if defined(AD_HESSIAN_VECTOR) || defined(AD_SECOND_ORDER)
+        slot = ad_tape_slot(gs, slot);
+        struct ad_entry* e = &gs->gradient_stack[slot];
+        e->coeff[0].dx = dx;
+        e->coeff[0].id = x.id;
+        AD_SET_ENTRY_ID(gs, slot, ret->id);
+        e->size = 1;
+#ifdef AD_HESSIAN_VECTOR
+        e->coeff[0].ddx = d2 * x.tangent;
+        ret->tangent = dx * x.tangent;
+#endif
+#ifdef AD_SECOND_ORDER
+        ad_entry_clear_hessian(e);
+        e->hessian[0] = d2;
+#endif
+#else
+        ad_record_unary(gs, slot, ret->id, dx, x.id);
+#endif
+    }
+
+    /**
+     * Records ret = f(a, b) with the partials da, db and the second order 
+     * partials haa, hab and hbb. With AD_HESSIAN_VECTOR ret gets its 
+     * tangent and the pairs the tangents of da and db, with 
+     * AD_SECOND_ORDER the entry keeps the second order partials. Without 
+     * either this is ad_record_binary.
+     * @param gs
+     * @param slot
+     * @param ret - the result, its id is recorded.
+     * @param da
+     * @param a
+     * @param db
+     * @param b
+     * @param haa
+     * @param hab
+     * @param hbb
+     */
+    inline void ad_record_binary_op(struct ad_gradient_structure* gs, int slot, struct ad_variable* ret,
+            double da, struct ad_variable a, double db, struct ad_variable b,
+            double haa, double hab, double hbb) {
+#if defined(AD_HESSIAN_VECTOR) || defined(AD_SECOND_ORDER)
+        slot = ad_tape_slot(gs, slot);
+        struct ad_entry* e = &gs->gradient_stack[slot];
+        e->coeff[0].dx = da;
+        e->coeff[0].id = a.id;
+        e->coeff[1].dx = db;
+        e->coeff[1].id = b.id;
+        AD_SET_ENTRY_ID(gs, slot, ret->id);
+        e->size = 2;
+#ifdef AD_HESSIAN_VECTOR
+        e->coeff[0].ddx = haa * a.tangent + hab * b.tangent;
+        e->coeff[1].ddx = hab * a.tangent + hbb * b.tangent;
+        ret->tangent = da * a.tangent + db * b.tangent;
+#endif
+#ifdef AD_SECOND_ORDER
+        ad_entry_clear_hessian(e);
+        e->hessian[AD_HESSIAN_INDEX(0, 0)] = haa;
+        e->hessian[AD_HESSIAN_INDEX(0, 1)] = hab;
+        e->hessian[AD_HESSIAN_INDEX(1, 1)] = hbb;
+#endif
+#else
+        ad_record_binary(gs, slot, ret->id, da, a.id, db, b.id);
+#endif
+    }
+
+    /**
+     * Number of consecutive slots (and with AD_IMPLICIT_ID ids) an entry of 
+     * n coefficients takes, see ad_record_nary. Same as on the device.
+     */
+#ifdef AD_CSR_TAPE
+#define AD_NARY_OPERATIONS(n) 1
+#else
+#define AD_NARY_OPERATIONS(n) (((n) + MAX_VARIABLE_IN_EXPESSION - 1) / MAX_VARIABLE_IN_EXPESSION)
+
+    /**
+     * Writes an entry of n coefficients, dx[i] w.r.t. args[i], to the 
+     * AD_NARY_OPERATIONS(n) slots from slot. Every slot holds 
+     * MAX_VARIABLE_IN_EXPESSION of the coefficients, the last one also the 
+     * result id and size. The others stay empty entries, so sweeps skip 
+     * them and the last slot of the tape is still the last result. With 
+     * AD_HESSIAN_VECTOR the partials are taken to be constant along the 
+     * direction, with AD_SECOND_ORDER their second order partials are 0.
+     * @param gs
+     * @param slot
+     * @param id - id of the result.
+     * @param n
+     * @param dx - NULL for all 1.
+     * @param args
+     */
+    inline void ad_record_nary(struct ad_gradient_structure* gs, int slot, int id, int n, const double* dx,
+            const struct ad_variable* args) {
+        int slots = AD_NARY_OPERATIONS(n);
+        int first = ad_tape_span(gs, slot, slots);
+        int last = first + slots - 1;
+        for (int i = 0; i < n; i++) {
+            int s = last - i / MAX_VARIABLE_IN_EXPESSION;
+            int k = i % MAX_VARIABLE_IN_EXPESSION;
+#if defined(AD_SOA_TAPE)
+            gs->coeff_dx[(size_t) k * gs->capacity + s] = dx ? dx[i] : 1.0;
+            gs->coeff_id[(size_t) k * gs->capacity + s] = args[i].id;
+#else
+            gs->gradient_stack[s].coeff[k] = (struct ad_pair){.dx = (ad_partial_t) (dx ? dx[i] : 1.0), .id = args[i].id};
+#endif
+        }
+        for (int s = first; s <= last; s++) {
+            AD_SET_ENTRY_ID(gs, s, s == last ? id : 0);
+#if defined(AD_SOA_TAPE)
+            gs->entry_size[s] = s == last ? n : 0;
+#else
+            gs->gradient_stack[s].size = s == last ? n : 0;
+            ad_entry_clear_hessian(&gs->gradient_stack[s]);
+#endif
+        }
+    }
+#endif
+
+    /**
+     * Tape accessors, valid for all layouts. slot is relative to the bound 
+     * segment, see ad_tape_slot. Without AD_CSR_TAPE coefficient i of an 
+     * entry is in slot - i / MAX_VARIABLE_IN_EXPESSION, see ad_record_nary.
+     */
+    inline int ad_entry_id(const struct ad_gradient_structure* gs, int slot) {
+#if defined(AD_IMPLICIT_ID)
+        return gs->segment_base + slot + ad_id_offset(gs);
+#elif defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE)
+        return gs->entry_id[slot];
+#else
+        return gs->gradient_stack[slot].id;
+#endif
+    }
+
+    inline int ad_entry_size(const struct ad_gradient_structure* gs, int slot) {
+#if defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE)
+        return gs->entry_size[slot];
+#else
+        return gs->gradient_stack[slot].size;
+#endif
+    }
+
+    inline double ad_entry_dx(const struct ad_gradient_structure* gs, int slot, int i) {
+#if defined(AD_CSR_TAPE)
+        return gs->coeff_dx[gs->entry_offset[slot] + i];
+#elif defined(AD_SOA_TAPE)
+        return gs->coeff_dx[(size_t) (i % MAX_VARIABLE_IN_EXPESSION) * gs->capacity + slot - i / MAX_VARIABLE_IN_EXPESSION];
+#else
+        return gs->gradient_stack[slot - i / MAX_VARIABLE_IN_EXPESSION].coeff[i % MAX_VARIABLE_IN_EXPESSION].dx;
+#endif
+    }
+
+    inline int ad_entry_coeff_id(const struct ad_gradient_structure* gs, int slot, int i) {
+#if defined(AD_CSR_TAPE)
+        return gs->coeff_id[gs->entry_offset[slot] + i];
+#elif defined(AD_SOA_TAPE)
+        return gs->coeff_id[(size_t) (i % MAX_VARIABLE_IN_EXPESSION) * gs->capacity + slot - i / MAX_VARIABLE_IN_EXPESSION];
+#else
+        return gs->gradient_stack[slot - i / MAX_VARIABLE_IN_EXPESSION].coeff[i % MAX_VARIABLE_IN_EXPESSION].id;
+#endif
+    }
+
+#ifdef AD_HESSIAN_VECTOR
+
+    inline double ad_entry_ddx(const struct ad_gradient_structure* gs, int slot, int i) {
+        return gs->gradient_stack[slot - i / MAX_VARIABLE_IN_EXPESSION].coeff[i % MAX_VARIABLE_IN_EXPESSION].ddx;
+    }
+#endif
+
+#ifdef AD_THREAD_SAFE
+
+    /**
+     * Slots [slot, slot_end) and ids [id, id_end) of gs reserved by the 
+     * calling thread, valid while gs->epoch is unchanged.
+     */
+    struct ad_thread_block {
+        struct ad_gradient_structure* gs;
+        int epoch;
+        int slot;
+        int slot_end;
+        int id;
+        int id_end;
+    };
+
+    inline struct ad_thread_block* ad_thread_block_get() {
+        static thread_local struct ad_thread_block block = {NULL, 0, 0, 0, 0, 0};
+        return &block;
+    }
+
+    inline std::mutex& ad_thread_mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    /**
+     * Gives the calling thread the next AD_THREAD_BLOCK ids of gs, or slots 
+     * if more, and as many slots if slots is set. Taking both at once keeps 
+     * every slot at ad_id_offset(gs) from its id for AD_IMPLICIT_ID.
+     * @param gs
+     * @param slots - least number of slots, 0 for ids only.
+     * @return the block of the calling thread.
+     */
+    inline struct ad_thread_block* ad_thread_reserve(struct ad_gradient_structure* gs, int slots) {
+        struct ad_thread_block* b = ad_thread_block_get();
+        std::lock_guard<std::mutex> lock(ad_thread_mutex());
+        if (b->gs != gs || b->epoch != gs->epoch) {
+            b->gs = gs;
+            b->epoch = gs->epoch;
+            b->slot = b->slot_end = 0;
+            b->id = b->id_end = 0;
+        }
+        int n = AD_THREAD_BLOCK > slots ? AD_THREAD_BLOCK : slots;
+        if (slots) {
+            if (gs->chunk != NULL) {
+                ad_fatal("AD_THREAD_SAFE needs a contiguous tape, see ad_tape_bind");
+            }
+            n = n < gs->capacity - gs->stack_current ? n : gs->capacity - gs->stack_current;
+            if (n < slots) {
+                ad_fatal("tape overflow, increase its capacity");
+            }
+            b->slot = gs->stack_current;
+            b->slot_end = b->slot + n;
+            gs->stack_current += n;
+        }
+        b->id = gs->current_variable_id;
+        b->id_end = b->id + n;
+        gs->current_variable_id += n;
+        return b;
+    }
+
+    /**
+     * Next tape slot of the calling thread, see AD_THREAD_SAFE.
+     * @param gs
+     * @return 
+     */
+    inline int ad_next_slot(struct ad_gradient_structure* gs) {
+        struct ad_thread_block* b = ad_thread_block_get();
+        if (b->gs != gs || b->epoch != gs->epoch || b->slot == b->slot_end) {
+            b = ad_thread_reserve(gs, 1);
+        }
+        return b->slot++;
+    }
+
+    inline void ad_thread_flush(struct ad_gradient_structure* gs);
+
+    /**
+     * First of the next n consecutive tape slots of the calling thread. 
+     * What is left of its block if they do not fit is flushed, see 
+     * ad_thread_flush.
+     * @param gs
+     * @param n
+     * @return 
+     */
+    inline int ad_next_slots(struct ad_gradient_structure* gs, int n) {
+        struct ad_thread_block* b = ad_thread_block_get();
+        if (b->gs != gs || b->epoch != gs->epoch || b->slot + n > b->slot_end) {
+            ad_thread_flush(gs);
+            b = ad_thread_reserve(gs, n);
+        }
+        int slot = b->slot;
+        b->slot += n;
+        return slot;
+    }
+
+    /**
+     * Next variable id of the calling thread, see AD_THREAD_SAFE.
+     * @param gs
+     * @return 
+     */
+    inline int ad_next_id(struct ad_gradient_structure* gs) {
+        struct ad_thread_block* b = ad_thread_block_get();
+        if (b->gs != gs || b->epoch != gs->epoch || b->id == b->id_end) {
+            b = ad_thread_reserve(gs, 0);
+        }
+        return b->id++;
+    }
+#else
+
+    inline int ad_next_slot(struct ad_gradient_structure* gs) {
+        return atomic_inc(gs->stack_current);
+    }
+
+    inline int ad_next_slots(struct ad_gradient_structure* gs, int n) {
+        return atomic_add(gs->stack_current, n);
+    }
+
+    inline int ad_next_id(struct ad_gradient_structure* gs) {
+        return atomic_inc(gs->current_variable_id);
+    }
+#endif
+
+    /**
+     * Id of the result of an entry of n coefficients. With AD_IMPLICIT_ID 
+     * the entry takes an id with each of its AD_NARY_OPERATIONS(n) slots 
+     * and its result is the last of them, see ad_record_nary.
+     * @param gs
+     * @param n
+     * @return 
+     */
+    inline int ad_next_nary_id(struct ad_gradient_structure* gs, int n) {
+        int id = ad_next_id(gs);
+#ifdef AD_IMPLICIT_ID
+        for (int i = 1; i < AD_NARY_OPERATIONS(n); i++) {
+            id = ad_next_id(gs);
+        }
+#endif
+        return id;
+    }
+
+    /**
+     * Ends the recording of the calling thread on gs with AD_THREAD_SAFE, 
+     * nothing otherwise. Its unused slots and ids are given back if 
+     * nothing was reserved after them and left as empty entries if not. 
+     * The next entry of the thread then comes after everything other 
+     * threads reserved so far. Call it in every thread that recorded 
+     * before the results are used by another thread. compute_gradient, 
+     * compute_gradient_into and compute_sparse_hessian do it for the 
+     * calling thread.
+     * @param gs
+     */
+    inline void ad_thread_flush(struct ad_gradient_structure* gs) {
+#ifdef AD_THREAD_SAFE
+        struct ad_thread_block* b = ad_thread_block_get();
+        std::lock_guard<std::mutex> lock(ad_thread_mutex());
+        if (b->gs != gs || b->epoch != gs->epoch) {
+            return;
+        }
+        if (b->slot_end == gs->stack_current) {
+            gs->stack_current = b->slot;
+        } else {
+            for (; b->slot < b->slot_end; b->slot++) {
+                ad_record_empty(gs, b->slot, b->id < b->id_end ? b->id++ : 0);
+            }
+        }
+        if (b->id_end == gs->current_variable_id) {
+            gs->current_variable_id = b->id;
+        }
+        b->gs = NULL;
+#endif
+    }
+
+    /**
+     * Body of ad_parallel_for, records item i on gs.
+     */
+    typedef void (*ad_host_kernel)(struct ad_gradient_structure* gs, int i, void* data);
+
+    /**
+     * Host counterpart of launching a kernel that records with pad_init: 
+     * runs kernel for the items [0, n) on the OpenMP threads, each thread 
+     * on a consecutive part of them. Every part gets its own range of 
+     * operations slots, ids (and AD_CSR_TAPE pairs) per item on the tape, 
+     * in item order, and records into a private copy of gs without 
+     * atomics or locks. The ranges are then joined in gs, so the tape 
+     * reads as if the items were recorded one after the other and 
+     * compute_gradient can be used as usual. Slots a part leaves unused 
+     * are empty entries. On a segmented tape every part but the first 
+     * records into chunks of its own, which are linked into the tape in 
+     * part order after; the pool is only used outside of the parallel 
+     * region. Runs serially without OpenMP.
+     * @param gs
+     * @param n - number of items.
+     * @param operations - most operations kernel records per item, more is 
+     * a fatal error.
+     * @param kernel
+     * @param data - passed to kernel.
+     */
+    inline void ad_parallel_for(struct ad_gradient_structure* gs, int n, int operations, ad_host_kernel kernel, void* data) {
+        int parts = 1;
+#ifdef _OPENMP
+        parts = omp_get_max_threads();
+#endif
+        if (parts <= 1 || n < parts) {
+            for (int i = 0; i < n; i++) {
+                kernel(gs, i, data);
+            }
+            return;
+        }
+
+        const int slot = gs->stack_current;
+        const int id = gs->current_variable_id;
+        const bool segmented = gs->recording == 1 && gs->chunk != NULL;
+        if (gs->chunk == NULL && (int64_t) n * operations > gs->capacity - slot) {
+            ad_fatal("tape overflow, increase its capacity");
+        }
+
+        //segmented: the first part goes on in the chunk holding slot, the 
+        //others start on a chunk taken here and grow from a private pool
+        struct ad_chunk_pool* own = NULL;
+        struct ad_tape_chunk** ends = NULL;
+        if (segmented) {
+            ad_tape_slot(gs, slot);
+            struct ad_tape_chunk* c = gs->chunk->next;
+            gs->chunk->next = NULL;
+            while (c != NULL) {
+                struct ad_tape_chunk* next = c->next;
+                ad_chunk_release(gs->pool, c);
+                c = next;
+            }
+            own = (struct ad_chunk_pool*) malloc(parts * sizeof (struct ad_chunk_pool));
+            ends = (struct ad_tape_chunk**) malloc(parts * sizeof (struct ad_tape_chunk*));
+            for (int k = 0; k < parts; k++) {
+                own[k].chunk_capacity = gs->pool->chunk_capacity;
+                own[k].free_list = k == 0 ? NULL : ad_chunk_acquire(gs->pool);
+            }
+        }
+        const int pair = gs->pair_current;
+        int last_slot = slot;
+        int last_id = id;
+        int last_pair = pair;
+        struct ad_gradient_structure tail = *gs;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+        for (int k = 0; k < parts; k++) {
+            int begin = (int) ((int64_t) n * k / parts);
+            int end = (int) ((int64_t) n * (k + 1) / parts);
+            int first = begin * operations;
+            int limit = end * operations;
+            struct ad_gradient_structure pgs = *gs;
+            pgs.stack_current = slot + first;
+            pgs.current_variable_id = id + first;
+#ifdef AD_CSR_TAPE
+            pgs.pair_current = pair + first * MAX_VARIABLE_IN_EXPESSION;
+#endif
+            if (segmented) {
+                pgs.pool = own + k;
+                if (k > 0) {
+                    struct ad_tape_chunk* c = ad_chunk_acquire(pgs.pool);
+                    pgs.chunk = c;
+                    pgs.segment_base = slot + first;
+                    pgs.segment_size = c->count;
+                    pgs.gradient_stack = (struct ad_entry*) ad_chunk_tape(c);
+                    pgs.pair_current = 0;
+                    ad_tape_columns(&pgs);
+                }
+            }
+            for (int i = begin; i < end; i++) {
+                kernel(&pgs, i, data);
+            }
+            ad_thread_flush(&pgs);
+            if (pgs.recording == 1) {
+                if (pgs.stack_current > slot + limit || pgs.current_variable_id > id + limit
+                        || (!segmented && pgs.pair_current > pair + limit * MAX_VARIABLE_IN_EXPESSION)) {
+                    ad_fatal("ad_parallel_for: more than operations entries per item");
+                }
+                if (k == parts - 1) {
+                    last_slot = pgs.stack_current;
+                    last_id = pgs.current_variable_id;
+                    last_pair = pgs.pair_current;
+                    tail = pgs;
+                } else {
+                    for (int s = pgs.stack_current; s < slot + limit; s++) {
+                        ad_record_empty(&pgs, s, id + (s - slot));
+                    }
+                    if (segmented) {
+                        //close the last chunk of the part where the next begins
+                        pgs.chunk->count = slot + limit - pgs.segment_base;
+                        pgs.chunk->pair_current = pgs.pair_current;
+                        ends[k] = pgs.chunk;
+                    }
+                }
+            }
+        }
+
+        if (segmented) {
+            for (int k = 1; k < parts; k++) {
+                struct ad_tape_chunk* c = k == parts - 1 ? tail.chunk : ends[k];
+                while (c->prev != NULL) {
+                    c = c->prev;
+                }
+                ends[k - 1]->next = c;
+                c->prev = ends[k - 1];
+            }
+            gs->chunk = tail.chunk;
+            gs->segment_base = tail.segment_base;
+            gs->segment_size = tail.segment_size;
+            gs->gradient_stack = tail.gradient_stack;
+            ad_tape_columns(gs);
+            free(own);
+            free(ends);
+        }
+        if (gs->recording == 1) {
+            gs->stack_current = last_slot;
+            gs->current_variable_id = last_id;
+            gs->pair_current = last_pair;
+        }
+    }
+
+    /**
+     * Gives var a new id and value. With AD_IMPLICIT_ID the id comes with 
+     * an empty tape slot. With AD_HESSIAN_VECTOR the tangent is 0, set it 
+     * to the direction after.
+     * @param gs
+     * @param var
+     * @param value
+     */
+    inline void ad_init_var(struct ad_gradient_structure* gs, struct ad_variable* var, double value){
+#ifdef AD_IMPLICIT_ID
+        int current = ad_next_slot(gs);
+        var->id = ad_next_id(gs);
+        ad_record_empty(gs, current, var->id);
+#else
+        var->id = ad_next_id(gs);
+#endif
+        var->value = value;
+#ifdef AD_HESSIAN_VECTOR
+        var->tangent = 0.0;
+#endif
+    }
+    
+    /**
+     * Adds two variables together. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_plus(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
+        struct ad_variable ret = {.value = a.value + b.value, .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            ret.id = ad_next_id(gs);
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_binary_op(gs, current, &ret,
+                    1.0, a, 1.0, b,
+                    0.0, 0.0, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Adds variable a to double b. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_plus_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a.value + b), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, 1.0, a, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Adds double a to variable b. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_plus_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a + b.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, 1.0, b, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Plus assign variable a and variable b. If the gradient structure is recording, 
+     * entries will be added and a gets the id of the new entry, otherwise 
+     * the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     */
+    inline void ad_plus_eq_v(struct ad_gradient_structure* gs, struct ad_variable* a, struct ad_variable b) {
+        a->value += b.value;
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            struct ad_variable ret = {.value = a->value, .id = var_id};
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_binary_op(gs, current, &ret,
+                    1.0, *a, 1.0, b,
+                    0.0, 0.0, 0.0);
+            *a = ret;
+        }
+    }
+
+    /**
+     * Plus assign variable a and double b. If the gradient structure is recording, 
+     * entries will be added and a gets the id of the new entry, otherwise 
+     * the result is only computed.
+     *  
+     * @param gs
+     * @param a
+     * @param b
+     */
+    inline void ad_plus_eq_d(struct ad_gradient_structure* gs, struct ad_variable* a, double b) {
+        a->value += b;
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            struct ad_variable ret = {.value = a->value, .id = var_id};
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, 1.0, *a, 0.0);
+            *a = ret;
+        }
+    }
+
+    /**
+     * Subtracts variable b from variable a. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_minus(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
+        struct ad_variable ret = {.value = a.value - b.value, .id = 0};
+
+        if (gs->recording) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_binary_op(gs, current, &ret,
+                    1.0, a, -1.0, b,
+                    0.0, 0.0, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Subtracts double b from variable a.If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_minus_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a.value - b), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            ret.id = ad_next_id(gs);
+
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, 1.0, a, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Subtracts variable b from double a. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     *  
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_minus_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a - b.value), .id = 0};
+
+        if (gs->recording) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, -1.0, b, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Multiplies to variables together. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_times(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
+        struct ad_variable ret = {.value = a.value * b.value, .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            ret.id = ad_next_id(gs);
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_binary_op(gs, current, &ret,
+                    b.value, a, a.value, b,
+                    0.0, 1.0, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Multiplies variable a and double b.If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_times_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a.value * b), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, b, a, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Multiplies double a and variable b.If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_times_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a * b.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, a, b, 0.0);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Divides variable a by variable b.If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_divide(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
+        struct ad_variable ret = {.value = a.value / b.value, .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double inv = 1.0 / b.value;
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_binary_op(gs, current, &ret,
+                    inv, a, -1.0 * ret.value * inv, b,
+                    0.0, -1.0 * inv * inv, 2.0 * ret.value * inv * inv);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Divides variable a by double b. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed. 
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_divide_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a.value / b), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double inv = 1.0 / b;
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, inv, a, 0.0);
+        }
+        return ret;
+    }
+
+    /**
+     * Divides double a by variable b. If the gradient structure is recording, 
+     * entries will be added, otherwise the result is only computed.
+     * @param gs
+     * @param a
+     * @param b
+     * @return 
+     */
+    inline const struct ad_variable ad_divide_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
+        struct ad_variable ret = {.value = (ad_value_t) (a / b.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double inv = 1.0 / b.value;
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, -1.0 * ret.value * inv, b, 2.0 * ret.value * inv * inv);
+
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_cos(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = cos(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            //            double inv = 1.0 / v.value;
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, -1.0 * sin(v.value), v, -1.0 * ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_sin(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = sin(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            //            double inv = 1.0 / v.value;
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, cos(v.value), v, -1.0 * ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_tan(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = tan(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double temp = 1.0 / cos(v.value);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, temp*temp, v, 2.0 * temp * temp * ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_acos(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = acos(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double temp = (-1.0) /
+                    pow(((1.0) -
+                    pow(v.value, (2.0))),
+                    (0.5));
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, temp, v, temp * temp * temp * v.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_asin(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = asin(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double temp = (1.0) /
+                    pow(((1.0) -
+                    pow(v.value, (2.0))),
+                    (0.5));
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, temp, v, temp * temp * temp * v.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_atan(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = atan(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double temp = (1.0) / (v.value * v.value + (1.0));
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, temp, v, -2.0 * v.value * temp * temp);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_cosh(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = cosh(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, sinh(v.value), v, ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_sinh(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = sinh(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, cosh(v.value), v, ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_tanh(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = tanh(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double temp = (1.0 / cosh(v.value))*(1.0 / cosh(v.value));
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, temp, v, -2.0 * ret.value * temp);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_exp(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = exp(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, ret.value, v, ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_log(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = log(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double inv = 1.0 / v.value;
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, 1.0 / v.value, v, -1.0 * inv * inv);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_log10(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = log10(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double inv = 1.0 / (v.value * 2.30258509299404590109361379290930926799774169921875);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, inv, v, -1.0 * inv / v.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_pow(struct ad_gradient_structure* gs,
+            struct ad_variable a, struct ad_variable b) {
+        struct ad_variable ret = {.value = pow(a.value, b.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double inv = b.value * pow(a.value, b.value - (1.0));
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_binary_op(gs, current, &ret,
+                    inv, a, log(a.value) * ret.value, b,
+                    (b.value - 1.0) * inv / a.value,
+                    (1.0 + b.value * log(a.value)) * ret.value / a.value,
+                    log(a.value) * log(a.value) * ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_pow_vd(struct ad_gradient_structure* gs,
+            struct ad_variable a, double b) {
+        struct ad_variable ret = {.value = (ad_value_t) (pow(a.value, b)), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            ret.id = ad_next_id(gs);
+            double inv = b * pow(a.value, b - (1.0));
+            //            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, inv, a, (b - 1.0) * inv / a.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_pow_dv(struct ad_gradient_structure* gs,
+            double a, struct ad_variable b) {
+        struct ad_variable ret = {.value = (ad_value_t) (pow(a, b.value)), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, log(a) * ret.value, b, log(a) * log(a) * ret.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_sqrt(struct ad_gradient_structure* gs, struct ad_variable v) {
+        struct ad_variable ret = {.value = sqrt(v.value), .id = 0};
+
+        if (gs->recording == 1) {
+            int current = ad_next_slot(gs);
+            int var_id = ad_next_id(gs);
+            double inv = .5 / ret.value;
+            ret.id = var_id;
+            //barrier(CLK_LOCAL_MEM_FENCE);
+            ad_record_unary_op(gs, current, &ret, inv, v, -0.5 * inv / v.value);
+        }
+        return ret;
+    }
+
+    inline const struct ad_variable ad_dot(struct ad_gradient_structure* gs, int n, const double* weights, const struct ad_variable* args);
+
+    /**
+     * Records a variable with the given value and partial derivatives 
+     * dx[i] w.r.t. args[i], for fused operations of any number of 
+     * arguments. This is a single entry: with AD_CSR_TAPE of exactly n 
+     * pairs, otherwise spread over AD_NARY_OPERATIONS(n) slots, see 
+     * ad_record_nary. An entry has to fit in a chunk of a segmented tape, 
+     * more arguments are summed in parts first, see ad_dot. With 
+     * AD_HESSIAN_VECTOR dx is taken to be constant along the direction.
+     * 
+     * @param gs
+     * @param value
+     * @param n - number of arguments, at least 1.
+     * @param dx
+     * @param args
+     * @return 
+     */
+    inline const struct ad_variable ad_nary(struct ad_gradient_structure* gs, double value, int n, const double* dx, const struct ad_variable* args) {
+        struct ad_variable ret = {.value = (ad_value_t) value, .id = 0};
+
+        if (gs->recording == 1 && gs->chunk != NULL && n > gs->pair_capacity) {
+            //larger than a segment, recorded in parts by ad_dot
+            ret = ad_dot(gs, n, dx, args);
+            ret.value = (ad_value_t) value;
+            return ret;
+        }
+        if (gs->recording == 1) {
+#ifdef AD_CSR_TAPE
+            int current = ad_next_slot(gs);
+            ret.id = ad_next_id(gs);
+            int p = ad_tape_pairs(gs, current, n, &current);
+            for (int i = 0; i < n; i++) {
+                gs->coeff_dx[p + i] = dx[i];
+                gs->coeff_id[p + i] = args[i].id;
+            }
+            AD_SET_ENTRY_ID(gs, current, ret.id);
+            gs->entry_size[current] = n;
+            gs->entry_offset[current] = p;
+#else
+            int current = ad_next_slots(gs, AD_NARY_OPERATIONS(n));
+            ret.id = ad_next_nary_id(gs, n);
+            ad_record_nary(gs, current, ret.id, n, dx, args);
+#endif
+#ifdef AD_HESSIAN_VECTOR
+            ret.tangent = 0.0;
+            for (int i = 0; i < n; i++) {
+                ret.tangent += dx[i] * args[i].tangent;
+            }
+#endif
+        }
+        return ret;
+    }
+
+    /**
+     * Sum of weights[i] * args[i], recorded like ad_nary as a single 
+     * entry, on a segmented tape as one per pair_capacity arguments and 
+     * one for their sum. The value is a single vectorizable loop, use 
+     * this instead of accumulating with ad_plus_eq_v. See ad_dot_reduce in 
+     * ad.cl for the device version.
+     * 
+     * @param gs
+     * @param n - number of arguments, at least 1.
+     * @param weights - the partial derivative w.r.t. every argument, NULL 
+     * for all 1.
+     * @param args
+     * @return 
+     */
+    inline const struct ad_variable ad_dot(struct ad_gradient_structure* gs, int n, const double* weights, const struct ad_variable* args) {
+        if (gs->recording == 1 && gs->chunk != NULL && n > gs->pair_capacity) {
+            //an entry has to fit in one segment, the parts are summed first
+            int most = gs->pair_capacity;
+            int parts = (n + most - 1) / most;
+            struct ad_variable* partial = (struct ad_variable*) malloc(parts * sizeof (struct ad_variable));
+            if (partial == NULL) {
+                ad_fatal("out of memory for partial sums");
+            }
+            for (int k = 0; k < parts; k++) {
+                int first = k * most;
+                partial[k] = ad_dot(gs, n - first < most ? n - first : most, weights ? weights + first : NULL, args + first);
+            }
+            struct ad_variable ret = ad_dot(gs, parts, NULL, partial);
+            free(partial);
+            return ret;
+        }
+
+        struct ad_variable ret = {.value = 0.0, .id = 0};
+        double value = 0.0;
+        if (weights) {
+#ifdef _OPENMP
+#pragma omp simd reduction(+:value)
+#endif
+            for (int i = 0; i < n; i++) {
+                value += weights[i] * args[i].value;
+            }
+        } else {
+#ifdef _OPENMP
+#pragma omp simd reduction(+:value)
+#endif
+            for (int i = 0; i < n; i++) {
+                value += args[i].value;
+            }
+        }
+        ret.value = value;
+
+        if (gs->recording == 1) {
+#ifdef AD_CSR_TAPE
+            int current = ad_next_slot(gs);
+            ret.id = ad_next_id(gs);
+            int p = ad_tape_pairs(gs, current, n, &current);
+            for (int i = 0; i < n; i++) {
+                gs->coeff_dx[p + i] = weights ? weights[i] : 1.0;
+                gs->coeff_id[p + i] = args[i].id;
+            }
+            AD_SET_ENTRY_ID(gs, current, ret.id);
+            gs->entry_size[current] = n;
+            gs->entry_offset[current] = p;
+#else
+            int current = ad_next_slots(gs, AD_NARY_OPERATIONS(n));
+            ret.id = ad_next_nary_id(gs, n);
+            ad_record_nary(gs, current, ret.id, n, weights, args);
+#endif
+#ifdef AD_HESSIAN_VECTOR
+            ret.tangent = 0.0;
+            for (int i = 0; i < n; i++) {
+                ret.tangent += (weights ? weights[i] : 1.0) * args[i].tangent;
+            }
+#endif
+        }
+        return ret;
+    }
+
+    /**
+     * Sum of args[0..n), see ad_dot.
+     * 
+     * @param gs
+     * @param n - number of arguments, at least 1.
+     * @param args
+     * @return 
+     */
+    inline const struct ad_variable ad_sum(struct ad_gradient_structure* gs, int n, const struct ad_variable* args) {
+        return ad_dot(gs, n, NULL, args);
+    }
+
+    /**
+     * Allocates a zeroed tape of size entries, see ad_tape_bind.
+     * @param size
+     * @return 
+     */
+    struct ad_entry* create_entries(int size) {
+        struct ad_entry* e = (struct ad_entry*) calloc(1, ad_tape_bytes(size));
+        return e;
+
+    }
+
+    /**
+     * Reverse sweep over the tape of gs, seeding the adjoint of the last 
+     * recorded variable with 1. gradient holds gs.current_variable_id + 1 
+     * adjoints and must be zero.
+     * @param gs
+     * @param gradient
+     * @return the smallest id whose adjoint was written.
+     */
+    inline int ad_reverse_sweep(struct ad_gradient_structure& gs, double* gradient) {
+        int low = gs.current_variable_id + 1;
+        int j = gs.stack_current - 1;
+        if (j >= 0) {
+            low = ad_entry_id(&gs, ad_tape_slot(&gs, j));
+            gradient[low] = 1.0;
+        }
+
+        //walk the segments back to front, local is relative to the bound one
+        while (j >= 0) {
+            int local = ad_tape_slot(&gs, j);
+            j -= local + 1;
+#ifdef AD_IMPLICIT_ID
+            //empty slots are independent variables and keep their adjoint
+            double* adjoint = gradient + ad_id_offset(&gs) + gs.segment_base;
+            for (; local >= 0; local--) {
+                int n = ad_entry_size(&gs, local);
+                if (n > 0) {
+                    double w = adjoint[local];
+                    adjoint[local] = 0.0;
+                    for (int i = 0; i < n; i++) {
+                        int id = ad_entry_coeff_id(&gs, local, i);
+                        low = id < low ? id : low;
+                        gradient[id] += w * ad_entry_dx(&gs, local, i);
+                    }
+                }
+            }
+#else
+            //empty slots are unused or hold independent variables
+            for (; local >= 0; local--) {
+                int n = ad_entry_size(&gs, local);
+                if (n > 0) {
+                    int id = ad_entry_id(&gs, local);
+                    double w = gradient[id];
+                    gradient[id] = 0.0;
+                    for (int i = 0; i < n; i++) {
+                        id = ad_entry_coeff_id(&gs, local, i);
+                        low = id < low ? id : low;
+                        gradient[id] += w * ad_entry_dx(&gs, local, i);
+                    }
+                }
+            }
+#endif
+        }
+        return low;
+    }
+
+#ifdef AD_HESSIAN_VECTOR
+
+    /**
+     * Same as ad_reverse_sweep, also accumulating the tangents of the 
+     * adjoints: for every pair the tangent of the argument's adjoint gets 
+     * t * dx + w * ddx, where w and t are the adjoint of the result and its 
+     * tangent. The tangents of the independent variables end up as H·v. 
+     * Not parallel, tangent holds as many values as gradient and must be 
+     * zero as well.
+     * @param gs
+     * @param gradient
+     * @param tangent
+     * @return the smallest id whose adjoint was written.
+     */
+    inline int ad_hessian_vector_sweep(struct ad_gradient_structure& gs, double* gradient, double* tangent) {
+        int low = gs.current_variable_id + 1;
+        int j = gs.stack_current - 1;
+        if (j >= 0) {
+            low = ad_entry_id(&gs, ad_tape_slot(&gs, j));
+            gradient[low] = 1.0;
+        }
+
+        while (j >= 0) {
+            int local = ad_tape_slot(&gs, j);
+            j -= local + 1;
+            for (; local >= 0; local--) {
+                int n = ad_entry_size(&gs, local);
+                if (n > 0) {
+                    int id = ad_entry_id(&gs, local);
+                    double w = gradient[id];
+                    double t = tangent[id];
+                    gradient[id] = 0.0;
+                    tangent[id] = 0.0;
+                    for (int i = 0; i < n; i++) {
+                        id = ad_entry_coeff_id(&gs, local, i);
+                        double dx = ad_entry_dx(&gs, local, i);
+                        low = id < low ? id : low;
+                        gradient[id] += w * dx;
+                        tangent[id] += t * dx + w * ad_entry_ddx(&gs, local, i);
+                    }
+                }
+            }
+        }
+        return low;
+    }
+#endif
+
+    /**
+     * Returns the workspace of gs, creating an empty one on first use.
+     * @param gs
+     * @return 
+     */
+    inline struct ad_gradient_workspace* ad_workspace(struct ad_gradient_structure* gs) {
+        if (gs->workspace == NULL) {
+            gs->workspace = (struct ad_gradient_workspace*) calloc(1, sizeof (struct ad_gradient_workspace));
+            if (gs->workspace == NULL) {
+                ad_fatal("out of memory for gradient workspace");
+            }
+        }
+        return gs->workspace;
+    }
+
+    inline void ad_sweep_push(struct ad_sweep_block* b, int id, double adjoint) {
+        if (b->record_count == b->record_capacity) {
+            b->record_capacity = b->record_capacity ? 2 * b->record_capacity : 1024;
+            b->records = (struct ad_sweep_record*) realloc(b->records, b->record_capacity * sizeof (struct ad_sweep_record));
+            if (b->records == NULL) {
+                ad_fatal("out of memory for gradient workspace");
+            }
+        }
+        b->records[b->record_count].id = id;
+        b->records[b->record_count].adjoint = adjoint;
+        b->record_count++;
+    }
+
+    /**
+     * Reverse sweep of block k. Adjoints of variables the block produces 
+     * are updated in place, those of the first inputs ids go to the 
+     * block's own row of input adjoints and all others are recorded and 
+     * merged by the caller.
+     * @param gs
+     * @param gradient
+     * @param owner - block producing each id, -1 if none.
+     * @param blocks
+     * @param k
+     * @param inputs
+     * @param input_adjoint - AD_SWEEP_BLOCKS rows of inputs adjoints.
+     */
+    inline void ad_sweep_block(const struct ad_gradient_structure& gs, double* gradient, const int* owner,
+            struct ad_sweep_block* blocks, int k, int inputs, double* input_adjoint) {
+        struct ad_sweep_block* b = &blocks[k];
+        struct ad_gradient_structure view = gs;
+        double* row = input_adjoint + (size_t) k * inputs;
+        int low = gs.current_variable_id + 1;
+        for (int j = b->end - 1; j >= b->begin; j--) {
+            int local = ad_tape_view_slot(&view, j);
+            int n = ad_entry_size(&view, local);
+            if (n > 0) {
+                int id = ad_entry_id(&view, local);
+                double w = gradient[id];
+                gradient[id] = 0.0;
+                for (int i = 0; i < n; i++) {
+                    int c = ad_entry_coeff_id(&view, local, i);
+                    double adjoint = w * ad_entry_dx(&view, local, i);
+                    low = c < low ? c : low;
+                    if (owner[c] == k) {
+                        gradient[c] += adjoint;
+                    } else if (c < inputs) {
+                        row[c] += adjoint;
+                    } else {
+                        ad_sweep_push(b, c, adjoint);
+                    }
+                }
+            }
+        }
+        b->low = low;
+    }
+
+    /**
+     * Same as ad_reverse_sweep, on the OpenMP threads. The tape is cut in 
+     * AD_SWEEP_BLOCKS blocks, where possible at an entry that only uses 
+     * variables from before its block, so the independent subgraphs of a 
+     * kernel launch end up in blocks that do not use each other's 
+     * results. A block is swept once every block using its results has 
+     * been swept, blocks of the same level run in parallel. Adjoints a 
+     * block does not own are added in block order after each level, and 
+     * those of the independent variables from per block rows at the end, 
+     * so the result does not depend on the number of threads.
+     * @param gs
+     * @param gradient
+     * @return the smallest id whose adjoint was written, -1 if the tape 
+     * can not be split and nothing was done.
+     */
+    inline int ad_parallel_reverse_sweep(struct ad_gradient_structure& gs, double* gradient) {
+        struct ad_gradient_workspace* ws = ad_workspace(&gs);
+        int n = gs.stack_current;
+        int size = gs.current_variable_id + 1;
+        int length = n / AD_SWEEP_BLOCKS;
+        if (length == 0) {
+            return -1;
+        }
+        if (ws->blocks == NULL) {
+            ws->blocks = (struct ad_sweep_block*) calloc(AD_SWEEP_BLOCKS, sizeof (struct ad_sweep_block));
+        }
+        if (size > ws->owner_capacity) {
+            free(ws->owner);
+            ws->owner = (int*) malloc((size_t) size * sizeof (int));
+            ws->owner_capacity = size;
+        }
+        if (ws->blocks == NULL || ws->owner == NULL) {
+            ad_fatal("out of memory for gradient workspace");
+        }
+        struct ad_sweep_block* blocks = ws->blocks;
+        int* owner = ws->owner;
+
+        //move each cut up to an entry using nothing produced in the block before it
+        struct ad_gradient_structure view = gs;
+        blocks[0].begin = 0;
+        for (int k = 1; k < AD_SWEEP_BLOCKS; k++) {
+            int first = size;
+            for (int j = blocks[k - 1].begin; j < k * length; j++) {
+                int local = ad_tape_view_slot(&view, j);
+                if (ad_entry_size(&view, local) > 0) {
+                    first = ad_entry_id(&view, local);
+                    break;
+                }
+            }
+            int cut = k * length;
+            for (int j = cut; j < k * length + length / 2; j++) {
+                int local = ad_tape_view_slot(&view, j);
+                int m = ad_entry_size(&view, local);
+                int i = 0;
+                while (i < m && ad_entry_coeff_id(&view, local, i) < first) {
+                    i++;
+                }
+                if (m > 0 && i == m) {
+                    cut = j;
+                    break;
+                }
+            }
+            blocks[k].begin = cut;
+            blocks[k - 1].end = cut;
+        }
+        blocks[AD_SWEEP_BLOCKS - 1].end = n;
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < size; i++) {
+            owner[i] = -1;
+        }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (int k = 0; k < AD_SWEEP_BLOCKS; k++) {
+            struct ad_gradient_structure v = gs;
+            int first = size;
+            for (int j = blocks[k].begin; j < blocks[k].end; j++) {
+                int local = ad_tape_view_slot(&v, j);
+                if (ad_entry_size(&v, local) > 0) {
+                    int id = ad_entry_id(&v, local);
+                    owner[id] = k;
+                    first = id < first ? id : first;
+                }
+            }
+            blocks[k].first = first;
+        }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (int k = 0; k < AD_SWEEP_BLOCKS; k++) {
+            struct ad_gradient_structure v = gs;
+            uint64_t producers = 0;
+            for (int j = blocks[k].begin; j < blocks[k].end; j++) {
+                int local = ad_tape_view_slot(&v, j);
+                int m = ad_entry_size(&v, local);
+                for (int i = 0; i < m; i++) {
+                    int o = owner[ad_entry_coeff_id(&v, local, i)];
+                    if (o >= 0 && o != k) {
+                        producers |= (uint64_t) 1 << o;
+                    }
+                }
+            }
+            blocks[k].producers = producers;
+            blocks[k].level = 0;
+            blocks[k].record_count = 0;
+        }
+
+        //levels, a block using results of a later block can not be scheduled
+        int levels = 1;
+        int inputs = size;
+        for (int k = AD_SWEEP_BLOCKS - 1; k >= 0; k--) {
+            if (blocks[k].producers >> k) {
+                return -1;
+            }
+            for (int o = 0; o < k; o++) {
+                if (((blocks[k].producers >> o) & 1) && blocks[o].level <= blocks[k].level) {
+                    blocks[o].level = blocks[k].level + 1;
+                    levels = blocks[o].level + 1 > levels ? blocks[o].level + 1 : levels;
+                }
+            }
+            inputs = blocks[k].first < inputs ? blocks[k].first : inputs;
+        }
+
+        //ids below the first recorded variable get a row per block if it is cheap
+        if ((size_t) inputs * AD_SWEEP_BLOCKS > (size_t) n) {
+            inputs = 0;
+        }
+        if ((size_t) inputs * AD_SWEEP_BLOCKS > ws->inputs_capacity) {
+            free(ws->inputs);
+            ws->inputs_capacity = (size_t) inputs * AD_SWEEP_BLOCKS;
+            ws->inputs = (double*) calloc(ws->inputs_capacity, sizeof (double));
+            if (ws->inputs == NULL) {
+                ad_fatal("out of memory for gradient workspace");
+            }
+        }
+
+        int low = ad_entry_id(&view, ad_tape_view_slot(&view, n - 1));
+        gradient[low] = 1.0;
+
+        for (int level = 0; level < levels; level++) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+            for (int k = 0; k < AD_SWEEP_BLOCKS; k++) {
+                if (blocks[k].level == level) {
+                    ad_sweep_block(gs, gradient, owner, blocks, k, inputs, ws->inputs);
+                }
+            }
+            for (int k = 0; k < AD_SWEEP_BLOCKS; k++) {
+                struct ad_sweep_block* b = &blocks[k];
+                if (b->level == level) {
+                    for (int r = 0; r < b->record_count; r++) {
+                        gradient[b->records[r].id] += b->records[r].adjoint;
+                    }
+                    b->record_count = 0;
+                    low = b->low < low ? b->low : low;
+                }
+            }
+        }
+
+        for (int k = 0; k < AD_SWEEP_BLOCKS; k++) {
+            double* row = ws->inputs + (size_t) k * inputs;
+            for (int i = 0; i < inputs; i++) {
+                gradient[i] += row[i];
+                row[i] = 0.0;
+            }
+        }
+        return low;
+    }
+
+    /**
+     * Sweeps with ad_parallel_reverse_sweep if compiled with OpenMP and 
+     * the tape has at least AD_PARALLEL_SWEEP_MIN entries, otherwise with 
+     * ad_reverse_sweep.
+     * @param gs
+     * @param gradient
+     * @return the smallest id whose adjoint was written.
+     */
+    inline int ad_gradient_sweep(struct ad_gradient_structure& gs, double* gradient) {
+#ifdef _OPENMP
+        if (gs.stack_current >= AD_PARALLEL_SWEEP_MIN && omp_get_max_threads() > 1) {
+            int low = ad_parallel_reverse_sweep(gs, gradient);
+            if (low >= 0) {
+                return low;
+            }
+        }
+#endif
+        return ad_reverse_sweep(gs, gradient);
+    }
+
+    /**
+     * Computes the gradient of the last recorded variable in a new 
+     * buffer the caller has to free. Prefer compute_gradient_into when 
+     * the gradient is computed repeatedly.
+     * @param gs
+     * @param size - set to the number of adjoints.
+     * @return the adjoints indexed by variable id, NULL if gs is not 
+     * recording.
+     */
+    double* compute_gradient(struct ad_gradient_structure& gs, int& size) {
+        double* gradient = NULL;
+        if (gs.recording == 1) {
+            ad_thread_flush(&gs);
+            size = gs.current_variable_id + 1;
+            gradient = (double*) calloc(size, sizeof (double));
+            ad_gradient_sweep(gs, gradient);
+        }
+        return gradient;
+    }
+
+    /**
+     * Returns the workspace of gs with room for size adjoints, all zero. 
+     * It is created on first use and only grows. The previous adjoints 
+     * are cleared over the range the last sweep touched, not the whole 
+     * buffer.
+     * @param gs
+     * @param size
+     * @return 
+     */
+    inline struct ad_gradient_workspace* ad_workspace_reserve(struct ad_gradient_structure* gs, int size) {
+        struct ad_gradient_workspace* ws = ad_workspace(gs);
+        if (size > ws->capacity) {
+            int capacity = 2 * ws->capacity > size ? 2 * ws->capacity : size;
+            free(ws->adjoint);
+            ws->adjoint = (double*) calloc(capacity, sizeof (double));
+            if (ws->adjoint == NULL) {
+                ad_fatal("out of memory for gradient workspace");
+            }
+#ifdef AD_HESSIAN_VECTOR
+            free(ws->tangent);
+            ws->tangent = (double*) calloc(capacity, sizeof (double));
+            if (ws->tangent == NULL) {
+                ad_fatal("out of memory for gradient workspace");
+            }
+#endif
+            ws->capacity = capacity;
+        } else if (ws->low < ws->high) {
+            memset(ws->adjoint + ws->low, 0, (size_t) (ws->high - ws->low) * sizeof (double));
+#ifdef AD_HESSIAN_VECTOR
+            memset(ws->tangent + ws->low, 0, (size_t) (ws->high - ws->low) * sizeof (double));
+#endif
+        }
+        ws->low = 0;
+        ws->high = 0;
+        return ws;
+    }
+
+    /**
+     * Frees the workspace of gs, see compute_gradient_into.
+     * @param gs
+     */
+    inline void ad_workspace_free(struct ad_gradient_structure* gs) {
+        struct ad_gradient_workspace* ws = gs->workspace;
+        if (ws != NULL) {
+            if (ws->blocks != NULL) {
+                for (int k = 0; k < AD_SWEEP_BLOCKS; k++) {
+                    free(ws->blocks[k].records);
+                }
+                free(ws->blocks);
+            }
+            free(ws->adjoint);
+            free(ws->tangent);
+            free(ws->owner);
+            free(ws->inputs);
+            free(ws);
+            gs->workspace = NULL;
+        }
+    }
+
+    /**
+     * Same as compute_gradient, but the adjoints are kept in the workspace 
+     * of gs and reused by the next call, so nothing is allocated once the 
+     * workspace is large enough. The returned buffer is owned by gs and 
+     * valid until the next call or ad_workspace_free. With 
+     * AD_HESSIAN_VECTOR the sweep is ad_hessian_vector_sweep, see 
+     * ad_hessian_vector.
+     * @param gs
+     * @param size - set to the number of adjoints.
+     * @return the adjoints indexed by variable id, NULL if gs is not 
+     * recording.
+     */
+    const double* compute_gradient_into(struct ad_gradient_structure& gs, int& size) {
+        if (gs.recording != 1) {
+            return NULL;
+        }
+        ad_thread_flush(&gs);
+        size = gs.current_variable_id + 1;
+        struct ad_gradient_workspace* ws = ad_workspace_reserve(&gs, size);
+#ifdef AD_HESSIAN_VECTOR
+        ws->low = ad_hessian_vector_sweep(gs, ws->adjoint, ws->tangent);
+#else
+        ws->low = ad_gradient_sweep(gs, ws->adjoint);
+#endif
+        ws->high = size;
+        return ws->adjoint;
+    }
+
+#ifdef AD_HESSIAN_VECTOR
+
+    /**
+     * H·v from the last compute_gradient_into, indexed by variable id like 
+     * the gradient: the product of the Hessian of the last recorded 
+     * variable with the tangents the independent variables had while 
+     * recording. Owned by gs and valid until the next call of 
+     * compute_gradient_into or ad_workspace_free.
+     * @param gs
+     * @return 
+     */
+    inline const double* ad_hessian_vector(const struct ad_gradient_structure& gs) {
+        return gs.workspace != NULL ? gs.workspace->tangent : NULL;
+    }
+#endif
+
+#ifdef AD_SECOND_ORDER
+
+    /**
+     * Lower triangle of a sparse symmetric matrix in compressed sparse row 
+     * form: row i holds the columns column[row_offset[i]] to 
+     * column[row_offset[i + 1] - 1], in increasing order and at most i, 
+     * with their values. See compute_sparse_hessian.
+     */
+    struct ad_sparse_hessian {
+        int n;
+        int nnz;
+        int* row_offset;
+        int* column;
+        double* value;
+    };
+
+    /**
+     * Weight of the edge to id in the sparse matrix of edge pushing.
+     */
+    struct ad_hessian_edge {
+        int id;
+        double weight;
+    };
+
+    /**
+     * Edges of one variable, the diagonal is an edge to itself.
+     */
+    struct ad_hessian_row {
+        struct ad_hessian_edge* edges;
+        int size;
+        int capacity;
+    };
+
+    inline void ad_hessian_row_add(struct ad_hessian_row* row, int id, double weight) {
+        for (int i = 0; i < row->size; i++) {
+            if (row->edges[i].id == id) {
+                row->edges[i].weight += weight;
+                return;
+            }
+        }
+        if (row->size == row->capacity) {
+            row->capacity = row->capacity ? 2 * row->capacity : 4;
+            row->edges = (struct ad_hessian_edge*) realloc(row->edges, row->capacity * sizeof (struct ad_hessian_edge));
+            if (row->edges == NULL) {
+                ad_fatal("out of memory for sparse hessian");
+            }
+        }
+        row->edges[row->size].id = id;
+        row->edges[row->size].weight = weight;
+        row->size++;
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = a, .id = b.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    inline void ad_hessian_row_remove(struct ad_hessian_row* row, int id) {
+        for (int i = 0; i < row->size; i++) {
+            if (row->edges[i].id == id) {
+                row->edges[i] = row->edges[--row->size];
+                return;
+            }
         }
+    }
 
-        return ret;
+    /**
+     * Adds weight to the symmetric entries (u, v) and (v, u).
+     */
+    inline void ad_hessian_add(struct ad_hessian_row* rows, int u, int v, double weight) {
+        if (weight != 0.0) {
+            ad_hessian_row_add(&rows[u], v, weight);
+            if (u != v) {
+                ad_hessian_row_add(&rows[v], u, weight);
+            }
+        }
     }
 
     /**
-     * Divides variable a by variable b.If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
-     * 
+     * Edge pushing (Gower and Mello) over the tape slots [0, end), creating 
+     * edges only for the slots [begin, end). Every entry first pushes the 
+     * edges of its result down to its arguments, then adds its second 
+     * order partials times the adjoint of its result. Since this is linear 
+     * in the created edges, disjoint slot ranges can be pushed separately 
+     * and the rows summed. gs is only read.
      * @param gs
-     * @param a
-     * @param b
-     * @return 
+     * @param adjoint - of every id, not cleared by the sweep.
+     * @param begin
+     * @param end
+     * @param rows - one per id, left with the edges of the variables that 
+     * have no entry, i.e. the independent variables.
      */
-    inline const struct ad_variable ad_divide(struct ad_gradient_structure* gs, struct ad_variable a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a.value / b.value, .id = 0};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = 1.0 / b.value;
-            e.coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-            e.coeff[1] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
-            e.size = 2;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    inline void ad_edge_push(const struct ad_gradient_structure& gs, const double* adjoint, int begin, int end,
+            struct ad_hessian_row* rows) {
+        struct ad_gradient_structure view = gs;
+        for (int j = end - 1; j >= 0; j--) {
+            int local = ad_tape_view_slot(&view, j);
+            const struct ad_entry* e = &view.gradient_stack[local];
+            int n = e->size;
+            if (n == 0) {
+                continue;
+            }
+            int r = ad_entry_id(&view, local);
+            struct ad_hessian_row* row = &rows[r];
+
+            //pushing
+            for (int k = 0; k < row->size; k++) {
+                int p = row->edges[k].id;
+                double w = row->edges[k].weight;
+                if (p == r) {
+                    for (int a = 0; a < n; a++) {
+                        int ia = ad_entry_coeff_id(&view, local, a);
+                        double da = ad_entry_dx(&view, local, a);
+                        for (int b = a; b < n; b++) {
+                            int ib = ad_entry_coeff_id(&view, local, b);
+                            double v = da * ad_entry_dx(&view, local, b) * w;
+                            if (a != b && ia == ib) {
+                                v *= 2.0;
+                            }
+                            ad_hessian_add(rows, ia, ib, v);
+                        }
+                    }
+                } else {
+                    ad_hessian_row_remove(&rows[p], r);
+                    for (int a = 0; a < n; a++) {
+                        int c = ad_entry_coeff_id(&view, local, a);
+                        ad_hessian_add(rows, p, c, (c == p ? 2.0 : 1.0) * ad_entry_dx(&view, local, a) * w);
+                    }
+                }
+            }
+            row->size = 0;
+
+            //creating, entries of more coefficients than fit a slot are linear
+            double w = adjoint[r];
+            if (j >= begin && w != 0.0 && n <= MAX_VARIABLE_IN_EXPESSION) {
+                for (int a = 0; a < n; a++) {
+                    for (int b = a; b < n; b++) {
+                        double v = w * e->hessian[AD_HESSIAN_INDEX(a, b)];
+                        if (a != b && e->coeff[a].id == e->coeff[b].id) {
+                            v *= 2.0;
+                        }
+                        ad_hessian_add(rows, e->coeff[a].id, e->coeff[b].id, v);
+                    }
+                }
+            }
         }
+    }
 
-        return ret;
+    inline int ad_hessian_column_compare(const void* a, const void* b) {
+        return *(const int*) a - *(const int*) b;
     }
 
     /**
-     * Divides variable a by double b. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed. 
-     * @param gs
-     * @param a
-     * @param b
-     * @return 
+     * Frees the arrays of h.
+     * @param h
      */
-    inline const struct ad_variable ad_divide_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {
-        struct ad_variable ret = {.value = a.value / b, .id = gs->current_variable_id++};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = 1.0 / b;
-            e.coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline void ad_sparse_hessian_free(struct ad_sparse_hessian* h) {
+        free(h->row_offset);
+        free(h->column);
+        free(h->value);
+        h->row_offset = NULL;
+        h->column = NULL;
+        h->value = NULL;
+        h->n = 0;
+        h->nnz = 0;
     }
 
     /**
-     * Divides double a by variable b. If the gradient structure is recording, 
-     * entries will be added, otherwise the result is only computed.
+     * Sparse Hessian of the last recorded variable w.r.t. the variables 
+     * ids[0..n), computed by edge pushing over a tape recorded with 
+     * AD_SECOND_ORDER. Only the nonzeros are ever stored, so the cost 
+     * follows the sparsity of the Hessian rather than n. With OpenMP and 
+     * at least AD_PARALLEL_SWEEP_MIN entries the tape is cut in one slot 
+     * range per thread, each thread pushes the edges created in its range 
+     * down to the independent variables and the results are summed; every 
+     * thread then needs its own row per id.
      * @param gs
-     * @param a
-     * @param b
-     * @return 
+     * @param n
+     * @param ids - the independent variables, row and column i is ids[i].
+     * @param h - set to the lower triangle, free with 
+     * ad_sparse_hessian_free.
+     * @return the number of nonzeros in the lower triangle, -1 if gs is 
+     * not recording.
      */
-    inline const struct ad_variable ad_divide_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {
-        struct ad_variable ret = {.value = a / b.value, .id = 0};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = 1.0 / b.value;
-            e.coeff[0] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-
+    int compute_sparse_hessian(struct ad_gradient_structure& gs, int n, const int* ids, struct ad_sparse_hessian* h) {
+        if (gs.recording != 1) {
+            return -1;
+        }
+        ad_thread_flush(&gs);
+        int size = gs.current_variable_id + 1;
+        int entries = gs.stack_current;
+
+        //adjoints of all ids, unlike ad_reverse_sweep none is cleared
+        double* adjoint = (double*) calloc(size, sizeof (double));
+        int* index = (int*) malloc((size_t) size * sizeof (int));
+        if (adjoint == NULL || index == NULL) {
+            ad_fatal("out of memory for sparse hessian");
+        }
+        struct ad_gradient_structure view = gs;
+        if (entries > 0) {
+            adjoint[ad_entry_id(&view, ad_tape_view_slot(&view, entries - 1))] = 1.0;
+        }
+        for (int j = entries - 1; j >= 0; j--) {
+            int local = ad_tape_view_slot(&view, j);
+            const struct ad_entry* e = &view.gradient_stack[local];
+            if (e->size > 0) {
+                double w = adjoint[ad_entry_id(&view, local)];
+                for (int i = 0; i < e->size; i++) {
+                    adjoint[ad_entry_coeff_id(&view, local, i)] += w * ad_entry_dx(&view, local, i);
+                }
+            }
         }
-        return ret;
-    }
 
-    inline const struct ad_variable ad_cos(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = log(v.value), .id = 0};
+        int parts = 1;
+#ifdef _OPENMP
+        if (entries >= AD_PARALLEL_SWEEP_MIN) {
+            parts = omp_get_max_threads();
+        }
+#endif
+        struct ad_hessian_row** rows = (struct ad_hessian_row**) malloc(parts * sizeof (struct ad_hessian_row*));
+        if (rows == NULL) {
+            ad_fatal("out of memory for sparse hessian");
+        }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            //            double inv = 1.0 / v.value;
-            e.coeff[0] = (struct ad_pair){.dx = -1.0 * sin(v.value), .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) if (parts > 1)
+#endif
+        for (int t = 0; t < parts; t++) {
+            int begin = (int) ((int64_t) entries * t / parts);
+            int end = (int) ((int64_t) entries * (t + 1) / parts);
+            rows[t] = (struct ad_hessian_row*) calloc(size, sizeof (struct ad_hessian_row));
+            if (rows[t] == NULL) {
+                ad_fatal("out of memory for sparse hessian");
+            }
+            ad_edge_push(gs, adjoint, begin, end, rows[t]);
         }
-        return ret;
-    }
 
-    inline const struct ad_variable ad_sin(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = sin(v.value), .id = 0};
+        //gather the lower triangle, summing the parts in order
+        for (int i = 0; i < size; i++) {
+            index[i] = -1;
+        }
+        for (int i = 0; i < n; i++) {
+            index[ids[i]] = i;
+        }
+        double* accumulator = (double*) malloc((n > 0 ? n : 1) * sizeof (double));
+        int* columns = (int*) malloc((n > 0 ? n : 1) * sizeof (int));
+        int* mark = (int*) malloc((n > 0 ? n : 1) * sizeof (int));
+        h->n = n;
+        h->nnz = 0;
+        h->row_offset = (int*) malloc((n + 1) * sizeof (int));
+        int capacity = n > 0 ? n : 1;
+        h->column = (int*) malloc(capacity * sizeof (int));
+        h->value = (double*) malloc(capacity * sizeof (double));
+        if (accumulator == NULL || columns == NULL || mark == NULL || h->row_offset == NULL || h->column == NULL || h->value == NULL) {
+            ad_fatal("out of memory for sparse hessian");
+        }
+        for (int i = 0; i < n; i++) {
+            mark[i] = -1;
+        }
+        for (int i = 0; i < n; i++) {
+            int count = 0;
+            for (int t = 0; t < parts; t++) {
+                const struct ad_hessian_row* row = &rows[t][ids[i]];
+                for (int k = 0; k < row->size; k++) {
+                    int c = index[row->edges[k].id];
+                    if (c >= 0 && c <= i) {
+                        if (mark[c] != i) {
+                            mark[c] = i;
+                            accumulator[c] = 0.0;
+                            columns[count++] = c;
+                        }
+                        accumulator[c] += row->edges[k].weight;
+                    }
+                }
+            }
+            qsort(columns, count, sizeof (int), ad_hessian_column_compare);
+            if (h->nnz + count > capacity) {
+                capacity = 2 * capacity > h->nnz + count ? 2 * capacity : h->nnz + count;
+                h->column = (int*) realloc(h->column, capacity * sizeof (int));
+                h->value = (double*) realloc(h->value, capacity * sizeof (double));
+                if (h->column == NULL || h->value == NULL) {
+                    ad_fatal("out of memory for sparse hessian");
+                }
+            }
+            h->row_offset[i] = h->nnz;
+            for (int k = 0; k < count; k++) {
+                h->column[h->nnz] = columns[k];
+                h->value[h->nnz++] = accumulator[columns[k]];
+            }
+        }
+        h->row_offset[n] = h->nnz;
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            //            double inv = 1.0 / v.value;
-            e.coeff[0] = (struct ad_pair){.dx = cos(v.value), .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+        for (int t = 0; t < parts; t++) {
+            for (int i = 0; i < size; i++) {
+                free(rows[t][i].edges);
+            }
+            free(rows[t]);
         }
-        return ret;
+        free(rows);
+        free(mark);
+        free(columns);
+        free(accumulator);
+        free(index);
+        free(adjoint);
+        return h->nnz;
     }
+#endif
 
-    inline const struct ad_variable ad_tan(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = tan(v.value), .id = 0};
+    /**
+     * Forward mode, see ad_dual in ad.cl. dx holds the partial 
+     * derivatives w.r.t. AD_DUAL_WIDTH independent variables and is 
+     * aligned like the real_t vector it is on the device, so ad_duals can 
+     * be read back from device buffers.
+     */
+    struct ad_dual {
+        double value;
+        double dx[AD_DUAL_WIDTH] __attribute__((aligned(AD_DUAL_WIDTH * sizeof (double))));
+    };
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double temp = 1.0 / cos(v.value);
-            e.coeff[0] = (struct ad_pair){.dx = temp*temp, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    /**
+     * The independent variable i of AD_DUAL_WIDTH with the given value.
+     * @param value
+     * @param i
+     * @return 
+     */
+    inline struct ad_dual ad_dual_variable(double value, int i) {
+        struct ad_dual ret;
+        ret.value = value;
+        for (int k = 0; k < AD_DUAL_WIDTH; k++) {
+            ret.dx[k] = k == i ? 1.0 : 0.0;
         }
         return ret;
     }
 
-    inline const struct ad_variable ad_acos(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = acos(v.value), .id = 0};
+    inline struct ad_dual ad_dual_constant(double value) {
+        return ad_dual_variable(value, -1);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double temp = (-1.0) /
-                    pow(((1.0) -
-                    pow(v.value, (2.0))),
-                    (0.5));
-            e.coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    /**
+     * Chain rule of the unary operations: the result has value and 
+     * partial derivative d w.r.t. v.
+     * @param value
+     * @param d
+     * @param v
+     * @return 
+     */
+    inline struct ad_dual ad_dual_chain(double value, double d, struct ad_dual v) {
+        struct ad_dual ret;
+        ret.value = value;
+        for (int k = 0; k < AD_DUAL_WIDTH; k++) {
+            ret.dx[k] = d * v.dx[k];
         }
         return ret;
     }
 
-    inline const struct ad_variable ad_asin(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = asin(v.value), .id = 0};
-
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double temp = (1.0) /
-                    pow(((1.0) -
-                    pow(v.value, (2.0))),
-                    (0.5));
-            e.coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
+    /**
+     * Linear combination ca * a + cb * b of the partial derivatives, with 
+     * the given value.
+     * @param value
+     * @param ca
+     * @param a
+     * @param cb
+     * @param b
+     * @return 
+     */
+    inline struct ad_dual ad_dual_chain2(double value, double ca, struct ad_dual a, double cb, struct ad_dual b) {
+        struct ad_dual ret;
+        ret.value = value;
+        for (int k = 0; k < AD_DUAL_WIDTH; k++) {
+            ret.dx[k] = ca * a.dx[k] + cb * b.dx[k];
         }
         return ret;
     }
 
-    inline const struct ad_variable ad_atan(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = atan(v.value), .id = 0};
+    inline struct ad_dual ad_dual_plus(struct ad_dual a, struct ad_dual b) {
+        return ad_dual_chain2(a.value + b.value, 1.0, a, 1.0, b);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double temp = (1.0) / (v.value * v.value + (1.0));
-            e.coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_plus_vd(struct ad_dual a, double b) {
+        a.value += b;
+        return a;
     }
 
-    inline const struct ad_variable ad_cosh(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = cosh(v.value), .id = 0};
+    inline struct ad_dual ad_dual_plus_dv(double a, struct ad_dual b) {
+        b.value += a;
+        return b;
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = sinh(v.value), .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_minus(struct ad_dual a, struct ad_dual b) {
+        return ad_dual_chain2(a.value - b.value, 1.0, a, -1.0, b);
     }
 
-    inline const struct ad_variable ad_sinh(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = sinh(v.value), .id = 0};
+    inline struct ad_dual ad_dual_minus_vd(struct ad_dual a, double b) {
+        a.value -= b;
+        return a;
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = cosh(v.value), .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_minus_dv(double a, struct ad_dual b) {
+        return ad_dual_chain(a - b.value, -1.0, b);
     }
 
-    inline const struct ad_variable ad_tanh(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = tanh(v.value), .id = 0};
+    inline struct ad_dual ad_dual_times(struct ad_dual a, struct ad_dual b) {
+        return ad_dual_chain2(a.value * b.value, b.value, a, a.value, b);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double temp = (1.0 / cosh(v.value))*(1.0 / cosh(v.value));
-            e.coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_times_vd(struct ad_dual a, double b) {
+        return ad_dual_chain(a.value * b, b, a);
     }
 
-    inline const struct ad_variable ad_exp(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = exp(v.value), .id = 0};
+    inline struct ad_dual ad_dual_times_dv(double a, struct ad_dual b) {
+        return ad_dual_chain(a * b.value, a, b);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            e.coeff[0] = (struct ad_pair){.dx = ret.value, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_divide(struct ad_dual a, struct ad_dual b) {
+        double inv = 1.0 / b.value;
+        double value = a.value * inv;
+        return ad_dual_chain2(value, inv, a, -1.0 * value * inv, b);
     }
 
-    inline const struct ad_variable ad_log(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = log(v.value), .id = 0};
+    inline struct ad_dual ad_dual_divide_vd(struct ad_dual a, double b) {
+        double inv = 1.0 / b;
+        return ad_dual_chain(a.value * inv, inv, a);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = 1.0 / v.value;
-            e.coeff[0] = (struct ad_pair){.dx = 1.0 / v.value, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_divide_dv(double a, struct ad_dual b) {
+        double value = a / b.value;
+        return ad_dual_chain(value, -1.0 * value / b.value, b);
     }
 
-    inline const struct ad_variable ad_log10(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = log10(v.value), .id = 0};
+    inline struct ad_dual ad_dual_cos(struct ad_dual v) {
+        return ad_dual_chain(cos(v.value), -1.0 * sin(v.value), v);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = 1.0 / (v.value * 2.30258509299404590109361379290930926799774169921875);
-            e.coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_sin(struct ad_dual v) {
+        return ad_dual_chain(sin(v.value), cos(v.value), v);
     }
 
-    inline const struct ad_variable ad_pow(struct ad_gradient_structure* gs,
-            struct ad_variable a, struct ad_variable b) {
-        struct ad_variable ret = {.value = pow(a.value, b.value), .id = 0};
+    inline struct ad_dual ad_dual_tan(struct ad_dual v) {
+        double temp = 1.0 / cos(v.value);
+        return ad_dual_chain(tan(v.value), temp*temp, v);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = b.value * pow(a.value, b.value - (1.0));
-            e.coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-            e.coeff[1] = (struct ad_pair){.dx = log(a.value) * ret.value, .id = b.id};
-            e.size = 2;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_acos(struct ad_dual v) {
+        return ad_dual_chain(acos(v.value), -1.0 / sqrt(1.0 - v.value * v.value), v);
     }
 
-    inline const struct ad_variable ad_pow_vd(struct ad_gradient_structure* gs,
-            struct ad_variable a, double b) {
-        struct ad_variable ret = {.value = pow(a.value, b), .id = 0};
+    inline struct ad_dual ad_dual_asin(struct ad_dual v) {
+        return ad_dual_chain(asin(v.value), 1.0 / sqrt(1.0 - v.value * v.value), v);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            ret.id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = b * pow(a.value, b - (1.0));
-            e.coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};
-            e.size = 1;
-            e.id = ret.id;
-            //            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_atan(struct ad_dual v) {
+        return ad_dual_chain(atan(v.value), 1.0 / (v.value * v.value + 1.0), v);
     }
 
-    inline const struct ad_variable ad_pow_dv(struct ad_gradient_structure* gs,
-            double a, struct ad_variable b) {
-        struct ad_variable ret = {.value = pow(a, b.value), .id = 0};
+    inline struct ad_dual ad_dual_cosh(struct ad_dual v) {
+        return ad_dual_chain(cosh(v.value), sinh(v.value), v);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = b.value * pow(a, b.value - (1.0));
-            e.coeff[0] = (struct ad_pair){.dx = log(a) * ret.value, .id = b.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_sinh(struct ad_dual v) {
+        return ad_dual_chain(sinh(v.value), cosh(v.value), v);
     }
 
-    inline const struct ad_variable ad_sqrt(struct ad_gradient_structure* gs, struct ad_variable v) {
-        struct ad_variable ret = {.value = sqrt(v.value), .id = 0};
+    inline struct ad_dual ad_dual_tanh(struct ad_dual v) {
+        double temp = 1.0 / cosh(v.value);
+        return ad_dual_chain(tanh(v.value), temp*temp, v);
+    }
 
-        if (gs->recording == 1) {
-            int current = atomic_inc(gs->stack_current);
-            int var_id = atomic_inc(gs->current_variable_id);
-            /*__private*/ struct ad_entry e;
-            double inv = .5 / ret.value;
-            e.coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};
-            e.size = 1;
-            e.id = var_id;
-            ret.id = var_id;
-            //barrier(CLK_LOCAL_MEM_FENCE);
-            gs->gradient_stack[current] = e;
-        }
-        return ret;
+    inline struct ad_dual ad_dual_exp(struct ad_dual v) {
+        double value = exp(v.value);
+        return ad_dual_chain(value, value, v);
     }
 
-    struct ad_entry* create_entries(int size) {
-        struct ad_entry* e = (struct ad_entry*) malloc(size * sizeof (ad_entry));
+    inline struct ad_dual ad_dual_log(struct ad_dual v) {
+        return ad_dual_chain(log(v.value), 1.0 / v.value, v);
+    }
 
-        for (int i = 0; i < size; i++) {
-            e[i].id = 0;
-            e[i].size = 0;
-        }
+    inline struct ad_dual ad_dual_log10(struct ad_dual v) {
+        return ad_dual_chain(log10(v.value), 1.0 / (v.value * 2.30258509299404590109361379290930926799774169921875), v);
+    }
 
-        return e;
+    inline struct ad_dual ad_dual_pow(struct ad_dual a, struct ad_dual b) {
+        double value = pow(a.value, b.value);
+        return ad_dual_chain2(value, b.value * pow(a.value, b.value - 1.0), a, log(a.value) * value, b);
+    }
 
+    inline struct ad_dual ad_dual_pow_vd(struct ad_dual a, double b) {
+        return ad_dual_chain(pow(a.value, b), b * pow(a.value, b - 1.0), a);
     }
 
-    double* compute_gradient(struct ad_gradient_structure& gs, int& size) {
+    inline struct ad_dual ad_dual_pow_dv(double a, struct ad_dual b) {
+        double value = pow(a, b.value);
+        return ad_dual_chain(value, log(a) * value, b);
+    }
 
+    inline struct ad_dual ad_dual_sqrt(struct ad_dual v) {
+        double value = sqrt(v.value);
+        return ad_dual_chain(value, .5 / value, v);
+    }
 
-        double* gradient = NULL;
-        if (gs.recording == 1) {
-            gradient = (double*)malloc(sizeof (double)*(gs.current_variable_id + 1));
-            size = gs.current_variable_id + 1;
-            memset(gradient, 0, size * sizeof (double));
-            //            for (int i = 0; i < size; i++) {
-            //                gradient[i] = 0;
-            //            }
-            gradient[gs.gradient_stack[gs.stack_current - 1].id] = 1.0;
-
-            for (int j = gs.stack_current - 1; j >= 0; j--) {
-                int id = gs.gradient_stack[j].id;
-                double w = gradient[id];
-//                if (w != 0.0) {
-                    gradient[id] = 0.0;
-                    for (int i = 0; i < gs.gradient_stack[j].size; i++) {
-                        //std::cout<<gs.gradient_stack[j].coeff[i].id<<"+="<<w<<"*"<<gs.gradient_stack[j].coeff[i].dx<<std::endl;
-                        gradient[gs.gradient_stack[j].coeff[i].id] += w * gs.gradient_stack[j].coeff[i].dx;
-                    }
-//                }
+    /**
+     * Sums v[0..n), e.g. the rows written by ad_dual_group_sum on the 
+     * device.
+     * @param v
+     * @param n
+     * @return 
+     */
+    inline struct ad_dual ad_dual_sum(const struct ad_dual* v, int n) {
+        struct ad_dual sum = ad_dual_constant(0.0);
+        for (int i = 0; i < n; i++) {
+            sum.value += v[i].value;
+            for (int k = 0; k < AD_DUAL_WIDTH; k++) {
+                sum.dx[k] += v[i].dx[k];
             }
         }
-        //        exit(0);
-        return gradient;
+        return sum;
     }
 
 
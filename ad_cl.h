@@ -0,0 +1,3200 @@
+/* Generated from ad.cl by make ad_cl.h, do not edit. */
+static const char* const ad4cl_api_lines[] = {
+    "/**\n",
+    " * A simple API to achieve reverse mode automatic differentiation of computer \n",
+    " * programs on a GPU using OpenCL. \n",
+    " */\n",
+    "\n",
+    "\n",
+    "//#ifdef cl_khr_fp64\n",
+    "//#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n",
+    "//#elif defined(cl_amd_fp64)\n",
+    "//#pragma OPENCL EXTENSION cl_amd_fp64 : enable\n",
+    "//#else\n",
+    "//#error \"double precision floating point not supported by OpenCL implementation.\"\n",
+    "//#endif\n",
+    "\n",
+    "\n",
+    "#if defined(cl_khr_fp64)  // Khronos extension available?\n",
+    "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n",
+    "#define DOUBLE_SUPPORT_AVAILABLE\n",
+    "#elif defined(cl_amd_fp64)  // AMD extension available?\n",
+    "#pragma OPENCL EXTENSION cl_amd_fp64 : enable\n",
+    "#define DOUBLE_SUPPORT_AVAILABLE\n",
+    "#endif\n",
+    "\n",
+    "\n",
+    "\n",
+    "#if defined(DOUBLE_SUPPORT_AVAILABLE)\n",
+    "\n",
+    "// double\n",
+    "typedef double real_t;\n",
+    "typedef double2 real2_t;\n",
+    "typedef double3 real3_t;\n",
+    "typedef double4 real4_t;\n",
+    "typedef double8 real8_t;\n",
+    "typedef double16 real16_t;\n",
+    "#define PI 3.14159265358979323846\n",
+    "\n",
+    "#else\n",
+    "\n",
+    "// float\n",
+    "typedef float real_t;\n",
+    "typedef float2 real2_t;\n",
+    "typedef float3 real3_t;\n",
+    "typedef float4 real4_t;\n",
+    "typedef float8 real8_t;\n",
+    "typedef float16 real16_t;\n",
+    "#define PI 3.14159265359f\n",
+    "\n",
+    "#endif\n",
+    "\n",
+    "\n",
+    "/**\n",
+    " * Storage precision of values and tape partials, must match ad4cl.h. \n",
+    " * Define AD_FLOAT_VALUES and/or AD_FLOAT_PARTIALS to store them in single \n",
+    " * precision; arithmetic between them and adjoint accumulation are \n",
+    " * unaffected.\n",
+    " */\n",
+    "#ifdef AD_FLOAT_VALUES\n",
+    "typedef float ad_value_t;\n",
+    "#else\n",
+    "typedef double ad_value_t;\n",
+    "#endif\n",
+    "\n",
+    "#ifdef AD_FLOAT_PARTIALS\n",
+    "typedef float ad_partial_t;\n",
+    "#else\n",
+    "typedef double ad_partial_t;\n",
+    "#endif\n",
+    "\n",
+    "#ifndef PRIVATE_STACK_SIZE\n",
+    "#define PRIVATE_STACK_SIZE 100\n",
+    "#endif\n",
+    "\n",
+    "#ifndef PRIVATE_GRADIENT_SIZE\n",
+    "#define PRIVATE_GRADIENT_SIZE 150\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Largest number of independent variables of a preaccumulation, see \n",
+    " * pad_preaccumulate.\n",
+    " */\n",
+    "#ifndef PREACCUMULATE_INPUTS\n",
+    "#define PREACCUMULATE_INPUTS 8\n",
+    "#endif\n",
+    "\n",
+    "#ifndef MAX_VARIABLE_IN_EXPESSION\n",
+    "#define MAX_VARIABLE_IN_EXPESSION 2\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Define AD_SOA_TAPE (-DAD_SOA_TAPE) to store the tape as a structure of \n",
+    " * arrays, or AD_CSR_TAPE to store it in compressed sparse row form, see \n",
+    " * ad_tape_columns in ad4cl.h. The host must use the same setting.\n",
+    " */\n",
+    "\n",
+    "#if defined(AD_SOA_TAPE) && defined(AD_CSR_TAPE)\n",
+    "#error \"AD_SOA_TAPE and AD_CSR_TAPE are mutually exclusive\"\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Define AD_IMPLICIT_ID to leave the result id out of every entry. The \n",
+    " * entry in slot s is then the result with id \n",
+    " * s + current_ad_variable_id - stack_current, see AD_ENTRY_ID.\n",
+    " */\n",
+    "\n",
+    "/**\n",
+    " * Define AD_HESSIAN_VECTOR to carry a tangent (the derivative along a \n",
+    " * direction v) in every ad_variable and the tangent of every partial in \n",
+    " * its ad_pair, see AD_RECORD_UNARY_OP and ad_reverse_sweep_hv. Only the \n",
+    " * array of ad_entry's layout is supported.\n",
+    " */\n",
+    "#if defined(AD_HESSIAN_VECTOR) && (defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE))\n",
+    "#error \"AD_HESSIAN_VECTOR needs the default tape layout\"\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Define AD_SECOND_ORDER to store the second order partials of every \n",
+    " * entry, the upper triangle of its local Hessian packed as indexed by \n",
+    " * AD_HESSIAN_INDEX, for the sparse Hessian in ad4cl.h. Only the array of \n",
+    " * ad_entry's layout is supported.\n",
+    " */\n",
+    "#if defined(AD_SECOND_ORDER) && (defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE))\n",
+    "#error \"AD_SECOND_ORDER needs the default tape layout\"\n",
+    "#endif\n",
+    "\n",
+    "#define AD_HESSIAN_SIZE (MAX_VARIABLE_IN_EXPESSION * (MAX_VARIABLE_IN_EXPESSION + 1) / 2)\n",
+    "#define AD_HESSIAN_INDEX(a, b) ((a) * (2 * MAX_VARIABLE_IN_EXPESSION - (a) - 1) / 2 + (b))\n",
+    "\n",
+    "struct  ad_variable {\n",
+    "    ad_value_t value;\n",
+    "    int id;\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "    ad_value_t tangent;\n",
+    "#endif\n",
+    "};\n",
+    "\n",
+    "struct  ad_pair {\n",
+    "    ad_partial_t dx;\n",
+    "    int id;\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "    ad_partial_t ddx;\n",
+    "#endif\n",
+    "};\n",
+    "\n",
+    "struct ad_entry {\n",
+    "    struct ad_pair coeff[MAX_VARIABLE_IN_EXPESSION];\n",
+    "#ifndef AD_IMPLICIT_ID\n",
+    "    int id;\n",
+    "#endif\n",
+    "    int size;\n",
+    "#ifdef AD_SECOND_ORDER\n",
+    "    ad_partial_t hessian[AD_HESSIAN_SIZE];\n",
+    "#endif\n",
+    "};\n",
+    "\n",
+    "/**\n",
+    " * Field order must match ad_gradient_structure in ad4cl.h, the host \n",
+    " * appends its own fields after pair_reserved. parent, reserved and \n",
+    " * pair_reserved are only used by the private gradient structures of the \n",
+    " * pad_ operations: the global gradient structure and the ends of the \n",
+    " * block reserved from it, see pad_slot.\n",
+    " */\n",
+    "struct  ad_gradient_structure {\n",
+    "    __global struct ad_entry* gradient_stack;\n",
+    "    int current_ad_variable_id;\n",
+    "    int stack_current;\n",
+    "    int recording;\n",
+    "    int counter;\n",
+    "    int capacity;\n",
+    "    __global ad_partial_t* coeff_dx;\n",
+    "    __global int* coeff_id;\n",
+    "    __global int* entry_id;\n",
+    "    __global int* entry_size;\n",
+    "    __global int* entry_offset;\n",
+    "    int pair_capacity;\n",
+    "    int pair_current;\n",
+    "    int pair_counter;\n",
+    "    __global struct ad_gradient_structure* parent;\n",
+    "    int reserved;\n",
+    "    int pair_reserved;\n",
+    "};\n",
+    "\n",
+    "struct ad_private_gradient_structure {\n",
+    "    struct ad_entry gradient_stack[PRIVATE_STACK_SIZE];\n",
+    "    int current_ad_variable_id;\n",
+    "    int stack_current;\n",
+    "    int recording;\n",
+    "    int counter;\n",
+    "};\n",
+    "\n",
+    "struct lbfgs_parameters_g {\n",
+    "    __global struct ad_gradient_structure* gs;\n",
+    "    __global struct ad_variable* parameters;\n",
+    "    __global real_t* gradient;\n",
+    "    int linesearch;\n",
+    "    int converged;\n",
+    "    int max_iterations;\n",
+    "    int linesearch_iteration;\n",
+    "    int max_linesearch_iterations;\n",
+    "    int gradient_size;\n",
+    "    int number_of_parameters;\n",
+    "};\n",
+    "\n",
+    "struct lbfgs_parameters_p {\n",
+    "    struct ad_private_gradient_structure* gs;\n",
+    "    struct ad_variable* parameters;\n",
+    "    real_t* gradient;\n",
+    "    int linesearch;\n",
+    "    int converged;\n",
+    "    int max_iterations;\n",
+    "    int linesearch_iteration;\n",
+    "    int max_linesearch_iterations;\n",
+    "    int gradient_size;\n",
+    "    int number_of_parameters;\n",
+    "};\n",
+    "\n",
+    "inline void lbfgs_update_g(struct lbfgs_parameters_g* parameters);\n",
+    "\n",
+    "inline void lbfgs_update_p(struct lbfgs_parameters_p* parameters);\n",
+    "\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "\n",
+    "/**\n",
+    " * Reserves n consecutive coefficient pairs and returns the offset of the \n",
+    " * first.\n",
+    " */\n",
+    "inline int __attribute__((overloadable)) ad_reserve_pairs(__global struct ad_gradient_structure* gs, int n) {\n",
+    "    return gs->pair_current + atomic_add(&gs->pair_counter, n);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Reserves n pairs from the block a private gradient structure got from \n",
+    " * pad_init, or from the global gradient structure once the block is used \n",
+    " * up.\n",
+    " */\n",
+    "inline int __attribute__((overloadable)) ad_reserve_pairs(struct ad_gradient_structure* gs, int n) {\n",
+    "    if (gs->pair_counter + n > gs->pair_reserved) {\n",
+    "        return ad_reserve_pairs(gs->parent, n);\n",
+    "    }\n",
+    "    int p = gs->pair_counter;\n",
+    "    gs->pair_counter += n;\n",
+    "    return gs->pair_current + p;\n",
+    "}\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Stores a result id into the tape, nothing with AD_IMPLICIT_ID.\n",
+    " */\n",
+    "#ifdef AD_IMPLICIT_ID\n",
+    "#define AD_STORE_ID(lvalue, rid) ((void) 0)\n",
+    "#else\n",
+    "#define AD_STORE_ID(lvalue, rid) ((lvalue) = (rid))\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Writes a one coefficient entry to slot of the tape. gs may be a global \n",
+    " * or a private gradient structure, hence a macro.\n",
+    " */\n",
+    "#if defined(AD_CSR_TAPE)\n",
+    "#define AD_RECORD_UNARY(gs, slot, rid, dx0, id0) do { \\\n",
+    "        int s_ = (slot); \\\n",
+    "        int p_ = ad_reserve_pairs((gs), 1); \\\n",
+    "        (gs)->coeff_dx[p_] = (dx0); \\\n",
+    "        (gs)->coeff_id[p_] = (id0); \\\n",
+    "        AD_STORE_ID((gs)->entry_id[s_], (rid)); \\\n",
+    "        (gs)->entry_size[s_] = 1; \\\n",
+    "        (gs)->entry_offset[s_] = p_; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_RECORD_BINARY(gs, slot, rid, dx0, id0, dx1, id1) do { \\\n",
+    "        int s_ = (slot); \\\n",
+    "        int p_ = ad_reserve_pairs((gs), 2); \\\n",
+    "        (gs)->coeff_dx[p_] = (dx0); \\\n",
+    "        (gs)->coeff_id[p_] = (id0); \\\n",
+    "        (gs)->coeff_dx[p_ + 1] = (dx1); \\\n",
+    "        (gs)->coeff_id[p_ + 1] = (id1); \\\n",
+    "        AD_STORE_ID((gs)->entry_id[s_], (rid)); \\\n",
+    "        (gs)->entry_size[s_] = 2; \\\n",
+    "        (gs)->entry_offset[s_] = p_; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_ENTRY_SIZE(gs, slot) ((gs)->entry_size[(slot)])\n",
+    "#define AD_ENTRY_DX(gs, slot, i) ((gs)->coeff_dx[(gs)->entry_offset[(slot)] + (i)])\n",
+    "#define AD_ENTRY_COEFF_ID(gs, slot, i) ((gs)->coeff_id[(gs)->entry_offset[(slot)] + (i)])\n",
+    "#elif defined(AD_SOA_TAPE)\n",
+    "#define AD_RECORD_UNARY(gs, slot, rid, dx0, id0) do { \\\n",
+    "        int s_ = (slot); \\\n",
+    "        (gs)->coeff_dx[s_] = (dx0); \\\n",
+    "        (gs)->coeff_id[s_] = (id0); \\\n",
+    "        AD_STORE_ID((gs)->entry_id[s_], (rid)); \\\n",
+    "        (gs)->entry_size[s_] = 1; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_RECORD_BINARY(gs, slot, rid, dx0, id0, dx1, id1) do { \\\n",
+    "        int s_ = (slot); \\\n",
+    "        (gs)->coeff_dx[s_] = (dx0); \\\n",
+    "        (gs)->coeff_id[s_] = (id0); \\\n",
+    "        (gs)->coeff_dx[(gs)->capacity + s_] = (dx1); \\\n",
+    "        (gs)->coeff_id[(gs)->capacity + s_] = (id1); \\\n",
+    "        AD_STORE_ID((gs)->entry_id[s_], (rid)); \\\n",
+    "        (gs)->entry_size[s_] = 2; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_ENTRY_SIZE(gs, slot) ((gs)->entry_size[(slot)])\n",
+    "#define AD_ENTRY_DX(gs, slot, i) \\\n",
+    "        ((gs)->coeff_dx[(i) % MAX_VARIABLE_IN_EXPESSION * (gs)->capacity + (slot) - (i) / MAX_VARIABLE_IN_EXPESSION])\n",
+    "#define AD_ENTRY_COEFF_ID(gs, slot, i) \\\n",
+    "        ((gs)->coeff_id[(i) % MAX_VARIABLE_IN_EXPESSION * (gs)->capacity + (slot) - (i) / MAX_VARIABLE_IN_EXPESSION])\n",
+    "#else\n",
+    "\n",
+    "/**\n",
+    " * Zeroes the second order partials of entry e, nothing without \n",
+    " * AD_SECOND_ORDER.\n",
+    " */\n",
+    "#ifdef AD_SECOND_ORDER\n",
+    "#define AD_CLEAR_HESSIAN(e) do { \\\n",
+    "        for (int h_ = 0; h_ < AD_HESSIAN_SIZE; h_++) { \\\n",
+    "            (e).hessian[h_] = 0.0; \\\n",
+    "        } \\\n",
+    "    } while (0)\n",
+    "#else\n",
+    "#define AD_CLEAR_HESSIAN(e) ((void) 0)\n",
+    "#endif\n",
+    "\n",
+    "#define AD_RECORD_UNARY(gs, slot, rid, dx0, id0) do { \\\n",
+    "        struct ad_entry e_; \\\n",
+    "        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = (id0)}; \\\n",
+    "        AD_STORE_ID(e_.id, (rid)); \\\n",
+    "        e_.size = 1; \\\n",
+    "        AD_CLEAR_HESSIAN(e_); \\\n",
+    "        (gs)->gradient_stack[(slot)] = e_; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_RECORD_BINARY(gs, slot, rid, dx0, id0, dx1, id1) do { \\\n",
+    "        struct ad_entry e_; \\\n",
+    "        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = (id0)}; \\\n",
+    "        e_.coeff[1] = (struct ad_pair){.dx = (dx1), .id = (id1)}; \\\n",
+    "        AD_STORE_ID(e_.id, (rid)); \\\n",
+    "        e_.size = 2; \\\n",
+    "        AD_CLEAR_HESSIAN(e_); \\\n",
+    "        (gs)->gradient_stack[(slot)] = e_; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_ENTRY_SIZE(gs, slot) ((gs)->gradient_stack[(slot)].size)\n",
+    "#define AD_ENTRY_DX(gs, slot, i) \\\n",
+    "        ((gs)->gradient_stack[(slot) - (i) / MAX_VARIABLE_IN_EXPESSION].coeff[(i) % MAX_VARIABLE_IN_EXPESSION].dx)\n",
+    "#define AD_ENTRY_COEFF_ID(gs, slot, i) \\\n",
+    "        ((gs)->gradient_stack[(slot) - (i) / MAX_VARIABLE_IN_EXPESSION].coeff[(i) % MAX_VARIABLE_IN_EXPESSION].id)\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Records ret = f(x) with f'(x) = dx0 and f''(x) = d2, or ret = f(x0, x1) \n",
+    " * with the partials dx0, dx1 and the second order partials h00, h01 and \n",
+    " * h11. With AD_HESSIAN_VECTOR ret gets its tangent and every pair the \n",
+    " * tangent of its partial, with AD_SECOND_ORDER the entry keeps the second \n",
+    " * order partials. Without either only the ids are used and the second \n",
+    " * order partials are not even evaluated.\n",
+    " */\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "#define AD_TANGENT_UNARY(e, ret, dx0, x, d2) do { \\\n",
+    "        (e).coeff[0].ddx = (d2) * (x).tangent; \\\n",
+    "        (ret).tangent = (dx0) * (x).tangent; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_TANGENT_BINARY(e, ret, dx0, x0, dx1, x1, h00, h01, h11) do { \\\n",
+    "        (e).coeff[0].ddx = (h00) * (x0).tangent + (h01) * (x1).tangent; \\\n",
+    "        (e).coeff[1].ddx = (h01) * (x0).tangent + (h11) * (x1).tangent; \\\n",
+    "        (ret).tangent = (dx0) * (x0).tangent + (dx1) * (x1).tangent; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_ENTRY_DDX(gs, slot, i) \\\n",
+    "        ((gs)->gradient_stack[(slot) - (i) / MAX_VARIABLE_IN_EXPESSION].coeff[(i) % MAX_VARIABLE_IN_EXPESSION].ddx)\n",
+    "#else\n",
+    "#define AD_TANGENT_UNARY(e, ret, dx0, x, d2) ((void) 0)\n",
+    "#define AD_TANGENT_BINARY(e, ret, dx0, x0, dx1, x1, h00, h01, h11) ((void) 0)\n",
+    "#endif\n",
+    "\n",
+    "#ifdef AD_SECOND_ORDER\n",
+    "#define AD_HESSIAN_UNARY(e, d2) do { \\\n",
+    "        AD_CLEAR_HESSIAN(e); \\\n",
+    "        (e).hessian[0] = (d2); \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_HESSIAN_BINARY(e, h00, h01, h11) do { \\\n",
+    "        AD_CLEAR_HESSIAN(e); \\\n",
+    "        (e).hessian[AD_HESSIAN_INDEX(0, 0)] = (h00); \\\n",
+    "        (e).hessian[AD_HESSIAN_INDEX(0, 1)] = (h01); \\\n",
+    "        (e).hessian[AD_HESSIAN_INDEX(1, 1)] = (h11); \\\n",
+    "    } while (0)\n",
+    "#else\n",
+    "#define AD_HESSIAN_UNARY(e, d2) ((void) 0)\n",
+    "#define AD_HESSIAN_BINARY(e, h00, h01, h11) ((void) 0)\n",
+    "#endif\n",
+    "\n",
+    "#if defined(AD_HESSIAN_VECTOR) || defined(AD_SECOND_ORDER)\n",
+    "#define AD_RECORD_UNARY_OP(gs, slot, ret, dx0, x, d2) do { \\\n",
+    "        struct ad_variable x_ = (x); \\\n",
+    "        struct ad_entry e_; \\\n",
+    "        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = x_.id}; \\\n",
+    "        AD_STORE_ID(e_.id, (ret).id); \\\n",
+    "        e_.size = 1; \\\n",
+    "        AD_TANGENT_UNARY(e_, ret, dx0, x_, d2); \\\n",
+    "        AD_HESSIAN_UNARY(e_, d2); \\\n",
+    "        (gs)->gradient_stack[(slot)] = e_; \\\n",
+    "    } while (0)\n",
+    "\n",
+    "#define AD_RECORD_BINARY_OP(gs, slot, ret, dx0, x0, dx1, x1, h00, h01, h11) do { \\\n",
+    "        struct ad_variable x0_ = (x0); \\\n",
+    "        struct ad_variable x1_ = (x1); \\\n",
+    "        struct ad_entry e_; \\\n",
+    "        e_.coeff[0] = (struct ad_pair){.dx = (dx0), .id = x0_.id}; \\\n",
+    "        e_.coeff[1] = (struct ad_pair){.dx = (dx1), .id = x1_.id}; \\\n",
+    "        AD_STORE_ID(e_.id, (ret).id); \\\n",
+    "        e_.size = 2; \\\n",
+    "        AD_TANGENT_BINARY(e_, ret, dx0, x0_, dx1, x1_, h00, h01, h11); \\\n",
+    "        AD_HESSIAN_BINARY(e_, h00, h01, h11); \\\n",
+    "        (gs)->gradient_stack[(slot)] = e_; \\\n",
+    "    } while (0)\n",
+    "#else\n",
+    "#define AD_RECORD_UNARY_OP(gs, slot, ret, dx0, x, d2) \\\n",
+    "        AD_RECORD_UNARY(gs, slot, (ret).id, dx0, (x).id)\n",
+    "\n",
+    "#define AD_RECORD_BINARY_OP(gs, slot, ret, dx0, x0, dx1, x1, h00, h01, h11) \\\n",
+    "        AD_RECORD_BINARY(gs, slot, (ret).id, dx0, (x0).id, dx1, (x1).id)\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Reads the entry in slot. Coefficient i of an entry of more than \n",
+    " * MAX_VARIABLE_IN_EXPESSION coefficients lives in slot - i / \n",
+    " * MAX_VARIABLE_IN_EXPESSION, see ad_nary.\n",
+    " */\n",
+    "#if defined(AD_IMPLICIT_ID)\n",
+    "#define AD_ENTRY_ID(gs, slot) ((slot) + (gs)->current_ad_variable_id - (gs)->stack_current)\n",
+    "#elif defined(AD_SOA_TAPE) || defined(AD_CSR_TAPE)\n",
+    "#define AD_ENTRY_ID(gs, slot) ((gs)->entry_id[(slot)])\n",
+    "#else\n",
+    "#define AD_ENTRY_ID(gs, slot) ((gs)->gradient_stack[(slot)].id)\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Binds gradient_stack to gs. With AD_SOA_TAPE or AD_CSR_TAPE the buffer \n",
+    " * is split into columns the same way as ad_tape_columns in ad4cl.h, using \n",
+    " * gs->capacity and gs->pair_capacity.\n",
+    " */\n",
+    "inline void ad_init(__global struct ad_gradient_structure* gs, __global struct ad_entry * gradient_stack) {\n",
+    "    gs->gradient_stack = gradient_stack;\n",
+    "#if defined(AD_CSR_TAPE)\n",
+    "    gs->coeff_dx = (__global ad_partial_t*) gradient_stack;\n",
+    "    gs->coeff_id = (__global int*) (gs->coeff_dx + gs->pair_capacity);\n",
+    "    gs->entry_id = gs->coeff_id + gs->pair_capacity;\n",
+    "#ifdef AD_IMPLICIT_ID\n",
+    "    gs->entry_size = gs->entry_id;\n",
+    "    gs->entry_id = 0;\n",
+    "#else\n",
+    "    gs->entry_size = gs->entry_id + gs->capacity;\n",
+    "#endif\n",
+    "    gs->entry_offset = gs->entry_size + gs->capacity;\n",
+    "#elif defined(AD_SOA_TAPE)\n",
+    "    gs->coeff_dx = (__global ad_partial_t*) gradient_stack;\n",
+    "    gs->coeff_id = (__global int*) (gs->coeff_dx + gs->capacity * MAX_VARIABLE_IN_EXPESSION);\n",
+    "    gs->entry_id = gs->coeff_id + gs->capacity * MAX_VARIABLE_IN_EXPESSION;\n",
+    "#ifdef AD_IMPLICIT_ID\n",
+    "    gs->entry_size = gs->entry_id;\n",
+    "    gs->entry_id = 0;\n",
+    "#else\n",
+    "    gs->entry_size = gs->entry_id + gs->capacity;\n",
+    "#endif\n",
+    "#endif\n",
+    "}\n",
+    "\n",
+    "inline void ad_init_p(struct ad_private_gradient_structure* gs) {\n",
+    "    for (int i = 0; i < PRIVATE_STACK_SIZE; i++) {\n",
+    "        AD_STORE_ID(gs->gradient_stack[i].id, 0);\n",
+    "        gs->gradient_stack[i].size = 0;\n",
+    "    }\n",
+    "    gs->counter = 0;\n",
+    "    gs->current_ad_variable_id = 0;\n",
+    "    gs->recording = 1;\n",
+    "    gs->stack_current = 0;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Binds the private gradient structure pgs to the block of operations \n",
+    " * slots starting at counter (and pairs at pair_counter with AD_CSR_TAPE) \n",
+    " * reserved from gs. The block is cleared so slots that end up unused are \n",
+    " * empty entries, which keeps resets independent of the tape size, see \n",
+    " * ad_reset.\n",
+    " */\n",
+    "inline void pad_bind(struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs, __global struct ad_entry * gradient_stack,\n",
+    "        int counter, int pair_counter, int operations) {\n",
+    "    pgs->gradient_stack = gradient_stack;\n",
+    "    pgs->counter = counter;\n",
+    "    pgs->current_ad_variable_id = gs->current_ad_variable_id;\n",
+    "    pgs->stack_current = gs->stack_current;\n",
+    "    pgs->recording = gs->recording;\n",
+    "    pgs->capacity = gs->capacity;\n",
+    "    pgs->coeff_dx = gs->coeff_dx;\n",
+    "    pgs->coeff_id = gs->coeff_id;\n",
+    "    pgs->entry_id = gs->entry_id;\n",
+    "    pgs->entry_size = gs->entry_size;\n",
+    "    pgs->entry_offset = gs->entry_offset;\n",
+    "    pgs->pair_capacity = gs->pair_capacity;\n",
+    "    pgs->pair_current = gs->pair_current;\n",
+    "    pgs->pair_counter = pair_counter;\n",
+    "    pgs->parent = gs;\n",
+    "    pgs->reserved = counter + operations;\n",
+    "    pgs->pair_reserved = pair_counter + operations * MAX_VARIABLE_IN_EXPESSION;\n",
+    "    for (int i = 0; i < operations; i++) {\n",
+    "        AD_ENTRY_SIZE(pgs, pgs->stack_current + pgs->counter + i) = 0;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Initializes the private gradient structure pgs with a block of \n",
+    " * operations consecutive tape slots for the pad_ operations of this work \n",
+    " * item, see pad_bind. Costs one atomic_add on gs per work item, \n",
+    " * pad_init_group only one per work group and pad_init_scan none.\n",
+    " * \n",
+    " * @param operations - pad_ operations recorded, more only cost an \n",
+    " * atomic_inc each, see pad_slot.\n",
+    " * @param pgs\n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " */\n",
+    "inline void pad_init(int operations, struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs, __global struct ad_entry * gradient_stack) {\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int pair_counter = 0;\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "        pair_counter = atomic_add(&gs->pair_counter, operations * MAX_VARIABLE_IN_EXPESSION);\n",
+    "#endif\n",
+    "        pad_bind(pgs, gs, gradient_stack, atomic_add(&gs->counter, operations), pair_counter, operations);\n",
+    "    } else {\n",
+    "        pgs->recording = 0;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Same as pad_init, but the whole work group reserves its blocks with a \n",
+    " * single atomic_add on gs: the operation counts of the work items are \n",
+    " * prefix summed in local memory and the last work item reserves the \n",
+    " * total. Every work item of the group must call it, those that record \n",
+    " * nothing with operations 0.\n",
+    " * \n",
+    " * @param operations - pad_ operations recorded by this work item, more \n",
+    " * only cost an atomic_inc each, see pad_slot.\n",
+    " * @param pgs\n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " * @param scratch - local memory for get_local_size(0) + 2 ints.\n",
+    " */\n",
+    "inline void pad_init_group(int operations, struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry * gradient_stack, __local int* scratch) {\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int lid = get_local_id(0);\n",
+    "        int n = get_local_size(0);\n",
+    "\n",
+    "        //inclusive prefix sum of the operation counts\n",
+    "        scratch[lid] = operations;\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "        for (int s = 1; s < n; s <<= 1) {\n",
+    "            int v = lid >= s ? scratch[lid - s] : 0;\n",
+    "            barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "            scratch[lid] += v;\n",
+    "            barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "        }\n",
+    "\n",
+    "        if (lid == n - 1) {\n",
+    "            scratch[n] = atomic_add(&gs->counter, scratch[lid]);\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "            scratch[n + 1] = atomic_add(&gs->pair_counter, scratch[lid] * MAX_VARIABLE_IN_EXPESSION);\n",
+    "#endif\n",
+    "        }\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "        int offset = scratch[lid] - operations;\n",
+    "        int pair_counter = 0;\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "        pair_counter = scratch[n + 1] + offset * MAX_VARIABLE_IN_EXPESSION;\n",
+    "#endif\n",
+    "        pad_bind(pgs, gs, gradient_stack, scratch[n] + offset, pair_counter, operations);\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    } else {\n",
+    "        pgs->recording = 0;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Turns the operation counts of a counting pass into tape offsets, for\n",
+    " * recordings whose layout must not depend on scheduling, see\n",
+    " * pad_init_scan. offsets[0..n) holds the operation count of every work\n",
+    " * item on input; on output offsets[0..n] holds their exclusive prefix sum\n",
+    " * and offsets[n + 1], offsets[n + 2] the counter and pair_counter of gs\n",
+    " * the block starts at. gs is advanced past the whole block.\n",
+    " *\n",
+    " * Launch as a single work group, each work item scans a chunk of\n",
+    " * consecutive counts so any n works.\n",
+    " *\n",
+    " * @param gs\n",
+    " * @param offsets - n + 3 ints.\n",
+    " * @param n - global size of the counting and recording kernels.\n",
+    " * @param scratch - local memory for get_local_size(0) ints.\n",
+    " */\n",
+    "__kernel void ad_scan_operations(__global struct ad_gradient_structure* gs,\n",
+    "        __global int* offsets,\n",
+    "        int n,\n",
+    "        __local int* scratch) {\n",
+    "    int lid = get_local_id(0);\n",
+    "    int size = get_local_size(0);\n",
+    "    int chunk = (n + size - 1) / size;\n",
+    "    int first = min(lid * chunk, n);\n",
+    "    int last = min(first + chunk, n);\n",
+    "\n",
+    "    int sum = 0;\n",
+    "    for (int i = first; i < last; i++) {\n",
+    "        sum += offsets[i];\n",
+    "    }\n",
+    "\n",
+    "    //inclusive prefix sum of the chunk totals\n",
+    "    scratch[lid] = sum;\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    for (int s = 1; s < size; s <<= 1) {\n",
+    "        int v = lid >= s ? scratch[lid - s] : 0;\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "        scratch[lid] += v;\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    }\n",
+    "\n",
+    "    int running = scratch[lid] - sum;\n",
+    "    for (int i = first; i < last; i++) {\n",
+    "        int count = offsets[i];\n",
+    "        offsets[i] = running;\n",
+    "        running += count;\n",
+    "    }\n",
+    "\n",
+    "    if (lid == size - 1) {\n",
+    "        int total = scratch[lid];\n",
+    "        offsets[n] = total;\n",
+    "        offsets[n + 1] = gs->counter;\n",
+    "        offsets[n + 2] = gs->pair_counter;\n",
+    "        gs->counter += total;\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "        gs->pair_counter += total * MAX_VARIABLE_IN_EXPESSION;\n",
+    "#endif\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Same as pad_init, but without atomics: the block of this work item is\n",
+    " * at the offset ad_scan_operations computed from the counting pass, so\n",
+    " * every slot is at the same position on every run and tapes and\n",
+    " * gradients are bit identical. The number of operations is the count\n",
+    " * given to the counting pass, recording more falls back to atomic_inc\n",
+    " * like pad_init, see pad_slot.\n",
+    " *\n",
+    " * @param offsets - output of ad_scan_operations, counted with the same\n",
+    " * global size as the calling kernel.\n",
+    " * @param pgs\n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " */\n",
+    "inline void pad_init_scan(__global const int* offsets, struct ad_gradient_structure* pgs, __global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry * gradient_stack) {\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int n = get_global_size(0);\n",
+    "        int id = get_global_id(0);\n",
+    "        int offset = offsets[id];\n",
+    "        int operations = offsets[id + 1] - offset;\n",
+    "        int pair_counter = 0;\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "        pair_counter = offsets[n + 2] + offset * MAX_VARIABLE_IN_EXPESSION;\n",
+    "#endif\n",
+    "        pad_bind(pgs, gs, gradient_stack, offsets[n + 1] + offset, pair_counter, operations);\n",
+    "    } else {\n",
+    "        pgs->recording = 0;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Hands out the next slot of the block reserved by pad_init, relative to \n",
+    " * stack_current. Once the block is used up the slots come from the global \n",
+    " * gradient structure, so recording more operations than reserved is only \n",
+    " * slower.\n",
+    " */\n",
+    "inline int pad_slot(struct ad_gradient_structure* pgs) {\n",
+    "    if (pgs->counter < pgs->reserved) {\n",
+    "        return pgs->counter++;\n",
+    "    }\n",
+    "    return atomic_inc(&pgs->parent->counter);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Same as pad_slot for n consecutive slots, the first is returned. They \n",
+    " * come from the global gradient structure as a whole when they do not \n",
+    " * fit the rest of the block.\n",
+    " */\n",
+    "inline int pad_slots(struct ad_gradient_structure* pgs, int n) {\n",
+    "    if (pgs->counter + n <= pgs->reserved) {\n",
+    "        int index = pgs->counter;\n",
+    "        pgs->counter += n;\n",
+    "        return index;\n",
+    "    }\n",
+    "    return atomic_add(&pgs->parent->counter, n);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Starts a new recording. Only the counters are reset: every slot handed \n",
+    " * out afterwards is written or cleared before it is read, see pad_init, \n",
+    " * so the cost does not depend on the size of the tape. Must be called by \n",
+    " * a single work item with no other work item recording, e.g. after the \n",
+    " * reverse sweep. The host counterpart is ad_reset in ad4cl.h.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param first_id - id of the first variable of the new recording, \n",
+    " * smaller ids (independent variables) stay valid.\n",
+    " */\n",
+    "inline void ad_reset(__global struct ad_gradient_structure* gs, int first_id) {\n",
+    "    gs->current_ad_variable_id = first_id;\n",
+    "    gs->stack_current = 0;\n",
+    "    gs->counter = 0;\n",
+    "    gs->pair_current = 0;\n",
+    "    gs->pair_counter = 0;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Gives var a new id and value. The id comes with an empty tape slot, so \n",
+    " * it can not collide with the ids of entries recorded concurrently. With \n",
+    " * AD_HESSIAN_VECTOR the tangent is 0, set it to the direction after.\n",
+    " */\n",
+    "inline void ad_init_var_g(__global struct ad_gradient_structure* gs, struct ad_variable* var, double value) {\n",
+    "    int index = atomic_inc(&gs->counter);\n",
+    "    var->id = index + gs->current_ad_variable_id;\n",
+    "    AD_ENTRY_SIZE(gs, index + gs->stack_current) = 0;\n",
+    "    var->value = value;\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "    var->tangent = 0.0;\n",
+    "#endif\n",
+    "}\n",
+    "\n",
+    "\n",
+    "\n",
+    "/**\n",
+    " * Adds two ad_variables together. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_plus(__global struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value + b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                1.0, a, 1.0, b,\n",
+    "                0.0, 0.0, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Adds ad_variable a to double b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_plus_vd(__global struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = a.value + b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Adds double a to ad_variable b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_plus_dv(__global struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a + b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, b, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Plus assign ad_variable a and ad_variable b. If the gradient structure is recording, \n",
+    " * entries will be added and a gets the id of the new entry, otherwise the \n",
+    " * result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " */\n",
+    "inline void ad_plus_eq(__global struct ad_gradient_structure* gs, struct ad_variable* a, const struct ad_variable b) {\n",
+    "    a->value += b.value;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        struct ad_variable ret = {.value = a->value, .id = index + gs->current_ad_variable_id};\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                1.0, *a, 1.0, b,\n",
+    "                0.0, 0.0, 0.0);\n",
+    "        *a = ret;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "inline void ad_plus_eq_g(__global struct ad_gradient_structure* gs, __global struct ad_variable* a, struct ad_variable b) {\n",
+    "    a->value += b.value;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        struct ad_variable ret = {.value = a->value, .id = index + gs->current_ad_variable_id};\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                1.0, *a, 1.0, b,\n",
+    "                0.0, 0.0, 0.0);\n",
+    "        *a = ret;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Plus assign ad_variable a and double b. If the gradient structure is recording, \n",
+    " * entries will be added and a gets the id of the new entry, otherwise the \n",
+    " * result is only computed.\n",
+    " *  \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " */\n",
+    "inline void ad_plus_eq_d(__global struct ad_gradient_structure* gs, struct ad_variable* a, double b) {\n",
+    "    a->value += b;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        struct ad_variable ret = {.value = a->value, .id = index + gs->current_ad_variable_id};\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, *a, 0.0);\n",
+    "        *a = ret;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts ad_variable b from ad_variable a. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_minus(__global struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value - b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                1.0, a, -1.0, b,\n",
+    "                0.0, 0.0, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts double b from ad_variable a.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_minus_vd(__global struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = a.value - b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts ad_variable b from double a. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " *  \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_minus_dv(__global struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a - b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0, b, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies to ad_variables together. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_times(__global struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value * b.value, .id = 0};\n",
+    "\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                b.value, a, a.value, b,\n",
+    "                0.0, 1.0, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies ad_variable a and double b.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_times_vd(__global struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = a.value * b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, b, a, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies double a and ad_variable b.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_times_dv(__global struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a * b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, a, b, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides ad_variable a by ad_variable b.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_divide(__global struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value / b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = 1.0 / b.value;\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                inv, a, -1.0 * ret.value * inv, b,\n",
+    "                0.0, -1.0 * inv * inv, 2.0 * ret.value * inv * inv);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides ad_variable a by double b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed. \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_divide_vd(__global struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = a.value / b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = 1.0 / b;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, a, 0.0);\n",
+    "    }\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides double a by ad_variable b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_divide_dv(__global struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a / b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = 1.0 / b.value;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0 * ret.value * inv, b, 2.0 * ret.value * inv * inv);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Adds two ad_variables together. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_plus(struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    //    struct ad_variable ret = {.value = a.value + b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        struct ad_variable ret = {.value = a.value + b.value, .id = gs->current_ad_variable_id + index};\n",
+    "        //        ret.id = index + gs->current_ad_variable_id;\n",
+    "        //        __global struct ad_entry* e =\n",
+    "        //                &gs->gradient_stack[index + gs->stack_current];\n",
+    "\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                1.0, a, 1.0, b,\n",
+    "                0.0, 0.0, 0.0);\n",
+    "        return ret;\n",
+    "    } else {\n",
+    "\n",
+    "        return (struct ad_variable) {\n",
+    "            .value = a.value + b.value, .id = 0\n",
+    "        };\n",
+    "    }\n",
+    "\n",
+    "    //    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Adds ad_variable a to double b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_plus_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = a.value + b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Adds double a to ad_variable b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_plus_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a + b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, b, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Plus assign ad_variable a and ad_variable b. If the gradient structure is recording, \n",
+    " * entries will be added and a gets the id of the new entry, otherwise the \n",
+    " * result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " */\n",
+    "inline void pad_plus_eq(struct ad_gradient_structure* gs, struct ad_variable* a, struct ad_variable b) {\n",
+    "    a->value += b.value;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        AD_RECORD_BINARY(gs, index + gs->stack_current, a->id,\n",
+    "                1.0, a->id, 1.0, b.id);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "inline void pad_plus_eq_g(struct ad_gradient_structure* gs, __global struct ad_variable* a, struct ad_variable b) {\n",
+    "    a->value += b.value;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        AD_RECORD_BINARY(gs, index + gs->stack_current, a->id,\n",
+    "                1.0, a->id, 1.0, b.id);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Plus assign ad_variable a and double b. If the gradient structure is recording, \n",
+    " * entries will be added and a gets the id of the new entry, otherwise the \n",
+    " * result is only computed.\n",
+    " *  \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " */\n",
+    "inline void pad_plus_eq_d(struct ad_gradient_structure* gs, struct ad_variable* a, double b) {\n",
+    "    a->value += b;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        AD_RECORD_UNARY(gs, index + gs->stack_current, a->id, 1.0, a->id);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts ad_variable b from ad_variable a. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_minus(struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value - b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                1.0, a, -1.0, b,\n",
+    "                0.0, 0.0, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts double b from ad_variable a.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_minus_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = a.value - b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        //        __global struct ad_entry* e =\n",
+    "        //                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, 1.0, a, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts ad_variable b from double a. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " *  \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_minus_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a - b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0, b, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies to ad_variables together. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_times(struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value * b.value, .id = 0};\n",
+    "\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        //        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_variable ret = {.value = a.value * b.value, .id = index + gs->current_ad_variable_id};\n",
+    "        //        __global struct ad_entry* e =\n",
+    "        //                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        //        (struct ad_entry){.coeff ={{.dx = a.value, .id = a.id},{.dx = b.value, .id = b.id}}, .id=ret.id, .size=2};\n",
+    "        //////          struct ad_pair data[] ={{.dx = a.value, .id = a.id},{.dx = b.value, .id = b.id}};\n",
+    "        //////        e.coeff = data;\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                b.value, a, a.value, b,\n",
+    "                0.0, 1.0, 0.0);\n",
+    "\n",
+    "        return ret;\n",
+    "    } else {\n",
+    "\n",
+    "        return (struct ad_variable) {\n",
+    "            .value = a.value * b.value, .id = 0\n",
+    "        };\n",
+    "    }\n",
+    "\n",
+    "    //    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies ad_variable a and double b.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_times_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    //    struct ad_variable ret = {.value = a.value * b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        struct ad_variable ret = {.value = a.value * b, .id = index + gs->current_ad_variable_id};\n",
+    "\n",
+    "        //        ret.id = index + gs->current_ad_variable_id;\n",
+    "        //        __global struct ad_entry* e =\n",
+    "        //                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, b, a, 0.0);\n",
+    "        return ret;\n",
+    "    } else {\n",
+    "\n",
+    "        return (struct ad_variable) {\n",
+    "            .value = a.value * b, .id = 0\n",
+    "        };\n",
+    "    }\n",
+    "\n",
+    "    //    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies double a and ad_variable b.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_times_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a * b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, a, b, 0.0);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides ad_variable a by ad_variable b.If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_divide(struct ad_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value / b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = 1.0 / b.value;\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                inv, a, -1.0 * ret.value * inv, b,\n",
+    "                0.0, -1.0 * inv * inv, 2.0 * ret.value * inv * inv);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides ad_variable a by double b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed. \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_divide_vd(struct ad_gradient_structure* gs, struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = a.value / b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        //        __global struct ad_entry* e =\n",
+    "        //                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        double inv = 1.0 / b;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, a, 0.0);\n",
+    "    }\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides double a by ad_variable b. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_divide_dv(struct ad_gradient_structure* gs, double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a / b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = pad_slot(gs);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = 1.0 / b.value;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0 * ret.value * inv, b, 2.0 * ret.value * inv * inv);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Number of operations an n argument ad_nary/pad_nary takes from the \n",
+    " * count given to pad_init: the slots its entry spans.\n",
+    " */\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "#define AD_NARY_OPERATIONS(n) 1\n",
+    "#else\n",
+    "#define AD_NARY_OPERATIONS(n) (((n) + MAX_VARIABLE_IN_EXPESSION - 1) / MAX_VARIABLE_IN_EXPESSION)\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Marks slot as part of an n-ary entry: the last slot gets the result rid \n",
+    " * and the size, the ones before it size 0 so the sweeps skip them. gs may \n",
+    " * be a global or a private gradient structure, hence a macro.\n",
+    " */\n",
+    "#if defined(AD_SOA_TAPE)\n",
+    "#define AD_RECORD_NARY_SLOT(gs, slot, rid, size) do { \\\n",
+    "        int s_ = (slot); \\\n",
+    "        AD_STORE_ID((gs)->entry_id[s_], (rid)); \\\n",
+    "        (gs)->entry_size[s_] = (size); \\\n",
+    "    } while (0)\n",
+    "#elif !defined(AD_CSR_TAPE)\n",
+    "#define AD_RECORD_NARY_SLOT(gs, slot, rid, size) do { \\\n",
+    "        int s_ = (slot); \\\n",
+    "        AD_STORE_ID((gs)->gradient_stack[s_].id, (rid)); \\\n",
+    "        (gs)->gradient_stack[s_].size = (size); \\\n",
+    "        AD_CLEAR_HESSIAN((gs)->gradient_stack[s_]); \\\n",
+    "    } while (0)\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Writes the n-ary entry of result rid over the AD_NARY_OPERATIONS(n) \n",
+    " * slots ending at last, see ad_nary. With AD_CSR_TAPE one slot and n \n",
+    " * pairs.\n",
+    " */\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "#define AD_RECORD_NARY(gs, last, rid, n, dx, args) do { \\\n",
+    "        int p_ = ad_reserve_pairs((gs), (n)); \\\n",
+    "        for (int i_ = 0; i_ < (n); i_++) { \\\n",
+    "            (gs)->coeff_dx[p_ + i_] = (dx)[i_]; \\\n",
+    "            (gs)->coeff_id[p_ + i_] = (args)[i_].id; \\\n",
+    "        } \\\n",
+    "        AD_STORE_ID((gs)->entry_id[(last)], (rid)); \\\n",
+    "        (gs)->entry_size[(last)] = (n); \\\n",
+    "        (gs)->entry_offset[(last)] = p_; \\\n",
+    "    } while (0)\n",
+    "#else\n",
+    "#define AD_RECORD_NARY(gs, last, rid, n, dx, args) do { \\\n",
+    "        int l_ = (last); \\\n",
+    "        int k_ = AD_NARY_OPERATIONS(n); \\\n",
+    "        for (int i_ = 0; i_ < (n); i_++) { \\\n",
+    "            AD_ENTRY_DX(gs, l_, i_) = (dx)[i_]; \\\n",
+    "            AD_ENTRY_COEFF_ID(gs, l_, i_) = (args)[i_].id; \\\n",
+    "        } \\\n",
+    "        for (int s_ = l_ - k_ + 1; s_ < l_; s_++) { \\\n",
+    "            AD_RECORD_NARY_SLOT(gs, s_, 0, 0); \\\n",
+    "        } \\\n",
+    "        AD_RECORD_NARY_SLOT(gs, l_, (rid), (n)); \\\n",
+    "    } while (0)\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Records a result with value whose partial derivative is dx[i] \n",
+    " * w.r.t. args[i] as a single entry. With AD_CSR_TAPE it takes one slot \n",
+    " * and exactly n pairs, otherwise AD_NARY_OPERATIONS(n) consecutive slots: \n",
+    " * the last holds the result and the size, coefficient i sits in slot \n",
+    " * last - i / MAX_VARIABLE_IN_EXPESSION and the slots before the last \n",
+    " * have size 0, see ad_nary in ad4cl.h. The result takes the id of the \n",
+    " * last slot. With AD_HESSIAN_VECTOR dx is taken to be constant along the \n",
+    " * direction.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param value\n",
+    " * @param n - number of arguments, at least 1.\n",
+    " * @param dx\n",
+    " * @param args\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_nary(__global struct ad_gradient_structure* gs, double value, int n, const double* dx, const struct ad_variable* args) {\n",
+    "    struct ad_variable ret = {.value = value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int operations = AD_NARY_OPERATIONS(n);\n",
+    "        int index = atomic_add(&gs->counter, operations) + operations - 1;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_NARY(gs, index + gs->stack_current, ret.id, n, dx, args);\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "        ret.tangent = 0.0;\n",
+    "        for (int i = 0; i < n; i++) {\n",
+    "            AD_ENTRY_DDX(gs, index + gs->stack_current, i) = 0.0;\n",
+    "            ret.tangent += dx[i] * args[i].tangent;\n",
+    "        }\n",
+    "#endif\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Private version of ad_nary. The block reserved by pad_init should \n",
+    " * account for AD_NARY_OPERATIONS(n) operations, see pad_slots.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param value\n",
+    " * @param n - number of arguments, at least 1.\n",
+    " * @param dx\n",
+    " * @param args\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable pad_nary(struct ad_gradient_structure* gs, double value, int n, const double* dx, const struct ad_variable* args) {\n",
+    "    struct ad_variable ret = {.value = value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int operations = AD_NARY_OPERATIONS(n);\n",
+    "        int index = pad_slots(gs, operations) + operations - 1;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_NARY(gs, index + gs->stack_current, ret.id, n, dx, args);\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "        ret.tangent = 0.0;\n",
+    "        for (int i = 0; i < n; i++) {\n",
+    "            AD_ENTRY_DDX(gs, index + gs->stack_current, i) = 0.0;\n",
+    "            ret.tangent += dx[i] * args[i].tangent;\n",
+    "        }\n",
+    "#endif\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_cos(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = cos(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, -1.0 * sin(v.value), v, -1.0 * ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_sin(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = sin(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, cos(v.value), v, -1.0 * ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_tan(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = tan(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double temp = 1.0 / cos(v.value);\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp*temp, v, 2.0 * temp * temp * ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_acos(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = acos(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double temp = (-1.0) /\n",
+    "                pow(((1.0) -\n",
+    "                pow(v.value, (2.0))),\n",
+    "                (0.5));\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, temp * temp * temp * v.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_asin(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = asin(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double temp = (1.0) /\n",
+    "                pow(((1.0) -\n",
+    "                pow(v.value, (2.0))),\n",
+    "                (0.5));\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, temp * temp * temp * v.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_atan(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = atan(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double temp = (1.0) / (v.value * v.value + (1.0));\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, -2.0 * v.value * temp * temp);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_cosh(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = cosh(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, sinh(v.value), v, ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_sinh(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = sinh(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, cosh(v.value), v, ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_tanh(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = tanh(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double temp = (1.0 / cosh(v.value))*(1.0 / cosh(v.value));\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, temp, v, -2.0 * ret.value * temp);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_exp(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = exp(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, ret.value, v, ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_log(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = log(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = 1.0 / v.value;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, v, -1.0 * inv * inv);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_log10(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = log10(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = 1.0 / (v.value * 2.30258509299404590109361379290930926799774169921875);\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, v, -1.0 * inv / v.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_pow(__global struct ad_gradient_structure* gs,\n",
+    "        const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = pow(a.value, b.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = b.value * pow(a.value, b.value - (1.0));\n",
+    "        AD_RECORD_BINARY_OP(gs, index + gs->stack_current, ret,\n",
+    "                inv, a, log(a.value) * ret.value, b,\n",
+    "                (b.value - 1.0) * inv / a.value,\n",
+    "                (1.0 + b.value * log(a.value)) * ret.value / a.value,\n",
+    "                log(a.value) * log(a.value) * ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_pow_vd(__global struct ad_gradient_structure* gs,\n",
+    "        struct ad_variable a, double b) {\n",
+    "    struct ad_variable ret = {.value = pow(a.value, b), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = b * pow(a.value, b - (1.0));\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, a, (b - 1.0) * inv / a.value);\n",
+    "    }\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_pow_dv(__global struct ad_gradient_structure* gs,\n",
+    "        double a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = pow(a, b.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = b.value * pow(a, b.value - (1.0));\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, log(a) * ret.value, b, log(a) * log(a) * ret.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable __attribute__((overloadable)) ad_sqrt(__global struct ad_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = sqrt(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = atomic_inc(&gs->counter);\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        double inv = .5 / ret.value;\n",
+    "        AD_RECORD_UNARY_OP(gs, index + gs->stack_current, ret, inv, v, -0.5 * inv / v.value);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "\n",
+    "/**\n",
+    " * Operations on private memory\n",
+    " */\n",
+    "\n",
+    "/**\n",
+    " * Adds two ad_variables together in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_plus_p(struct ad_private_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value + b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};\n",
+    "        e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};\n",
+    "        e->size = 2;\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Adds ad_variable a to real_t b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_plus_vd_p(struct ad_private_gradient_structure* gs, struct ad_variable a, real_t b) {\n",
+    "    struct ad_variable ret = {.value = a.value + b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};\n",
+    "        e->size = 1;\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Adds real_t a to ad_variable b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_plus_dv_p(struct ad_private_gradient_structure* gs, real_t a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a + b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = b.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Plus assign ad_variable a and ad_variable b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added and a gets the id of the new entry, otherwise the \n",
+    " * result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " */\n",
+    "inline void ad_plus_eq_p(struct ad_private_gradient_structure* gs, struct ad_variable* a, const struct ad_variable b) {\n",
+    "    a->value += b.value;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};\n",
+    "        e->coeff[1] = (struct ad_pair){.dx = 1.0, .id = b.id};\n",
+    "        e->size = 2;\n",
+    "        a->id = index + gs->current_ad_variable_id;\n",
+    "        AD_STORE_ID(e->id, a->id);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Plus assign ad_variable a and real_t b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added and a gets the id of the new entry, otherwise the \n",
+    " * result is only computed.\n",
+    " *  \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " */\n",
+    "inline void ad_plus_eq_d_p(struct ad_private_gradient_structure* gs, struct ad_variable* a, real_t b) {\n",
+    "    a->value += b;\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a->id};\n",
+    "        e->size = 1;\n",
+    "        a->id = index + gs->current_ad_variable_id;\n",
+    "        AD_STORE_ID(e->id, a->id);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts ad_variable b from ad_variable a in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_minus_p(struct ad_private_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value - b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};\n",
+    "        e->coeff[1] = (struct ad_pair){.dx = -1.0, .id = b.id};\n",
+    "        e->size = 2;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts real_t b from ad_variable a in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_minus_vd_p(struct ad_private_gradient_structure* gs, struct ad_variable a, real_t b) {\n",
+    "    struct ad_variable ret = {.value = a.value - b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = 1.0, .id = a.id};\n",
+    "        e->size = 1;\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Subtracts ad_variable b from real_t a in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " *  \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_minus_dv_p(struct ad_private_gradient_structure* gs, real_t a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a - b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = -1.0, .id = b.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies to ad_variables together in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_times_p(struct ad_private_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value * b.value, .id = 0};\n",
+    "\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = a.value, .id = a.id};\n",
+    "        e->coeff[1] = (struct ad_pair){.dx = b.value, .id = b.id};\n",
+    "        e->size = 2;\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies ad_variable a and real_t b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_times_vd_p(struct ad_private_gradient_structure* gs, struct ad_variable a, real_t b) {\n",
+    "    struct ad_variable ret = {.value = a.value * b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = b, .id = a.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Multiplies real_t a and ad_variable b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_times_dv_p(struct ad_private_gradient_structure* gs, real_t a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a * b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = b.value, .id = b.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides ad_variable a by ad_variable b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_divide_p(struct ad_private_gradient_structure* gs, const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a.value / b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = 1.0 / b.value;\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};\n",
+    "        e->coeff[1] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};\n",
+    "        e->size = 2;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides ad_variable a by real_t b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed. \n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_divide_vd_p(struct ad_private_gradient_structure* gs, struct ad_variable a, real_t b) {\n",
+    "    struct ad_variable ret = {.value = a.value / b, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = 1.0 / b;\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Divides real_t a by ad_variable b in private memory space. If the gradient structure is recording, \n",
+    " * entries will be added, otherwise the result is only computed.\n",
+    " * @param gs\n",
+    " * @param a\n",
+    " * @param b\n",
+    " * @return \n",
+    " */\n",
+    "inline const struct ad_variable ad_divide_dv_p(struct ad_private_gradient_structure* gs, real_t a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = a / b.value, .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = 1.0 / b.value;\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = -1.0 * ret.value * inv, .id = b.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_cos_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) cos(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = -1.0 * (real_t) sin(v.value), .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_sin_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) sin(v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = (real_t) cos(v.value), .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_tan_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) tan((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t temp = 1.0 / (real_t) cos((real_t) v.value);\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = temp*temp, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_acos_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) acos((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t temp = (-1.0) /\n",
+    "                (real_t) pow((real_t) ((1.0) -\n",
+    "                (real_t) pow((real_t) v.value, (real_t) (2.0))),\n",
+    "                (real_t) (0.5));\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_asin_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) asin((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t temp = (1.0) /\n",
+    "                (real_t) pow(((1.0) -\n",
+    "                (real_t) pow(v.value, (2.0))),\n",
+    "                (0.5));\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_atan_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) atan((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t temp = (1.0) / (v.value * v.value + (1.0));\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_cosh_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) cosh((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = (real_t) sinh((real_t) v.value), .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_sinh_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) sinh((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = (real_t) cosh((real_t) v.value), .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_tanh_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) tanh((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t temp = (1.0 / (real_t) cosh((real_t) v.value))*(1.0 / (real_t) cosh(v.value));\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = temp, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_exp_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) exp((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = ret.value, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_log_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) log((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = 1.0 / v.value;\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_log10_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) log10((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = 1.0 / (v.value * (real_t) 2.30258509299404590109361379290930926799774169921875);\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_pow_p(struct ad_private_gradient_structure* gs,\n",
+    "        const struct ad_variable a, const struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = (real_t) pow((real_t) a.value, (real_t) b.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = b.value * (real_t) pow((real_t) a.value, (real_t) b.value - (1.0));\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};\n",
+    "        e->coeff[1] = (struct ad_pair){.dx = (real_t) log(a.value) * ret.value, .id = b.id};\n",
+    "        e->size = 2;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_pow_vd_p(struct ad_private_gradient_structure* gs,\n",
+    "        struct ad_variable a, real_t b) {\n",
+    "    struct ad_variable ret = {.value = (real_t) pow(a.value, b), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = b * (real_t) pow((real_t) a.value, (real_t) b - (1.0));\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = inv, .id = a.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_pow_dv_p(struct ad_private_gradient_structure* gs,\n",
+    "        real_t a, struct ad_variable b) {\n",
+    "    struct ad_variable ret = {.value = (real_t) pow((real_t) a, (real_t) b.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = b.value * (real_t) pow(a, b.value - (1.0));\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = (real_t) log((real_t) a) * ret.value, .id = b.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline const struct ad_variable ad_sqrt_p(struct ad_private_gradient_structure* gs, struct ad_variable v) {\n",
+    "    struct ad_variable ret = {.value = (real_t) sqrt((real_t) v.value), .id = 0};\n",
+    "\n",
+    "    if (gs->recording == 1) {\n",
+    "        int index = gs->counter++;\n",
+    "        ret.id = index + gs->current_ad_variable_id;\n",
+    "        struct ad_entry* e =\n",
+    "                &gs->gradient_stack[index + gs->stack_current];\n",
+    "        real_t inv = .5 / ret.value;\n",
+    "        e->coeff[0] = (struct ad_pair){.dx = inv, .id = v.id};\n",
+    "        e->size = 1;\n",
+    "        AD_STORE_ID(e->id, ret.id);\n",
+    "    }\n",
+    "\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Preaccumulation: a work item records its own computation on a short \n",
+    " * private tape, sweeps it and emits a single entry holding the partials \n",
+    " * w.r.t. the independent variables, see pad_preaccumulate. The global \n",
+    " * tape then gets AD_NARY_OPERATIONS(n) entries per work item instead of \n",
+    " * one per operation.\n",
+    " */\n",
+    "\n",
+    "/**\n",
+    " * Starts a preaccumulation on the private gradient structure p. locals \n",
+    " * get the values of the n independent variables in inputs and the \n",
+    " * private ids 0 to n - 1, record with the _p operations on them. The tape \n",
+    " * is not cleared, only the slots recorded are swept. \n",
+    " * PRIVATE_STACK_SIZE bounds the operations recorded, \n",
+    " * PRIVATE_GRADIENT_SIZE the operations plus n and PREACCUMULATE_INPUTS n.\n",
+    " * \n",
+    " * @param p\n",
+    " * @param n\n",
+    " * @param inputs\n",
+    " * @param locals\n",
+    " */\n",
+    "inline void ad_preaccumulate_init_p(struct ad_private_gradient_structure* p, int n, const struct ad_variable* inputs, struct ad_variable* locals) {\n",
+    "    p->counter = 0;\n",
+    "    p->stack_current = 0;\n",
+    "    p->recording = 1;\n",
+    "    p->current_ad_variable_id = n;\n",
+    "    for (int i = 0; i < n; i++) {\n",
+    "        locals[i].value = inputs[i].value;\n",
+    "        locals[i].id = i;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Reverse sweep of the private tape of p seeded at result, dx[i] is set \n",
+    " * to the partial derivative of result w.r.t. the private id i < n.\n",
+    " * \n",
+    " * @param p\n",
+    " * @param result\n",
+    " * @param n\n",
+    " * @param dx\n",
+    " */\n",
+    "inline void ad_preaccumulate_sweep_p(struct ad_private_gradient_structure* p, struct ad_variable result, int n, double* dx) {\n",
+    "    double adjoint[PRIVATE_GRADIENT_SIZE];\n",
+    "    int size = p->current_ad_variable_id + p->counter;\n",
+    "    for (int i = 0; i < size; i++) {\n",
+    "        adjoint[i] = 0.0;\n",
+    "    }\n",
+    "    adjoint[result.id] = 1.0;\n",
+    "\n",
+    "    //ids come with the slots, see ad_plus_p\n",
+    "    int offset = p->current_ad_variable_id - p->stack_current;\n",
+    "    for (int j = p->stack_current + p->counter - 1; j >= p->stack_current; j--) {\n",
+    "        struct ad_entry* e = &p->gradient_stack[j];\n",
+    "        double w = adjoint[j + offset];\n",
+    "        if (w != 0.0) {\n",
+    "            for (int i = 0; i < e->size; i++) {\n",
+    "                adjoint[e->coeff[i].id] += w * e->coeff[i].dx;\n",
+    "            }\n",
+    "        }\n",
+    "    }\n",
+    "\n",
+    "    for (int i = 0; i < n; i++) {\n",
+    "        dx[i] = adjoint[i];\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Ends a preaccumulation: sweeps the private tape of p and records result \n",
+    " * on gs as one ad_nary entry w.r.t. inputs. pad_init should account for \n",
+    " * AD_NARY_OPERATIONS(n) operations, 1 for n <= 2. The _p operations are \n",
+    " * first order, so with AD_HESSIAN_VECTOR the second order terms of the \n",
+    " * preaccumulated block are lost.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param p\n",
+    " * @param result - recorded on p.\n",
+    " * @param n\n",
+    " * @param inputs - the independent variables given to ad_preaccumulate_init_p.\n",
+    " * @return result with an id of gs.\n",
+    " */\n",
+    "inline const struct ad_variable pad_preaccumulate(struct ad_gradient_structure* gs, struct ad_private_gradient_structure* p,\n",
+    "        struct ad_variable result, int n, const struct ad_variable* inputs) {\n",
+    "    double dx[PREACCUMULATE_INPUTS];\n",
+    "    if (gs->recording != 1) {\n",
+    "        return (struct ad_variable) {\n",
+    "            .value = result.value, .id = 0\n",
+    "        };\n",
+    "    }\n",
+    "    ad_preaccumulate_sweep_p(p, result, n, dx);\n",
+    "    return pad_nary(gs, result.value, n, dx, inputs);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Same as pad_preaccumulate, recording on the global gradient structure.\n",
+    " */\n",
+    "inline const struct ad_variable ad_preaccumulate(__global struct ad_gradient_structure* gs, struct ad_private_gradient_structure* p,\n",
+    "        struct ad_variable result, int n, const struct ad_variable* inputs) {\n",
+    "    double dx[PREACCUMULATE_INPUTS];\n",
+    "    if (gs->recording != 1) {\n",
+    "        return (struct ad_variable) {\n",
+    "            .value = result.value, .id = 0\n",
+    "        };\n",
+    "    }\n",
+    "    ad_preaccumulate_sweep_p(p, result, n, dx);\n",
+    "    return ad_nary(gs, result.value, n, dx, inputs);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Forward mode. An ad_dual carries its value and its partial derivatives \n",
+    " * w.r.t. AD_DUAL_WIDTH independent variables in one real_t vector, so \n",
+    " * models with a handful of parameters need no tape at all: every work \n",
+    " * item computes its term with the ad_dual_ operations and the terms are \n",
+    " * summed with ad_dual_group_sum and ad_dual_reduce. Must match ad4cl.h, \n",
+    " * see AD4CL_BUILD_OPTIONS.\n",
+    " */\n",
+    "#ifndef AD_DUAL_WIDTH\n",
+    "#define AD_DUAL_WIDTH 2\n",
+    "#endif\n",
+    "\n",
+    "#if AD_DUAL_WIDTH == 2\n",
+    "typedef real2_t ad_dual_vector_t;\n",
+    "#elif AD_DUAL_WIDTH == 4\n",
+    "typedef real4_t ad_dual_vector_t;\n",
+    "#elif AD_DUAL_WIDTH == 8\n",
+    "typedef real8_t ad_dual_vector_t;\n",
+    "#elif AD_DUAL_WIDTH == 16\n",
+    "typedef real16_t ad_dual_vector_t;\n",
+    "#else\n",
+    "#error \"AD_DUAL_WIDTH must be 2, 4, 8 or 16\"\n",
+    "#endif\n",
+    "\n",
+    "struct ad_dual {\n",
+    "    real_t value;\n",
+    "    ad_dual_vector_t dx;\n",
+    "};\n",
+    "\n",
+    "/**\n",
+    " * The independent variable i of AD_DUAL_WIDTH with the given value.\n",
+    " */\n",
+    "inline struct ad_dual ad_dual_variable(real_t value, int i) {\n",
+    "    struct ad_dual ret = {.value = value, .dx = (ad_dual_vector_t) (0.0)};\n",
+    "    ((real_t*) &ret.dx)[i] = 1.0;\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * A constant, all partial derivatives are 0.\n",
+    " */\n",
+    "inline struct ad_dual ad_dual_constant(real_t value) {\n",
+    "    struct ad_dual ret = {.value = value, .dx = (ad_dual_vector_t) (0.0)};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Chain rule of the unary operations: the result has value and partial \n",
+    " * derivative d w.r.t. v.\n",
+    " */\n",
+    "inline struct ad_dual ad_dual_chain(real_t value, real_t d, struct ad_dual v) {\n",
+    "    struct ad_dual ret = {.value = value, .dx = d * v.dx};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_plus(struct ad_dual a, struct ad_dual b) {\n",
+    "    struct ad_dual ret = {.value = a.value + b.value, .dx = a.dx + b.dx};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_plus_vd(struct ad_dual a, real_t b) {\n",
+    "    a.value += b;\n",
+    "    return a;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_plus_dv(real_t a, struct ad_dual b) {\n",
+    "    b.value += a;\n",
+    "    return b;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_minus(struct ad_dual a, struct ad_dual b) {\n",
+    "    struct ad_dual ret = {.value = a.value - b.value, .dx = a.dx - b.dx};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_minus_vd(struct ad_dual a, real_t b) {\n",
+    "    a.value -= b;\n",
+    "    return a;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_minus_dv(real_t a, struct ad_dual b) {\n",
+    "    struct ad_dual ret = {.value = a - b.value, .dx = -b.dx};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_times(struct ad_dual a, struct ad_dual b) {\n",
+    "    struct ad_dual ret = {.value = a.value * b.value, .dx = b.value * a.dx + a.value * b.dx};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_times_vd(struct ad_dual a, real_t b) {\n",
+    "    return ad_dual_chain(a.value * b, b, a);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_times_dv(real_t a, struct ad_dual b) {\n",
+    "    return ad_dual_chain(a * b.value, a, b);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_divide(struct ad_dual a, struct ad_dual b) {\n",
+    "    real_t inv = 1.0 / b.value;\n",
+    "    real_t value = a.value * inv;\n",
+    "    struct ad_dual ret = {.value = value, .dx = inv * a.dx - value * inv * b.dx};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_divide_vd(struct ad_dual a, real_t b) {\n",
+    "    real_t inv = 1.0 / b;\n",
+    "    return ad_dual_chain(a.value * inv, inv, a);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_divide_dv(real_t a, struct ad_dual b) {\n",
+    "    real_t value = a / b.value;\n",
+    "    return ad_dual_chain(value, -1.0 * value / b.value, b);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_cos(struct ad_dual v) {\n",
+    "    return ad_dual_chain(cos(v.value), -1.0 * sin(v.value), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_sin(struct ad_dual v) {\n",
+    "    return ad_dual_chain(sin(v.value), cos(v.value), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_tan(struct ad_dual v) {\n",
+    "    real_t temp = 1.0 / cos(v.value);\n",
+    "    return ad_dual_chain(tan(v.value), temp*temp, v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_acos(struct ad_dual v) {\n",
+    "    return ad_dual_chain(acos(v.value), -1.0 / sqrt(1.0 - v.value * v.value), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_asin(struct ad_dual v) {\n",
+    "    return ad_dual_chain(asin(v.value), 1.0 / sqrt(1.0 - v.value * v.value), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_atan(struct ad_dual v) {\n",
+    "    return ad_dual_chain(atan(v.value), 1.0 / (v.value * v.value + 1.0), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_cosh(struct ad_dual v) {\n",
+    "    return ad_dual_chain(cosh(v.value), sinh(v.value), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_sinh(struct ad_dual v) {\n",
+    "    return ad_dual_chain(sinh(v.value), cosh(v.value), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_tanh(struct ad_dual v) {\n",
+    "    real_t temp = 1.0 / cosh(v.value);\n",
+    "    return ad_dual_chain(tanh(v.value), temp*temp, v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_exp(struct ad_dual v) {\n",
+    "    real_t value = exp(v.value);\n",
+    "    return ad_dual_chain(value, value, v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_log(struct ad_dual v) {\n",
+    "    return ad_dual_chain(log(v.value), 1.0 / v.value, v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_log10(struct ad_dual v) {\n",
+    "    return ad_dual_chain(log10(v.value), 1.0 / (v.value * 2.30258509299404590109361379290930926799774169921875), v);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_pow(struct ad_dual a, struct ad_dual b) {\n",
+    "    real_t value = pow(a.value, b.value);\n",
+    "    struct ad_dual ret = {.value = value,\n",
+    "        .dx = b.value * pow(a.value, b.value - 1.0) * a.dx + log(a.value) * value * b.dx};\n",
+    "    return ret;\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_pow_vd(struct ad_dual a, real_t b) {\n",
+    "    return ad_dual_chain(pow(a.value, b), b * pow(a.value, b - 1.0), a);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_pow_dv(real_t a, struct ad_dual b) {\n",
+    "    real_t value = pow(a, b.value);\n",
+    "    return ad_dual_chain(value, log(a) * value, b);\n",
+    "}\n",
+    "\n",
+    "inline struct ad_dual ad_dual_sqrt(struct ad_dual v) {\n",
+    "    real_t value = sqrt(v.value);\n",
+    "    return ad_dual_chain(value, .5 / value, v);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Sums v over the work group, work item 0 writes the sum to \n",
+    " * out[get_group_id(0)]. Every work item of the group must call it. The \n",
+    " * local size must be a power of two.\n",
+    " * \n",
+    " * @param v\n",
+    " * @param scratch - local memory for get_local_size(0) ad_duals.\n",
+    " * @param out - a row per work group, see ad_dual_reduce.\n",
+    " */\n",
+    "inline void ad_dual_group_sum(struct ad_dual v, __local struct ad_dual* scratch, __global struct ad_dual* out) {\n",
+    "    int lid = get_local_id(0);\n",
+    "    scratch[lid] = v;\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    for (int s = get_local_size(0) / 2; s > 0; s >>= 1) {\n",
+    "        if (lid < s) {\n",
+    "            scratch[lid] = ad_dual_plus(scratch[lid], scratch[lid + s]);\n",
+    "        }\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    }\n",
+    "    if (lid == 0) {\n",
+    "        out[get_group_id(0)] = scratch[0];\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Sums in[0..n) into out[get_group_id(0)], launched as a single work \n",
+    " * group it reduces the rows of ad_dual_group_sum to one ad_dual. The \n",
+    " * order of the additions only depends on n and the local size. A second \n",
+    " * dimension reduces a batch: group k of it sums in[k * n..(k + 1) * n) \n",
+    " * into out[k * get_num_groups(0) + get_group_id(0)].\n",
+    " * \n",
+    " * @param in\n",
+    " * @param n\n",
+    " * @param out\n",
+    " * @param scratch - local memory for get_local_size(0) ad_duals.\n",
+    " */\n",
+    "__kernel void ad_dual_reduce(__global const struct ad_dual* in,\n",
+    "        int n,\n",
+    "        __global struct ad_dual* out,\n",
+    "        __local struct ad_dual* scratch) {\n",
+    "    in += get_group_id(1) * n;\n",
+    "    out += get_group_id(1) * get_num_groups(0);\n",
+    "    struct ad_dual sum = ad_dual_constant(0.0);\n",
+    "    for (int i = get_global_id(0); i < n; i += get_global_size(0)) {\n",
+    "        sum = ad_dual_plus(sum, in[i]);\n",
+    "    }\n",
+    "    ad_dual_group_sum(sum, scratch, out);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Work group sum of the values (and tangents) of v, written to \n",
+    " * out[get_group_id(0)] with id 0. The local size must be a power of two.\n",
+    " * \n",
+    " * @param v\n",
+    " * @param scratch - local memory for get_local_size(0) ad_variables.\n",
+    " * @param out\n",
+    " */\n",
+    "inline void ad_variable_group_sum(struct ad_variable v, __local struct ad_variable* scratch, __global struct ad_variable* out) {\n",
+    "    int lid = get_local_id(0);\n",
+    "    scratch[lid] = v;\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    for (int s = get_local_size(0) / 2; s > 0; s >>= 1) {\n",
+    "        if (lid < s) {\n",
+    "            scratch[lid].value += scratch[lid + s].value;\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "            scratch[lid].tangent += scratch[lid + s].tangent;\n",
+    "#endif\n",
+    "        }\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    }\n",
+    "    if (lid == 0) {\n",
+    "        scratch[0].id = 0;\n",
+    "        out[get_group_id(0)] = scratch[0];\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * First pass of ad_sum_reduce/ad_dot_reduce. The result is recorded as \n",
+    " * one entry of AD_NARY_OPERATIONS(n) operations starting at gs->counter, \n",
+    " * laid out like ad_nary: with AD_CSR_TAPE one slot of n pairs, otherwise \n",
+    " * consecutive slots of which the last holds the result. All slots, ids \n",
+    " * and pairs follow from \n",
+    " * gs->counter and gs->pair_counter, so every work item writes its own \n",
+    " * part without atomics. The counters are only advanced by \n",
+    " * ad_reduce_result.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param in\n",
+    " * @param weights - the partial derivative of every input, 0 for all 1.\n",
+    " * @param n - number of inputs, at least 1.\n",
+    " * @param rows - a partial value per work group.\n",
+    " * @param scratch\n",
+    " */\n",
+    "inline void ad_linear_reduce(__global struct ad_gradient_structure* gs,\n",
+    "        __global const struct ad_variable* in,\n",
+    "        __global const double* weights,\n",
+    "        int n,\n",
+    "        __global struct ad_variable* rows,\n",
+    "        __local struct ad_variable* scratch) {\n",
+    "    struct ad_variable r = {.value = 0.0, .id = 0};\n",
+    "    int base = gs->counter;\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "    int p = gs->pair_current + gs->pair_counter;\n",
+    "#endif\n",
+    "\n",
+    "    for (int i = get_global_id(0); i < n; i += get_global_size(0)) {\n",
+    "        double w = weights ? weights[i] : 1.0;\n",
+    "        r.value += w * in[i].value;\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "        r.tangent += w * in[i].tangent;\n",
+    "#endif\n",
+    "        if (gs->recording == 1) {\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "            gs->coeff_dx[p + i] = w;\n",
+    "            gs->coeff_id[p + i] = in[i].id;\n",
+    "            if (i == 0) {\n",
+    "                int current = base + gs->stack_current;\n",
+    "                AD_STORE_ID(gs->entry_id[current], base + gs->current_ad_variable_id);\n",
+    "                gs->entry_size[current] = n;\n",
+    "                gs->entry_offset[current] = p;\n",
+    "            }\n",
+    "#else\n",
+    "            int last = base + AD_NARY_OPERATIONS(n) - 1 + gs->stack_current;\n",
+    "            AD_ENTRY_DX(gs, last, i) = w;\n",
+    "            AD_ENTRY_COEFF_ID(gs, last, i) = in[i].id;\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "            AD_ENTRY_DDX(gs, last, i) = 0.0;\n",
+    "#endif\n",
+    "            if (i % MAX_VARIABLE_IN_EXPESSION == 0) {\n",
+    "                int slot = last - i / MAX_VARIABLE_IN_EXPESSION;\n",
+    "                if (slot == last) {\n",
+    "                    AD_RECORD_NARY_SLOT(gs, slot, last + gs->current_ad_variable_id - gs->stack_current, n);\n",
+    "                } else {\n",
+    "                    AD_RECORD_NARY_SLOT(gs, slot, 0, 0);\n",
+    "                }\n",
+    "            }\n",
+    "#endif\n",
+    "        }\n",
+    "    }\n",
+    "\n",
+    "    ad_variable_group_sum(r, scratch, rows);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Records the sum of in[0..n) on the tape, see ad_linear_reduce. \n",
+    " * Finished by ad_reduce_result over the get_num_groups(0) rows.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " * @param in\n",
+    " * @param n\n",
+    " * @param rows\n",
+    " * @param scratch - local memory for get_local_size(0) ad_variables.\n",
+    " */\n",
+    "__kernel void ad_sum_reduce(__global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry* gradient_stack,\n",
+    "        __global const struct ad_variable* in,\n",
+    "        int n,\n",
+    "        __global struct ad_variable* rows,\n",
+    "        __local struct ad_variable* scratch) {\n",
+    "    ad_init(gs, gradient_stack);\n",
+    "    ad_linear_reduce(gs, in, 0, n, rows, scratch);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Records the sum of weights[i] * in[i] on the tape, see \n",
+    " * ad_linear_reduce. Finished by ad_reduce_result over the \n",
+    " * get_num_groups(0) rows.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " * @param in\n",
+    " * @param weights\n",
+    " * @param n\n",
+    " * @param rows\n",
+    " * @param scratch - local memory for get_local_size(0) ad_variables.\n",
+    " */\n",
+    "__kernel void ad_dot_reduce(__global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry* gradient_stack,\n",
+    "        __global const struct ad_variable* in,\n",
+    "        __global const double* weights,\n",
+    "        int n,\n",
+    "        __global struct ad_variable* rows,\n",
+    "        __local struct ad_variable* scratch) {\n",
+    "    ad_init(gs, gradient_stack);\n",
+    "    ad_linear_reduce(gs, in, weights, n, rows, scratch);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Second pass of ad_sum_reduce/ad_dot_reduce, launched as a single work \n",
+    " * group: sums the rows into result, gives it the id of the last recorded \n",
+    " * entry and advances the counters of gs past the n inputs.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param rows\n",
+    " * @param groups - number of rows, the work groups of the first pass.\n",
+    " * @param n\n",
+    " * @param result\n",
+    " * @param scratch - local memory for get_local_size(0) ad_variables.\n",
+    " */\n",
+    "__kernel void ad_reduce_result(__global struct ad_gradient_structure* gs,\n",
+    "        __global const struct ad_variable* rows,\n",
+    "        int groups,\n",
+    "        int n,\n",
+    "        __global struct ad_variable* result,\n",
+    "        __local struct ad_variable* scratch) {\n",
+    "    struct ad_variable r = {.value = 0.0, .id = 0};\n",
+    "    for (int i = get_global_id(0); i < groups; i += get_global_size(0)) {\n",
+    "        r.value += rows[i].value;\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "        r.tangent += rows[i].tangent;\n",
+    "#endif\n",
+    "    }\n",
+    "    ad_variable_group_sum(r, scratch, result);\n",
+    "\n",
+    "    if (get_local_id(0) == 0 && gs->recording == 1) {\n",
+    "        int operations = AD_NARY_OPERATIONS(n);\n",
+    "        result->id = gs->counter + operations - 1 + gs->current_ad_variable_id;\n",
+    "        gs->counter += operations;\n",
+    "#ifdef AD_CSR_TAPE\n",
+    "        gs->pair_counter += n;\n",
+    "#endif\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "\n",
+    "\n",
+    "\n",
+    "\n",
+    "\n",
+    "\n",
+    "\n",
+    "#if defined(cl_khr_int64_base_atomics)\n",
+    "#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable\n",
+    "\n",
+    "/**\n",
+    " * Number of independent variables whose adjoints ad_reverse_sweep sums \n",
+    " * per work group instead of adding them atomically.\n",
+    " */\n",
+    "#ifndef AD_SWEEP_INPUTS\n",
+    "#define AD_SWEEP_INPUTS 4\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Adds v to *p. OpenCL 1.x has no atomic add for doubles, so this is a \n",
+    " * compare and swap loop on the bits.\n",
+    " */\n",
+    "inline void ad_atomic_add(__global double* p, double v) {\n",
+    "    union {\n",
+    "        double d;\n",
+    "        long l;\n",
+    "    } old, next;\n",
+    "    do {\n",
+    "        old.d = *p;\n",
+    "        next.d = old.d + v;\n",
+    "    } while (atom_cmpxchg((volatile __global long*) p, old.l, next.l) != old.l);\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Sums the first inputs entries of adjoint over the work group and adds \n",
+    " * them to row get_group_id(0) of rows. The local size must be a power of \n",
+    " * two.\n",
+    " */\n",
+    "inline void ad_sweep_sum_inputs(const double* adjoint, int inputs, __global double* rows, __local double* scratch) {\n",
+    "    int lid = get_local_id(0);\n",
+    "    for (int i = 0; i < inputs; i++) {\n",
+    "        scratch[lid] = adjoint[i];\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "        for (int s = get_local_size(0) / 2; s > 0; s >>= 1) {\n",
+    "            if (lid < s) {\n",
+    "                scratch[lid] += scratch[lid + s];\n",
+    "            }\n",
+    "            barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "        }\n",
+    "        if (lid == 0) {\n",
+    "            rows[get_group_id(0) * inputs + i] += scratch[0];\n",
+    "        }\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Prepares the buffers of ad_reverse_sweep: the adjoint of the last \n",
+    " * variable recorded on gs is 1, all other adjoints and the rows of \n",
+    " * input_adjoint are 0. Works with any global size.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " * @param gradient - room for every id of gs.\n",
+    " * @param input_adjoint\n",
+    " * @param rows - number of rows of input_adjoint.\n",
+    " * @param inputs\n",
+    " */\n",
+    "__kernel void ad_gradient_init(__global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry* gradient_stack,\n",
+    "        __global double* gradient,\n",
+    "        __global double* input_adjoint,\n",
+    "        int rows,\n",
+    "        int inputs) {\n",
+    "    ad_init(gs, gradient_stack);\n",
+    "    inputs = min(inputs, AD_SWEEP_INPUTS);\n",
+    "    int size = gs->current_ad_variable_id + gs->counter + 1;\n",
+    "    int seed = AD_ENTRY_ID(gs, gs->stack_current + gs->counter - 1);\n",
+    "    for (int i = get_global_id(0); i < size; i += get_global_size(0)) {\n",
+    "        gradient[i] = i == seed ? 1.0 : 0.0;\n",
+    "    }\n",
+    "    for (int i = get_global_id(0); i < rows * inputs; i += get_global_size(0)) {\n",
+    "        input_adjoint[i] = 0.0;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Reverse sweep of the tape slots [begin, end), one segment of segment \n",
+    " * consecutive slots per work item. end < 0 stands for the end of the tape.\n",
+    " * \n",
+    " * Launch once per level, in order: a slot using a result from another \n",
+    " * segment must have been swept by an earlier launch. For a recording \n",
+    " * made of pad_init blocks followed by a serial tail (e.g. the sum of the \n",
+    " * kernel outputs) that is one launch over the tail with a single work \n",
+    " * item, then one over the blocks with segment set to the operations \n",
+    " * passed to pad_init.\n",
+    " * \n",
+    " * Adjoints of ids below inputs (the independent variables, at most \n",
+    " * AD_SWEEP_INPUTS) are summed per work group and added to row \n",
+    " * get_group_id(0) of input_adjoint, see ad_gradient_gather. All other \n",
+    " * adjoints are updated atomically. The local size must be a power of two.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " * @param gradient - initialized by ad_gradient_init.\n",
+    " * @param begin\n",
+    " * @param end\n",
+    " * @param segment\n",
+    " * @param inputs\n",
+    " * @param input_adjoint\n",
+    " * @param scratch - a double per work item.\n",
+    " */\n",
+    "__kernel void ad_reverse_sweep(__global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry* gradient_stack,\n",
+    "        __global double* gradient,\n",
+    "        int begin,\n",
+    "        int end,\n",
+    "        int segment,\n",
+    "        int inputs,\n",
+    "        __global double* input_adjoint,\n",
+    "        __local double* scratch) {\n",
+    "    double adjoint[AD_SWEEP_INPUTS];\n",
+    "    for (int i = 0; i < AD_SWEEP_INPUTS; i++) {\n",
+    "        adjoint[i] = 0.0;\n",
+    "    }\n",
+    "\n",
+    "    ad_init(gs, gradient_stack);\n",
+    "    inputs = min(inputs, AD_SWEEP_INPUTS);\n",
+    "    if (end < 0) {\n",
+    "        end = gs->stack_current + gs->counter;\n",
+    "    }\n",
+    "\n",
+    "    int first = begin + get_global_id(0) * segment;\n",
+    "    int last = min(first + segment, end);\n",
+    "    for (int j = last - 1; j >= first; j--) {\n",
+    "        int size = AD_ENTRY_SIZE(gs, j);\n",
+    "        if (size > 0) {\n",
+    "            double w = gradient[AD_ENTRY_ID(gs, j)];\n",
+    "            for (int i = 0; i < size; i++) {\n",
+    "                int id = AD_ENTRY_COEFF_ID(gs, j, i);\n",
+    "                double dx = w * AD_ENTRY_DX(gs, j, i);\n",
+    "                if (id < inputs) {\n",
+    "                    adjoint[id] += dx;\n",
+    "                } else {\n",
+    "                    ad_atomic_add(&gradient[id], dx);\n",
+    "                }\n",
+    "            }\n",
+    "        }\n",
+    "    }\n",
+    "\n",
+    "    ad_sweep_sum_inputs(adjoint, inputs, input_adjoint, scratch);\n",
+    "}\n",
+    "\n",
+    "#ifdef AD_HESSIAN_VECTOR\n",
+    "\n",
+    "/**\n",
+    " * Same as ad_gradient_init for ad_reverse_sweep_hv, tangent and the rows \n",
+    " * of input_tangent are set to 0.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " * @param gradient\n",
+    " * @param tangent - room for every id of gs.\n",
+    " * @param input_adjoint\n",
+    " * @param input_tangent\n",
+    " * @param rows\n",
+    " * @param inputs\n",
+    " */\n",
+    "__kernel void ad_hessian_vector_init(__global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry* gradient_stack,\n",
+    "        __global double* gradient,\n",
+    "        __global double* tangent,\n",
+    "        __global double* input_adjoint,\n",
+    "        __global double* input_tangent,\n",
+    "        int rows,\n",
+    "        int inputs) {\n",
+    "    ad_init(gs, gradient_stack);\n",
+    "    inputs = min(inputs, AD_SWEEP_INPUTS);\n",
+    "    int size = gs->current_ad_variable_id + gs->counter + 1;\n",
+    "    int seed = AD_ENTRY_ID(gs, gs->stack_current + gs->counter - 1);\n",
+    "    for (int i = get_global_id(0); i < size; i += get_global_size(0)) {\n",
+    "        gradient[i] = i == seed ? 1.0 : 0.0;\n",
+    "        tangent[i] = 0.0;\n",
+    "    }\n",
+    "    for (int i = get_global_id(0); i < rows * inputs; i += get_global_size(0)) {\n",
+    "        input_adjoint[i] = 0.0;\n",
+    "        input_tangent[i] = 0.0;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/**\n",
+    " * Combined reverse sweep of a tape recorded with AD_HESSIAN_VECTOR: \n",
+    " * gradient gets the adjoints as with ad_reverse_sweep and tangent their \n",
+    " * derivatives along the direction the independent variables were given \n",
+    " * as tangents, so the tangents of the independent variables are H·v. \n",
+    " * Launched like ad_reverse_sweep, the input rows of both are read with \n",
+    " * ad_gradient_gather.\n",
+    " * \n",
+    " * @param gs\n",
+    " * @param gradient_stack\n",
+    " * @param gradient - initialized by ad_hessian_vector_init.\n",
+    " * @param tangent - initialized by ad_hessian_vector_init.\n",
+    " * @param begin\n",
+    " * @param end\n",
+    " * @param segment\n",
+    " * @param inputs\n",
+    " * @param input_adjoint\n",
+    " * @param input_tangent\n",
+    " * @param scratch - a double per work item.\n",
+    " */\n",
+    "__kernel void ad_reverse_sweep_hv(__global struct ad_gradient_structure* gs,\n",
+    "        __global struct ad_entry* gradient_stack,\n",
+    "        __global double* gradient,\n",
+    "        __global double* tangent,\n",
+    "        int begin,\n",
+    "        int end,\n",
+    "        int segment,\n",
+    "        int inputs,\n",
+    "        __global double* input_adjoint,\n",
+    "        __global double* input_tangent,\n",
+    "        __local double* scratch) {\n",
+    "    double adjoint[AD_SWEEP_INPUTS];\n",
+    "    double adjoint_tangent[AD_SWEEP_INPUTS];\n",
+    "    for (int i = 0; i < AD_SWEEP_INPUTS; i++) {\n",
+    "        adjoint[i] = 0.0;\n",
+    "        adjoint_tangent[i] = 0.0;\n",
+    "    }\n",
+    "\n",
+    "    ad_init(gs, gradient_stack);\n",
+    "    inputs = min(inputs, AD_SWEEP_INPUTS);\n",
+    "    if (end < 0) {\n",
+    "        end = gs->stack_current + gs->counter;\n",
+    "    }\n",
+    "\n",
+    "    int first = begin + get_global_id(0) * segment;\n",
+    "    int last = min(first + segment, end);\n",
+    "    for (int j = last - 1; j >= first; j--) {\n",
+    "        int size = AD_ENTRY_SIZE(gs, j);\n",
+    "        if (size > 0) {\n",
+    "            int result = AD_ENTRY_ID(gs, j);\n",
+    "            double w = gradient[result];\n",
+    "            double t = tangent[result];\n",
+    "            for (int i = 0; i < size; i++) {\n",
+    "                int id = AD_ENTRY_COEFF_ID(gs, j, i);\n",
+    "                double dx = AD_ENTRY_DX(gs, j, i);\n",
+    "                double a = w * dx;\n",
+    "                double da = t * dx + w * AD_ENTRY_DDX(gs, j, i);\n",
+    "                if (id < inputs) {\n",
+    "                    adjoint[id] += a;\n",
+    "                    adjoint_tangent[id] += da;\n",
+    "                } else {\n",
+    "                    ad_atomic_add(&gradient[id], a);\n",
+    "                    ad_atomic_add(&tangent[id], da);\n",
+    "                }\n",
+    "            }\n",
+    "        }\n",
+    "    }\n",
+    "\n",
+    "    ad_sweep_sum_inputs(adjoint, inputs, input_adjoint, scratch);\n",
+    "    ad_sweep_sum_inputs(adjoint_tangent, inputs, input_tangent, scratch);\n",
+    "}\n",
+    "#endif\n",
+    "\n",
+    "/**\n",
+    " * Copies the adjoints of ids[0..n) to out, adding up the rows of \n",
+    " * input_adjoint for the independent variables, so only the n adjoints the \n",
+    " * caller needs are read back instead of the tape or the whole gradient.\n",
+    " * \n",
+    " * @param gradient\n",
+    " * @param input_adjoint\n",
+    " * @param rows\n",
+    " * @param inputs\n",
+    " * @param ids\n",
+    " * @param n\n",
+    " * @param out\n",
+    " */\n",
+    "__kernel void ad_gradient_gather(__global const double* gradient,\n",
+    "        __global const double* input_adjoint,\n",
+    "        int rows,\n",
+    "        int inputs,\n",
+    "        __global const int* ids,\n",
+    "        int n,\n",
+    "        __global double* out) {\n",
+    "    int k = get_global_id(0);\n",
+    "    inputs = min(inputs, AD_SWEEP_INPUTS);\n",
+    "    if (k < n) {\n",
+    "        int id = ids[k];\n",
+    "        double g = gradient[id];\n",
+    "        if (id < inputs) {\n",
+    "            for (int r = 0; r < rows; r++) {\n",
+    "                g += input_adjoint[r * inputs + id];\n",
+    "            }\n",
+    "        }\n",
+    "        out[k] = g;\n",
+    "    }\n",
+    "}\n",
+    "#endif\n",
+    0
+};
@@ -1,3 +1,4 @@
 #!/bin/sh
 
+make ad_cl.h
 clang++  -O3 main.cpp -framework OpenCL
@@ -1,28 +1,41 @@
 
-__kernel void AD(__global struct gradient_structure* gs,
-        __global struct entry* gradient_stack,
-        __global struct variable* a,
-        __global struct variable*b,
+/**
+ * Counting pass of AD: the number of pad_ operations every work item 
+ * records, turned into tape offsets by ad_scan_operations.
+ */
+__kernel void AD_count(__global int* offsets, int size) {
+    int id = get_global_id(0);
+    offsets[id] = id < size ? 4 : 0;
+}
+
+__kernel void AD(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __constant struct ad_variable* params,
         __global double *x,
         __global double *y,
-        __global struct variable *out, int size) {
+        __global struct ad_variable *out, int size,
+        __global const int* offsets) {
 
+    struct ad_gradient_structure pgs;
 
     //initialize the gradient structure
     ad_init(gs, gradient_stack);
 
+    //our block of the tape comes from the counting pass, no atomics
+    pad_init_scan(offsets, &pgs, gs, gradient_stack);
+
     //get global id
     int id = get_global_id(0);
 
 
     
      if (id < size) {
-        struct variable aa = *a;
-        struct variable bb = *b;
+        struct ad_variable aa = params[0];
+        struct ad_variable bb = params[1];
         double xx = x[id];
         double yy = y[id];
-        struct variable temp = ad_minus_vd(gs, ad_plus(gs, ad_times_vd(gs, aa, xx), bb), yy);
-        out[id]=ad_times(gs, temp, temp);
+        struct ad_variable temp = pad_minus_vd(&pgs, pad_plus(&pgs, pad_times_vd(&pgs, aa, xx), bb), yy);
+        out[id]=pad_times(&pgs, temp, temp);
     }
     
 
@@ -16,8 +16,7 @@
 
 #define __CL_ENABLE_EXCEPTIONS 
 
-#include "cl.hpp"
-#include "ad4cl.h"
+#include "Runtime.hpp"
 #include "Variable.hpp"
 #include <fstream>
 #include <sstream>
@@ -117,20 +116,31 @@ std::string my_kernel = "__kernel void AD(__global struct gradient_structure* gs
    " }\n/*if(get_local_id(0)){gs->counter+=lgs.current_variable_id++;}*/"\
   "}\n";
 
-void AD(struct gradient_structure* gs,
-        struct variable* a,
-        struct variable*b,
+void AD(struct ad_gradient_structure* gs,
+        struct ad_variable* a,
+        struct ad_variable*b,
         double *x,
         double *y,
-        struct variable *out, int size) {
+        struct ad_variable *out, int size) {
 
     //    int id = get_global_id(0);
-    for (int i = 0; i < size; i++) {
-        //minus(gs, plus(gs, times(gs,a, x[i]) ,b), y[i]);
-        struct variable temp =  ad_minus_vd(gs, ad_plus(gs, ad_times_vd(gs, *a, x[i]), *b), y[i]);
-        struct variable v = ad_times(gs,temp,temp);// minus_vd(gs, plus_vv(gs, times_vd(gs, *a, x[i]), *b), y[i]), minus_vd(gs, plus_vv(gs, times_vd(gs, *a, x[i]), *b), y[i]));
-        out[i] = v;
-        //        std::cout << out[i].value << " === " << std::pow(((a->value * x[i] + b->value) - y[i]), 2.0) << "\n";
+    //with AD_THREAD_SAFE the observations are recorded on all cores, see ad_thread_flush
+#ifdef _OPENMP
+#pragma omp parallel if (AD_HOST_THREADS)
+#endif
+    {
+        ad_thread_flush(gs);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+        for (int i = 0; i < size; i++) {
+            //minus(gs, plus(gs, times(gs,a, x[i]) ,b), y[i]);
+            struct ad_variable temp =  ad_minus_vd(gs, ad_plus(gs, ad_times_vd(gs, *a, x[i]), *b), y[i]);
+            struct ad_variable v = ad_times(gs,temp,temp);// minus_vd(gs, plus_vv(gs, times_vd(gs, *a, x[i]), *b), y[i]), minus_vd(gs, plus_vv(gs, times_vd(gs, *a, x[i]), *b), y[i]));
+            out[i] = v;
+            //        std::cout << out[i].value << " === " << std::pow(((a->value * x[i] + b->value) - y[i]), 2.0) << "\n";
+        }
+        ad_thread_flush(gs);
     }
 
 
@@ -138,6 +148,46 @@ void AD(struct gradient_structure* gs,
 #include <sys/time.h>
 int HOST = 0;
 
+/**
+ * One evaluation in flight: a gradient structure with its tape and the 
+ * device buffers it is recorded from. main alternates two of them.
+ */
+struct evaluation {
+    struct ad_gradient_structure gs;
+    struct ad_entry* entries;
+    //a and b as uploaded, one write per evaluation
+    struct ad_variable params[2];
+    struct ad_variable sum;
+    cl::Event event;
+    cl::Buffer params_d;
+    cl::Buffer out_d;
+    cl::Buffer rows_d;
+    cl::Buffer sum_d;
+    cl::Buffer offsets_d;
+};
+
+/**
+ * Enqueues the recording of the objective at e.params on the device of 
+ * rt, up to the readback of the sum and the tape, and returns without 
+ * waiting, see Runtime::restore. The kernels of rt have their arguments 
+ * set already.
+ */
+void enqueue_evaluation(ad4cl::Runtime& rt, evaluation& e, const cl::NDRange& globalSize,
+        const cl::NDRange& localSize) {
+    rt.write(e.params_d, e.params, sizeof (e.params));
+
+    //counting pass and scan give every work item a fixed block of the tape
+    rt.record(rt.kernel("AD_count"), globalSize, localSize);
+    rt.record(rt.kernel("ad_scan_operations"), localSize, localSize);
+    e.event = rt.record(rt.kernel("AD"), globalSize, localSize);
+    rt.record(rt.kernel("ad_sum_reduce"), globalSize, localSize);
+    rt.record(rt.kernel("ad_reduce_result"), localSize, localSize);
+
+    //read the sum of our kernel values, the recording only when it is used
+    rt.read(e.sum_d, &e.sum, sizeof (ad_variable));
+    rt.readback(e.gs.recording == 1);
+}
+
 void TEST_EXPRESSION() {
 
 
@@ -157,96 +207,30 @@ void TEST_EXPRESSION() {
  * derivative w.r.t a variable.
  */
 int main(int argc, char** argv) {
-    std::cout << sizeof (struct gradient_structure) << "\n" << sizeof (struct entry);
+    std::cout << sizeof (struct ad_gradient_structure) << "\n" << sizeof (struct ad_entry);
     std::cout << "\n" << 49000 / 40 << "\n";
 
-    std::string source_code;
-
-    //Read the ad4cl api.
-    std::string line;
-    std::ifstream in;
-    in.open("ad.cl");
-
-    std::stringstream ss;
-
-    while (in.good()) {
-        std::getline(in, line);
-        ss << line << "\n";
-    }
-    
-     std::ifstream kin;
-    kin.open("kernel.cl");
-
-    while (kin.good()) {
-        std::getline(kin, line);
-        ss << line << "\n";
-    }
-    
-
-    //append with our kernel
-//    ss << my_kernel;
-    source_code = ss.str();
-
-    std::cout<<source_code<<"\n";
-
-
-
-    //opencl declarations
-    cl::CommandQueue queue;
-    cl::Kernel kernel;
-    cl::Context context;
-    cl::Program program_;
-    std::vector<cl::Device> devices;
-    cl_int error = CL_SUCCESS;
-
-    // Query platforms
-    std::vector<cl::Platform> platforms;
+    //context, queue, program and the device gradient structure of the two 
+    //evaluations in flight, rt[1] shares the context and program of rt[0]
+    ad4cl::Runtime rt[2];
 
     try {
-        cl::Platform::get(&platforms);
-        if (platforms.size() == 0) {
-            std::cout << "Platform size 0\n";
-            exit(0);
-        }
-
-        //print platform info 
-        std::cout << platforms[0];
-
-        // Get list of devices on default platform and create context
-        cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties) (platforms[0])(), 0};
-        context = cl::Context(CL_DEVICE_TYPE_GPU, properties);
-        devices = context.getInfo<CL_CONTEXT_DEVICES > ();
-
-
-        const cl::Device device = devices[0];
-
-        //print device info
-        std::cout << device << "\n";
-
-        //set the program source
-        cl::Program::Sources source(1, std::make_pair(source_code.c_str(), source_code.size()));
-        program_ = cl::Program(context, source, &error);
-
-        //build the program
-        program_.build(devices);
-
-        //set the queue
 #ifdef CL_PROFILING
-        queue = cl::CommandQueue(context, devices[0], CL_QUEUE_PROFILING_ENABLE);
+        rt[0].initialize(0, CL_DEVICE_TYPE_GPU, CL_QUEUE_PROFILING_ENABLE);
 #else
-        queue = cl::CommandQueue(context, devices[0]);
+        rt[0].initialize(0, CL_DEVICE_TYPE_GPU);
 #endif
-        if (error != CL_SUCCESS) {
-            std::cout << "---> " << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]) << "\n";
-            exit(0);
-        }
-
-
-        // Create kernel object
-        kernel = cl::Kernel(program_, "AD");
-
+        //print platform and device info 
+        std::cout << rt[0].platform();
+        std::cout << rt[0].device() << "\n";
+
+        //our kernels with the parts of the compiled in ad4cl api they use
+        const char* launched[] = {"ad_scan_operations", "ad_sum_reduce", "ad_reduce_result"};
+        rt[0].build_kernels("kernel.cl", AD4CL_BUILD_OPTIONS, std::vector<std::string>(launched, launched + 3));
+        rt[1].share(rt[0]);
     } catch (cl::Error err) {
-        std::cout << "---> " << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]);
+        std::cout << err.what() << "\n";
+        exit(0);
     }
 
 
@@ -258,7 +242,7 @@ int main(int argc, char** argv) {
     double* y = new double[DATA_SIZE];
 
     // Number of work items in each local work group
-    local_size = devices[0].getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE > ();
+    local_size = rt[0].device().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE > ();
 
     // Number of total work items - localSize must be devisor
     global_size = std::ceil(DATA_SIZE / (double) local_size + 1) * local_size;
@@ -273,66 +257,92 @@ std::cout << global_size << "\n";
         y[i] = aa * x[i] + bb;
     }
 
-    //create a gradient structure
-    struct gradient_structure gs;
-    gs.current_variable_id = 0;
-    gs.stack_current = 0;
-    gs.recording = 1;
-    gs.counter = 0;
-    struct entry* entries = new entry[STACK_SIZE];
-    for (int i = 0; i < STACK_SIZE; i++) {
-        entries[i].size = 0;
-        entries[i].id = 0;
+    //create the gradient structures, a and b are the first two ids of both
+    evaluation ev[2];
+    for (int s = 0; s < 2; s++) {
+        ev[s].gs = ad_gradient_structure();
+        ev[s].gs.recording = 1;
+        ev[s].entries = create_entries(STACK_SIZE);
+        ad_tape_bind(&ev[s].gs, ev[s].entries, STACK_SIZE);
+        ev[s].gs.current_variable_id = 2;
     }
-    gs.gradient_stack = entries;
 
     //create out variables
-    variable a = {.value = aa - .005, .id = gs.current_variable_id++};
-    variable b = {.value = bb - .0051, .id = gs.current_variable_id++};
-    variable sum = {.value = 0.0, .id = gs.current_variable_id++};
-    variable* out = new variable[DATA_SIZE]; //{.value = 0.0, .id = gs.current_variable_id++};
+    ad_variable a = {.value = aa - .005, .id = 0};
+    ad_variable b = {.value = bb - .0051, .id = 1};
+    ad_variable* out = new ad_variable[DATA_SIZE]; //{.value = 0.0, .id = gs.current_variable_id++};
 
+    const int ITERATIONS = 37;
 
     try {
 
-
-        //set the buffers
-        cl::Buffer gs_d = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof (gradient_structure));
-        cl::Buffer entry_d = cl::Buffer(context, CL_MEM_READ_WRITE, STACK_SIZE * sizeof (entry));
-        cl::Buffer a_d = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof (variable));
-        cl::Buffer b_d = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof (variable));
-        cl::Buffer x_d = cl::Buffer(context, CL_MEM_READ_ONLY, DATA_SIZE * sizeof (double));
-        cl::Buffer y_d = cl::Buffer(context, CL_MEM_READ_ONLY, DATA_SIZE * sizeof (double));
-        cl::Buffer out_d = cl::Buffer(context, CL_MEM_WRITE_ONLY, DATA_SIZE * sizeof (variable));
-
-        queue.enqueueWriteBuffer(x_d, CL_TRUE, 0, sizeof (double)*DATA_SIZE, x);
-        queue.enqueueWriteBuffer(y_d, CL_TRUE, 0, sizeof (double)*DATA_SIZE, y);
-        //        queue.enqueueWriteBuffer(out_d, CL_TRUE, 0, sizeof (variable), &out);
-
-        kernel.setArg(0, gs_d);
-        kernel.setArg(1, entry_d);
-        kernel.setArg(2, a_d);
-        kernel.setArg(3, b_d);
-        kernel.setArg(4, x_d);
-        kernel.setArg(5, y_d);
-        kernel.setArg(6, out_d);
-        kernel.setArg(7, DATA_SIZE);
-        //        kernel.setArg(8, DATA_STRIDE);
         // Number of work items in each local work group
         cl::NDRange localSize(local_size);
         // Number of total work items - localSize must be devisor
         cl::NDRange globalSize(global_size); //(int) (std::ceil(DATA_SIZE / (double) 64)*64));
 
+        //set the buffers, the data is shared, the rest is per evaluation
+        cl::Buffer x_d = rt[0].buffer(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, DATA_SIZE * sizeof (double), x);
+        cl::Buffer y_d = rt[0].buffer(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, DATA_SIZE * sizeof (double), y);
+
+        for (int s = 0; s < 2; s++) {
+            evaluation& e = ev[s];
+            rt[s].bind(&e.gs, e.entries, STACK_SIZE);
+            std::cout << "tape transport: " << rt[s].transport_name(rt[s].transport()) << "\n";
+            e.params_d = rt[s].buffer(CL_MEM_READ_ONLY, sizeof (e.params));
+            e.out_d = rt[s].buffer(CL_MEM_READ_WRITE, DATA_SIZE * sizeof (ad_variable));
+            e.rows_d = rt[s].buffer(CL_MEM_READ_WRITE, (global_size / local_size) * sizeof (ad_variable));
+            e.sum_d = rt[s].buffer(CL_MEM_WRITE_ONLY, sizeof (ad_variable));
+            e.offsets_d = rt[s].buffer(CL_MEM_READ_WRITE, (global_size + 3) * sizeof (int));
+
+            // Create kernel objects, the gradient structure and tape are bound by the runtime
+            cl::Kernel& kernel = rt[s].ad_kernel("AD");
+            cl::Kernel& count_kernel = rt[s].kernel("AD_count");
+            cl::Kernel& scan_kernel = rt[s].kernel("ad_scan_operations");
+            cl::Kernel& sum_kernel = rt[s].ad_kernel("ad_sum_reduce");
+            cl::Kernel& result_kernel = rt[s].kernel("ad_reduce_result");
+
+            kernel.setArg(2, e.params_d);
+            kernel.setArg(3, x_d);
+            kernel.setArg(4, y_d);
+            kernel.setArg(5, e.out_d);
+            kernel.setArg(6, DATA_SIZE);
+            kernel.setArg(7, e.offsets_d);
+            count_kernel.setArg(0, e.offsets_d);
+            count_kernel.setArg(1, DATA_SIZE);
+            scan_kernel.setArg(0, rt[s].gs_buffer());
+            scan_kernel.setArg(1, e.offsets_d);
+            scan_kernel.setArg(2, (int) global_size);
+            scan_kernel.setArg(3, cl::__local(local_size * sizeof (int)));
+            //out is summed and recorded on the device, only the sum is read back
+            sum_kernel.setArg(2, e.out_d);
+            sum_kernel.setArg(3, DATA_SIZE);
+            sum_kernel.setArg(4, e.rows_d);
+            sum_kernel.setArg(5, cl::__local(local_size * sizeof (ad_variable)));
+            result_kernel.setArg(0, rt[s].gs_buffer());
+            result_kernel.setArg(1, e.rows_d);
+            result_kernel.setArg(2, (int) (global_size / local_size));
+            result_kernel.setArg(3, DATA_SIZE);
+            result_kernel.setArg(4, e.sum_d);
+            result_kernel.setArg(5, cl::__local(local_size * sizeof (ad_variable)));
+        }
 
+        //the parameters of every iteration are known ahead, so the device 
+        //records iteration iter + 1 while the host sweeps iteration iter
+        if (!HOST) {
+            ev[0].params[0] = a;
+            ev[0].params[1] = b;
+            enqueue_evaluation(rt[0], ev[0], globalSize, localSize);
+        }
 
-        for (int iter = 0; iter < 37; iter++) {
-            sum.value = 0.0;
+        for (int iter = 0; iter < ITERATIONS; iter++) {
             std::cout << "iteration " << iter << std::endl;
-            if ((iter % 2) == 0) {
-                gs.recording = 1;
-            } else {
-                gs.recording = 1;
-            }
+            evaluation& e = ev[iter & 1];
+            struct ad_gradient_structure& gs = e.gs;
+
+            //our function value.
+            struct ad_variable f;
+            struct ad_variable sum;
 
             if (HOST) {
                 static struct timeval tm1, tm2;
@@ -343,33 +353,24 @@ std::cout << global_size << "\n";
                 std::cout<<t<<" ms"<<std::endl;
             } else {
 
-                queue.enqueueWriteBuffer(gs_d, CL_TRUE, 0, sizeof (gradient_structure), &gs);
-                queue.enqueueWriteBuffer(a_d, CL_TRUE, 0, sizeof (variable), &a);
-                queue.enqueueWriteBuffer(b_d, CL_TRUE, 0, sizeof (variable), &b);
-                //            out.value = 0.0;
-                queue.enqueueWriteBuffer(out_d, CL_TRUE, 0, DATA_SIZE * sizeof (variable), out);
-                cl::Event event;
-                queue.enqueueNDRangeKernel(
-                        kernel,
-                        cl::NullRange,
-                        globalSize,
-                        localSize,
-                        NULL,
-                        &event);
-
-
-
-
+                if (iter + 1 < ITERATIONS) {
+                    evaluation& next = ev[(iter + 1) & 1];
+                    next.params[0] = a;
+                    next.params[1] = b;
+                    next.params[0].value += .0000001;
+                    next.params[1].value += .0000001;
+                    enqueue_evaluation(rt[(iter + 1) & 1], next, globalSize, localSize);
+                }
 
-                // Block until kernel completion
-                event.wait();
+                //waits for this iteration only
+                rt[iter & 1].restore();
+                sum = e.sum;
 
 #ifdef CL_PROFILING
-
                 cl_ulong start =
-                        event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+                        e.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
                 cl_ulong end =
-                        event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+                        e.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
                 double time = 1.e-6 * (end - start);
                 double startTime = start * 1.e-6;
                 double endTime = end * 1.e-6;
@@ -378,47 +379,25 @@ std::cout << global_size << "\n";
 #endif
             }
 
-
-            //our function value.
-            struct variable f;
-            if (!HOST) {
-                //read our kernel value
-                queue.enqueueReadBuffer(out_d, CL_TRUE, 0, DATA_SIZE * sizeof (variable), (struct variable*) out);
-
-            }
-
             if (gs.recording == 1) {
-                double* g;
+                const double* g;
                 int gsize = 0;
 
                 if (!HOST) {
-                    queue.enqueueReadBuffer(gs_d, CL_TRUE, 0, sizeof (gradient_structure), &gs);
-                    queue.enqueueReadBuffer(entry_d, CL_TRUE, 0, STACK_SIZE * sizeof (entry), (struct entry*) entries);
-                    gs.gradient_stack = entries;
-
-                    gpu_restore(&gs);
-//                    gs.stack_current += gs.counter;
-//                    gs.current_variable_id += gs.counter;
                     std::cout << gs.current_variable_id << "\n";
                     std::cout << gs.stack_current << std::endl;
 
                 }
 
-
-                for (int i = 0; i < DATA_SIZE; i++) {
-//                    std::cout<<out[i].value<<"\n";
-                    ad_plus_eq_v(&gs, &sum, out[i]/*times_vv(&gs,out[i],out[i])*/);
-                    //                    sum = plus_vv(&gs, sum, out[i]);
-                    //                std::cout<<sum.value<<"\n";
-                    out[i].value = 0;
+                if (HOST) {
+                    sum = ad_sum(&gs, DATA_SIZE, out);
                 }
-//                exit(0);
                 //finish up with the native api.
                 f = ad_times_dv(&gs, static_cast<double> (DATA_SIZE) / 2.0, ad_log(&gs, sum));
 
                 //                break;
                 //compute the function gradient
-                g = compute_gradient(gs, gsize);
+                g = compute_gradient_into(gs, gsize);
 
 
 
@@ -426,14 +405,10 @@ std::cout << global_size << "\n";
                 std::cout << std::fixed << std::setprecision(10) << "f  = " << f.value << std::endl;
                 std::cout << a.value << ", df/da = " << g[a.id] << std::endl;
                 std::cout << b.value << ", df/db = " << g[b.id] << std::endl;
-                free(g);
             } else {
 
-                for (int i = 0; i < DATA_SIZE; i++) {
-                    ad_plus_eq_v(&gs, &sum, out[i]);
-                    //                    sum = plus_vv(&gs, sum, out[i]);
-                    //                std::cout<<sum.value<<"\n";
-                    out[i].value = 0;
+                if (HOST) {
+                    sum = ad_sum(&gs, DATA_SIZE, out);
                 }
                 //finish up with the native api.
                 f = ad_times_dv(&gs, static_cast<double> (DATA_SIZE) / 2.0, ad_log(&gs, sum));
@@ -448,25 +423,22 @@ std::cout << global_size << "\n";
             a.value += .0000001;
             b.value += .0000001;
 
-            gs.stack_current = 0;
-            gs.current_variable_id = b.id + 1;
-            gs.counter = 1;
-            for (int i = 0; i < STACK_SIZE; i++) {
-                entries[i].size = 0;
-                entries[i].id = 0;
-            }
+            //start over without touching the tape
+            ad_reset(&gs, b.id + 1);
         }
 
     } catch (cl::Error err) {
 
-        std::cout << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]);
+        std::cout << err.what() << "\n" << rt[0].build_log();
         exit(0);
     }
 
     delete[] x;
     delete[] y;
-    delete[] entries;
+    for (int s = 0; s < 2; s++) {
+        free(ev[s].entries);
+        ad_workspace_free(&ev[s].gs);
+    }
 
     return 0;
 }
-
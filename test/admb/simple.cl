@@ -1,49 +1,20 @@
-
-inline void compute_gradient(__global struct ad_gradient_structure* gs, __global double* gradient, int* size) {
-
-
-    if (gs->recording == 1) {
-        *size = gs->counter + gs->current_ad_variable_id + 1;
-
-        for (int i = 0; i < *size; i++) {
-            gradient[i] = 0.0;
-        }
-
-        gradient[gs->gradient_stack[gs->counter + gs->stack_current - 1].id] = 1.0;
-
-#pragma unroll
-        for (int j = gs->counter + gs->stack_current - 1; j >= 0; j--) {
-            int id = gs->gradient_stack[j].id;
-            double w = gradient[id];
-//            //                if (w != 0.0) {
-            gradient[id] = 0.0;
-            struct ad_entry ge = gs->gradient_stack[j];
-            for (int i = 0; i < ge.size; i++) {
-                gradient[ge.coeff[i].id] += w * ge.coeff[i].dx;
-            }
-            gs->gradient_stack[j].size = 0;
-            gs->gradient_stack[j].id = 0;
-            //                }
-        }
-    }
+/**
+ * Counting pass of AD: the number of pad_ operations every work item 
+ * records, turned into tape offsets by ad_scan_operations. Each 
+ * observation is preaccumulated into one entry w.r.t. a and b.
+ */
+__kernel void AD_count(__global int* offsets, int size) {
+    const int id = get_global_id(0);
+    offsets[id] = id < size ? AD_NARY_OPERATIONS(2) : 0;
 }
-//#define DOALL_ON_GPU
-
-#ifdef DOALL_ON_GPU
 
 __kernel void AD(__global struct ad_gradient_structure* gs,
         __global struct ad_entry* gradient_stack,
-        __constant struct ad_variable* a,
-        __constant struct ad_variable*b,
+        __constant struct ad_variable* params,
         __global double *x,
         __global double *y,
-        __global struct ad_variable *out,
-        int size,
-        __global double* gradient_buffer,
-        __global double* da,
-        __global double* db,
-        __global double* f,
-        __global volatile int* counter) {
+        __global struct ad_variable *out, int size,
+        __global const int* offsets) {
 
 
 
@@ -51,92 +22,108 @@ __kernel void AD(__global struct ad_gradient_structure* gs,
     //get global id
     const int id = get_global_id(0);
 
-    if (id < size) {
+    //declare a private gradient structure and use pad operations.    
+    struct ad_gradient_structure pgs;
 
-        //declare a private gradient structure and use pad operations.    
-        struct ad_gradient_structure pgs;
+    //initialize the global gradient structure
+    ad_init(gs, gradient_stack);
 
-        //initialize the global gradient structure
-        ad_init(gs, gradient_stack);
+    //initialize the private gradient structure at the offset of the counting pass, no atomics.
+    pad_init_scan(offsets, &pgs, gs, gradient_stack);
 
-        //initialize the private gradient structure and prefetch our stack entries.
-        pad_init(4, &pgs, gs, gradient_stack);
+    if (id < size) {
 
-        struct ad_variable aa = *a;
-        struct ad_variable bb = *b;
+        struct ad_variable inputs[2] = {params[0], params[1]};
+        struct ad_variable p[2];
         double xx = x[id];
         double yy = y[id];
 
-        struct ad_variable temp = pad_minus_vd(&pgs, pad_plus(&pgs, pad_times_vd(&pgs, aa, xx), bb), yy);
-        out[id] = pad_times(&pgs, temp, temp);
-
-        atomic_dec(counter);
-        //barrier(CLK_LOCAL_MEM_FENCE);
-
-        if (id == (size-1)) {
-
-            while(*counter > 0){}
-            
-            struct ad_variable sum = {.value = 0.0, .id = gs->current_ad_variable_id + atomic_inc(&gs->counter)};
-            for (int i = 0; i < size; i++) {
-                ad_plus_eq(gs, &sum, out[i]);
-                out[i].value = 0;
-            }
+        //record the observation on a private tape, only its partials w.r.t. a and b go to the tape
+        struct ad_private_gradient_structure ppgs;
+        ad_preaccumulate_init_p(&ppgs, 2, inputs, p);
+        struct ad_variable temp = ad_minus_vd_p(&ppgs, ad_plus_p(&ppgs, ad_times_vd_p(&ppgs, p[0], xx), p[1]), yy);
+        out[id] = pad_preaccumulate(&pgs, &ppgs, ad_times_p(&ppgs, temp, temp), 2, inputs);
+    }
 
+    //    barrier(CLK_GLOBAL_MEM_FENCE);
+}
 
-            struct ad_variable ff = ad_times_dv(gs, (double) (size) / 2.0, ad_log(gs, sum));
-            int gsize = 0;
-            compute_gradient(gs, gradient_buffer, &gsize);
-            *f = gs->counter; //sum.id;//value;
-            *da = gradient_buffer[a->id];
-            *db = gradient_buffer[b->id];
+/**
+ * Forward mode version of AD: no tape, each work item computes its 
+ * squared residual as an ad_dual w.r.t. a and b and the work group sums 
+ * them into rows, see ad_dual_reduce.
+ */
+__kernel void AD_dual(__constant struct ad_variable* params,
+        __global double *x,
+        __global double *y,
+        int size,
+        __global struct ad_dual* rows,
+        __local struct ad_dual* scratch) {
 
-        }
+    const int id = get_global_id(0);
+    struct ad_dual r = ad_dual_constant(0.0);
 
+    if (id < size) {
+        struct ad_dual aa = ad_dual_variable(params[0].value, 0);
+        struct ad_dual bb = ad_dual_variable(params[1].value, 1);
+        struct ad_dual temp = ad_dual_minus_vd(ad_dual_plus(ad_dual_times_vd(aa, x[id]), bb), y[id]);
+        r = ad_dual_times(temp, temp);
     }
 
-
-
-
+    ad_dual_group_sum(r, scratch, rows);
 }
 
-
-#else
-
-__kernel void AD(__global struct ad_gradient_structure* gs,
-        __global struct ad_entry* gradient_stack,
-        __constant struct ad_variable* a,
-        __constant struct ad_variable*b,
+/**
+ * AD_dual for all 2 * nvar perturbed parameter vectors of a central 
+ * difference Hessian in one launch. point holds the nvar parameters 
+ * followed by their steps. Copy k = get_group_id(1) moves parameter 
+ * k / 2 by its step, down for odd k, and writes its own set of 
+ * get_num_groups(0) rows, reduced per copy by ad_dual_reduce. nvar is at 
+ * most AD_DUAL_WIDTH.
+ */
+__kernel void AD_dual_hessian(__constant double* point,
+        int nvar,
         __global double *x,
         __global double *y,
-        __global struct ad_variable *out, int size) {
-
-
-
+        int size,
+        __global struct ad_dual* rows,
+        __local struct ad_dual* scratch) {
 
-    //get global id
     const int id = get_global_id(0);
+    const int copy = get_group_id(1);
+    const int k = copy / 2;
+    const double step = (copy & 1) ? -point[nvar + k] : point[nvar + k];
+    struct ad_dual r = ad_dual_constant(0.0);
 
     if (id < size) {
+        struct ad_dual p[AD_DUAL_WIDTH];
+        for (int i = 0; i < nvar; i++) {
+            p[i] = ad_dual_variable(point[i] + (i == k ? step : 0.0), i);
+        }
+        struct ad_dual temp = ad_dual_minus_vd(ad_dual_plus(ad_dual_times_vd(p[0], x[id]), p[1]), y[id]);
+        r = ad_dual_times(temp, temp);
+    }
 
-        //declare a private gradient structure and use pad operations.    
-        struct ad_gradient_structure pgs;
-
-        //initialize the global gradient structure
-        ad_init(gs, gradient_stack);
+    ad_dual_group_sum(r, scratch, rows + copy * get_num_groups(0));
+}
 
-        //initialize the private gradient structure and prefetch our stack entries.
-        pad_init(4, &pgs, gs, gradient_stack);
+#ifdef DO_ALL_ON_GPU
 
-        struct ad_variable aa = *a;
-        struct ad_variable bb = *b;
-        double xx = x[id];
-        double yy = y[id];
+/**
+ * Records the objective from the sum of the outputs of AD, see 
+ * ad_sum_reduce, on a single work item. The gradient is then computed 
+ * with ad_reverse_sweep.
+ */
+__kernel void AD_objective(__global struct ad_gradient_structure* gs,
+        __global struct ad_entry* gradient_stack,
+        __global const struct ad_variable *sum,
+        int size,
+        __global double* f) {
 
-        struct ad_variable temp = pad_minus_vd(&pgs, pad_plus(&pgs, pad_times_vd(&pgs, aa, xx), bb), yy);
-        out[id] = pad_times(&pgs, temp, temp);
-    }
+    ad_init(gs, gradient_stack);
 
-    //    barrier(CLK_GLOBAL_MEM_FENCE);
+    struct ad_variable ff = ad_times_dv(gs, (double) (size) / 2.0, ad_log(gs, *sum));
+    *f = ff.value;
 }
+
 #endif
\ No newline at end of file
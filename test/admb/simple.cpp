@@ -2,6 +2,8 @@
 
 #include <admodel.h>
 #include <cmath>
+#include <cfloat>
+#include <algorithm>
 #define CL_PROFILING
 #include <vector>
 #include <sys/time.h>
@@ -11,6 +13,30 @@ extern "C" {
 }
 #include "simple.hpp"
 
+//AD preaccumulates 4 operations w.r.t. 2 parameters, keep the private tape that small
+#define SIMPLE_BUILD_OPTIONS AD4CL_BUILD_OPTIONS " -DPRIVATE_STACK_SIZE=4 -DPRIVATE_GRADIENT_SIZE=6 -DPREACCUMULATE_INPUTS=2"
+
+/**
+ * Arguments of AD_observation.
+ */
+struct AD_data {
+    struct ad_variable* a;
+    struct ad_variable* b;
+    double* x;
+    double* y;
+    struct ad_variable* out;
+};
+
+/**
+ * Records observation i of AD, 4 operations like AD_count on the device.
+ */
+inline void AD_observation(struct ad_gradient_structure* gs, int i, void* data) {
+    struct AD_data* d = (struct AD_data*) data;
+    //        struct ad_variable pred = ad_plus(gs, ad_times_vd(gs, *a, x[i]), *b);
+    struct ad_variable temp = ad_minus_vd(gs, ad_plus(gs, ad_times_vd(gs, *d->a, d->x[i]), *d->b), d->y[i]);
+    d->out[i] = ad_times(gs, temp, temp);
+}
+
 inline void AD(struct ad_gradient_structure* gs,
         struct ad_variable* a,
         struct ad_variable*b,
@@ -18,32 +44,9 @@ inline void AD(struct ad_gradient_structure* gs,
         double *y,
         struct ad_variable *out, int size) {
 
-    for (int i = 0; i < size; i++) {
-        //        struct ad_variable pred = ad_plus(gs, ad_times_vd(gs, *a, x[i]), *b);
-        struct ad_variable temp = ad_minus_vd(gs, ad_plus(gs, ad_times_vd(gs, *a, x[i]), *b), y[i]);
-        out[i] = ad_times(gs, temp, temp);
-    }
-
-
-}
-
-void Gradient(std::vector<double>& g, struct ad_gradient_structure& gs) {
-
-    std::fill(g.begin(), g.end(), 0.0);
-
-    if (g.size() < gs.current_variable_id) {
-        g.resize(gs.current_variable_id + 1);
-    }
-    g[gs.gradient_stack[gs.stack_current - 1].id] = 1.0;
-
-    for (int j = gs.stack_current - 1; j >= 0; j--) {
-        int id = gs.gradient_stack[j].id;
-        double w = g[id];
-        g[id] = 0.0;
-        for (int i = 0; i < gs.gradient_stack[j].size; i++) {
-            g[gs.gradient_stack[j].coeff[i].id] += w * gs.gradient_stack[j].coeff[i].dx;
-        }
-    }
+    //the observations are split over the OpenMP threads, each recording into its own range of the tape
+    struct AD_data data = {a, b, x, y, out};
+    ad_parallel_for(gs, size, 4, AD_observation, &data);
 }
 
 model_data::model_data(int argc, char * argv[]) : ad_comm(argc, argv) {
@@ -118,13 +121,11 @@ void model_parameters::initialize_opencl() {
     gs->stack_current = 0;
     gs->recording = 1;
     gs->counter = 0;
+    gs->pair_current = 0;
+    gs->pair_counter = 0;
 
-    this->gradient_stack = new ad_entry[this->ad4cl_stack_size.val];
-    for (int i = 0; i < this->ad4cl_stack_size.val; i++) {
-        this->gradient_stack[i].size = 0;
-        this->gradient_stack[i].id = 0;
-    }
-    gs->gradient_stack = this->gradient_stack;
+    this->gradient_stack = create_entries(this->ad4cl_stack_size.val);
+    ad_tape_bind(gs, this->gradient_stack, this->ad4cl_stack_size.val);
 
     aa = (struct ad_variable){.value = 0, .id = gs->current_variable_id++};
     bb = (struct ad_variable){.value = 0, .id = gs->current_variable_id++};
@@ -132,103 +133,48 @@ void model_parameters::initialize_opencl() {
 
 
 
-    error = CL_SUCCESS;
-    std::string source_code;
-
-    //Read the ad4cl api.
-    std::string line;
-    std::ifstream in;
-    in.open(ad4cl_api);
-
-
-
-
-
-    std::stringstream ss;
-
-    while (in.good()) {
-        std::getline(in, line);
-        ss << line << "\n";
-    }
-
-    std::ifstream kin;
-    kin.open(kernel_code);
-
-    while (kin.good()) {
-        std::getline(kin, line);
-        ss << line << "\n";
-    }
-    source_code = ss.str();
-
-    std::vector<cl::Platform> platforms;
-
     try {
-        cl::Platform::get(&platforms);
-        if (platforms.size() == 0) {
-            std::cout << "Platform size 0\n";
-            exit(0);
-        }
-
-        //print platform info 
-        //        std::cout << platforms[1];
-
-        // Get list of devices on default platform and create context
-        cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties) (platforms[gpu_index.val])(), 0};
-        context = cl::Context(CL_DEVICE_TYPE_GPU, properties);
-        devices = context.getInfo<CL_CONTEXT_DEVICES > ();
-
-        //        std::cout << __LINE__ << std::endl;
-        const cl::Device device = devices[0];
-
-        //print device info
-        //        std::cout << device << "\n";
-
-        //set the program source
-        source = cl::Program::Sources(1, std::make_pair(source_code.c_str(), source_code.size()));
-        program_ = cl::Program(context, source, &error);
-        //        std::cout << __LINE__ << std::endl;
-        //build the program
-        program_.build(devices);
-        //        std::cout << __LINE__ << std::endl;
-        //set the queue
 #ifdef CL_PROFILING
-        queue = cl::CommandQueue(context, devices[0], CL_QUEUE_PROFILING_ENABLE);
+        rt.initialize(gpu_index.val, CL_DEVICE_TYPE_GPU, CL_QUEUE_PROFILING_ENABLE);
+#else
+        rt.initialize(gpu_index.val, CL_DEVICE_TYPE_GPU);
+#endif
+
+        //the model kernels with the compiled in ad4cl api unless simple.dat names an ad.cl
+#ifdef DO_ALL_ON_GPU
+        std::string options = SIMPLE_BUILD_OPTIONS " -DDO_ALL_ON_GPU";
 #else
-        queue = cl::CommandQueue(context, devices[0]);
+        std::string options = SIMPLE_BUILD_OPTIONS;
 #endif
-        //        std::cout << __LINE__ << std::endl;
-        if (error != CL_SUCCESS) {
-            std::cout << "---> " << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]) << "\n";
-            exit(0);
+        std::string api = (char*) ad4cl_api;
+        if (api == "embedded") {
+            const char* launched[] = {"ad_scan_operations", "ad_sum_reduce", "ad_reduce_result", "ad_dual_reduce"};
+            rt.build_kernels((char*) kernel_code, options, std::vector<std::string>(launched, launched + 4));
+        } else {
+            rt.build_files(api, (char*) kernel_code, options);
         }
-        //        std::cout << __LINE__ << std::endl;
 
         // Create kernel object
-        kernel = cl::Kernel(program_, "AD");
+        rt.bind(gs, gradient_stack, this->ad4cl_stack_size.val);
+        std::cout << "tape transport: " << rt.transport_name(rt.transport()) << "\n";
+        kernel = rt.ad_kernel("AD");
+        count_kernel = rt.kernel("AD_count");
+        scan_kernel = rt.kernel("ad_scan_operations");
+        sum_kernel = rt.ad_kernel("ad_sum_reduce");
+        result_kernel = rt.kernel("ad_reduce_result");
+        dual_kernel = rt.kernel("AD_dual");
+        dual_reduce_kernel = rt.kernel("ad_dual_reduce");
+        hessian_kernel = rt.kernel("AD_dual_hessian");
+        //a second ad_dual_reduce with its own arguments
+        hessian_reduce_kernel = cl::Kernel(rt.program(), "ad_dual_reduce");
 
         //std::cout<<"here"<<std::endl;
 
 
-        gs_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof ( struct ad_gradient_structure), gs);
-        ad_entry_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, this->ad4cl_stack_size.val * sizeof (struct ad_entry), gradient_stack);
-        a_d = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof ( ad_variable), &aa);
-        b_d = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof ( ad_variable), &bb);
-        x_d = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, DATA_SIZE * sizeof (double), x);
-        y_d = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, DATA_SIZE * sizeof (double), Y);
-        out_d = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, DATA_SIZE * sizeof (struct ad_variable), out);
-
-#ifdef DO_ALL_ON_GPU
-        f_h = 0.0;
-        da_h = 0.0;
-        db_h = 0.0;
-        counter = DATA_SIZE;
-        gradient_buffer_h = new double[GRADIENT_BUFFER_SIZE];
-        f_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof (double), &f_h);
-        da_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof (double), &da_h);
-        db_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof (double), &db_h);
-        gradient_buffer_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, GRADIENT_BUFFER_SIZE * sizeof (double), gradient_buffer_h);
-        counter_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof (int), &counter);
-#endif
+        params_d = rt.buffer(CL_MEM_READ_ONLY, sizeof (params));
+        x_d = rt.buffer(CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, DATA_SIZE * sizeof (double), x);
+        y_d = rt.buffer(CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, DATA_SIZE * sizeof (double), Y);
+        out_d = rt.buffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, DATA_SIZE * sizeof (struct ad_variable), out);
 
 
         // Number of work items in each local work group
@@ -237,32 +183,103 @@ void model_parameters::initialize_opencl() {
         // Number of total work items - localSize must be devisor
         global_size = std::ceil(DATA_SIZE / (double) local_size + 1) * local_size;
 
+        //operation counts of AD_count, then the offsets of ad_scan_operations
+        offsets_d = rt.buffer(CL_MEM_READ_WRITE, (global_size + 3) * sizeof (int));
+
 
 
         //    queue.enqueueWriteBuffer(x_d, CL_TRUE, 0, sizeof (double)*DATA_SIZE, x);
         //    queue.enqueueWriteBuffer(y_d, CL_TRUE, 0, sizeof (double)*DATA_SIZE, Y);
 
-        kernel.setArg(0, gs_d);
-        kernel.setArg(1, ad_entry_d);
-        kernel.setArg(2, a_d);
-        kernel.setArg(3, b_d);
-        kernel.setArg(4, x_d);
-        kernel.setArg(5, y_d);
-        kernel.setArg(6, out_d);
-        kernel.setArg(7, DATA_SIZE);
+        kernel.setArg(2, params_d);
+        kernel.setArg(3, x_d);
+        kernel.setArg(4, y_d);
+        kernel.setArg(5, out_d);
+        kernel.setArg(6, DATA_SIZE);
+        kernel.setArg(7, offsets_d);
+
+        count_kernel.setArg(0, offsets_d);
+        count_kernel.setArg(1, DATA_SIZE);
+
+        scan_kernel.setArg(0, rt.gs_buffer());
+        scan_kernel.setArg(1, offsets_d);
+        scan_kernel.setArg(2, (int) global_size);
+        scan_kernel.setArg(3, cl::__local(local_size * sizeof (int)));
+
+        //the sum of out is reduced and recorded on the device, only sum is read back
+        rows_d = rt.buffer(CL_MEM_READ_WRITE, (global_size / local_size) * sizeof (struct ad_variable));
+        sum_d = rt.buffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof (struct ad_variable), &sum);
+
+        sum_kernel.setArg(2, out_d);
+        sum_kernel.setArg(3, DATA_SIZE);
+        sum_kernel.setArg(4, rows_d);
+        sum_kernel.setArg(5, cl::__local(local_size * sizeof (struct ad_variable)));
+
+        result_kernel.setArg(0, rt.gs_buffer());
+        result_kernel.setArg(1, rows_d);
+        result_kernel.setArg(2, (int) (global_size / local_size));
+        result_kernel.setArg(3, DATA_SIZE);
+        result_kernel.setArg(4, sum_d);
+        result_kernel.setArg(5, cl::__local(local_size * sizeof (struct ad_variable)));
+
+        //forward mode, a row per work group reduced to dual_sum on the device
+        dual_rows_d = rt.buffer(CL_MEM_READ_WRITE, (global_size / local_size) * sizeof (struct ad_dual));
+        dual_sum_d = rt.buffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof (struct ad_dual), &dual_sum);
+
+        dual_kernel.setArg(0, params_d);
+        dual_kernel.setArg(1, x_d);
+        dual_kernel.setArg(2, y_d);
+        dual_kernel.setArg(3, DATA_SIZE);
+        dual_kernel.setArg(4, dual_rows_d);
+        dual_kernel.setArg(5, cl::__local(local_size * sizeof (struct ad_dual)));
+
+        dual_reduce_kernel.setArg(0, dual_rows_d);
+        dual_reduce_kernel.setArg(1, (int) (global_size / local_size));
+        dual_reduce_kernel.setArg(2, dual_sum_d);
+        dual_reduce_kernel.setArg(3, cl::__local(local_size * sizeof (struct ad_dual)));
+
+        //central difference hessian, the 2 * nvar perturbed copies of AD_dual share one launch
+        nvar = initial_params::nvarcalc();
+        if (nvar <= AD_DUAL_WIDTH) {
+            hessian_sum.resize(2 * nvar);
+            hessian_point.resize(2 * nvar);
+            hessian_point_d = rt.buffer(CL_MEM_READ_ONLY, 2 * nvar * sizeof (double));
+            hessian_rows_d = rt.buffer(CL_MEM_READ_WRITE, 2 * nvar * (global_size / local_size) * sizeof (struct ad_dual));
+            hessian_sum_d = rt.buffer(CL_MEM_READ_WRITE, 2 * nvar * sizeof (struct ad_dual));
+
+            hessian_kernel.setArg(0, hessian_point_d);
+            hessian_kernel.setArg(1, nvar);
+            hessian_kernel.setArg(2, x_d);
+            hessian_kernel.setArg(3, y_d);
+            hessian_kernel.setArg(4, DATA_SIZE);
+            hessian_kernel.setArg(5, hessian_rows_d);
+            hessian_kernel.setArg(6, cl::__local(local_size * sizeof (struct ad_dual)));
+
+            hessian_reduce_kernel.setArg(0, hessian_rows_d);
+            hessian_reduce_kernel.setArg(1, (int) (global_size / local_size));
+            hessian_reduce_kernel.setArg(2, hessian_sum_d);
+            hessian_reduce_kernel.setArg(3, cl::__local(local_size * sizeof (struct ad_dual)));
+        }
 
 #ifdef DO_ALL_ON_GPU
 
-        kernel.setArg(8, gradient_buffer_d);
-        kernel.setArg(9, da_d);
-        kernel.setArg(10, db_d);
-        kernel.setArg(11, f_d);
-        kernel.setArg(12, counter_d);
+        //objective and gradient on the device, only f, df/da and df/db are read back
+        f_h = 0.0;
+        sweep_rows = global_size / local_size;
+        grad_ids[0] = aa.id;
+        grad_ids[1] = bb.id;
+        objective_kernel = rt.ad_kernel("AD_objective");
+        f_d = rt.buffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof (double), &f_h);
+
+        objective_kernel.setArg(2, sum_d);
+        objective_kernel.setArg(3, DATA_SIZE);
+        objective_kernel.setArg(4, f_d);
 
 #endif
 
     } catch (cl::Error err) {
-        std::cout << err.what() << "---> " << error << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]);
+        std::cout << err.what() << "\n";
+        exit(0);
     }
 
 }
@@ -280,26 +297,18 @@ void model_parameters::userfunction(void) {
 
     if (gradient_method == AD4CL_DEVICE) {
         try {
-            gs->counter = 0;
-            queue.enqueueWriteBuffer(gs_d, CL_TRUE, 0, sizeof ( ad_gradient_structure), gs);
-            queue.enqueueWriteBuffer(a_d, CL_TRUE, 0, sizeof ( ad_variable), &aa);
-            queue.enqueueWriteBuffer(b_d, CL_TRUE, 0, sizeof ( ad_variable), &bb);
-#ifdef DO_ALL_ON_GPU
-            queue.enqueueWriteBuffer(counter_d, CL_TRUE, 0, sizeof ( int), &counter);
-#endif
-            cl::Event event;
-            queue.enqueueNDRangeKernel(
-                    kernel,
-                    cl::NullRange,
-                    cl::NDRange(global_size),
-                    cl::NDRange(local_size),
-                    NULL,
-                    &event);
+            params[0] = aa;
+            params[1] = bb;
+            rt.write(params_d, params, sizeof (params));
+
+            //count and lay out the tape first, AD then records without atomics
+            rt.record(count_kernel, cl::NDRange(global_size), cl::NDRange(local_size));
+            rt.record(scan_kernel, cl::NDRange(local_size), cl::NDRange(local_size));
+            cl::Event event = rt.record(kernel, cl::NDRange(global_size), cl::NDRange(local_size));
+#ifdef CL_PROFILING
 
             // Block until kernel completion
             event.wait();
-#ifdef CL_PROFILING
-
             cl_ulong start =
                     event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
             cl_ulong end =
@@ -309,33 +318,34 @@ void model_parameters::userfunction(void) {
 
 #endif
 
-            queue.enqueueReadBuffer(gs_d, CL_TRUE, 0, sizeof ( ad_gradient_structure), gs);
-
-#ifndef DO_ALL_ON_GPU
-            queue.enqueueReadBuffer(ad_entry_d, CL_TRUE, 0, this->ad4cl_stack_size.val * sizeof ( ad_entry), (struct ad_entry*) gradient_stack);
-
-            queue.enqueueReadBuffer(out_d, CL_TRUE, 0, DATA_SIZE * sizeof ( ad_variable), (struct ad_variable*) out);
-
-            gs->gradient_stack = gradient_stack;
+            rt.record(sum_kernel, cl::NDRange(global_size), cl::NDRange(local_size));
+            rt.record(result_kernel, cl::NDRange(local_size), cl::NDRange(local_size));
 
+#ifdef DO_ALL_ON_GPU
+            //AD recorded one preaccumulated slot per observation, the sum and AD_objective the serial tail after them
+            int blocks_end = gs->stack_current + DATA_SIZE;
+            rt.record(objective_kernel, cl::NDRange(1), cl::NDRange(1));
+
+            //ids below bb.id + 1 are the parameters
+            rt.sweep_begin(bb.id + 1, sweep_rows, global_size, local_size);
+            rt.sweep(blocks_end, -1, this->ad4cl_stack_size.val, 1, 1);
+            rt.sweep(gs->stack_current, blocks_end, 1, global_size, local_size);
+            rt.gather(grad_ids, 2, grad_h);
+            rt.read(f_d, &f_h, sizeof ( double));
+
+            //the gradient is complete, only the counters are needed
+            rt.readback(false);
+#else
+            rt.read(sum_d, &sum, sizeof ( ad_variable));
+            rt.readback();
 #endif
 
-
-
             //         exit(0);
 
 
-            gpu_restore(gs);
+            rt.restore();
 
 #ifdef DO_ALL_ON_GPU
-            try {
-                queue.enqueueReadBuffer(f_d, CL_TRUE, 0, sizeof ( double), &f_h);
-                queue.enqueueReadBuffer(da_d, CL_TRUE, 0, sizeof ( double), &da_h);
-                queue.enqueueReadBuffer(db_d, CL_TRUE, 0, sizeof ( double), &db_h);
-            } catch (cl::Error err) {
-                std::cout << __LINE__ << " " << err.what() << std::endl;
-                std::cout << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]);
-            }
 
             //            ad_variable sum = {.value = 0.0, .id = gs->current_variable_id++};
             //            for (int i = 0; i < DATA_SIZE; i++) {
@@ -352,36 +362,46 @@ void model_parameters::userfunction(void) {
             //set admb adjoint code
             f.v->xvalue() = f_h;
             std::cout << f_h;
-            AD_SET_DERIVATIVES2(f, a, da_h, b, db_h);
+            AD_SET_DERIVATIVES2(f, a, grad_h[0], b, grad_h[1]);
 #else
-            ad_variable sum = {.value = 0.0, .id = gs->current_variable_id++};
-            for (int i = 0; i < DATA_SIZE; i++) {
-                ad_plus_eq_v(gs, &sum, out[i]);
-                out[i].value = 0;
-            }
-
-
             //finish up with the native api.
             struct ad_variable ff = ad_times_dv(gs, static_cast<double> (DATA_SIZE) / 2.0, ad_log(gs, sum));
 
 
             //compute gradient
-            Gradient(gradient, *gs);
+            int gsize = 0;
+            const double* gradient = compute_gradient_into(*gs, gsize);
 
-            std::cout << "grad size = " << gradient.size() << "\n";
+            std::cout << "grad size = " << gsize << "\n";
             //set admb adjoint code
             f.v->xvalue() = ff.value;
             AD_SET_DERIVATIVES2(f, a, gradient[aa.id], b, gradient[bb.id]);
 #endif
         } catch (cl::Error err) {
             std::cout << __LINE__ << " " << err.what() << std::endl;
-            std::cout << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]);
         }
 
         //reset the ad4cl gradient structure
-        gs->stack_current = 0;
-        gs->counter = 0;
-        gs->current_variable_id = bb.id + 1;
+        ad_reset(gs, bb.id + 1);
+
+    } else if (gradient_method == AD4CL_DUAL) {
+        try {
+            params[0] = aa;
+            params[1] = bb;
+            rt.write(params_d, params, sizeof (params));
+            rt.launch(dual_kernel, cl::NDRange(global_size), cl::NDRange(local_size));
+            rt.launch(dual_reduce_kernel, cl::NDRange(local_size), cl::NDRange(local_size));
+            rt.read(dual_sum_d, &dual_sum, sizeof (struct ad_dual));
+            rt.finish();
+
+            //finish up on the host, d/da and d/db come with the value
+            struct ad_dual ff = ad_dual_times_dv(static_cast<double> (DATA_SIZE) / 2.0, ad_dual_log(dual_sum));
+
+            f.v->xvalue() = ff.value;
+            AD_SET_DERIVATIVES2(f, a, ff.dx[0], b, ff.dx[1]);
+        } catch (cl::Error err) {
+            std::cout << __LINE__ << " " << err.what() << std::endl;
+        }
 
     } else if (gradient_method == AD4CL_HOST) {
 
@@ -396,26 +416,22 @@ void model_parameters::userfunction(void) {
         double t = 1000.00 * (double) (tm2.tv_sec - tm1.tv_sec) + (double) (tm2.tv_usec - tm1.tv_usec) / 1000.000;
         cout << "kernel equivalent time " << t << " ms, ";
 #endif
-        ad_variable sum = {.value = 0.0, .id = gs->current_variable_id++};
-        for (int i = 0; i < DATA_SIZE; i++) {
-            ad_plus_eq_v(gs, &sum, out[i]);
-            out[i].value = 0;
-        }
+        sum = ad_sum(gs, DATA_SIZE, out);
 
 
         //finish up with the native api.
         struct ad_variable ff = ad_times_dv(gs, static_cast<double> (DATA_SIZE) / 2.0, ad_log(gs, sum));
 
         //compute the gradient
-        Gradient(gradient, *gs);
+        int gsize = 0;
+        const double* gradient = compute_gradient_into(*gs, gsize);
 
         //set the admb adjoint code
         f.v->xvalue() = ff.value;
         AD_SET_DERIVATIVES2(f, a, gradient[aa.id], b, gradient[bb.id]);
 
         //reset the ad4cl gradient structure
-        gs->stack_current = 0;
-        gs->current_variable_id = bb.id + 1;
+        ad_reset(gs, bb.id + 1);
 
     } else {
 
@@ -461,7 +477,75 @@ model_parameters::~model_parameters() {
 void model_parameters::report(const dvector & gradients) {
 }
 
+/**
+ * Central difference Hessian of f w.r.t. the nvar active parameters from 
+ * the forward mode gradients with parameter i moved up and down by 
+ * step * max(1, |x_i|). x are the coordinates of initial_params::xinit, 
+ * the ones of ADMB's admodel.hes; a and b are unbounded, so they are the 
+ * parameters themselves. All 2 * nvar gradient evaluations run as one 
+ * batched AD_dual_hessian launch, are reduced per copy by ad_dual_reduce 
+ * and read back together.
+ * 
+ * @param step - relative step, see final_calcs.
+ * @return the symmetrized Hessian, indexed from 1 like ADMB's.
+ */
+dmatrix model_parameters::batched_hessian(double step) {
+    dvector theta(1, nvar);
+    initial_params::xinit(theta);
+    for (int i = 0; i < nvar; i++) {
+        hessian_point[i] = theta[i + 1];
+        hessian_point[nvar + i] = step * std::max(1.0, std::fabs(theta[i + 1]));
+    }
+    try {
+        rt.write(hessian_point_d, &hessian_point[0], 2 * nvar * sizeof (double));
+        rt.launch(hessian_kernel, cl::NDRange(global_size, 2 * nvar), cl::NDRange(local_size, 1));
+        rt.launch(hessian_reduce_kernel, cl::NDRange(local_size, 2 * nvar), cl::NDRange(local_size, 1));
+        rt.read(hessian_sum_d, &hessian_sum[0], 2 * nvar * sizeof (struct ad_dual));
+        rt.finish();
+    } catch (cl::Error err) {
+        std::cout << __LINE__ << " " << err.what() << std::endl;
+    }
+
+    dmatrix hessian(1, nvar, 1, nvar);
+    for (int i = 0; i < nvar; i++) {
+        struct ad_dual up = ad_dual_times_dv(static_cast<double> (DATA_SIZE) / 2.0, ad_dual_log(hessian_sum[2 * i]));
+        struct ad_dual down = ad_dual_times_dv(static_cast<double> (DATA_SIZE) / 2.0, ad_dual_log(hessian_sum[2 * i + 1]));
+        for (int j = 0; j < nvar; j++) {
+            hessian(i + 1, j + 1) = (up.dx[j] - down.dx[j]) / (2.0 * hessian_point[nvar + i]);
+        }
+    }
+
+    //symmetrize, the two estimates of a cross term differ by truncation error
+    for (int i = 1; i <= nvar; i++) {
+        for (int j = i + 1; j <= nvar; j++) {
+            hessian(i, j) = hessian(j, i) = 0.5 * (hessian(i, j) + hessian(j, i));
+        }
+    }
+    return hessian;
+}
+
+/**
+ * Prints the batched Hessian next to the finite difference one ADMB 
+ * writes to admodel.hes, which it does not replace: hess_routine is not 
+ * virtual. Only with the device methods, AD4CL_HOST leaves the device 
+ * idle. The relative step is cbrt(DBL_EPSILON), the usual choice for 
+ * central differences, or the value of -bhstep.
+ */
 void model_parameters::final_calcs(void) {
+    if (gradient_method != AD4CL_DEVICE && gradient_method != AD4CL_DUAL) {
+        return;
+    }
+    if (nvar > AD_DUAL_WIDTH) {
+        std::cout << "batched hessian: " << nvar << " parameters, AD_DUAL_WIDTH is " << AD_DUAL_WIDTH << std::endl;
+        return;
+    }
+    double step = std::cbrt(DBL_EPSILON);
+    int nopt = 0;
+    int on = option_match(ad_comm::argc, ad_comm::argv, "-bhstep", nopt);
+    if (on > -1 && nopt > 0) {
+        step = atof(ad_comm::argv[on + 1]);
+    }
+    std::cout << "batched hessian:\n" << batched_hessian(step) << std::endl;
 }
 
 void model_parameters::set_runtime(void) {
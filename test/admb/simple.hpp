@@ -3,14 +3,8 @@
 
 //#define DO_ALL_ON_GPU
 
-#ifdef DO_ALL_ON_GPU
-#define GRADIENT_BUFFER_SIZE  5000000
-#endif
-
 #define __CL_ENABLE_EXCEPTIONS 
-#include "../../cl.hpp"
-
-#include "../../ad4cl.h"
+#include "../../Runtime.hpp"
 
 
 #define STACK_SIZE 50000
@@ -137,49 +131,62 @@ public:
     }
 private:
 
-    cl::CommandQueue queue;
+    ad4cl::Runtime rt;
     cl::Kernel kernel;
-    cl::Context context;
-    cl::Program program_;
-    cl::Program::Sources source;
-    std::vector<cl::Device> devices;
-    cl_int error;
-    cl::Buffer gs_d;
-    cl::Buffer ad_entry_d;
-    cl::Buffer a_d;
-    cl::Buffer b_d;
+    cl::Kernel count_kernel;
+    cl::Kernel scan_kernel;
+    cl::Buffer params_d;
     cl::Buffer x_d;
     cl::Buffer y_d;
     cl::Buffer out_d;
+    cl::Buffer offsets_d;
+    cl::Kernel sum_kernel;
+    cl::Kernel result_kernel;
+    cl::Buffer rows_d;
+    cl::Buffer sum_d;
+
+    struct ad_dual dual_sum;
+    cl::Kernel dual_kernel;
+    cl::Kernel dual_reduce_kernel;
+    cl::Buffer dual_rows_d;
+    cl::Buffer dual_sum_d;
+
+    //the active parameters, 2 per copy of AD_dual_hessian
+    int nvar;
+    std::vector<struct ad_dual> hessian_sum;
+    std::vector<double> hessian_point;
+    cl::Kernel hessian_kernel;
+    cl::Kernel hessian_reduce_kernel;
+    cl::Buffer hessian_point_d;
+    cl::Buffer hessian_rows_d;
+    cl::Buffer hessian_sum_d;
     
 #ifdef DO_ALL_ON_GPU
     double f_h;
-    double da_h;
-    double db_h;
-    double* gradient_buffer_h;
-    int counter;
-    cl::Buffer da_d;
-    cl::Buffer db_d;
+    double grad_h[2];
+    int grad_ids[2];
+    int sweep_rows;
+    cl::Kernel objective_kernel;
     cl::Buffer f_d;
-    cl::Buffer gradient_buffer_d;
-    cl::Buffer counter_d;
 #endif
     
     int DATA_SIZE;
 
     struct ad_variable aa;
     struct ad_variable bb;
+    //aa and bb as uploaded, one write per evaluation
+    struct ad_variable params[2];
     struct ad_variable sum;
     struct ad_variable* out;
     struct ad_gradient_structure* gs;
     struct ad_entry* gradient_stack;
     size_t global_size, local_size;
-    std::vector<double> gradient;
 
     enum GradientMethod {
         ADMB = 0,
         AD4CL_DEVICE,
-        AD4CL_HOST
+        AD4CL_HOST,
+        AD4CL_DUAL
     };
 
     GradientMethod gradient_method;
@@ -194,6 +201,7 @@ private:
     objective_function_value f;
 public:
     void initialize_opencl(void);
+    dmatrix batched_hessian(double step);
     virtual void userfunction(void);
     virtual void report(const dvector& gradients);
     virtual void final_calcs(void);
@@ -0,0 +1,34 @@
+/*
+ * File:   cache.cpp
+ *
+ * Runtime::cache creates a missing cache directory right away and turns
+ * the cache off, with a message, for a directory it can not create.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include "cl_standin.hpp"
+#include "Runtime.hpp"
+#include "check.hpp"
+
+int main(int argc, char** argv) {
+    char base[] = "/tmp/ad4cl_cache_XXXXXX";
+    CHECK(mkdtemp(base) != NULL);
+    std::string dir = std::string(base) + "/binaries";
+    std::string file = std::string(base) + "/file";
+    std::ofstream(file.c_str()) << "not a directory";
+
+    ad4cl::Runtime rt;
+    struct stat st;
+    CHECK(rt.cache(dir));
+    CHECK(stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+    CHECK(rt.cache(dir));
+    CHECK(!rt.cache(file));
+    CHECK(!rt.cache(file + "/binaries"));
+    CHECK(rt.cache(""));
+
+    rmdir(dir.c_str());
+    remove(file.c_str());
+    rmdir(base);
+    return check_done("cache");
+}
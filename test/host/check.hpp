@@ -0,0 +1,44 @@
+/* 
+ * File:   check.hpp
+ *
+ * Helpers shared by the host checks: CHECK and CHECK_CLOSE report a 
+ * failure and go on, check_done prints the verdict and gives the exit 
+ * status.
+ */
+
+#ifndef CHECK_HPP
+#define	CHECK_HPP
+
+#include <cstdio>
+#include <cmath>
+
+static int check_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        check_failures++; \
+    } \
+} while (0)
+
+/**
+ * a and b agree to tol relative to their size.
+ */
+#define CHECK_CLOSE(a, b, tol) do { \
+    double check_a_ = (a), check_b_ = (b); \
+    if (!(std::fabs(check_a_ - check_b_) <= (tol) * (1.0 + std::fabs(check_a_) + std::fabs(check_b_)))) { \
+        std::printf("%s:%d: %s = %.17g, %s = %.17g\n", __FILE__, __LINE__, #a, check_a_, #b, check_b_); \
+        check_failures++; \
+    } \
+} while (0)
+
+/**
+ * Prints the verdict of the check name.
+ * @return the exit status, 0 if nothing failed.
+ */
+inline int check_done(const char* name) {
+    std::printf("%s: %s\n", name, check_failures == 0 ? "ok" : "FAILED");
+    return check_failures == 0 ? 0 : 1;
+}
+
+#endif	/* CHECK_HPP */
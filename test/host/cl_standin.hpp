@@ -0,0 +1,315 @@
+/*
+ * File:   cl_standin.hpp
+ *
+ * In-memory stand-in for the parts of cl.hpp that Runtime.hpp uses, so
+ * the host side of Runtime can be checked without an OpenCL platform.
+ * Buffers are host memory, reads and writes are memcpy and counted,
+ * kernels do nothing. Include it before Runtime.hpp; it takes the include
+ * guard of cl.hpp.
+ */
+
+#ifndef CL_HPP_
+#define CL_HPP_
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef int cl_int;
+typedef unsigned int cl_bool;
+typedef unsigned long cl_ulong;
+typedef unsigned long cl_device_type;
+typedef unsigned long cl_mem_flags;
+typedef unsigned long cl_map_flags;
+typedef unsigned long cl_command_queue_properties;
+typedef long cl_context_properties;
+
+#define CL_SUCCESS 0
+#define CL_FALSE 0
+#define CL_TRUE 1
+#define CL_DEVICE_TYPE_CPU 2
+#define CL_DEVICE_TYPE_GPU 4
+#define CL_QUEUE_PROFILING_ENABLE 2
+#define CL_MEM_READ_WRITE 1
+#define CL_MEM_WRITE_ONLY 2
+#define CL_MEM_READ_ONLY 4
+#define CL_MEM_USE_HOST_PTR 8
+#define CL_MEM_ALLOC_HOST_PTR 16
+#define CL_MEM_COPY_HOST_PTR 32
+#define CL_MAP_READ 1
+#define CL_MAP_WRITE 2
+#define CL_CONTEXT_PLATFORM 0x1084
+
+enum {
+    CL_CONTEXT_DEVICES, CL_DEVICE_HOST_UNIFIED_MEMORY, CL_DEVICE_NAME,
+    CL_DEVICE_TYPE, CL_DEVICE_VERSION, CL_DRIVER_VERSION,
+    CL_PROGRAM_BUILD_LOG, CL_PROGRAM_BINARY_SIZES, CL_PROGRAM_BINARIES,
+    CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END
+};
+
+namespace cl {
+
+    struct Device;
+
+    /**
+     * Result of every getInfo, converts to whatever is asked for as empty
+     * or 0.
+     */
+    struct Info {
+        operator std::string() const {
+            return std::string();
+        }
+
+        operator cl_ulong() const {
+            return 0;
+        }
+
+        operator std::vector<size_t>() const {
+            return std::vector<size_t>();
+        }
+
+        operator std::vector<Device>() const;
+    };
+
+    struct Error : std::exception {
+
+        Error(cl_int err = 0, const char* call = NULL) : err_(err) {
+        }
+
+        const char* what() const throw () {
+            return "cl::Error";
+        }
+
+        cl_int err() const {
+            return err_;
+        }
+
+        cl_int err_;
+    };
+
+    struct Device {
+
+        void* operator()() const {
+            return NULL;
+        }
+
+        template<int N> Info getInfo() const {
+            return Info();
+        }
+    };
+
+    /**
+     * One device, so Runtime::initialize can take devices_[0].
+     */
+    inline Info::operator std::vector<Device>() const {
+        return std::vector<Device>(1);
+    }
+
+    struct Platform {
+
+        static void get(std::vector<Platform>* platforms) {
+            platforms->assign(1, Platform());
+        }
+
+        void* operator()() const {
+            return NULL;
+        }
+
+        template<int N> Info getInfo() const {
+            return Info();
+        }
+    };
+
+    struct Context {
+
+        Context() {
+        }
+
+        Context(cl_device_type type, cl_context_properties* properties) {
+        }
+
+        void* operator()() const {
+            return NULL;
+        }
+
+        template<int N> Info getInfo() const {
+            return Info();
+        }
+    };
+
+    struct Program {
+        typedef std::vector<std::pair<const char*, size_t> > Sources;
+        typedef std::vector<std::pair<const void*, size_t> > Binaries;
+
+        Program() {
+        }
+
+        Program(const Context& context, const Sources& sources, cl_int* err = NULL) {
+        }
+
+        Program(const Context& context, const std::vector<Device>& devices, const Binaries& binaries,
+                std::vector<cl_int>* status = NULL, cl_int* err = NULL) {
+        }
+
+        void build(const std::vector<Device>& devices, const char* options = NULL) {
+        }
+
+        template<int N> Info getInfo() const {
+            return Info();
+        }
+
+        template<class T> cl_int getInfo(int name, T* value) const {
+            return CL_SUCCESS;
+        }
+
+        template<int N> std::string getBuildInfo(const Device& device) const {
+            return std::string();
+        }
+    };
+
+    /**
+     * Host memory shared by the copies of a buffer, like a cl_mem handle.
+     */
+    struct Buffer {
+        std::shared_ptr<std::vector<char> > data;
+
+        Buffer() {
+        }
+
+        Buffer(const Context& context, cl_mem_flags flags, size_t size, void* host = NULL)
+        : data(new std::vector<char>(size)) {
+            if (host != NULL && (flags & CL_MEM_COPY_HOST_PTR)) {
+                memcpy(&(*data)[0], host, size);
+            }
+        }
+    };
+
+    struct LocalSpaceArg {
+        size_t size;
+    };
+
+    inline LocalSpaceArg __local(size_t size) {
+        LocalSpaceArg arg;
+        arg.size = size;
+        return arg;
+    }
+
+    struct Kernel {
+
+        Kernel() {
+        }
+
+        Kernel(const Program& program, const char* name) {
+        }
+
+        void* operator()() const {
+            return NULL;
+        }
+
+        template<class T> cl_int setArg(int index, const T& value) {
+            return CL_SUCCESS;
+        }
+    };
+
+    struct NDRange {
+
+        NDRange() {
+        }
+
+        NDRange(size_t x) {
+        }
+
+        NDRange(size_t x, size_t y) {
+        }
+    };
+
+    static const NDRange NullRange;
+
+    struct Event {
+
+        void wait() const {
+        }
+
+        template<int N> cl_ulong getProfilingInfo() const {
+            return 0;
+        }
+
+        template<int N> Info getInfo() const {
+            return Info();
+        }
+    };
+
+    /**
+     * Every command completes when it is enqueued. reads and bytes_read
+     * count the enqueueReadBuffer calls of all queues.
+     */
+    struct CommandQueue {
+
+        CommandQueue() {
+        }
+
+        CommandQueue(const Context& context, const Device& device, cl_command_queue_properties properties = 0) {
+        }
+
+        void* operator()() const {
+            return NULL;
+        }
+
+        cl_int enqueueWriteBuffer(const Buffer& buffer, cl_bool blocking, size_t offset, size_t size, const void* host,
+                const std::vector<Event>* events = NULL, Event* event = NULL) {
+            memcpy(&(*buffer.data)[offset], host, size);
+            return CL_SUCCESS;
+        }
+
+        cl_int enqueueReadBuffer(const Buffer& buffer, cl_bool blocking, size_t offset, size_t size, void* host,
+                const std::vector<Event>* events = NULL, Event* event = NULL) {
+            reads()++;
+            bytes_read() += size;
+            memcpy(host, &(*buffer.data)[offset], size);
+            return CL_SUCCESS;
+        }
+
+        void* enqueueMapBuffer(const Buffer& buffer, cl_bool blocking, cl_map_flags flags, size_t offset, size_t size,
+                const std::vector<Event>* events = NULL, Event* event = NULL, cl_int* err = NULL) {
+            return &(*buffer.data)[offset];
+        }
+
+        cl_int enqueueUnmapMemObject(const Buffer& buffer, void* mapped,
+                const std::vector<Event>* events = NULL, Event* event = NULL) {
+            return CL_SUCCESS;
+        }
+
+        cl_int enqueueNDRangeKernel(const Kernel& kernel, const NDRange& offset, const NDRange& global,
+                const NDRange& local, const std::vector<Event>* events = NULL, Event* event = NULL) {
+            return CL_SUCCESS;
+        }
+
+        cl_int enqueueTask(const Kernel& kernel) {
+            return CL_SUCCESS;
+        }
+
+        cl_int flush() {
+            return CL_SUCCESS;
+        }
+
+        cl_int finish() {
+            return CL_SUCCESS;
+        }
+
+        static int& reads() {
+            static int n = 0;
+            return n;
+        }
+
+        static size_t& bytes_read() {
+            static size_t n = 0;
+            return n;
+        }
+    };
+}
+
+#endif /* CL_HPP_ */
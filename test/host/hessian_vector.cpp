@@ -0,0 +1,56 @@
+/* 
+ * File:   hessian_vector.cpp
+ *
+ * H·v of AD_HESSIAN_VECTOR against central differences of the gradient 
+ * along v.
+ */
+
+#include "model.hpp"
+#include "check.hpp"
+
+/**
+ * Records the model at x with tangents v and returns the gradient in g 
+ * and H·v in hv.
+ */
+static void sweep(const double* x, const double* v, double* g, double* hv) {
+    model_tape tape(256);
+    struct ad_variable vars[MODEL_SIZE];
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        ad_init_var(&tape.gs, &vars[i], x[i]);
+        vars[i].tangent = v[i];
+    }
+    model(&tape.gs, vars);
+    int n = 0;
+    const double* gradient = compute_gradient_into(tape.gs, n);
+    const double* product = ad_hessian_vector(tape.gs);
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        g[i] = gradient[vars[i].id];
+        hv[i] = product[vars[i].id];
+    }
+}
+
+int main(int argc, char** argv) {
+    const double x[MODEL_SIZE] = {0.3, 0.45, 0.6, 0.7};
+    const double directions[][MODEL_SIZE] = {
+        {1.0, 0.0, 0.0, 0.0},
+        {0.0, 0.0, 1.0, 0.0},
+        {0.5, -1.0, 0.25, 2.0}
+    };
+    const double h = 1e-5;
+    for (int d = 0; d < 3; d++) {
+        const double* v = directions[d];
+        double g[MODEL_SIZE], hv[MODEL_SIZE], gp[MODEL_SIZE], gm[MODEL_SIZE], unused[MODEL_SIZE];
+        double xp[MODEL_SIZE], xm[MODEL_SIZE];
+        for (int i = 0; i < MODEL_SIZE; i++) {
+            xp[i] = x[i] + h * v[i];
+            xm[i] = x[i] - h * v[i];
+        }
+        sweep(x, v, g, hv);
+        sweep(xp, v, gp, unused);
+        sweep(xm, v, gm, unused);
+        for (int i = 0; i < MODEL_SIZE; i++) {
+            CHECK_CLOSE(hv[i], (gp[i] - gm[i]) / (2.0 * h), 1e-6);
+        }
+    }
+    return check_done("hessian_vector");
+}
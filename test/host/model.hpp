@@ -0,0 +1,55 @@
+/* 
+ * File:   model.hpp
+ *
+ * Test function of four variables built from every host operator, 
+ * recorded on a contiguous tape, for the second order checks.
+ */
+
+#ifndef MODEL_HPP
+#define MODEL_HPP
+
+#include <cstdlib>
+#include "ad4cl.h"
+
+#define MODEL_SIZE 4
+#define MODEL_TERMS 12
+
+/**
+ * Records the model at x, all components in (0.2, 0.8), and returns it.
+ */
+static struct ad_variable model(struct ad_gradient_structure* gs, const struct ad_variable* x) {
+    struct ad_variable t[MODEL_TERMS];
+    t[0] = ad_times(gs, x[0], ad_sin(gs, x[1]));
+    t[1] = ad_divide(gs, ad_exp(gs, x[2]), ad_plus_vd(gs, x[3], 1.0));
+    t[2] = ad_pow(gs, x[0], x[3]);
+    t[3] = ad_times_dv(gs, 0.5, ad_log(gs, ad_plus(gs, x[1], x[2])));
+    t[4] = ad_times(gs, ad_cos(gs, ad_times(gs, x[2], x[3])), ad_tan(gs, x[0]));
+    t[5] = ad_minus(gs, ad_acos(gs, x[1]), ad_times(gs, ad_asin(gs, x[2]), ad_atan(gs, x[3])));
+    t[6] = ad_times(gs, ad_cosh(gs, x[0]), ad_sinh(gs, x[1]));
+    t[7] = ad_divide(gs, ad_tanh(gs, x[2]), ad_log10(gs, ad_plus_dv(gs, 2.0, x[3])));
+    t[8] = ad_times(gs, ad_sqrt(gs, x[0]), ad_pow_vd(gs, x[1], 3.0));
+    t[9] = ad_times(gs, ad_pow_dv(gs, 2.0, x[2]), ad_divide_vd(gs, x[3], 2.0));
+    t[10] = ad_times(gs, ad_divide_dv(gs, 1.0, x[0]), ad_minus_vd(gs, x[1], 0.1));
+    t[11] = ad_times(gs, ad_minus_dv(gs, 1.0, x[2]), ad_times_vd(gs, x[3], 3.0));
+    return ad_sum(gs, MODEL_TERMS, t);
+}
+
+/**
+ * Gradient structure recording on its own contiguous tape.
+ */
+struct model_tape {
+    struct ad_gradient_structure gs;
+    struct ad_entry* entries;
+
+    model_tape(int capacity) : gs(ad_gradient_structure()), entries(create_entries(capacity)) {
+        ad_tape_bind(&gs, entries, capacity);
+        gs.recording = 1;
+    }
+
+    ~model_tape() {
+        ad_workspace_free(&gs);
+        free(entries);
+    }
+};
+
+#endif /* MODEL_HPP */
@@ -0,0 +1,120 @@
+/*
+ * File:   nary.cpp
+ *
+ * ad_dot and ad_nary record a single entry in every tape layout, spread
+ * over AD_NARY_OPERATIONS(n) slots without AD_CSR_TAPE, and on a
+ * segmented tape move to the next chunk or are summed in parts when they
+ * do not fit.
+ */
+
+#include "ad4cl.h"
+#include "check.hpp"
+
+/**
+ * Records the dot product of n arguments with the weights 1, 2, 3, ...
+ * after skip other entries and checks the tape and the gradient.
+ */
+static void check_dot(struct ad_gradient_structure* gs, int skip, int n) {
+    struct ad_variable* args = (struct ad_variable*) malloc(n * sizeof (struct ad_variable));
+    double* weights = (double*) malloc(n * sizeof (double));
+    double expected = 0.0;
+    for (int i = 0; i < n; i++) {
+        ad_init_var(gs, &args[i], 0.5 + i);
+        weights[i] = 1.0 + i;
+        expected += weights[i] * args[i].value;
+    }
+    struct ad_variable x = args[0];
+    for (int i = 0; i < skip; i++) {
+        x = ad_times(gs, x, args[n - 1]);
+    }
+    ad_thread_flush(gs);
+    int slot = gs->stack_current;
+    struct ad_variable r = ad_dot(gs, n, weights, args);
+    ad_thread_flush(gs);
+    CHECK_CLOSE(r.value, expected, 1e-12);
+
+    if (gs->chunk == NULL || n <= gs->pair_capacity) {
+        //one entry, its result last
+        CHECK(gs->stack_current == slot + AD_NARY_OPERATIONS(n));
+        CHECK(r.id == gs->current_variable_id - 1);
+        int local = ad_tape_slot(gs, gs->stack_current - 1);
+        CHECK(ad_entry_id(gs, local) == r.id);
+        CHECK(ad_entry_size(gs, local) == n);
+        for (int i = 0; i < n; i++) {
+            CHECK(ad_entry_coeff_id(gs, local, i) == args[i].id);
+            CHECK(ad_entry_dx(gs, local, i) == weights[i]);
+        }
+        for (int s = slot; s < gs->stack_current - 1; s++) {
+            CHECK(ad_entry_size(gs, ad_tape_slot(gs, s)) == 0);
+        }
+    }
+
+    int size = 0;
+    double* g = compute_gradient(*gs, size);
+    for (int i = 0; i < n; i++) {
+        CHECK_CLOSE(g[args[i].id], weights[i], 1e-12);
+    }
+    free(g);
+    free(weights);
+    free(args);
+}
+
+int main(int argc, char** argv) {
+    struct ad_gradient_structure gs = ad_gradient_structure();
+    struct ad_entry* entries = create_entries(100);
+    ad_tape_bind(&gs, entries, 100);
+    gs.recording = 1;
+    for (int n = 1; n <= 7; n++) {
+        ad_reset(&gs, 0);
+        check_dot(&gs, 1, n);
+    }
+
+    //ad_nary takes the value as given
+    ad_reset(&gs, 0);
+    struct ad_variable args[5];
+    double dx[5];
+    for (int i = 0; i < 5; i++) {
+        ad_init_var(&gs, &args[i], i);
+        dx[i] = -0.5 * i;
+    }
+    struct ad_variable r = ad_nary(&gs, 42.0, 5, dx, args);
+    ad_thread_flush(&gs);
+    CHECK(r.value == 42.0);
+    int size = 0;
+    double* g = compute_gradient(gs, size);
+    for (int i = 0; i < 5; i++) {
+        CHECK(g[args[i].id] == dx[i]);
+    }
+    free(g);
+    ad_workspace_free(&gs);
+    free(entries);
+
+#ifndef AD_THREAD_SAFE
+    //chunks of 4 entries hold 8 coefficients
+    struct ad_chunk_pool* pool = ad_chunk_pool_create(4);
+    struct ad_gradient_structure segmented = ad_gradient_structure();
+    ad_tape_use_pool(&segmented, pool);
+    segmented.recording = 1;
+    check_dot(&segmented, 3, 7);
+    ad_reset(&segmented, 0);
+    check_dot(&segmented, 1, 8);
+    ad_reset(&segmented, 0);
+    check_dot(&segmented, 2, 30);
+    ad_workspace_free(&segmented);
+    ad_tape_reset(&segmented);
+    free(segmented.chunk);
+    ad_chunk_pool_free(pool);
+#endif
+
+#if defined(AD_THREAD_SAFE)
+    return check_done("nary_thread_safe");
+#elif defined(AD_IMPLICIT_ID)
+    return check_done("nary_implicit");
+#elif defined(AD_SOA_TAPE)
+    return check_done("nary_soa");
+#elif defined(AD_CSR_TAPE)
+    return check_done("nary_csr");
+#else
+    return check_done("nary");
+#endif
+}
@@ -0,0 +1,111 @@
+/* 
+ * File:   parallel_for.cpp
+ *
+ * ad_parallel_for against recording the same items one after the other, 
+ * with exactly and with more operations per item than recorded, on a 
+ * contiguous and on a segmented tape.
+ */
+
+#include <cstdlib>
+#include "ad4cl.h"
+#include "check.hpp"
+
+struct least_squares {
+    struct ad_variable a;
+    struct ad_variable b;
+    struct ad_variable* out;
+};
+
+/**
+ * Records (a x + b - y)^2 for observation i, 4 operations.
+ */
+static void residual(struct ad_gradient_structure* gs, int i, void* data) {
+    struct least_squares* ls = (struct least_squares*) data;
+    double x = 1e-3 * i, y = std::sin(x);
+    struct ad_variable r = ad_minus_vd(gs, ad_plus(gs, ad_times_vd(gs, ls->a, x), ls->b), y);
+    ls->out[i] = ad_times(gs, r, r);
+}
+
+/**
+ * Records size residuals on a new tape, contiguous or made of chunks of 
+ * chunk entries if chunk > 0, in parallel if operations > 0, and returns 
+ * df/da and df/db of their sum in g.
+ */
+static double record(int size, int operations, int chunk, double* g) {
+    struct ad_gradient_structure gs = ad_gradient_structure();
+    struct ad_entry* entries = NULL;
+    struct ad_chunk_pool* pool = NULL;
+    if (chunk > 0) {
+        pool = ad_chunk_pool_create(chunk);
+        ad_tape_use_pool(&gs, pool);
+    } else {
+        entries = create_entries(8 * size + 16);
+        ad_tape_bind(&gs, entries, 8 * size + 16);
+    }
+    gs.recording = 1;
+    struct least_squares ls;
+    ad_init_var(&gs, &ls.a, 0.8);
+    ad_init_var(&gs, &ls.b, 0.1);
+    ls.out = (struct ad_variable*) malloc(size * sizeof (struct ad_variable));
+    if (operations > 0) {
+        ad_parallel_for(&gs, size, operations, residual, &ls);
+    } else {
+        for (int i = 0; i < size; i++) {
+            residual(&gs, i, &ls);
+        }
+    }
+    struct ad_variable f = ad_sum(&gs, size, ls.out);
+    int n = 0;
+    const double* gradient = compute_gradient_into(gs, n);
+    g[0] = gradient[ls.a.id];
+    g[1] = gradient[ls.b.id];
+    free(ls.out);
+    ad_workspace_free(&gs);
+    if (pool != NULL) {
+        ad_tape_reset(&gs);
+        free(gs.chunk);
+        ad_chunk_pool_free(pool);
+    }
+    free(entries);
+    return f.value;
+}
+
+int main(int argc, char** argv) {
+#ifdef _OPENMP
+    if (omp_get_max_threads() < 4) {
+        omp_set_num_threads(4);
+    }
+#endif
+    const int size = 10001;
+    //a chunk holds the pairs of the sum with AD_CSR_TAPE, the parts still 
+    //span several chunks each
+    const int chunk = size / 2 + 1;
+    double serial[2], exact[2], padded[2], segmented[2], chunked[2];
+    double f = record(size, 0, 0, serial);
+    CHECK(record(size, 4, 0, exact) == f);
+    CHECK(record(size, 6, 0, padded) == f);
+    CHECK(record(size, 0, chunk, segmented) == f);
+    CHECK(record(size, 6, chunk, chunked) == f);
+    for (int k = 0; k < 2; k++) {
+        CHECK_CLOSE(exact[k], serial[k], 1e-12);
+        CHECK_CLOSE(padded[k], serial[k], 1e-12);
+        CHECK_CLOSE(segmented[k], serial[k], 1e-12);
+        CHECK_CLOSE(chunked[k], serial[k], 1e-12);
+    }
+
+    double da = 0.0, db = 0.0;
+    for (int i = 0; i < size; i++) {
+        double x = 1e-3 * i, r = 0.8 * x + 0.1 - std::sin(x);
+        da += 2.0 * r * x;
+        db += 2.0 * r;
+    }
+    CHECK_CLOSE(serial[0], da, 1e-10);
+    CHECK_CLOSE(serial[1], db, 1e-10);
+#if defined(AD_SOA_TAPE)
+    return check_done("parallel_for_soa");
+#elif defined(AD_CSR_TAPE)
+    return check_done("parallel_for_csr");
+#else
+    return check_done("parallel_for");
+#endif
+}
@@ -0,0 +1,75 @@
+/* 
+ * File:   parallel_sweep.cpp
+ *
+ * ad_parallel_reverse_sweep against the serial ad_reverse_sweep and the 
+ * analytic gradient, on a contiguous and on a segmented tape large enough
+ * for ad_gradient_sweep to go parallel.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include "ad4cl.h"
+#include "check.hpp"
+
+/**
+ * Records sum of (a x + b - y)^2 + (c x - y)^2 / 2 over size observations
+ * on gs and checks the gradient of both sweeps.
+ */
+static void check_sweeps(struct ad_gradient_structure* gs, int size) {
+    struct ad_variable a, b, c;
+    ad_init_var(gs, &a, 1.7);
+    ad_init_var(gs, &b, -0.4);
+    ad_init_var(gs, &c, 0.9);
+    struct ad_variable* out = (struct ad_variable*) malloc(size * sizeof (struct ad_variable));
+    double da = 0.0, db = 0.0, dc = 0.0;
+    for (int i = 0; i < size; i++) {
+        double x = 1e-4 * i, y = std::cos(x);
+        struct ad_variable r = ad_minus_vd(gs, ad_plus(gs, ad_times_vd(gs, a, x), b), y);
+        struct ad_variable s = ad_minus_vd(gs, ad_times_vd(gs, c, x), y);
+        out[i] = ad_plus(gs, ad_times(gs, r, r), ad_times_dv(gs, 0.5, ad_times(gs, s, s)));
+        double rr = a.value * x + b.value - y, ss = c.value * x - y;
+        da += 2.0 * rr * x;
+        db += 2.0 * rr;
+        dc += ss * x;
+    }
+    ad_sum(gs, size, out);
+    CHECK(gs->stack_current >= AD_PARALLEL_SWEEP_MIN);
+
+    int n = 0;
+    const double* g = compute_gradient_into(*gs, n);
+    double* serial = (double*) calloc(gs->current_variable_id + 1, sizeof (double));
+    ad_reverse_sweep(*gs, serial);
+    for (int id = 0; id < gs->current_variable_id; id++) {
+        if (g[id] != serial[id]) {
+            CHECK_CLOSE(g[id], serial[id], 1e-12);
+        }
+    }
+    CHECK_CLOSE(g[a.id], da, 1e-10);
+    CHECK_CLOSE(g[b.id], db, 1e-10);
+    CHECK_CLOSE(g[c.id], dc, 1e-10);
+    free(serial);
+    free(out);
+}
+
+int main(int argc, char** argv) {
+#ifdef _OPENMP
+    if (omp_get_max_threads() < 4) {
+        omp_set_num_threads(4);
+    }
+#endif
+    const int size = 20000;
+
+    struct ad_gradient_structure gs = ad_gradient_structure();
+    struct ad_entry* entries = create_entries(10 * size);
+    ad_tape_bind(&gs, entries, 10 * size);
+    gs.recording = 1;
+    check_sweeps(&gs, size);
+    ad_workspace_free(&gs);
+    free(entries);
+
+#ifndef AD_THREAD_SAFE
+    //segments of 1000 entries
+    check_sweeps(create_gradient_structure(1000), size);
+#endif
+    return check_done("parallel_sweep");
+}
@@ -0,0 +1,111 @@
+/*
+ * File:   readback.cpp
+ *
+ * Runtime::restore over the in-memory stand-in of cl.hpp: the host
+ * records a little, the "device" records more in its copy of the tape,
+ * and restore has to reproduce that recording while reading only the
+ * slots (and pairs) the device recorded.
+ */
+
+#include "cl_standin.hpp"
+#include "Runtime.hpp"
+#include "check.hpp"
+
+int main(int argc, char** argv) {
+    const int capacity = 4000;
+    struct ad_gradient_structure gs = ad_gradient_structure();
+#ifdef AD_CSR_TAPE
+    size_t bytes = ad_csr_tape_bytes(capacity, capacity * MAX_VARIABLE_IN_EXPESSION);
+    struct ad_entry* host = (struct ad_entry*) calloc(1, bytes);
+    struct ad_entry* device = (struct ad_entry*) calloc(1, bytes);
+    ad_csr_tape_bind(&gs, host, capacity, capacity * MAX_VARIABLE_IN_EXPESSION);
+#else
+    size_t bytes = ad_tape_bytes(capacity);
+    struct ad_entry* host = create_entries(capacity);
+    struct ad_entry* device = create_entries(capacity);
+    ad_tape_bind(&gs, host, capacity);
+#endif
+    gs.recording = 1;
+    struct ad_variable a, b;
+    ad_init_var(&gs, &a, 1.5);
+    ad_init_var(&gs, &b, 0.25);
+    struct ad_variable v = ad_times(&gs, a, b);
+
+    ad4cl::Runtime rt;
+    rt.initialize(0, CL_DEVICE_TYPE_CPU);
+    rt.bind(&gs, host, capacity, ad4cl::Runtime::COPY);
+
+    //what a kernel records on top of the uploaded structure
+    struct ad_gradient_structure dev = gs;
+    memcpy(device, host, bytes);
+    dev.gradient_stack = device;
+    ad_tape_columns(&dev);
+    for (int i = 0; i < 500; i++) {
+        v = ad_plus(&dev, ad_times(&dev, v, a), b);
+    }
+    struct ad_gradient_structure recorded = dev;
+    recorded.stack_current = gs.stack_current;
+    recorded.counter = dev.stack_current - gs.stack_current;
+    recorded.current_variable_id = gs.current_variable_id;
+    recorded.pair_current = gs.pair_current;
+    recorded.pair_counter = dev.pair_current - gs.pair_current;
+
+    rt.upload();
+    rt.write(rt.gs_buffer(), &recorded, sizeof (recorded));
+    rt.write(rt.tape_buffer(), device, bytes);
+    struct ad_entry* recorded_by_host = (struct ad_entry*) malloc(bytes);
+    memcpy(recorded_by_host, host, bytes);
+    cl::CommandQueue::reads() = 0;
+    cl::CommandQueue::bytes_read() = 0;
+    rt.readback();
+    rt.restore();
+
+#ifdef AD_CSR_TAPE
+    size_t range = ad_csr_tape_bytes(recorded.counter, recorded.pair_counter);
+#else
+    size_t range = ad_tape_bytes(recorded.counter);
+#endif
+    CHECK(cl::CommandQueue::bytes_read() == sizeof (struct ad_gradient_structure) + range);
+    //the structure, then one read per column
+    CHECK(cl::CommandQueue::reads() <= 1 + 2 * MAX_VARIABLE_IN_EXPESSION + 3);
+
+    //restore lays the columns out over the bound tape, not over whatever
+    //gs points to by then
+    memcpy(host, recorded_by_host, bytes);
+    struct ad_entry* elsewhere = (struct ad_entry*) calloc(1, bytes);
+    gs.gradient_stack = elsewhere;
+    ad_tape_columns(&gs);
+    rt.readback();
+    rt.restore();
+    free(elsewhere);
+
+    CHECK(gs.stack_current == dev.stack_current);
+    CHECK(gs.current_variable_id == dev.current_variable_id);
+    CHECK(gs.pair_current == dev.pair_current);
+    for (int s = 0; s < gs.stack_current; s++) {
+        CHECK(ad_entry_id(&gs, s) == ad_entry_id(&dev, s));
+        CHECK(ad_entry_size(&gs, s) == ad_entry_size(&dev, s));
+        for (int k = 0; k < ad_entry_size(&gs, s); k++) {
+            CHECK(ad_entry_dx(&gs, s, k) == ad_entry_dx(&dev, s, k));
+            CHECK(ad_entry_coeff_id(&gs, s, k) == ad_entry_coeff_id(&dev, s, k));
+        }
+    }
+    int n = 0, m = 0;
+    const double* g = compute_gradient_into(gs, n);
+    const double* e = compute_gradient_into(dev, m);
+    CHECK(g[a.id] == e[a.id]);
+    CHECK(g[b.id] == e[b.id]);
+
+    free(host);
+    free(device);
+    free(recorded_by_host);
+#if defined(AD_IMPLICIT_ID)
+    return check_done("readback_implicit");
+#elif defined(AD_SOA_TAPE)
+    return check_done("readback_soa");
+#elif defined(AD_CSR_TAPE)
+    return check_done("readback_csr");
+#else
+    return check_done("readback");
+#endif
+}
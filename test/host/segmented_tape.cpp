@@ -0,0 +1,96 @@
+/* 
+ * File:   segmented_tape.cpp
+ *
+ * The model recorded on a segmented tape of small chunks against the same 
+ * recording on a contiguous tape, before and after ad_reset, which has to 
+ * return the chunks to the pool for the next recording.
+ */
+
+#include "model.hpp"
+#include "check.hpp"
+
+/**
+ * Number of chunks in the free list of pool.
+ */
+static int free_chunks(const struct ad_chunk_pool* pool) {
+    int n = 0;
+    for (const struct ad_tape_chunk* c = pool->free_list; c != NULL; c = c->next) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Number of chunks of the tape of gs.
+ */
+static int tape_chunks(const struct ad_gradient_structure* gs) {
+    const struct ad_tape_chunk* c = gs->chunk;
+    while (c->prev != NULL) {
+        c = c->prev;
+    }
+    int n = 0;
+    for (; c != NULL; c = c->next) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Records the model at x on gs, from first_id on, and checks its gradient 
+ * against the same recording on a contiguous tape.
+ */
+static void check_recording(struct ad_gradient_structure* gs, int first_id, const double* x) {
+    model_tape tape(256);
+    struct ad_variable vars[MODEL_SIZE], expected[MODEL_SIZE];
+    ad_reset(gs, first_id);
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        ad_init_var(gs, &vars[i], x[i]);
+        ad_init_var(&tape.gs, &expected[i], x[i]);
+    }
+    struct ad_variable f = model(gs, vars);
+    CHECK(model(&tape.gs, expected).value == f.value);
+    CHECK(gs->stack_current == tape.gs.stack_current);
+
+    int n = 0, m = 0;
+    const double* g = compute_gradient_into(*gs, n);
+    const double* e = compute_gradient_into(tape.gs, m);
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        CHECK(g[vars[i].id] == e[expected[i].id]);
+    }
+}
+
+int main(int argc, char** argv) {
+    const double x[MODEL_SIZE] = {0.3, 0.45, 0.6, 0.7};
+    const double y[MODEL_SIZE] = {0.7, 0.25, 0.4, 0.5};
+    //6 entries hold the 12 pairs of the sum with AD_CSR_TAPE
+    struct ad_chunk_pool* pool = ad_chunk_pool_create(6);
+    struct ad_gradient_structure gs = ad_gradient_structure();
+    ad_tape_use_pool(&gs, pool);
+    gs.recording = 1;
+
+    check_recording(&gs, 0, x);
+    int chunks = tape_chunks(&gs);
+    CHECK(chunks > 2);
+    CHECK(free_chunks(pool) == 0);
+
+    //the second recording takes the released chunks again
+    check_recording(&gs, 0, y);
+    CHECK(tape_chunks(&gs) == chunks);
+    CHECK(free_chunks(pool) == 0);
+
+    ad_reset(&gs, 0);
+    CHECK(tape_chunks(&gs) == 1);
+    CHECK(free_chunks(pool) == chunks - 1);
+    check_recording(&gs, 0, x);
+    CHECK(free_chunks(pool) == 0);
+
+    ad_workspace_free(&gs);
+    ad_tape_reset(&gs);
+#if defined(AD_SOA_TAPE)
+    return check_done("segmented_tape_soa");
+#elif defined(AD_CSR_TAPE)
+    return check_done("segmented_tape_csr");
+#else
+    return check_done("segmented_tape");
+#endif
+}
@@ -0,0 +1,124 @@
+/* 
+ * File:   sparse_hessian.cpp
+ *
+ * compute_sparse_hessian against central differences of the gradient of 
+ * the model, and against the analytic tridiagonal Hessian of a chain long 
+ * enough to be split over the threads.
+ */
+
+#include <cmath>
+#include "model.hpp"
+#include "check.hpp"
+
+/**
+ * Gradient of the model at x in g.
+ */
+static void gradient(const double* x, double* g) {
+    model_tape tape(256);
+    struct ad_variable vars[MODEL_SIZE];
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        ad_init_var(&tape.gs, &vars[i], x[i]);
+    }
+    model(&tape.gs, vars);
+    int n = 0;
+    const double* adjoint = compute_gradient_into(tape.gs, n);
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        g[i] = adjoint[vars[i].id];
+    }
+}
+
+/**
+ * The lower triangle against the dense Hessian of central differences, 
+ * with the same nonzeros.
+ */
+static void check_model() {
+    const double x[MODEL_SIZE] = {0.3, 0.45, 0.6, 0.7};
+    const double step = 1e-5;
+    double dense[MODEL_SIZE][MODEL_SIZE];
+    for (int j = 0; j < MODEL_SIZE; j++) {
+        double xp[MODEL_SIZE], xm[MODEL_SIZE], gp[MODEL_SIZE], gm[MODEL_SIZE];
+        for (int i = 0; i < MODEL_SIZE; i++) {
+            xp[i] = x[i] + (i == j ? step : 0.0);
+            xm[i] = x[i] - (i == j ? step : 0.0);
+        }
+        gradient(xp, gp);
+        gradient(xm, gm);
+        for (int i = 0; i < MODEL_SIZE; i++) {
+            dense[i][j] = (gp[i] - gm[i]) / (2.0 * step);
+        }
+    }
+
+    model_tape tape(256);
+    struct ad_variable vars[MODEL_SIZE];
+    int ids[MODEL_SIZE];
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        ad_init_var(&tape.gs, &vars[i], x[i]);
+        ids[i] = vars[i].id;
+    }
+    model(&tape.gs, vars);
+    int nonzeros = 0;
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        for (int j = 0; j <= i; j++) {
+            nonzeros += std::fabs(dense[i][j]) > 1e-6;
+        }
+    }
+    struct ad_sparse_hessian h;
+    CHECK(compute_sparse_hessian(tape.gs, MODEL_SIZE, ids, &h) == nonzeros);
+    for (int i = 0; i < MODEL_SIZE; i++) {
+        for (int k = h.row_offset[i]; k < h.row_offset[i + 1]; k++) {
+            CHECK(h.column[k] <= i);
+            CHECK_CLOSE(h.value[k], dense[i][h.column[k]], 1e-6);
+        }
+    }
+    ad_sparse_hessian_free(&h);
+}
+
+/**
+ * Hessian of sum x[i]^2 x[i + 1] + sum sin(x[i]), 2 n - 1 nonzeros in 
+ * the lower triangle.
+ */
+static void check_chain(int n) {
+    model_tape tape(5 * n);
+    struct ad_variable* x = (struct ad_variable*) malloc(n * sizeof (struct ad_variable));
+    struct ad_variable* terms = (struct ad_variable*) malloc(2 * n * sizeof (struct ad_variable));
+    int* ids = (int*) malloc(n * sizeof (int));
+    for (int i = 0; i < n; i++) {
+        ad_init_var(&tape.gs, &x[i], 0.5 + 0.25 * std::sin(i));
+        ids[i] = x[i].id;
+    }
+    for (int i = 0; i < n; i++) {
+        terms[2 * i] = ad_sin(&tape.gs, x[i]);
+        terms[2 * i + 1] = i + 1 < n ? ad_times(&tape.gs, ad_times(&tape.gs, x[i], x[i]), x[i + 1]) : x[i];
+    }
+    ad_sum(&tape.gs, 2 * n, terms);
+
+    struct ad_sparse_hessian h;
+    CHECK(compute_sparse_hessian(tape.gs, n, ids, &h) == 2 * n - 1);
+    for (int i = 0; i < n; i++) {
+        CHECK(h.row_offset[i + 1] - h.row_offset[i] == (i > 0 ? 2 : 1));
+        for (int k = h.row_offset[i]; k < h.row_offset[i + 1]; k++) {
+            int j = h.column[k];
+            double expected = j < i ? 2.0 * x[j].value
+                    : (i + 1 < n ? 2.0 * x[i + 1].value : 0.0) - std::sin(x[i].value);
+            CHECK(j == i || j == i - 1);
+            CHECK_CLOSE(h.value[k], expected, 1e-12);
+        }
+    }
+    ad_sparse_hessian_free(&h);
+    free(ids);
+    free(terms);
+    free(x);
+}
+
+int main(int argc, char** argv) {
+    check_model();
+    check_chain(30);
+#ifdef _OPENMP
+    //above AD_PARALLEL_SWEEP_MIN entries, serial and on four threads
+    omp_set_num_threads(1);
+    check_chain(25000);
+    omp_set_num_threads(4);
+#endif
+    check_chain(25000);
+    return check_done("sparse_hessian");
+}
@@ -0,0 +1,89 @@
+/* 
+ * File:   thread_safe.cpp
+ *
+ * AD_THREAD_SAFE with a gradient structure from create_gradient_structure:
+ * serial recording, then the least squares objective of main.cpp recorded
+ * on eight OpenMP threads, against its analytic gradient and, with 
+ * AD_HESSIAN_VECTOR, its analytic Hessian column of a.
+ */
+
+#include "ad4cl.h"
+#include "check.hpp"
+
+int main(int argc, char** argv) {
+    //serial recording through the default constructor
+    struct ad_gradient_structure* gs = create_gradient_structure(1000);
+    struct ad_variable a, b;
+    ad_init_var(gs, &a, 1.5);
+    ad_init_var(gs, &b, 2.0);
+    struct ad_variable c = ad_times(gs, a, b);
+    int n = 0;
+    const double* g = compute_gradient_into(*gs, n);
+    CHECK_CLOSE(c.value, 3.0, 1e-15);
+    CHECK_CLOSE(g[a.id], 2.0, 1e-15);
+    CHECK_CLOSE(g[b.id], 1.5, 1e-15);
+
+    //sum of (a x + b - y)^2 recorded by every thread, as AD in main.cpp
+    const int size = 20000;
+    double* x = new double[size];
+    double* y = new double[size];
+    struct ad_variable* out = new struct ad_variable[size];
+    for (int i = 0; i < size; i++) {
+        x[i] = 0.001 * i;
+        y[i] = 4.0 * x[i] + 3.0 + 0.1 * std::sin((double) i);
+    }
+    struct ad_gradient_structure* ts = create_gradient_structure(8 * size);
+    ad_init_var(ts, &a, 4.1);
+    ad_init_var(ts, &b, 2.9);
+#ifdef AD_HESSIAN_VECTOR
+    a.tangent = 1.0;
+#endif
+#pragma omp parallel num_threads(8)
+    {
+        ad_thread_flush(ts);
+#pragma omp for
+        for (int i = 0; i < size; i++) {
+            struct ad_variable r = ad_minus_vd(ts, ad_plus(ts, ad_times_vd(ts, a, x[i]), b), y[i]);
+            out[i] = ad_times(ts, r, r);
+        }
+        ad_thread_flush(ts);
+    }
+    struct ad_variable f = ad_sum(ts, size, out);
+    g = compute_gradient_into(*ts, n);
+
+    double ff = 0.0, da = 0.0, db = 0.0, daa = 0.0, dab = 0.0;
+    for (int i = 0; i < size; i++) {
+        double r = a.value * x[i] + b.value - y[i];
+        ff += r * r;
+        da += 2.0 * r * x[i];
+        db += 2.0 * r;
+        daa += 2.0 * x[i] * x[i];
+        dab += 2.0 * x[i];
+    }
+    CHECK_CLOSE(f.value, ff, 1e-10);
+    CHECK_CLOSE(g[a.id], da, 1e-10);
+    CHECK_CLOSE(g[b.id], db, 1e-10);
+#ifdef AD_HESSIAN_VECTOR
+    const double* hv = ad_hessian_vector(*ts);
+    CHECK_CLOSE(hv[a.id], daa, 1e-10);
+    CHECK_CLOSE(hv[b.id], dab, 1e-10);
+#else
+    (void) daa;
+    (void) dab;
+#endif
+
+    delete[] x;
+    delete[] y;
+    delete[] out;
+#if defined(AD_IMPLICIT_ID)
+    return check_done("thread_safe_implicit");
+#elif defined(AD_SOA_TAPE)
+    return check_done("thread_safe_soa");
+#elif defined(AD_CSR_TAPE)
+    return check_done("thread_safe_csr");
+#elif defined(AD_HESSIAN_VECTOR)
+    return check_done("thread_safe_hv");
+#else
+    return check_done("thread_safe");
+#endif
+}
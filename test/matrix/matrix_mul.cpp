@@ -16,8 +16,7 @@
 #include <sstream>
 #include <sys/time.h>
 
-#include "../../ad4cl.h"
-#include "../../cl.hpp"
+#include "../../Runtime.hpp"
 
 
 
@@ -68,13 +67,11 @@ int main(int argc, char** argv) {
     gs->stack_current = 0;
     gs->recording = 1;
     gs->counter = 0;
+    gs->pair_current = 0;
+    gs->pair_counter = 0;
 
-    struct ad_entry* gradient_stack = new ad_entry[GRADIENT_STACK_SIZE];
-    for (int i = 0; i < GRADIENT_STACK_SIZE; i++) {
-        gradient_stack[i].size = 0;
-        gradient_stack[i].id = 0;
-    }
-    gs->gradient_stack = gradient_stack;
+    struct ad_entry* gradient_stack = create_entries(GRADIENT_STACK_SIZE);
+    ad_tape_bind(gs, gradient_stack, GRADIENT_STACK_SIZE);
 
 
     struct ad_variable * A = new struct ad_variable[widthA * heightA];
@@ -94,102 +91,37 @@ int main(int argc, char** argv) {
 
     lastid = gs->current_variable_id;
 
-    cl::CommandQueue queue;
-    cl::Kernel kernel;
-    cl::Context context;
-    cl::Program program_;
-    cl::Program::Sources source;
-    std::vector<cl::Device> devices;
-    cl_int error;
-    cl::Buffer gs_d;
-    cl::Buffer ad_entry_d;
+    ad4cl::Runtime rt;
     cl::Buffer a_d;
     cl::Buffer b_d;
     cl::Buffer c_d;
 
-    error = CL_SUCCESS;
-    std::string source_code;
-
-    //Read the ad4cl api.
-    std::string line;
-    std::ifstream in;
-    in.open("../../ad.cl");
-
-    std::stringstream ss;
-
-    while (in.good()) {
-        std::getline(in, line);
-        ss << line << "\n";
-    }
-
-    std::ifstream kin;
-    kin.open("matrixmul.cl");
-
-    while (kin.good()) {
-        std::getline(kin, line);
-        ss << line << "\n";
-    }
-    source_code = ss.str();
-
-    std::vector<cl::Platform> platforms;
-
     try {
-        cl::Platform::get(&platforms);
-        if (platforms.size() == 0) {
-            std::cout << "Platform size 0\n";
-            exit(0);
-        }
-
-
-
-        // Get list of devices on default platform and create context
-        cl_context_properties properties[] = {CL_CONTEXT_PLATFORM, (cl_context_properties) (platforms[1])(), 0};
-        context = cl::Context(CL_DEVICE_TYPE_GPU, properties);
-        devices = context.getInfo<CL_CONTEXT_DEVICES > ();
-
-
-
-        //set the program source
-        source = cl::Program::Sources(1, std::make_pair(source_code.c_str(), source_code.size()));
-        program_ = cl::Program(context, source, &error);
-
-        std::stringstream args;
-        //build the program
-        program_.build(devices);
-
-        //set the queue
 #ifdef CL_PROFILING
-        queue = cl::CommandQueue(context, devices[0], CL_QUEUE_PROFILING_ENABLE);
+        rt.initialize(1, CL_DEVICE_TYPE_GPU, CL_QUEUE_PROFILING_ENABLE);
 #else
-        queue = cl::CommandQueue(context, devices[0]);
+        rt.initialize(1, CL_DEVICE_TYPE_GPU);
 #endif
-        if (error != CL_SUCCESS) {
-            std::cout << "---> " << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]) << "\n";
-            exit(0);
-        }
+        //our kernel with the parts of the compiled in ad4cl api it uses
+        rt.build_kernels("matrixmul.cl");
 
+        rt.bind(gs, gradient_stack, GRADIENT_STACK_SIZE);
+        a_d = rt.buffer(CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, (widthA * heightA) * sizeof ( ad_variable), A);
+        b_d = rt.buffer(CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, (widthB * heightB) * sizeof ( ad_variable), B);
+        c_d = rt.buffer(CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, (widthC * heightC) * sizeof ( ad_variable), C);
 
         // Create kernel object
-        kernel = cl::Kernel(program_, "matrixMult");
-
+        cl::Kernel& kernel = rt.ad_kernel("matrixMult");
+        kernel.setArg(2, a_d);
+        kernel.setArg(3, b_d);
+        kernel.setArg(4, c_d);
+        kernel.setArg(5, widthA);
+        kernel.setArg(6, widthB);
     } catch (cl::Error err) {
-        std::cout << err.what() << "---> " << error << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG > (devices[0]);
+        std::cout << err.what() << "\n";
+        exit(0);
     }
 
-    gs_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof ( struct ad_gradient_structure), gs);
-    ad_entry_d = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, GRADIENT_STACK_SIZE * sizeof (struct ad_entry), gradient_stack);
-    a_d = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, (widthA * heightA) * sizeof ( ad_variable), A);
-    b_d = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, (widthB * heightB) * sizeof ( ad_variable), B);
-    c_d = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, (widthC * heightC) * sizeof ( ad_variable), C);
-
-
-    kernel.setArg(0, gs_d);
-    kernel.setArg(1, ad_entry_d);
-    kernel.setArg(2, a_d);
-    kernel.setArg(3, b_d);
-    kernel.setArg(4, c_d);
-    kernel.setArg(5, widthA);
-    kernel.setArg(6, widthB);
     for (int iter = 0; iter < 100; iter++) {
 #ifdef HOST
 #ifdef CL_PROFILING
@@ -205,27 +137,16 @@ int main(int argc, char** argv) {
 #else
 
         //
-        cl::Event event;
         try {
-            queue.enqueueWriteBuffer(gs_d, CL_TRUE, 0, sizeof ( struct ad_gradient_structure), gs);
-            queue.enqueueWriteBuffer(a_d, CL_TRUE, 0, (widthA * heightA) * sizeof ( struct ad_variable), A);
-            queue.enqueueWriteBuffer(b_d, CL_TRUE, 0, (widthB * heightB) * sizeof (struct ad_variable), B);
-
+            rt.write(a_d, A, (widthA * heightA) * sizeof ( struct ad_variable));
+            rt.write(b_d, B, (widthB * heightB) * sizeof (struct ad_variable));
 
+            cl::Event event = rt.record(rt.kernel("matrixMult"), cl::NDRange(widthA, heightB), cl::NDRange(16, 16));
 
-            queue.enqueueNDRangeKernel(
-                    kernel,
-                    cl::NullRange,
-                    cl::NDRange(widthA, heightB),
-                    cl::NDRange(16, 16),
-                    NULL,
-                    &event);
-
+#ifdef CL_PROFILING
             // Block until kernel completion
             event.wait();
 
-#ifdef CL_PROFILING
-
             cl_ulong start =
                     event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
             cl_ulong end =
@@ -235,17 +156,15 @@ int main(int argc, char** argv) {
 
 #endif
 
-            queue.enqueueReadBuffer(gs_d, CL_TRUE, 0, sizeof ( struct ad_gradient_structure), (struct ad_gradient_structure*) gs);
-//            queue.enqueueReadBuffer(ad_entry_d, CL_TRUE, 0, sizeof ( struct ad_entry)*GRADIENT_STACK_SIZE, (struct ad_entry*) gradient_stack);
-            queue.enqueueReadBuffer(c_d, CL_TRUE, 0, (widthC * heightC) * sizeof (struct ad_variable), (struct ad_variable*) C);
-
-            gs->gradient_stack = gradient_stack;
-            gpu_restore(gs);
+            //the tape is not needed, only the counters and C
+            rt.read(c_d, C, (widthC * heightC) * sizeof (struct ad_variable));
+            rt.readback(false);
+            rt.restore();
 
             //           
 
         } catch (cl::Error err) {
-            std::cout << error << err.what() << event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+            std::cout << err.what() << std::endl;
         }
 
 #endif
@@ -270,15 +189,14 @@ int main(int argc, char** argv) {
 //        }
 
         std::cout << gs->stack_current << std::endl;
-        gs->stack_current = 0;
-        gs->current_variable_id = lastid + 1;
+        ad_reset(gs, lastid + 1);
 
     }
 
     delete[] A;
     delete[] B;
     delete[] C;
-    delete[] gradient_stack;
+    free(gradient_stack);
     delete gs;
     return 0;
 }